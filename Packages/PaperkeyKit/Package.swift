@@ -22,16 +22,45 @@ let package = Package(
                 "./COPYING",
                 "./CMakeLists.txt",
                 "./README",
-                "./paperkeytest.c"
+                "./paperkey.c",
+                "./paperkeytest.c",
+                "./paperkeybench.c",
+                "./paperkeyindex.c",
+                "./paperkeyd.c",
+                "./paperkeyload.c"
             ],
             sources: [
+                "./agent.c",
+                "./arena.c",
+                "./armor.c",
+                "./batch.c",
+                "./bulkio.c",
+                "./context.c",
+                "./diagnose.c",
+                "./encode.c",
                 "./extract.c",
+                "./fec.c",
+                "./fixed.c",
+                "./fpindex.c",
+                "./gf256.c",
+                "./kbx.c",
+                "./metrics.c",
+                "./ocr.c",
                 "./output.c",
                 "./packets.c",
                 "./parse.c",
+                "./pdecode.c",
+                "./pool.c",
+                "./pscan.c",
+                "./qr.c",
+                "./render.c",
                 "./restore.c",
+                "./service.c",
+                "./sexp.c",
                 "./sha1.c",
-                "./stream.c"
+                "./sha256.c",
+                "./stream.c",
+                "./verify.c"
             ],
             cSettings: [
                 .headerSearchPath("./")
@@ -0,0 +1,687 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "agent.h"
+#include "armor.h"
+#include "encode.h"
+#include "internal.h"
+#include "metrics.h"
+#include "output.h"
+#include "packets.h"
+#include "parse.h"
+#include "sexp.h"
+#include "sha1.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Far more than any key file needs. */
+#define MAX_KEY_FILE (1 << 20)
+
+/* The curve parameters libgcrypt takes a keygrip over, as it has them
+   in its own tables. */
+struct curve {
+  const char *oid;
+  size_t oid_len;
+  const char *p, *a, *b, *n, *gx, *gy;
+  /* Whether the keygrip takes q without the 0x40 prefix OpenPGP puts
+     on these curves. */
+  int compact;
+};
+
+#define OID(_oid) _oid, sizeof(_oid) - 1
+
+static const struct curve curves[] = {
+    {OID("\x2A\x86\x48\xCE\x3D\x03\x01\x07"), /* NIST P-256 */
+     "ffffffff00000001000000000000000000000000ffffffffffffffffffffffff",
+     "ffffffff00000001000000000000000000000000fffffffffffffffffffffffc",
+     "5ac635d8aa3a93e7b3ebbd55769886bc651d06b0cc53b0f63bce3c3e27d2604b",
+     "ffffffff00000000ffffffffffffffffbce6faada7179e84f3b9cac2fc632551",
+     "6b17d1f2e12c4247f8bce6e563a440f277037d812deb33a0f4a13945d898c296",
+     "4fe342e2fe1a7f9b8ee7eb4a7c0f9e162bce33576b315ececbb6406837bf51f5", 0},
+    {OID("\x2B\x81\x04\x00\x22"), /* NIST P-384 */
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffe"
+     "ffffffff0000000000000000ffffffff",
+     "fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffe"
+     "ffffffff0000000000000000fffffffc",
+     "b3312fa7e23ee7e4988e056be3f82d19181d9c6efe8141120314088f5013875a"
+     "c656398d8a2ed19d2a85c8edd3ec2aef",
+     "ffffffffffffffffffffffffffffffffffffffffffffffffc7634d81f4372ddf"
+     "581a0db248b0a77aecec196accc52973",
+     "aa87ca22be8b05378eb1c71ef320ad746e1d3b628ba79b9859f741e082542a38"
+     "5502f25dbf55296c3a545e3872760ab7",
+     "3617de4a96262c6f5d9e98bf9292dc29f8f41dbd289a147ce9da3113b5f0b8c0"
+     "0a60b1ce1d7e819d7a431d7c90ea0e5f",
+     0},
+    {OID("\x2B\x81\x04\x00\x23"), /* NIST P-521 */
+     "01ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+     "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+     "ffff",
+     "01ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+     "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+     "fffc",
+     "0051953eb9618e1c9a1f929a21a0b68540eea2da725b99b315f3b8b489918ef1"
+     "09e156193951ec7e937b1652c0bd3bb1bf073573df883d2c34f1ef451fd46b50"
+     "3f00",
+     "01ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff"
+     "fffa51868783bf2f966b7fcc0148f709a5d03bb5c9b8899c47aebb6fb71e9138"
+     "6409",
+     "00c6858e06b70404e9cd9e3ecb662395b4429c648139053fb521f828af606b4d"
+     "3dbaa14b5e77efe75928fe1dc127a2ffa8de3348b3c1856a429bf97e7e31c2e5"
+     "bd66",
+     "011839296a789a3bc0045c8a5fb42c7d1bd998f54449579b446817afbd17273e"
+     "662c97ee72995ef42640c550b9013fad0761353c7086a272c24088be94769fd1"
+     "6650",
+     0},
+    {OID("\x2B\x06\x01\x04\x01\xDA\x47\x0F\x01"), /* Ed25519 */
+     "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed",
+     /* a is -1 and b is -d; the keygrip takes their magnitude. */
+     "01", "2dfc9311d490018c7338bf8688861767ff8ff5b2bebe27548a14b235eca6874a",
+     "1000000000000000000000000000000014def9dea2f79cd65812631a5cf5d3ed",
+     "216936d3cd6e53fec0a4e231fdd6dc5c692cc7609525a7b2c9562d608f25d51a",
+     "6666666666666666666666666666666666666666666666666666666666666658", 1},
+    {OID("\x2B\x06\x01\x04\x01\x97\x55\x01\x05\x01"), /* Curve25519 */
+     "7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffed",
+     "01db41", "01",
+     "1000000000000000000000000000000014def9dea2f79cd65812631a5cf5d3ed",
+     "09", "20ae19a1b8a086b4e01edd2c7748d14c923d4d7e6d7c61b229e9c5a27eced3d9",
+     1},
+};
+
+/* Write hex right-aligned into len bytes. */
+static void from_hex(unsigned char *out, size_t len, const char *hex) {
+  size_t n = strlen(hex) / 2;
+
+  memset(out, 0, len - n);
+  out += len - n;
+  while (n--) {
+    *out++ = hex_value(hex[0]) << 4 | hex_value(hex[1]);
+    hex += 2;
+  }
+}
+
+/* How libgcrypt hashes a value into a keygrip. */
+enum grip_form {
+  /* Without leading zeros. */
+  GRIP_UNSIGNED,
+  /* With a zero ahead of a set top bit, as gpg hands MPIs over. */
+  GRIP_SIGNED,
+  /* Byte for byte. */
+  GRIP_RAW
+};
+
+static void grip_param(struct sha1_ctx *sha, char name,
+                       const unsigned char *data, size_t len,
+                       enum grip_form form) {
+  char head[32];
+  int pad;
+
+  if (form != GRIP_RAW)
+    while (len && *data == 0) {
+      data++;
+      len--;
+    }
+  pad = form == GRIP_SIGNED && len && (*data & 0x80);
+
+  snprintf(head, sizeof(head), "(1:%c%u:", name, (unsigned int)(len + pad));
+  sha1_process_bytes(head, strlen(head), sha);
+  if (pad)
+    sha1_process_bytes("", 1, sha);
+  sha1_process_bytes(data, len, sha);
+  sha1_process_bytes(")", 1, sha);
+}
+
+static void grip_hex(struct sha1_ctx *sha, char name, const char *hex) {
+  unsigned char value[66];
+  size_t len = strlen(hex) / 2;
+
+  from_hex(value, len, hex);
+  grip_param(sha, name, value, len, GRIP_UNSIGNED);
+}
+
+/* Step over one MPI of a key packet. */
+static int read_mpi(const unsigned char *buf, size_t len, size_t *offset,
+                    const unsigned char **data, size_t *n) {
+  if (len - *offset < 2)
+    return -1;
+  *n = ((buf[*offset] << 8 | buf[*offset + 1]) + 7) / 8;
+  *offset += 2;
+  if (len - *offset < *n)
+    return -1;
+  *data = &buf[*offset];
+  *offset += *n;
+  return 0;
+}
+
+static int ecc_keygrip(const unsigned char *pubkey, size_t len,
+                       size_t offset, struct sha1_ctx *sha) {
+  const struct curve *curve = NULL;
+  const unsigned char *q;
+  unsigned char g[1 + 2 * 66];
+  size_t i, oid_len, qlen, plen;
+
+  if (offset >= len)
+    return -1;
+  oid_len = pubkey[offset++];
+  if (len - offset < oid_len)
+    return -1;
+
+  for (i = 0; i < sizeof(curves) / sizeof(curves[0]); i++)
+    if (curves[i].oid_len == oid_len &&
+        memcmp(curves[i].oid, &pubkey[offset], oid_len) == 0)
+      curve = &curves[i];
+  offset += oid_len;
+  if (curve == NULL || read_mpi(pubkey, len, &offset, &q, &qlen) != 0)
+    return -1;
+
+  if (curve->compact && qlen == 33 && q[0] == 0x40) {
+    q++;
+    qlen--;
+  }
+
+  /* The base point, uncompressed. */
+  plen = strlen(curve->p) / 2;
+  g[0] = 0x04;
+  from_hex(&g[1], plen, curve->gx);
+  from_hex(&g[1 + plen], plen, curve->gy);
+
+  grip_hex(sha, 'p', curve->p);
+  grip_hex(sha, 'a', curve->a);
+  grip_hex(sha, 'b', curve->b);
+  grip_param(sha, 'g', g, 1 + 2 * plen, GRIP_UNSIGNED);
+  grip_hex(sha, 'n', curve->n);
+  grip_param(sha, 'q', q, qlen, GRIP_RAW);
+  return 0;
+}
+
+int paperkey_keygrip(const unsigned char *pubkey, size_t len,
+                     unsigned char grip[20]) {
+  const unsigned char *mpi[4];
+  size_t mpi_len[4], offset = 6;
+  struct sha1_ctx sha;
+  const char *names;
+  int i;
+
+  if (len < 6 || pubkey[0] != 4)
+    return -1;
+
+  sha1_init_ctx(&sha);
+
+  switch (pubkey[5]) {
+  case 1: /* RSA */
+  case 2:
+  case 3:
+    if (read_mpi(pubkey, len, &offset, &mpi[0], &mpi_len[0]) != 0)
+      return -1;
+    /* Just the modulus, with no framing. */
+    while (mpi_len[0] && *mpi[0] == 0) {
+      mpi[0]++;
+      mpi_len[0]--;
+    }
+    if (mpi_len[0] && (*mpi[0] & 0x80))
+      sha1_process_bytes("", 1, &sha);
+    sha1_process_bytes(mpi[0], mpi_len[0], &sha);
+    sha1_finish_ctx(&sha, grip);
+    return 0;
+
+  case 16: /* Elgamal */
+    names = "pgy";
+    break;
+
+  case 17: /* DSA */
+    names = "pqgy";
+    break;
+
+  case 18: /* ECDH */
+  case 19: /* ECDSA */
+  case 22: /* EdDSA */
+    if (ecc_keygrip(pubkey, len, offset, &sha) != 0)
+      return -1;
+    sha1_finish_ctx(&sha, grip);
+    return 0;
+
+  default:
+    return -1;
+  }
+
+  for (i = 0; names[i]; i++)
+    if (read_mpi(pubkey, len, &offset, &mpi[i], &mpi_len[i]) != 0)
+      return -1;
+  for (i = 0; names[i]; i++)
+    grip_param(&sha, names[i], mpi[i], mpi_len[i], GRIP_SIGNED);
+  sha1_finish_ctx(&sha, grip);
+  return 0;
+}
+
+/* Append an OpenPGP MPI, adding its bytes to the checksum of an
+   unprotected key. */
+static struct packet *put_mpi(struct paperkey_ctx *ctx, struct packet *secret,
+                              const struct sexp *value, unsigned int *sum) {
+  const unsigned char *data = value->data;
+  size_t len = value->len, i;
+  unsigned char head[2];
+  unsigned int bits = 0;
+
+  while (len && *data == 0) {
+    data++;
+    len--;
+  }
+  if (len) {
+    bits = (len - 1) * 8;
+    for (i = data[0]; i; i >>= 1)
+      bits++;
+  }
+  if (bits > 0xFFFF)
+    goto fail;
+
+  head[0] = bits >> 8;
+  head[1] = bits & 0xFF;
+  *sum += head[0] + head[1];
+  for (i = 0; i < len; i++)
+    *sum += data[i];
+
+  secret = append_packet(ctx, secret, head, 2);
+  if (secret == NULL)
+    return NULL;
+  return append_packet(ctx, secret, data, len);
+
+fail:
+  free_packet(ctx, secret);
+  return NULL;
+}
+
+static struct packet *put_checksum(struct paperkey_ctx *ctx,
+                                   struct packet *secret, unsigned int sum) {
+  unsigned char csum[2];
+
+  csum[0] = (sum >> 8) & 0xFF;
+  csum[1] = sum & 0xFF;
+  return append_packet(ctx, secret, csum, 2);
+}
+
+static int atom_number(const struct sexp *node, unsigned long *value) {
+  size_t i;
+
+  if (node->data == NULL || node->len == 0 || node->len > 9)
+    return -1;
+
+  *value = 0;
+  for (i = 0; i < node->len; i++) {
+    if (node->data[i] < '0' || node->data[i] > '9')
+      return -1;
+    *value = *value * 10 + (node->data[i] - '0');
+  }
+  return 0;
+}
+
+/* The OpenPGP numbers for the names gpg gives ciphers and hashes. */
+static int algo_id(const struct sexp *node, const char *const *names) {
+  int i;
+
+  for (i = 0; names[i]; i++)
+    if (names[i][0] && sexp_is(node, names[i]))
+      return i;
+  return -1;
+}
+
+static const char *const cipher_names[] = {
+    "", "IDEA", "3DES", "CAST5", "BLOWFISH", "", "", "AES", "AES192",
+    "AES256", "TWOFISH", "CAMELLIA128", "CAMELLIA192", "CAMELLIA256", NULL};
+
+static const char *const hash_names[] = {
+    "", "MD5", "SHA1", "RIPEMD160", "", "", "", "", "SHA256", "SHA384",
+    "SHA512", "SHA224", NULL};
+
+/* A key gpg imported and the agent has not touched since, kept as
+   (openpgp-private-key (version "4") (algo RSA) (skey _ n _ e ...)
+   (csum "123") (protection ...)), where the secret values are the
+   last of skey, or a single encrypted one marked "e". */
+static struct packet *from_openpgp(struct paperkey_ctx *ctx,
+                                   const struct sexp_tree *tree, size_t key) {
+  const struct sexp *nodes = tree->nodes;
+  size_t version = sexp_find(tree, key, "version");
+  size_t algo = sexp_find(tree, key, "algo");
+  size_t skey = sexp_find(tree, key, "skey");
+  size_t prot = sexp_find(tree, key, "protection");
+  size_t csum = sexp_find(tree, key, "csum");
+  struct packet *secret = NULL;
+  size_t first, count, i;
+  unsigned long value;
+
+  if (!version || !algo || !skey || !prot || !csum ||
+      !sexp_is(&nodes[version + 2], "4") || nodes[algo + 2].data == NULL)
+    return NULL;
+
+  /* The markers and values of skey alternate. */
+  count = nodes[skey].end - (skey + 2);
+  for (i = skey + 2; i < nodes[skey].end; i++)
+    if (nodes[i].data == NULL)
+      return NULL;
+  if (count == 0 || count % 2)
+    return NULL;
+
+  if (sexp_is(&nodes[prot + 2], "none")) {
+    unsigned int sum = 0;
+    unsigned char usage = 0;
+
+    count = sexp_is(&nodes[algo + 2], "RSA") ? 4 : 1;
+    if (count * 2 > nodes[skey].end - (skey + 2) ||
+        atom_number(&nodes[csum + 2], &value) != 0)
+      return NULL;
+    first = nodes[skey].end - count * 2;
+
+    secret = append_packet(ctx, NULL, &usage, 1);
+    for (i = first; secret && i < nodes[skey].end; i += 2) {
+      if (!sexp_is(&nodes[i], "_")) {
+        free_packet(ctx, secret);
+        return NULL;
+      }
+      secret = put_mpi(ctx, secret, &nodes[i + 1], &sum);
+    }
+    return secret ? put_checksum(ctx, secret, value) : NULL;
+  } else {
+    /* (protection sha1 CAST5 IV S2KMODE SHA1 SALT COUNT) */
+    const struct sexp *p = &nodes[prot + 2];
+    const struct sexp *blob = &nodes[nodes[skey].end - 1];
+    unsigned char head[4];
+    unsigned long mode;
+    int cipher, hash;
+
+    if (nodes[prot].end != prot + 9)
+      return NULL;
+    for (i = 0; i < 7; i++)
+      if (p[i].data == NULL)
+        return NULL;
+
+    if (sexp_is(&p[0], "sha1"))
+      head[0] = 254;
+    else if (sexp_is(&p[0], "sum"))
+      head[0] = 255;
+    else
+      return NULL;
+
+    cipher = algo_id(&p[1], cipher_names);
+    hash = algo_id(&p[4], hash_names);
+    if (cipher < 0 || hash < 0 || atom_number(&p[3], &mode) != 0 ||
+        (mode != 0 && mode != 1 && mode != 3) ||
+        (mode && p[5].len != 8) ||
+        (mode == 3 && (atom_number(&p[6], &value) != 0 || value > 255)) ||
+        !sexp_is(&nodes[nodes[skey].end - 2], "e"))
+      return NULL;
+
+    head[1] = cipher;
+    head[2] = mode;
+    head[3] = hash;
+    secret = append_packet(ctx, NULL, head, 4);
+    if (secret && mode)
+      secret = append_packet(ctx, secret, p[5].data, 8);
+    if (secret && mode == 3) {
+      head[0] = value;
+      secret = append_packet(ctx, secret, head, 1);
+    }
+    if (secret)
+      secret = append_packet(ctx, secret, p[2].data, p[2].len);
+    if (secret)
+      secret = append_packet(ctx, secret, blob->data, blob->len);
+    return secret;
+  }
+}
+
+/* A key the agent holds in its own unprotected form, such as
+   (rsa (n ...) (e ...) (d ...) (p ...) (q ...) (u ...)). */
+static struct packet *from_agent(struct paperkey_ctx *ctx,
+                                 const struct sexp_tree *tree, size_t key) {
+  const struct sexp *nodes = tree->nodes;
+  const struct sexp *algo = &nodes[key + 1];
+  struct packet *secret;
+  unsigned char usage = 0;
+  unsigned int sum = 0;
+  const char *names;
+
+  if (sexp_is(algo, "rsa"))
+    names = "dpqu";
+  else if (sexp_is(algo, "dsa") || sexp_is(algo, "elg"))
+    names = "x";
+  else if (sexp_is(algo, "ecc"))
+    names = "d";
+  else
+    return NULL;
+
+  secret = append_packet(ctx, NULL, &usage, 1);
+  for (; secret && *names; names++) {
+    char name[2] = {*names, 0};
+    size_t param = sexp_find(tree, key, name);
+
+    if (!param || nodes[param].end != param + 3 ||
+        nodes[param + 2].data == NULL) {
+      free_packet(ctx, secret);
+      return NULL;
+    }
+    secret = put_mpi(ctx, secret, &nodes[param + 2], &sum);
+  }
+  return secret ? put_checksum(ctx, secret, sum) : NULL;
+}
+
+/* The value of the "Key:" item of an extended key file.  Continuation
+   lines start with a space, which is dropped as they are joined on,
+   since the writer breaks lines anywhere, even inside a token. */
+static unsigned char *key_item(struct paperkey_ctx *ctx,
+                               const unsigned char *file, size_t len,
+                               size_t *item_len) {
+  unsigned char *item = NULL;
+  size_t pos = 0, n = 0;
+  int in_key = 0;
+
+  while (pos < len) {
+    const unsigned char *line = &file[pos], *end;
+    size_t line_len;
+
+    end = memchr(line, '\n', len - pos);
+    line_len = end ? (size_t)(end - line) : len - pos;
+    pos += end ? line_len + 1 : line_len;
+    if (line_len && line[line_len - 1] == '\r')
+      line_len--;
+
+    if (in_key) {
+      if (line_len == 0 || (line[0] != ' ' && line[0] != '\t'))
+        break;
+      memcpy(&item[n], &line[1], line_len - 1);
+      n += line_len - 1;
+    } else if (line_len >= 4 && memcmp(line, "Key:", 4) == 0) {
+      item = ctx_malloc(ctx, len);
+      if (item == NULL)
+        return NULL;
+      for (line += 4, line_len -= 4; line_len && (*line == ' ' || *line == '\t');
+           line++, line_len--)
+        ;
+      memcpy(item, line, line_len);
+      n = line_len;
+      in_key = 1;
+    }
+  }
+
+  *item_len = n;
+  return item;
+}
+
+struct packet *agent_key_secret(struct paperkey_ctx *ctx,
+                                const unsigned char *file, size_t len) {
+  struct sexp_tree tree;
+  struct packet *secret = NULL;
+  unsigned char *item = NULL;
+  const struct sexp *nodes;
+  size_t item_len = 0, skip = 0, key;
+
+  while (skip < len && (file[skip] == ' ' || file[skip] == '\t' ||
+                        file[skip] == '\r' || file[skip] == '\n'))
+    skip++;
+
+  if (skip < len && file[skip] == '(') {
+    if (sexp_parse(ctx, file, len, &tree) != 0)
+      return NULL;
+  } else {
+    item = key_item(ctx, file, len, &item_len);
+    if (item == NULL || sexp_parse(ctx, item, item_len, &tree) != 0) {
+      ctx_free(ctx, item, len);
+      return NULL;
+    }
+  }
+
+  /* (private-key (rsa ...)) or (protected-private-key (rsa ...)) */
+  nodes = tree.nodes;
+  key = 2;
+  if (tree.count > 3 && nodes[1].data && nodes[key].data == NULL &&
+      nodes[key + 1].data) {
+    if (sexp_is(&nodes[1], "private-key")) {
+      secret = from_agent(ctx, &tree, key);
+    } else if (sexp_is(&nodes[1], "protected-private-key")) {
+      size_t prot = sexp_find(&tree, key, "protected");
+
+      /* (protected openpgp-native (openpgp-private-key ...)) is the
+         only protection that is OpenPGP underneath. */
+      if (prot && nodes[prot].end > prot + 4 &&
+          sexp_is(&nodes[prot + 2], "openpgp-native") &&
+          nodes[prot + 3].data == NULL &&
+          sexp_is(&nodes[prot + 4], "openpgp-private-key"))
+        secret = from_openpgp(ctx, &tree, prot + 3);
+    }
+  }
+
+  sexp_tree_free(ctx, &tree);
+  ctx_free(ctx, item, len);
+  return secret;
+}
+
+/* The secret part of one key packet, from its key file in keydir. */
+static struct packet *read_key_file(struct paperkey_ctx *ctx,
+                                    const char *keydir,
+                                    const struct packet *pubkey) {
+  static const char hex[] = "0123456789ABCDEF";
+  unsigned char grip[20], *file;
+  struct packet *secret = NULL;
+  size_t path_len = strlen(keydir) + 1 + 40 + 4 + 1;
+  struct stat st;
+  char *path;
+  int fd, i;
+
+  if (paperkey_keygrip(pubkey->buf, pubkey->len, grip) != 0)
+    return NULL;
+
+  path = ctx_malloc(ctx, path_len);
+  if (path == NULL)
+    return NULL;
+  strcpy(path, keydir);
+  strcat(path, "/");
+  for (i = 0; i < 20; i++) {
+    char digits[3] = {hex[grip[i] >> 4], hex[grip[i] & 0xF], 0};
+
+    strcat(path, digits);
+  }
+  strcat(path, ".key");
+
+  fd = open(path, O_RDONLY);
+  ctx_free(ctx, path, path_len);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= MAX_KEY_FILE &&
+      (file = ctx_malloc(ctx, st.st_size)) != NULL) {
+    if (read(fd, file, st.st_size) == st.st_size)
+      secret = agent_key_secret(ctx, file, st.st_size);
+    ctx_free(ctx, file, st.st_size);
+  }
+  close(fd);
+  return secret;
+}
+
+static void output_key(struct paperkey_ctx *ctx, struct packet *pubkey,
+                       struct packet *secret) {
+  unsigned char fingerprint[MAX_FINGERPRINT];
+
+  key_fingerprint(ctx, pubkey, pubkey->len, fingerprint);
+  output_bytes(ctx, pubkey->buf, 1);
+  output_bytes(ctx, fingerprint, fingerprint_length(pubkey->buf[0]));
+  output_length16(ctx, secret->len);
+  output_packet(ctx, secret);
+}
+
+static int extract_agent_from(struct paperkey_ctx *ctx, struct stream *input,
+                              const char *keydir, struct stream *output) {
+  struct packet *pubkey, *secret;
+  unsigned char fingerprint[MAX_FINGERPRINT];
+  unsigned char version = 0;
+  int missing = 0;
+
+  pubkey = parse(ctx, input, 6, 0);
+  if (!pubkey)
+    return 1;
+
+  secret = read_key_file(ctx, keydir, pubkey);
+  if (secret == NULL ||
+      key_fingerprint(ctx, pubkey, pubkey->len, fingerprint) != 0 ||
+      output_start(ctx, output, ctx->output_type, fingerprint,
+                   fingerprint_length(pubkey->buf[0])) != 0) {
+    free_packet(ctx, secret);
+    free_packet(ctx, pubkey);
+    return 1;
+  }
+  output_bytes(ctx, &version, 1);
+  output_key(ctx, pubkey, secret);
+  free_packet(ctx, secret);
+  free_packet(ctx, pubkey);
+
+  /* The rest of the certificate is read either way, so input is left
+     at the next one. */
+  while ((pubkey = parse(ctx, input, 14, 6))) {
+    secret = missing ? NULL : read_key_file(ctx, keydir, pubkey);
+    if (secret)
+      output_key(ctx, pubkey, secret);
+    else
+      missing = 1;
+    free_packet(ctx, secret);
+    free_packet(ctx, pubkey);
+  }
+
+  /* A subkey left out would make a document that restores to less
+     than the key. */
+  if (missing || paperkey_ctx_limit_hit(ctx) != PAPERKEY_LIMIT_NONE) {
+    output_discard(ctx);
+    return 1;
+  }
+
+  if (output_finish(ctx) != 0)
+    return 1;
+
+  return 0;
+}
+
+static int extract_agent_input(struct paperkey_ctx *ctx, struct stream *pubring,
+                               const char *keydir, struct stream *output) {
+  struct stream *binary;
+  int ret;
+
+  if (!armor_detect(pubring))
+    return extract_agent_from(ctx, pubring, keydir, output);
+
+  binary = armor_decode(ctx, pubring);
+  if (binary == NULL)
+    return 1;
+  ret = extract_agent_from(ctx, binary, keydir, output);
+  armor_free(ctx, binary);
+  return ret;
+}
+
+int paperkey_extract_agent(struct paperkey_ctx *ctx, struct stream *pubring,
+                           const char *keydir, struct stream *output) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = 1;
+
+  if (ctx_admit(ctx, pubring, NULL) == 0)
+    ret = extract_agent_input(ctx, pubring, keydir, output);
+
+  metrics_record(ctx, PAPERKEY_METRIC_EXTRACT, timer);
+  return ret;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _AGENT_H_
+#define _AGENT_H_
+
+#include "context.h"
+#include "stream.h"
+#include <stddef.h>
+
+/* The keygrip gpg-agent files a key under, from the body of a v4
+   public key packet: the SHA-1 of the key's public parameters the way
+   libgcrypt lays them out.  RSA, DSA, Elgamal and the NIST P-256,
+   P-384, P-521, Ed25519 and Curve25519 curves are known.  Returns 0,
+   or -1 for anything else. */
+int paperkey_keygrip(const unsigned char *pubkey, size_t len,
+                     unsigned char grip[20]);
+
+/* Extract the first certificate in pubring, binary or armored, taking
+   the secret parts of its keys from the gpg-agent key files in keydir
+   (usually ~/.gnupg/private-keys-v1.d) instead of from an exported
+   secret key.  The output is the same as paperkey_extract() gives for
+   the secret key gpg would export.
+
+   Keys still in the OpenPGP form gpg imported them in are copied as
+   they are, protected or not.  Keys the agent holds unprotected are
+   written unprotected.  Keys the agent has protected itself cannot be
+   turned back into OpenPGP without their passphrase, and count as
+   missing, as do keys on smartcards.  Any key missing fails the
+   extract, since the document would restore to less than the key.
+   The next call starts at the next certificate either way, so a whole
+   keyring can be done a call at a time.
+   Returns 0 or 1 like paperkey_extract(). */
+int paperkey_extract_agent(struct paperkey_ctx *ctx, struct stream *pubring,
+                           const char *keydir, struct stream *output);
+
+/* The secret part of a v4 secret key packet, from the contents of one
+   key file in canonical S-expression or extended key format.  Returns
+   NULL if it holds no secret key that can be written as OpenPGP. */
+struct packet *agent_key_secret(struct paperkey_ctx *ctx,
+                                const unsigned char *file, size_t len);
+
+#endif /* !_AGENT_H_ */
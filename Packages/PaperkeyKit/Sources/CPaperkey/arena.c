@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(_n) (((_n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t pos;
+};
+
+#define CHUNK_HEADER ARENA_ROUND(sizeof(struct arena_chunk))
+#define CHUNK_DATA(_chunk) ((unsigned char *)(_chunk) + CHUNK_HEADER)
+
+void arena_init(struct arena *arena, size_t limit) {
+  memset(arena, 0, sizeof(*arena));
+  arena->limit = limit;
+}
+
+void arena_init_fixed(struct arena *arena, void *buf, size_t len) {
+  uintptr_t start = ((uintptr_t)buf + ARENA_ALIGN - 1) &
+                    ~(uintptr_t)(ARENA_ALIGN - 1);
+  struct arena_chunk *chunk = (struct arena_chunk *)start;
+  size_t skip = start - (uintptr_t)buf + CHUNK_HEADER;
+
+  memset(arena, 0, sizeof(*arena));
+  arena->fixed = 1;
+  if (buf == NULL || len < skip)
+    return;
+
+  chunk->next = NULL;
+  chunk->size = (len - skip) & ~(size_t)(ARENA_ALIGN - 1);
+  chunk->pos = 0;
+  arena->chunks = arena->current = chunk;
+}
+
+void arena_reset(struct arena *arena) {
+  struct arena_chunk *chunk;
+
+  for (chunk = arena->chunks; chunk; chunk = chunk->next)
+    chunk->pos = 0;
+
+  arena->current = arena->chunks;
+  arena->last = NULL;
+  arena->used = 0;
+}
+
+void arena_release(struct arena *arena) {
+  while (arena->chunks && !arena->fixed) {
+    struct arena_chunk *next = arena->chunks->next;
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+
+  arena->current = NULL;
+  arena->last = NULL;
+  arena->used = 0;
+}
+
+static void *arena_take(struct arena *arena, size_t size) {
+  struct arena_chunk *chunk = arena->current;
+  unsigned char *ptr;
+
+  if (arena->limit && arena->used + size > arena->limit)
+    return NULL;
+
+  if (chunk == NULL || chunk->size - chunk->pos < size) {
+    /* After a reset the chunks past the current one are empty, so
+       the next one can be reused if it is big enough. */
+    if (chunk && chunk->next && chunk->next->size >= size)
+      chunk = chunk->next;
+    else if (arena->fixed) {
+      arena->failed = 1;
+      return NULL;
+    } else {
+      size_t want = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+      struct arena_chunk *fresh = malloc(CHUNK_HEADER + want);
+
+      if (fresh == NULL)
+        return NULL;
+
+      fresh->size = want;
+      fresh->pos = 0;
+      if (chunk) {
+        fresh->next = chunk->next;
+        chunk->next = fresh;
+      } else {
+        fresh->next = arena->chunks;
+        arena->chunks = fresh;
+      }
+      chunk = fresh;
+    }
+
+    arena->current = chunk;
+  }
+
+  ptr = CHUNK_DATA(chunk) + chunk->pos;
+  chunk->pos += size;
+  arena->used += size;
+  arena->last = ptr;
+
+  return ptr;
+}
+
+void *arena_alloc(void *opaque, void *ptr, size_t osize, size_t nsize) {
+  struct arena *arena = opaque;
+  struct arena_chunk *chunk = arena->current;
+  size_t oround = ARENA_ROUND(osize);
+  void *fresh;
+
+  if (ptr && ptr == arena->last) {
+    /* The most recent block can be shrunk, grown or freed in place. */
+    size_t start = (unsigned char *)ptr - CHUNK_DATA(chunk);
+    size_t nround = ARENA_ROUND(nsize);
+
+    if (nsize == 0) {
+      chunk->pos = start;
+      arena->used -= oround;
+      arena->last = NULL;
+      return NULL;
+    }
+
+    if (start + nround <= chunk->size &&
+        (!arena->limit || arena->used - oround + nround <= arena->limit)) {
+      chunk->pos = start + nround;
+      arena->used = arena->used - oround + nround;
+      return ptr;
+    }
+  }
+
+  /* Anything else stays allocated until the next reset. */
+  if (nsize == 0)
+    return NULL;
+
+  fresh = arena_take(arena, ARENA_ROUND(nsize));
+  if (fresh && ptr)
+    memcpy(fresh, ptr, osize < nsize ? osize : nsize);
+
+  return fresh;
+}
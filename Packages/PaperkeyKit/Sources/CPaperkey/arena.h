@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+struct arena_chunk;
+
+/* A bump allocator that is reset between jobs instead of freeing each
+   block.  Freeing or growing the most recent block is done in place,
+   which covers the append_packet pattern.  Chunks are kept across
+   resets so a warmed-up worker stops touching the system allocator.
+   An arena is owned by a single thread. */
+struct arena {
+  struct arena_chunk *chunks;
+  struct arena_chunk *current;
+  unsigned char *last;
+  /* Bytes handed out since the last reset, and the cap on that
+     (0 for none). */
+  size_t used;
+  size_t limit;
+  /* Set for an arena over a caller's buffer, which never allocates;
+     failed records that it ran out. */
+  int fixed;
+  int failed;
+};
+
+void arena_init(struct arena *arena, size_t limit);
+/* An arena that hands out len bytes of buf, less ARENA_FIXED_OVERHEAD,
+   and nothing more. */
+#define ARENA_FIXED_OVERHEAD 64
+void arena_init_fixed(struct arena *arena, void *buf, size_t len);
+void arena_reset(struct arena *arena);
+void arena_release(struct arena *arena);
+/* A paperkey_alloc_fn; opaque is the struct arena. */
+void *arena_alloc(void *opaque, void *ptr, size_t osize, size_t nsize);
+
+#endif /* !_ARENA_H_ */
@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "armor.h"
+#include "encode.h"
+#include "internal.h"
+#include "output.h"
+#include <string.h>
+
+#define ARMOR_BEGIN "-----BEGIN PGP "
+#define ARMOR_END "-----END PGP "
+
+/* Data bytes per output line, 64 characters. */
+#define LINE_BYTES 48
+
+/* Longest data line read, well over the 76 characters RFC 4880
+   allows. */
+#define MAX_LINE 1024
+
+static int starts_with(const char *line, size_t len, const char *prefix) {
+  size_t n = strlen(prefix);
+
+  return len >= n && memcmp(line, prefix, n) == 0;
+}
+
+/* The next line of input, pointing into its buffer, without the line
+   ending or trailing white space.  NULL at the end of the input. */
+static const char *next_line(struct stream *input, size_t *len) {
+  const char *line, *end;
+  size_t left;
+
+  if (stream_eof(input))
+    return NULL;
+
+  line = (const char *)&input->buffer[input->pos];
+  left = input->size - input->pos;
+  end = memchr(line, '\n', left);
+  *len = end ? (size_t)(end - line) : left;
+  input->pos += end ? *len + 1 : *len;
+
+  while (*len && (line[*len - 1] == '\r' || line[*len - 1] == ' ' ||
+                  line[*len - 1] == '\t'))
+    (*len)--;
+  return line;
+}
+
+int armor_detect(const struct stream *input) {
+  int pos = input->pos;
+
+  while (pos < input->size &&
+         (input->buffer[pos] == '\n' || input->buffer[pos] == '\r' ||
+          input->buffer[pos] == ' ' || input->buffer[pos] == '\t'))
+    pos++;
+
+  return starts_with((const char *)&input->buffer[pos], input->size - pos,
+                     ARMOR_BEGIN);
+}
+
+static struct stream *new_binary(struct paperkey_ctx *ctx, size_t size) {
+  struct stream *binary = ctx_malloc(ctx, sizeof(*binary));
+
+  if (binary == NULL)
+    return NULL;
+  memset(binary, 0, sizeof(*binary));
+
+  binary->buffer = ctx_malloc(ctx, size);
+  if (binary->buffer == NULL) {
+    ctx_free(ctx, binary, sizeof(*binary));
+    return NULL;
+  }
+  binary->memsize = size;
+  return binary;
+}
+
+void armor_free(struct paperkey_ctx *ctx, struct stream *binary) {
+  if (binary == NULL)
+    return;
+  ctx_free(ctx, binary->buffer, binary->memsize);
+  ctx_free(ctx, binary, sizeof(*binary));
+}
+
+/* Decode whole groups of four characters onto the end of binary,
+   taking their CRC-24 while they are still in the cache. */
+static int decode_groups(struct stream *binary, const char *text, size_t len,
+                         unsigned long *crc) {
+  unsigned char *dst = &binary->buffer[binary->size];
+  ssize_t n;
+
+  n = decode_data(BASE64, dst, text, len);
+  if (n < 0)
+    return -1;
+
+  do_crc24(crc, dst, n);
+  binary->size += n;
+  return 0;
+}
+
+struct stream *armor_decode(struct paperkey_ctx *ctx, struct stream *input) {
+  struct stream *binary;
+  const char *line;
+  /* A group of four characters split across lines is put back
+     together here. */
+  char held[3 + MAX_LINE];
+  size_t len, carry = 0;
+  unsigned long crc = CRC24_INIT;
+  unsigned char expected[3];
+  int headers = 1, padded = 0, have_crc = 0;
+
+  do {
+    line = next_line(input, &len);
+    if (line == NULL)
+      return NULL;
+  } while (len == 0);
+  if (!starts_with(line, len, ARMOR_BEGIN))
+    return NULL;
+
+  /* Base64 never decodes to more than 3 bytes for 4 characters. */
+  binary = new_binary(ctx, (input->size - input->pos) / 4 * 3 + 3);
+  if (binary == NULL)
+    return NULL;
+
+  for (;;) {
+    size_t whole;
+
+    line = next_line(input, &len);
+    if (line == NULL)
+      goto fail;
+    if (starts_with(line, len, ARMOR_END))
+      break;
+
+    /* Header lines such as "Version: ..." end at a blank line. */
+    if (headers) {
+      if (len == 0 || memchr(line, ':', len)) {
+        headers = len != 0;
+        continue;
+      }
+      headers = 0;
+    }
+    if (len == 0)
+      continue;
+
+    if (line[0] == '=') {
+      if (len != 5 || decode_data(BASE64, expected, &line[1], 4) != 3)
+        goto fail;
+      have_crc = 1;
+      continue;
+    }
+    if (padded || have_crc || len > MAX_LINE)
+      goto fail;
+
+    while (len && line[len - 1] == '=') {
+      padded = 1;
+      len--;
+    }
+
+    if (carry) {
+      memcpy(&held[carry], line, len);
+      line = held;
+      len += carry;
+    }
+
+    whole = padded ? len : len / 4 * 4;
+    if (decode_groups(binary, line, whole, &crc) != 0)
+      goto fail;
+
+    carry = len - whole;
+    memmove(held, &line[whole], carry);
+  }
+
+  /* Some writers leave off the padding. */
+  if (carry && decode_groups(binary, held, carry, &crc) != 0)
+    goto fail;
+
+  if (have_crc && !ctx->ignore_crc_error &&
+      (crc & 0xFFFFFFL) != ((unsigned long)expected[0] << 16 |
+                            expected[1] << 8 | expected[2]))
+    goto fail;
+
+  return binary;
+
+fail:
+  armor_free(ctx, binary);
+  return NULL;
+}
+
+static void put(struct armor_writer *writer, const char *text, size_t len) {
+  if (!writer->failed && stream_write(text, 1, len, writer->out) != len)
+    writer->failed = 1;
+}
+
+static void put_line(struct armor_writer *writer, const unsigned char *data,
+                     size_t len) {
+  char text[LINE_BYTES / 3 * 4 + 1];
+  size_t n = encode_base64_padded(text, data, len);
+
+  text[n++] = '\n';
+  put(writer, text, n);
+}
+
+static int armor_write(void *opaque, const void *buf, size_t len) {
+  struct armor_writer *writer = opaque;
+  const unsigned char *data = buf;
+
+  do_crc24(&writer->crc, data, len);
+
+  if (writer->len) {
+    size_t take = LINE_BYTES - writer->len;
+
+    if (take > len)
+      take = len;
+    memcpy(&writer->line[writer->len], data, take);
+    writer->len += take;
+    data += take;
+    len -= take;
+
+    if (writer->len < LINE_BYTES)
+      return writer->failed ? -1 : 0;
+    put_line(writer, writer->line, LINE_BYTES);
+    writer->len = 0;
+  }
+
+  /* Whole lines straight from the caller's buffer. */
+  for (; len >= LINE_BYTES; data += LINE_BYTES, len -= LINE_BYTES)
+    put_line(writer, data, LINE_BYTES);
+
+  memcpy(writer->line, data, len);
+  writer->len = len;
+  return writer->failed ? -1 : 0;
+}
+
+void armor_begin(struct armor_writer *writer, struct stream *out,
+                 const char *label, struct stream *sink) {
+  writer->out = out;
+  writer->label = label;
+  writer->crc = CRC24_INIT;
+  writer->len = 0;
+  writer->failed = 0;
+
+  if (stream_printf(out, "%s%s-----\n\n", ARMOR_BEGIN, label) < 0)
+    writer->failed = 1;
+
+  memset(sink, 0, sizeof(*sink));
+  sink->sink = armor_write;
+  sink->sink_opaque = writer;
+}
+
+int armor_end(struct armor_writer *writer) {
+  unsigned char crc[3];
+  char text[8];
+
+  if (writer->len)
+    put_line(writer, writer->line, writer->len);
+
+  crc[0] = (writer->crc & 0xFFFFFFL) >> 16;
+  crc[1] = (writer->crc & 0xFFFFFFL) >> 8;
+  crc[2] = (writer->crc & 0xFFFFFFL);
+  text[0] = '=';
+  encode_base64_padded(&text[1], crc, 3);
+  text[5] = '\n';
+  put(writer, text, 6);
+
+  if (stream_printf(writer->out, "%s%s-----\n", ARMOR_END, writer->label) < 0)
+    writer->failed = 1;
+
+  return writer->failed ? -1 : 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _ARMOR_H_
+#define _ARMOR_H_
+
+#include "stream.h"
+#include <stddef.h>
+
+struct paperkey_ctx;
+
+/* OpenPGP ASCII armor (RFC 4880 section 6): base64 lines between
+   "-----BEGIN PGP ...-----" and "-----END PGP ...-----", with an
+   optional "=XXXX" CRC-24 of the data before the end line. */
+
+/* Whether input holds an armor header line at its position, after any
+   blank lines.  The position is left alone. */
+int armor_detect(const struct stream *input);
+
+/* Decode the armored block at input's position and move past it.  The
+   base64 is decoded a line at a time straight into the returned
+   stream, and the CRC-24 is taken of each line as it is decoded.
+   Returns NULL if the armor is malformed or its CRC does not match,
+   unless the ctx ignores CRC errors.  Release the stream with
+   armor_free(). */
+struct stream *armor_decode(struct paperkey_ctx *ctx, struct stream *input);
+void armor_free(struct paperkey_ctx *ctx, struct stream *binary);
+
+/* Armors what is written to a sink stream on its way to out, one
+   64 character line at a time, so nothing but the current line is
+   held back. */
+struct armor_writer {
+  struct stream *out;
+  const char *label;
+  unsigned long crc;
+  unsigned char line[48];
+  size_t len;
+  int failed;
+};
+
+/* Write the header line for label, such as "PRIVATE KEY BLOCK", and
+   make sink a stream whose writes are armored into out. */
+void armor_begin(struct armor_writer *writer, struct stream *out,
+                 const char *label, struct stream *sink);
+/* Write the last line, the CRC-24 and the end line.  Returns 0, or -1
+   if any write to out failed. */
+int armor_end(struct armor_writer *writer);
+
+#endif /* !_ARMOR_H_ */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "batch.h"
+#include "arena.h"
+#include "internal.h"
+#include "metrics.h"
+#include "pool.h"
+#include <stdlib.h>
+
+struct batch_worker {
+  struct paperkey_ctx ctx;
+  struct arena arena;
+};
+
+struct batch_run {
+  struct batch_worker *workers;
+  void *jobs;
+};
+
+static void drop_output(struct stream **output) {
+  if (*output) {
+    free((*output)->buffer);
+    free(*output);
+    *output = NULL;
+  }
+}
+
+static void run_extract(void *opaque, size_t index, unsigned int worker) {
+  struct batch_run *run = opaque;
+  struct batch_worker *w = &run->workers[worker];
+  struct extract_job *job = &((struct extract_job *)run->jobs)[index];
+  struct stream input = *job->input;
+
+  arena_reset(&w->arena);
+  job->status = 1;
+  job->output = create_empty_stream();
+  if (job->output)
+    job->status = paperkey_extract(&w->ctx, &input, job->output);
+  if (job->status != 0)
+    drop_output(&job->output);
+  else
+    job->output->pos = 0;
+}
+
+static void run_restore(void *opaque, size_t index, unsigned int worker) {
+  struct batch_run *run = opaque;
+  struct batch_worker *w = &run->workers[worker];
+  struct restore_job *job = &((struct restore_job *)run->jobs)[index];
+  struct stream pubring = *job->pubring;
+  struct stream secrets = *job->secrets;
+
+  arena_reset(&w->arena);
+  job->status = 1;
+  job->output = create_empty_stream();
+  if (job->output)
+    job->status = paperkey_restore(&w->ctx, &pubring, &secrets,
+                                   job->input_type, job->output);
+  if (job->status != 0)
+    drop_output(&job->output);
+  else
+    job->output->pos = 0;
+}
+
+static int run_batch(const struct paperkey_ctx *ctx,
+                     const struct paperkey_batch *batch, void *jobs,
+                     size_t count, pool_fn fn) {
+  struct batch_run run;
+  struct pool *pool;
+  unsigned int workers, i;
+
+  if (count == 0)
+    return 0;
+
+  workers = batch->concurrency ? batch->concurrency : pool_default_workers();
+  if (workers > count)
+    workers = count;
+
+  pool = pool_new(workers);
+  if (pool == NULL)
+    return -1;
+  workers = pool_workers(pool);
+
+  run.jobs = jobs;
+  run.workers = calloc(workers, sizeof(*run.workers));
+  if (run.workers == NULL) {
+    pool_free(pool);
+    return -1;
+  }
+
+  for (i = 0; i < workers; i++) {
+    struct batch_worker *w = &run.workers[i];
+
+    arena_init(&w->arena, batch->job_memory_limit);
+    w->ctx = *ctx;
+    w->ctx.alloc = arena_alloc;
+    w->ctx.alloc_opaque = &w->arena;
+    w->ctx.allocated = 0;
+    /* A shard of its own, so workers never share counters. */
+    w->ctx.metrics = NULL;
+    paperkey_ctx_set_metrics(&w->ctx, metrics_registry(ctx));
+  }
+
+  pool_run(pool, count, fn, &run);
+  pool_free(pool);
+
+  for (i = 0; i < workers; i++) {
+    paperkey_ctx_set_metrics(&run.workers[i].ctx, NULL);
+    arena_release(&run.workers[i].arena);
+  }
+  free(run.workers);
+
+  return 0;
+}
+
+int extract_many(const struct paperkey_ctx *ctx,
+                 const struct paperkey_batch *batch, struct extract_job *jobs,
+                 size_t count) {
+  return run_batch(ctx, batch, jobs, count, run_extract);
+}
+
+int restore_many(const struct paperkey_ctx *ctx,
+                 const struct paperkey_batch *batch, struct restore_job *jobs,
+                 size_t count) {
+  return run_batch(ctx, batch, jobs, count, run_restore);
+}
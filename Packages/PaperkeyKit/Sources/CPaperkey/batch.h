@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "context.h"
+#include "output.h"
+#include "stream.h"
+#include <stddef.h>
+
+struct paperkey_batch {
+  /* Number of worker threads, 0 for one per online CPU. */
+  unsigned int concurrency;
+  /* Cap on the working memory of a single job in bytes, 0 for none.
+     A job that needs more fails instead of starving its neighbours.
+     The output stream handed back to the caller is not counted. */
+  size_t job_memory_limit;
+};
+
+struct extract_job {
+  /* Filled in by the caller.  Input streams are read through a
+     private copy of the struct, so the same buffer may be shared by
+     several jobs. */
+  const struct stream *input;
+
+  /* Filled in by extract_many().  The output is a stream from
+     create_empty_stream() rewound for reading, or NULL if the job
+     failed. */
+  struct stream *output;
+  int status;
+};
+
+struct restore_job {
+  const struct stream *pubring;
+  const struct stream *secrets;
+  enum data_type input_type;
+
+  struct stream *output;
+  int status;
+};
+
+/* Run every job on a shared pool of workers, each with its own
+   context cloned from the options of ctx and its own arena.  Results
+   are stored in the job array in order.  Returns 0 when the batch
+   ran (whatever the individual statuses), -1 if the workers could not
+   be started. */
+int extract_many(const struct paperkey_ctx *ctx,
+                 const struct paperkey_batch *batch, struct extract_job *jobs,
+                 size_t count);
+int restore_many(const struct paperkey_ctx *ctx,
+                 const struct paperkey_batch *batch, struct restore_job *jobs,
+                 size_t count);
+
+#endif /* !_BATCH_H_ */
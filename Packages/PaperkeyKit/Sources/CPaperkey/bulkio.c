@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "bulkio.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+/* The open, read, write and close ops came with 5.6; fast poll is the
+   first feature flag after them. */
+#ifdef IORING_FEAT_FAST_POLL
+#define HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#define DEFAULT_DEPTH 256
+#define MAX_THREADS 16
+/* First guess at the size of a file read through the ring, which
+   covers most keys in one read. */
+#define READ_CHUNK 16384
+
+enum step { STEP_OPEN, STEP_DATA, STEP_CLOSE };
+
+#ifdef HAVE_IO_URING
+struct ring {
+  int fd;
+  unsigned int entries;
+  unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned int *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+  /* Prepared but not yet handed to the kernel. */
+  unsigned int pending;
+};
+#endif
+
+struct bulkio {
+  pthread_mutex_t lock;
+  /* Queued ops for the back end, and finished ones for waiters. */
+  pthread_cond_t work, finished;
+  struct bulkio_op *head, *tail;
+  int stopping;
+  unsigned int depth;
+  int uring;
+  pthread_t *threads;
+  unsigned int nthreads;
+#ifdef HAVE_IO_URING
+  struct ring ring;
+  /* Written to wake the ring thread when ops are queued. */
+  int event_fd;
+  uint64_t event_value;
+#endif
+};
+
+static struct bulkio_op *pop(struct bulkio *io) {
+  struct bulkio_op *op = io->head;
+
+  io->head = op->next;
+  if (io->head == NULL)
+    io->tail = NULL;
+  return op;
+}
+
+/* The back ends finish an op with the lock held. */
+static void finish(struct bulkio *io, struct bulkio_op *op) {
+  if (op->type == BULKIO_READ) {
+    if (op->error) {
+      free(op->buf);
+      op->buf = NULL;
+      op->len = 0;
+    } else {
+      op->len = op->pos;
+    }
+  }
+  op->done = 1;
+  pthread_cond_broadcast(&io->finished);
+}
+
+/* The whole op with blocking calls, for the threads back end. */
+static void run_blocking(struct bulkio_op *op) {
+  ssize_t n;
+
+  if (op->type == BULKIO_READ) {
+    struct stat st;
+
+    op->fd = open(op->path, O_RDONLY | O_CLOEXEC);
+    if (op->fd < 0) {
+      op->error = errno;
+      return;
+    }
+    op->size = fstat(op->fd, &st) == 0 && st.st_size > 0 ? st.st_size + 1
+                                                          : READ_CHUNK;
+    op->buf = malloc(op->size);
+    if (op->buf == NULL)
+      op->error = ENOMEM;
+    while (!op->error) {
+      if (op->pos == op->size) {
+        unsigned char *grown = realloc(op->buf, op->size * 2);
+
+        if (grown == NULL) {
+          op->error = ENOMEM;
+          break;
+        }
+        op->buf = grown;
+        op->size *= 2;
+      }
+      n = read(op->fd, &op->buf[op->pos], op->size - op->pos);
+      if (n < 0 && errno != EINTR)
+        op->error = errno;
+      else if (n == 0)
+        break;
+      else if (n > 0)
+        op->pos += n;
+    }
+  } else {
+    op->fd = open(op->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (op->fd < 0) {
+      op->error = errno;
+      return;
+    }
+    while (!op->error && op->pos < op->len) {
+      n = write(op->fd, &op->buf[op->pos], op->len - op->pos);
+      if (n < 0 && errno != EINTR)
+        op->error = errno;
+      else if (n > 0)
+        op->pos += n;
+    }
+  }
+
+  if (close(op->fd) != 0 && !op->error)
+    op->error = errno;
+}
+
+static void *io_thread(void *arg) {
+  struct bulkio *io = arg;
+
+  pthread_mutex_lock(&io->lock);
+  for (;;) {
+    struct bulkio_op *op;
+
+    while (io->head == NULL && !io->stopping)
+      pthread_cond_wait(&io->work, &io->lock);
+    if (io->head == NULL)
+      break;
+    op = pop(io);
+    pthread_mutex_unlock(&io->lock);
+
+    run_blocking(op);
+
+    pthread_mutex_lock(&io->lock);
+    finish(io, op);
+  }
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+#ifdef HAVE_IO_URING
+
+static int ring_setup(struct ring *r, unsigned int entries) {
+  struct io_uring_params p;
+  size_t sq_len, cq_len;
+
+  memset(r, 0, sizeof(*r));
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (r->fd < 0)
+    return -1;
+
+  sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_len > sq_len)
+      sq_len = cq_len;
+    cq_len = sq_len;
+  }
+
+  r->sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED) {
+    close(r->fd);
+    return -1;
+  }
+  r->sq_len = sq_len;
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED) {
+      munmap(r->sq_ptr, sq_len);
+      close(r->fd);
+      return -1;
+    }
+    r->cq_len = cq_len;
+  }
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED) {
+    if (r->cq_len)
+      munmap(r->cq_ptr, r->cq_len);
+    munmap(r->sq_ptr, sq_len);
+    close(r->fd);
+    return -1;
+  }
+
+  r->entries = p.sq_entries;
+  r->sq_head = (unsigned int *)((char *)r->sq_ptr + p.sq_off.head);
+  r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+  r->sq_mask = (unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+  r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+  r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask = (unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+  return 0;
+}
+
+static void ring_free(struct ring *r) {
+  munmap(r->sqes, r->sqes_len);
+  if (r->cq_len)
+    munmap(r->cq_ptr, r->cq_len);
+  munmap(r->sq_ptr, r->sq_len);
+  close(r->fd);
+}
+
+/* Whether the kernel knows every op the ring back end uses. */
+static int ring_supported(struct ring *r) {
+  static const unsigned char needed[] = {IORING_OP_OPENAT, IORING_OP_READ,
+                                         IORING_OP_WRITE, IORING_OP_CLOSE};
+  size_t size = sizeof(struct io_uring_probe) +
+                256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  size_t i;
+  int ok;
+
+  if (probe == NULL)
+    return 0;
+  ok = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PROBE, probe,
+               256) == 0;
+  for (i = 0; ok && i < sizeof(needed); i++)
+    ok = needed[i] <= probe->last_op &&
+         (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+  free(probe);
+  return ok;
+}
+
+/* Only the ring thread touches the submission queue, which can never
+   fill up: it holds one entry per op in flight and one for the
+   eventfd. */
+static struct io_uring_sqe *next_sqe(struct ring *r, uint64_t user_data) {
+  unsigned int tail = *r->sq_tail, index = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = &r->sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = user_data;
+  r->sq_array[index] = index;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  r->pending++;
+  return sqe;
+}
+
+static void prep_rw(struct ring *r, uint8_t opcode, int fd, void *addr,
+                    size_t len, uint64_t offset, uint64_t user_data) {
+  struct io_uring_sqe *sqe = next_sqe(r, user_data);
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)addr;
+  sqe->len = len > 0x7FFFF000 ? 0x7FFFF000 : len;
+  sqe->off = offset;
+}
+
+static void prep_open(struct ring *r, struct bulkio_op *op) {
+  struct io_uring_sqe *sqe = next_sqe(r, (uintptr_t)op);
+
+  sqe->opcode = IORING_OP_OPENAT;
+  sqe->fd = AT_FDCWD;
+  sqe->addr = (uintptr_t)op->path;
+  if (op->type == BULKIO_READ) {
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+  } else {
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    sqe->len = 0600;
+  }
+  op->step = STEP_OPEN;
+}
+
+static void prep_close(struct ring *r, struct bulkio_op *op) {
+  struct io_uring_sqe *sqe = next_sqe(r, (uintptr_t)op);
+
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = op->fd;
+  op->step = STEP_CLOSE;
+}
+
+/* The next read or write of an open file, or its close once there is
+   no more to do. */
+static void prep_data(struct ring *r, struct bulkio_op *op) {
+  op->step = STEP_DATA;
+  if (op->type == BULKIO_WRITE) {
+    if (op->pos == op->len)
+      prep_close(r, op);
+    else
+      prep_rw(r, IORING_OP_WRITE, op->fd, &op->buf[op->pos],
+              op->len - op->pos, op->pos, (uintptr_t)op);
+    return;
+  }
+
+  if (op->pos == op->size) {
+    size_t size = op->size ? op->size * 2 : READ_CHUNK;
+    unsigned char *grown = realloc(op->buf, size);
+
+    if (grown == NULL) {
+      op->error = ENOMEM;
+      prep_close(r, op);
+      return;
+    }
+    op->buf = grown;
+    op->size = size;
+  }
+  prep_rw(r, IORING_OP_READ, op->fd, &op->buf[op->pos], op->size - op->pos,
+          op->pos, (uintptr_t)op);
+}
+
+/* Move an op on by the result of its last step.  Returns 1 once it is
+   done. */
+static int advance(struct ring *r, struct bulkio_op *op, int res) {
+  switch (op->step) {
+  case STEP_OPEN:
+    if (res < 0) {
+      op->error = -res;
+      return 1;
+    }
+    op->fd = res;
+    prep_data(r, op);
+    return 0;
+
+  case STEP_DATA:
+    if (res < 0) {
+      op->error = -res;
+      prep_close(r, op);
+    } else if (op->type == BULKIO_READ && (size_t)res < op->size - op->pos) {
+      /* A short read of a regular file is its end, which saves
+         another trip for the zero-length read. */
+      op->pos += res;
+      prep_close(r, op);
+    } else {
+      op->pos += res;
+      prep_data(r, op);
+    }
+    return 0;
+
+  default:
+    if (res < 0 && !op->error)
+      op->error = -res;
+    return 1;
+  }
+}
+
+static void arm_event(struct bulkio *io) {
+  prep_rw(&io->ring, IORING_OP_READ, io->event_fd, &io->event_value,
+          sizeof(io->event_value), 0, 0);
+}
+
+static void *ring_thread(void *arg) {
+  struct bulkio *io = arg;
+  struct ring *r = &io->ring;
+  unsigned int inflight = 0;
+
+  arm_event(io);
+
+  pthread_mutex_lock(&io->lock);
+  for (;;) {
+    unsigned int head, tail;
+    int ret;
+
+    while (inflight < io->depth && io->head) {
+      prep_open(r, pop(io));
+      inflight++;
+    }
+    if (io->stopping && inflight == 0 && io->head == NULL)
+      break;
+    pthread_mutex_unlock(&io->lock);
+
+    /* Start what is prepared and sleep until something completes, a
+       new op included, as that writes the eventfd. */
+    ret = syscall(__NR_io_uring_enter, r->fd, r->pending, 1,
+                  IORING_ENTER_GETEVENTS, NULL, 0);
+    if (ret > 0)
+      r->pending -= ret;
+
+    pthread_mutex_lock(&io->lock);
+    head = *r->cq_head;
+    tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+      struct bulkio_op *op = (struct bulkio_op *)(uintptr_t)cqe->user_data;
+
+      if (op == NULL) {
+        arm_event(io);
+      } else if (advance(r, op, cqe->res)) {
+        finish(io, op);
+        inflight--;
+      }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&io->lock);
+  return NULL;
+}
+
+static int start_ring(struct bulkio *io) {
+  if (ring_setup(&io->ring, io->depth + 1) != 0)
+    return -1;
+  if (!ring_supported(&io->ring)) {
+    ring_free(&io->ring);
+    return -1;
+  }
+  io->event_fd = eventfd(0, EFD_CLOEXEC);
+  if (io->event_fd < 0) {
+    ring_free(&io->ring);
+    return -1;
+  }
+  io->threads = malloc(sizeof(*io->threads));
+  if (io->threads == NULL ||
+      pthread_create(&io->threads[0], NULL, ring_thread, io) != 0) {
+    free(io->threads);
+    io->threads = NULL;
+    close(io->event_fd);
+    ring_free(&io->ring);
+    return -1;
+  }
+  io->nthreads = 1;
+  io->uring = 1;
+  return 0;
+}
+
+static void wake_ring(struct bulkio *io) {
+  uint64_t one = 1;
+
+  if (write(io->event_fd, &one, sizeof(one)) < 0) {
+    /* The counter is full, so the thread has a wakeup pending. */
+  }
+}
+
+#endif /* HAVE_IO_URING */
+
+static int start_threads(struct bulkio *io) {
+  unsigned int n = io->depth < MAX_THREADS ? io->depth : MAX_THREADS;
+
+  io->threads = calloc(n, sizeof(*io->threads));
+  if (io->threads == NULL)
+    return -1;
+  for (; io->nthreads < n; io->nthreads++)
+    if (pthread_create(&io->threads[io->nthreads], NULL, io_thread, io) != 0)
+      break;
+  return io->nthreads ? 0 : -1;
+}
+
+struct bulkio *bulkio_new(unsigned int depth, int force_threads) {
+  struct bulkio *io = calloc(1, sizeof(*io));
+  int started = -1;
+
+  if (io == NULL)
+    return NULL;
+  io->depth = depth ? depth : DEFAULT_DEPTH;
+  pthread_mutex_init(&io->lock, NULL);
+  pthread_cond_init(&io->work, NULL);
+  pthread_cond_init(&io->finished, NULL);
+
+#ifdef HAVE_IO_URING
+  if (!force_threads)
+    started = start_ring(io);
+#else
+  (void)force_threads;
+#endif
+  if (started != 0)
+    started = start_threads(io);
+  if (started != 0) {
+    bulkio_free(io);
+    return NULL;
+  }
+  return io;
+}
+
+const char *bulkio_backend(const struct bulkio *io) {
+  return io->uring ? "io_uring" : "threads";
+}
+
+void bulkio_submit(struct bulkio *io, struct bulkio_op *ops, size_t count) {
+  size_t i;
+
+  if (count == 0)
+    return;
+
+  pthread_mutex_lock(&io->lock);
+  for (i = 0; i < count; i++) {
+    struct bulkio_op *op = &ops[i];
+
+    if (op->type == BULKIO_READ) {
+      op->buf = NULL;
+      op->len = 0;
+    }
+    op->error = 0;
+    op->done = 0;
+    op->fd = -1;
+    op->pos = 0;
+    op->size = 0;
+    op->next = NULL;
+    if (io->tail)
+      io->tail->next = op;
+    else
+      io->head = op;
+    io->tail = op;
+  }
+  pthread_cond_broadcast(&io->work);
+  pthread_mutex_unlock(&io->lock);
+
+#ifdef HAVE_IO_URING
+  if (io->uring)
+    wake_ring(io);
+#endif
+}
+
+void bulkio_wait(struct bulkio *io, struct bulkio_op *ops, size_t count) {
+  size_t i;
+
+  pthread_mutex_lock(&io->lock);
+  for (i = 0; i < count; i++)
+    while (!ops[i].done)
+      pthread_cond_wait(&io->finished, &io->lock);
+  pthread_mutex_unlock(&io->lock);
+}
+
+void bulkio_free(struct bulkio *io) {
+  unsigned int i;
+
+  if (io == NULL)
+    return;
+
+  pthread_mutex_lock(&io->lock);
+  io->stopping = 1;
+  pthread_cond_broadcast(&io->work);
+  pthread_mutex_unlock(&io->lock);
+#ifdef HAVE_IO_URING
+  if (io->uring)
+    wake_ring(io);
+#endif
+
+  for (i = 0; i < io->nthreads; i++)
+    pthread_join(io->threads[i], NULL);
+  free(io->threads);
+
+#ifdef HAVE_IO_URING
+  if (io->uring) {
+    close(io->event_fd);
+    ring_free(&io->ring);
+  }
+#endif
+  pthread_cond_destroy(&io->finished);
+  pthread_cond_destroy(&io->work);
+  pthread_mutex_destroy(&io->lock);
+  free(io);
+}
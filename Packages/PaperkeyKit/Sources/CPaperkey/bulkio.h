@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _BULKIO_H_
+#define _BULKIO_H_
+
+#include <stddef.h>
+
+/* Whole-file reads and writes for runs over many small files.  Ops are
+   queued in batches and carried out in the background, at most a fixed
+   number at a time, so the caller can keep the CPU busy with the last
+   batch meanwhile.
+
+   On Linux the opens, reads, writes and closes go through an io_uring
+   instance set up with the raw system calls, so one system call starts
+   or reaps the next step of many files at once.  Where io_uring is
+   missing or refused (old kernels, seccomp, other systems) a few
+   threads make the same calls one at a time instead. */
+
+enum bulkio_type { BULKIO_READ, BULKIO_WRITE };
+
+struct bulkio_op {
+  /* Filled in by the caller.  A read fills buf with malloc()ed memory
+     of len bytes, owned by the caller once it is done.  A write stores
+     len bytes of buf in path, created with mode 0600 or truncated, and
+     leaves buf alone. */
+  enum bulkio_type type;
+  const char *path;
+  unsigned char *buf;
+  size_t len;
+
+  /* 0, or the errno value of the step that failed. */
+  int error;
+
+  /* Private to bulkio while the op is queued. */
+  int done;
+  int fd;
+  int step;
+  size_t pos;
+  size_t size;
+  struct bulkio_op *next;
+};
+
+struct bulkio;
+
+/* At most depth ops in flight, 0 for a default.  With force_threads
+   the io_uring back end is not tried, for comparisons. */
+struct bulkio *bulkio_new(unsigned int depth, int force_threads);
+/* "io_uring" or "threads". */
+const char *bulkio_backend(const struct bulkio *io);
+/* Queue the ops, which must stay in place until they are done. */
+void bulkio_submit(struct bulkio *io, struct bulkio_op *ops, size_t count);
+/* Wait until each of the ops is done. */
+void bulkio_wait(struct bulkio *io, struct bulkio_op *ops, size_t count);
+/* Waits for every queued op first. */
+void bulkio_free(struct bulkio *io);
+
+#endif /* !_BULKIO_H_ */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "context.h"
+#include "internal.h"
+#include "metrics.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void *default_alloc(void *opaque, void *ptr, size_t osize,
+                           size_t nsize) {
+  (void)opaque;
+  (void)osize;
+
+  if (nsize == 0) {
+    free(ptr);
+    return NULL;
+  }
+
+  return realloc(ptr, nsize);
+}
+
+void paperkey_ctx_init(struct paperkey_ctx *ctx) {
+  memset(ctx, 0, sizeof(*ctx));
+  ctx->alloc = default_alloc;
+  ctx->output_type = BASE16;
+  ctx->output_width = 78;
+  ctx->out.all_crc = CRC24_INIT;
+}
+
+struct paperkey_ctx *paperkey_ctx_new(void) {
+  return paperkey_ctx_new_with_allocator(NULL, NULL);
+}
+
+struct paperkey_ctx *paperkey_ctx_new_with_allocator(paperkey_alloc_fn alloc,
+                                                     void *opaque) {
+  struct paperkey_ctx *ctx;
+
+  if (alloc == NULL)
+    alloc = default_alloc;
+
+  ctx = alloc(opaque, NULL, 0, sizeof(*ctx));
+  if (ctx == NULL)
+    return NULL;
+
+  paperkey_ctx_init(ctx);
+  ctx->alloc = alloc;
+  ctx->alloc_opaque = opaque;
+
+  return ctx;
+}
+
+void paperkey_ctx_free(struct paperkey_ctx *ctx) {
+  if (ctx == NULL)
+    return;
+  paperkey_ctx_set_metrics(ctx, NULL);
+  ctx->alloc(ctx->alloc_opaque, ctx, sizeof(*ctx), 0);
+}
+
+void paperkey_ctx_set_output_type(struct paperkey_ctx *ctx,
+                                  enum data_type type) {
+  ctx->output_type = type;
+}
+
+void paperkey_ctx_set_output_width(struct paperkey_ctx *ctx,
+                                   unsigned int width) {
+  ctx->output_width = width;
+}
+
+void paperkey_ctx_set_ignore_crc_error(struct paperkey_ctx *ctx, int ignore) {
+  ctx->ignore_crc_error = ignore;
+}
+
+void paperkey_ctx_set_ocr_repair(struct paperkey_ctx *ctx, int repair) {
+  ctx->ocr_repair = repair;
+}
+
+void paperkey_ctx_set_decode_threads(struct paperkey_ctx *ctx,
+                                     unsigned int threads) {
+  ctx->decode_threads = threads;
+}
+
+void paperkey_ctx_set_scan_threads(struct paperkey_ctx *ctx,
+                                   unsigned int threads) {
+  ctx->scan_threads = threads;
+}
+
+void paperkey_ctx_set_fec(struct paperkey_ctx *ctx, unsigned int percent) {
+  ctx->fec_percent = percent > 100 ? 100 : percent;
+}
+
+void paperkey_ctx_set_timestamp(struct paperkey_ctx *ctx, time_t timestamp) {
+  ctx->timestamp = timestamp;
+  ctx->have_timestamp = 1;
+}
+
+void paperkey_ctx_set_comment(struct paperkey_ctx *ctx, const char *comment) {
+  ctx->comment = comment;
+}
+
+void paperkey_ctx_set_armor(struct paperkey_ctx *ctx, int armor) {
+  ctx->armor_output = armor;
+}
+
+void paperkey_ctx_set_pubring_index(struct paperkey_ctx *ctx,
+                                    const struct paperkey_index *index) {
+  ctx->pubring_index = index;
+}
+
+void paperkey_ctx_set_limit(struct paperkey_ctx *ctx,
+                            enum paperkey_limit limit, size_t value) {
+  if (limit > PAPERKEY_LIMIT_NONE && limit < PAPERKEY_LIMIT_COUNT)
+    ctx->limits[limit] = value;
+}
+
+enum paperkey_limit paperkey_ctx_limit_hit(const struct paperkey_ctx *ctx) {
+  return __atomic_load_n(&ctx->limit_hit, __ATOMIC_ACQUIRE);
+}
+
+int ctx_refuse(struct paperkey_ctx *ctx, enum paperkey_limit limit) {
+  int none = PAPERKEY_LIMIT_NONE;
+
+  __atomic_compare_exchange_n(&ctx->limit_hit, &none, limit, 0,
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+  return -1;
+}
+
+static int admit_input(struct paperkey_ctx *ctx, const struct stream *input) {
+  size_t max = ctx->limits[PAPERKEY_LIMIT_INPUT];
+
+  if (input && max && input->size > input->pos &&
+      (size_t)(input->size - input->pos) > max)
+    return ctx_refuse(ctx, PAPERKEY_LIMIT_INPUT);
+  return 0;
+}
+
+int ctx_admit(struct paperkey_ctx *ctx, const struct stream *input,
+              const struct stream *second) {
+  __atomic_store_n(&ctx->limit_hit, PAPERKEY_LIMIT_NONE, __ATOMIC_RELAXED);
+  ctx->cert_packets = 0;
+  if (admit_input(ctx, input) != 0 || admit_input(ctx, second) != 0)
+    return -1;
+  return 0;
+}
+
+int ctx_admit_packet(struct paperkey_ctx *ctx, unsigned int *count,
+                     unsigned char type, unsigned int length) {
+  size_t max_packet = ctx->limits[PAPERKEY_LIMIT_PACKET];
+  size_t max_count = ctx->limits[PAPERKEY_LIMIT_CERT_PACKETS];
+
+  if (max_packet && length > max_packet)
+    return ctx_refuse(ctx, PAPERKEY_LIMIT_PACKET);
+  if (type == 5 || type == 6)
+    *count = 0;
+  if (++*count > max_count && max_count != 0)
+    return ctx_refuse(ctx, PAPERKEY_LIMIT_CERT_PACKETS);
+  return 0;
+}
+
+/* The budget is checked before the allocator is called, so a refused
+   block never exists even for a moment. */
+void *ctx_realloc(struct paperkey_ctx *ctx, void *ptr, size_t osize,
+                  size_t nsize) {
+  size_t max = ctx->limits[PAPERKEY_LIMIT_MEMORY];
+  void *block;
+
+  if (nsize == 0) {
+    ctx_free(ctx, ptr, osize);
+    return NULL;
+  }
+
+  if (max && nsize > osize &&
+      (ctx->allocated > max || nsize - osize > max - ctx->allocated)) {
+    ctx_refuse(ctx, PAPERKEY_LIMIT_MEMORY);
+    return NULL;
+  }
+
+  block = ctx->alloc(ctx->alloc_opaque, ptr, osize, nsize);
+  if (block == NULL)
+    return NULL;
+  if (nsize >= osize)
+    ctx->allocated += nsize - osize;
+  else
+    ctx->allocated -= osize - nsize < ctx->allocated ? osize - nsize
+                                                     : ctx->allocated;
+  return block;
+}
+
+void ctx_free(struct paperkey_ctx *ctx, void *ptr, size_t osize) {
+  if (ptr) {
+    ctx->alloc(ctx->alloc_opaque, ptr, osize, 0);
+    ctx->allocated -= osize < ctx->allocated ? osize : ctx->allocated;
+  }
+}
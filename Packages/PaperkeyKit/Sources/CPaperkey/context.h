@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+
+#include "output.h"
+#include "stream.h"
+#include <stddef.h>
+#include <time.h>
+
+/* An operation context.  It owns the encoder state, the allocator and
+   the options of one extract or restore at a time, so separate
+   contexts can be used from separate threads without any locking. */
+struct paperkey_ctx;
+
+/* Allocator hook in the style of lua_Alloc: a NULL ptr allocates, a
+   zero nsize frees, anything else resizes.  osize is the size of the
+   block being resized or freed (0 for a fresh allocation).  Returning
+   NULL on a non-zero nsize reports an allocation failure. */
+typedef void *(*paperkey_alloc_fn)(void *opaque, void *ptr, size_t osize,
+                                   size_t nsize);
+
+struct paperkey_ctx *paperkey_ctx_new(void);
+struct paperkey_ctx *paperkey_ctx_new_with_allocator(paperkey_alloc_fn alloc,
+                                                     void *opaque);
+void paperkey_ctx_free(struct paperkey_ctx *ctx);
+
+void paperkey_ctx_set_output_type(struct paperkey_ctx *ctx,
+                                  enum data_type type);
+void paperkey_ctx_set_output_width(struct paperkey_ctx *ctx,
+                                   unsigned int width);
+void paperkey_ctx_set_ignore_crc_error(struct paperkey_ctx *ctx, int ignore);
+/* Try to fix base16 lines that fail their CRC by swapping characters
+   that scanners commonly confuse, such as 0/O/D or 8/B. */
+void paperkey_ctx_set_ocr_repair(struct paperkey_ctx *ctx, int repair);
+/* Decode large base16 documents on this many threads (0 or 1 for the
+   calling thread only). */
+void paperkey_ctx_set_decode_threads(struct paperkey_ctx *ctx,
+                                     unsigned int threads);
+/* Scan pubrings on this many threads (0 or 1 for the calling thread
+   only), when building an index and when restoring without one. */
+void paperkey_ctx_set_scan_threads(struct paperkey_ctx *ctx,
+                                   unsigned int threads);
+/* Append Reed-Solomon parity lines worth this percentage of the data
+   lines (1 to 100) to text output, or 0 to turn them off. */
+void paperkey_ctx_set_fec(struct paperkey_ctx *ctx, unsigned int percent);
+/* Use a fixed timestamp in the text header instead of the current
+   time.  Useful for reproducible output. */
+void paperkey_ctx_set_timestamp(struct paperkey_ctx *ctx, time_t timestamp);
+/* Add a comment to the text header, one "# " line per line of it, or
+   none with NULL.  The string stays owned by the caller. */
+void paperkey_ctx_set_comment(struct paperkey_ctx *ctx, const char *comment);
+
+/* Write restored keys in ASCII armor instead of binary.  Secret keys
+   and pubrings are read either way. */
+void paperkey_ctx_set_armor(struct paperkey_ctx *ctx, int armor);
+
+/* Look keys up in this index of the pubring (see fpindex.h) and
+   restore from their certificate alone, instead of scanning the
+   pubring from the start.  NULL turns it off.  The index stays owned
+   by the caller. */
+struct paperkey_index;
+void paperkey_ctx_set_pubring_index(struct paperkey_ctx *ctx,
+                                    const struct paperkey_index *index);
+
+/* Limits on what one operation takes in, for contexts that serve
+   untrusted input.  Each is 0, for none, until it is set.  Going over
+   one fails the operation before anything is allocated for what would
+   not fit, and paperkey_ctx_limit_hit() then says which it was. */
+enum paperkey_limit {
+  PAPERKEY_LIMIT_NONE,
+  /* Octets left in each input stream: the key, pubring or secrets. */
+  PAPERKEY_LIMIT_INPUT,
+  /* Octets in the body of one packet read from an input, and in the
+     secrets decoded from a document. */
+  PAPERKEY_LIMIT_PACKET,
+  /* Packets in one certificate, from its primary key on. */
+  PAPERKEY_LIMIT_CERT_PACKETS,
+  /* Octets held at once through the allocator of the context, counted
+     from the osize and nsize it is called with. */
+  PAPERKEY_LIMIT_MEMORY,
+  PAPERKEY_LIMIT_COUNT
+};
+void paperkey_ctx_set_limit(struct paperkey_ctx *ctx,
+                            enum paperkey_limit limit, size_t value);
+/* The limit that failed the last operation on ctx, or
+   PAPERKEY_LIMIT_NONE. */
+enum paperkey_limit paperkey_ctx_limit_hit(const struct paperkey_ctx *ctx);
+
+int paperkey_extract(struct paperkey_ctx *ctx, struct stream *input,
+                     struct stream *output);
+int paperkey_restore(struct paperkey_ctx *ctx, struct stream *pubring,
+                     struct stream *secrets, enum data_type input_type,
+                     struct stream *output);
+
+#endif /* !_CONTEXT_H_ */
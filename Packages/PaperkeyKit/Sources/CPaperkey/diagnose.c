@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "diagnose.h"
+#include "encode.h"
+#include "internal.h"
+#include "output.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Line numbers past this are taken as misreads rather than grown into. */
+#define DIAGNOSE_MAX_LINES 65535
+
+struct line_slot {
+  size_t offset;
+  unsigned int len;
+  int seen;
+};
+
+struct diagnosis {
+  struct paperkey_ctx *ctx;
+  struct paperkey_report *report;
+
+  /* Slot n holds where the data of line n went in buf. */
+  struct line_slot *slots;
+  unsigned int nslots;
+
+  unsigned char *buf;
+  size_t size;
+};
+
+const char *line_problem_name(enum line_problem problem) {
+  switch (problem) {
+  case LINE_MISSING:
+    return "missing";
+  case LINE_DUPLICATE:
+    return "duplicated";
+  case LINE_OUT_OF_ORDER:
+    return "out of order";
+  case LINE_BAD_CRC:
+    return "bad CRC";
+  case LINE_MALFORMED:
+    return "malformed";
+  }
+  return "unknown";
+}
+
+static int add_issue(struct diagnosis *d, unsigned int number,
+                     unsigned int input_line, enum line_problem problem) {
+  struct paperkey_report *report = d->report;
+
+  if (report->count == report->size) {
+    size_t size = report->size ? report->size * 2 : 16;
+    struct line_issue *tmp;
+
+    tmp = ctx_realloc(d->ctx, report->issues,
+                      report->size * sizeof(*report->issues),
+                      size * sizeof(*report->issues));
+    if (tmp == NULL)
+      return -1;
+    report->issues = tmp;
+    report->size = size;
+  }
+
+  report->issues[report->count].number = number;
+  report->issues[report->count].input_line = input_line;
+  report->issues[report->count].problem = problem;
+  report->count++;
+  return 0;
+}
+
+static int grow_slots(struct diagnosis *d, unsigned int number) {
+  unsigned int n = d->nslots ? d->nslots : 64;
+  struct line_slot *tmp;
+
+  while (n <= number)
+    n *= 2;
+
+  tmp = ctx_realloc(d->ctx, d->slots, d->nslots * sizeof(*d->slots),
+                    n * sizeof(*d->slots));
+  if (tmp == NULL)
+    return -1;
+  memset(&tmp[d->nslots], 0, (n - d->nslots) * sizeof(*tmp));
+  d->slots = tmp;
+  d->nslots = n;
+  return 0;
+}
+
+static int keep_data(struct diagnosis *d, struct line_slot *slot,
+                     const unsigned char *data, size_t len) {
+  size_t used = d->report->bytes;
+
+  if (d->size - used < len) {
+    size_t size = d->size ? d->size : 1024;
+    unsigned char *tmp;
+
+    while (size - used < len)
+      size *= 2;
+
+    tmp = ctx_realloc(d->ctx, d->buf, d->size, size);
+    if (tmp == NULL)
+      return -1;
+    d->buf = tmp;
+    d->size = size;
+  }
+
+  memcpy(&d->buf[used], data, len);
+  slot->offset = used;
+  slot->len = len;
+  d->report->bytes += len;
+  return 0;
+}
+
+static int compare_issues(const void *a, const void *b) {
+  const struct line_issue *x = a, *y = b;
+
+  if (x->number != y->number)
+    return x->number < y->number ? -1 : 1;
+  if (x->input_line != y->input_line)
+    return x->input_line < y->input_line ? -1 : 1;
+  return 0;
+}
+
+static int diagnose_raw(struct diagnosis *d, struct stream *secrets) {
+  struct paperkey_report *report = d->report;
+  unsigned long all_crc = CRC24_INIT;
+  unsigned char buffer[1024];
+  struct line_slot whole;
+  size_t got;
+
+  while ((got = stream_read(buffer, 1, sizeof(buffer), secrets)))
+    if (keep_data(d, &whole, buffer, got) != 0)
+      return -1;
+
+  if (report->bytes < 3) {
+    report->total_crc = TOTAL_CRC_MISSING;
+    return 0;
+  }
+
+  report->bytes -= 3;
+  report->expected_crc = (unsigned long)d->buf[report->bytes] << 16 |
+                         d->buf[report->bytes + 1] << 8 |
+                         d->buf[report->bytes + 2];
+  do_crc24(&all_crc, d->buf, report->bytes);
+  report->computed_crc = all_crc & 0xFFFFFFL;
+  report->total_crc = report->computed_crc == report->expected_crc
+                          ? TOTAL_CRC_OK
+                          : TOTAL_CRC_MISMATCH;
+  return 0;
+}
+
+static int diagnose_text(struct diagnosis *d, struct stream *secrets) {
+  struct paperkey_report *report = d->report;
+  unsigned int input_line = 0, highest = 0, final_line = 0, n;
+  unsigned long all_crc = CRC24_INIT;
+  char line[1024];
+
+  while (stream_gets(line, sizeof(line), secrets)) {
+    unsigned char decoded[sizeof(line)];
+    unsigned long line_crc = CRC24_INIT, new_crc;
+    const char *p = line + strspn(line, " ");
+    unsigned int number;
+    struct line_slot *slot;
+    ssize_t got;
+
+    input_line++;
+    if (line[0] == '#' || line[strspn(line, " \r\n")] == '\0')
+      continue;
+
+    number = isdigit((unsigned char)*p) ? strtoul(p, NULL, 10) : 0;
+    if (number == 0 || number > DIAGNOSE_MAX_LINES) {
+      if (add_issue(d, 0, input_line, LINE_MALFORMED) != 0)
+        return -1;
+      continue;
+    }
+
+    if (number >= d->nslots && grow_slots(d, number) != 0)
+      return -1;
+    slot = &d->slots[number];
+
+    if (slot->seen) {
+      if (add_issue(d, number, input_line, LINE_DUPLICATE) != 0)
+        return -1;
+      continue;
+    }
+    slot->seen = 1;
+    if (number < highest &&
+        add_issue(d, number, input_line, LINE_OUT_OF_ORDER) != 0)
+      return -1;
+    if (number > highest)
+      highest = number;
+
+    got = decode_line(report->type, line, decoded, &new_crc);
+    if (got < 0) {
+      if (add_issue(d, number, input_line, LINE_MALFORMED) != 0)
+        return -1;
+      continue;
+    }
+
+    if (got == 0) {
+      final_line = number;
+      report->expected_crc = new_crc;
+      continue;
+    }
+
+    do_crc24(&line_crc, decoded, got);
+    if ((line_crc & 0xFFFFFFL) != new_crc &&
+        add_issue(d, number, input_line, LINE_BAD_CRC) != 0)
+      return -1;
+
+    if (keep_data(d, slot, decoded, got) != 0)
+      return -1;
+  }
+
+  report->lines = highest;
+  for (n = 1; n <= highest; n++)
+    if (!d->slots[n].seen && add_issue(d, n, 0, LINE_MISSING) != 0)
+      return -1;
+
+  /* The total covers the data in line number order, whatever order the
+     lines came in. */
+  if (final_line == 0) {
+    report->total_crc = TOTAL_CRC_MISSING;
+  } else {
+    for (n = 1; n < final_line; n++)
+      if (d->slots[n].len)
+        do_crc24(&all_crc, &d->buf[d->slots[n].offset], d->slots[n].len);
+    report->computed_crc = all_crc & 0xFFFFFFL;
+    report->total_crc = report->computed_crc == report->expected_crc
+                            ? TOTAL_CRC_OK
+                            : TOTAL_CRC_MISMATCH;
+  }
+
+  if (report->count)
+    qsort(report->issues, report->count, sizeof(*report->issues),
+          compare_issues);
+  return 0;
+}
+
+int paperkey_diagnose(struct paperkey_ctx *ctx, struct stream *secrets,
+                      enum data_type input_type,
+                      struct paperkey_report *report) {
+  struct diagnosis d;
+  int ret;
+
+  memset(report, 0, sizeof(*report));
+  memset(&d, 0, sizeof(d));
+  d.ctx = ctx;
+  d.report = report;
+
+  if (input_type == AUTO) {
+    input_type = detect_data_type(secrets);
+    if (input_type == AUTO)
+      return -1;
+  }
+  report->type = input_type;
+
+  if (input_type == RAW)
+    ret = diagnose_raw(&d, secrets);
+  else
+    ret = diagnose_text(&d, secrets);
+
+  ctx_free(ctx, d.slots, d.nslots * sizeof(*d.slots));
+  ctx_free(ctx, d.buf, d.size);
+
+  if (ret != 0)
+    return -1;
+  return report->count || report->total_crc != TOTAL_CRC_OK;
+}
+
+void paperkey_report_free(struct paperkey_ctx *ctx,
+                          struct paperkey_report *report) {
+  ctx_free(ctx, report->issues, report->size * sizeof(*report->issues));
+  report->issues = NULL;
+  report->count = report->size = 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _DIAGNOSE_H_
+#define _DIAGNOSE_H_
+
+#include "context.h"
+#include "output.h"
+#include "stream.h"
+#include <stddef.h>
+
+enum line_problem {
+  /* A number below the last line was never seen. */
+  LINE_MISSING,
+  /* The same number appears again. */
+  LINE_DUPLICATE,
+  /* The number is lower than one seen before it. */
+  LINE_OUT_OF_ORDER,
+  /* The data does not match the CRC-24 at the end of the line. */
+  LINE_BAD_CRC,
+  /* No line number, no CRC, or characters outside the encoding. */
+  LINE_MALFORMED
+};
+
+struct line_issue {
+  /* The line number as printed, 0 if it could not be read. */
+  unsigned int number;
+  /* Where the line is in the input, counting from 1, or 0 for a
+     missing line. */
+  unsigned int input_line;
+  enum line_problem problem;
+};
+
+enum total_crc_status { TOTAL_CRC_OK, TOTAL_CRC_MISMATCH, TOTAL_CRC_MISSING };
+
+struct paperkey_report {
+  enum data_type type;
+  /* Highest line number seen, including the final CRC line. */
+  unsigned int lines;
+  /* Bytes of data decoded, bad lines included. */
+  size_t bytes;
+
+  enum total_crc_status total_crc;
+  unsigned long expected_crc;
+  unsigned long computed_crc;
+
+  /* Every problem found, ordered by line number and then by position
+     in the input. */
+  struct line_issue *issues;
+  size_t count;
+  size_t size;
+};
+
+/* Decode a whole secrets document in one pass without stopping at the
+   first error, and list everything wrong with it.  Returns 0 for a
+   clean document, 1 when the report lists problems, and -1 if the type
+   could not be detected or memory ran out.  Release the report with
+   paperkey_report_free() whatever the result. */
+int paperkey_diagnose(struct paperkey_ctx *ctx, struct stream *secrets,
+                      enum data_type input_type,
+                      struct paperkey_report *report);
+void paperkey_report_free(struct paperkey_ctx *ctx,
+                          struct paperkey_report *report);
+
+const char *line_problem_name(enum line_problem problem);
+
+#endif /* !_DIAGNOSE_H_ */
@@ -0,0 +1,569 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "encode.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Base64 runs 16 characters at a time with SSSE3 where the CPU has it,
+   chosen at run time so the build needs no special flags. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define BASE64_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/* Alphabets: RFC 4648 base32 and base64 (both unpadded, the line
+   length says where the data stops) and RFC 9285 base45, which is
+   exactly the QR code alphanumeric character set. */
+static const char base32_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+static const char base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char base45_alphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ $%*+-./:";
+
+/* Reverse lookups, 0xFF for characters outside the alphabet. */
+static const unsigned char base32_value[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF};
+
+static const unsigned char base64_value[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+    0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12,
+    0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24,
+    0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30,
+    0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF};
+
+static const unsigned char base45_value[256] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x24, 0xFF, 0xFF, 0xFF,
+    0x25, 0x26, 0xFF, 0xFF, 0xFF, 0xFF, 0x27, 0x28, 0xFF, 0x29, 0x2A, 0x2B,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x2C, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10,
+    0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C,
+    0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+const char *encoding_name(enum data_type type) {
+  switch (type) {
+  case BASE32:
+    return "Base32";
+  case BASE64:
+    return "Base64";
+  case BASE45:
+    return "Base45";
+  case RAW:
+    return "Raw";
+  default:
+    return "Base16";
+  }
+}
+
+unsigned int encoding_line_items(enum data_type type, unsigned int width) {
+  unsigned int group_bytes, group_chars, items;
+
+  /* Every line is "NNN: " + data + CRC-24, so 5 + 6 characters are
+     spoken for.  Base16 data carries its own separating space, the
+     others need one in front of the CRC. */
+  switch (type) {
+  case BASE32:
+    group_bytes = 5;
+    group_chars = 8;
+    break;
+  case BASE64:
+    group_bytes = 3;
+    group_chars = 4;
+    break;
+  case BASE45:
+    group_bytes = 2;
+    group_chars = 3;
+    break;
+  default:
+    if (width < 5 + 6 + 3)
+      return 0;
+    items = (width - 5 - 6) / 3;
+    return items > MAX_LINE_ITEMS ? MAX_LINE_ITEMS : items;
+  }
+
+  if (width < 5 + 1 + 6 + group_chars)
+    return 0;
+
+  items = (width - 5 - 1 - 6) / group_chars * group_bytes;
+  if (items > MAX_LINE_ITEMS)
+    items = MAX_LINE_ITEMS / group_bytes * group_bytes;
+
+  return items;
+}
+
+static size_t encode_bits(char *dst, const unsigned char *src, size_t len,
+                          const char *alphabet, unsigned int bits) {
+  unsigned int mask = (1U << bits) - 1;
+  unsigned long acc = 0;
+  unsigned int nbits = 0;
+  size_t i, n = 0;
+
+  for (i = 0; i < len; i++) {
+    acc = (acc << 8) | src[i];
+    nbits += 8;
+    while (nbits >= bits) {
+      nbits -= bits;
+      dst[n++] = alphabet[(acc >> nbits) & mask];
+    }
+    acc &= (1UL << nbits) - 1;
+  }
+
+  if (nbits)
+    dst[n++] = alphabet[(acc << (bits - nbits)) & mask];
+
+  return n;
+}
+
+static ssize_t decode_bits(unsigned char *dst, const char *src, size_t len,
+                           const unsigned char *value, unsigned int bits) {
+  unsigned long acc = 0;
+  unsigned int nbits = 0;
+  size_t i, n = 0;
+
+  for (i = 0; i < len; i++) {
+    unsigned char v = value[(unsigned char)src[i]];
+
+    if (v == 0xFF)
+      return -1;
+
+    acc = (acc << bits) | v;
+    nbits += bits;
+    if (nbits >= 8) {
+      nbits -= 8;
+      dst[n++] = acc >> nbits;
+      acc &= (1UL << nbits) - 1;
+    }
+  }
+
+  /* A whole character of leftover bits means a truncated group, and
+     the padding bits of a final partial group are always zero. */
+  if (nbits >= bits || acc != 0)
+    return -1;
+
+  return n;
+}
+
+static size_t encode_base45(char *dst, const unsigned char *src, size_t len) {
+  size_t i, n = 0;
+
+  for (i = 0; i + 1 < len; i += 2) {
+    unsigned int v = src[i] << 8 | src[i + 1];
+
+    dst[n++] = base45_alphabet[v % 45];
+    dst[n++] = base45_alphabet[v / 45 % 45];
+    dst[n++] = base45_alphabet[v / (45 * 45)];
+  }
+
+  if (i < len) {
+    dst[n++] = base45_alphabet[src[i] % 45];
+    dst[n++] = base45_alphabet[src[i] / 45];
+  }
+
+  return n;
+}
+
+static ssize_t decode_base45(unsigned char *dst, const char *src, size_t len) {
+  size_t i, n = 0;
+
+  if (len % 3 == 1)
+    return -1;
+
+  for (i = 0; i < len; i += 3) {
+    unsigned int c = base45_value[(unsigned char)src[i]];
+    unsigned int d = base45_value[(unsigned char)src[i + 1]];
+    unsigned int v;
+
+    if (c == 0xFF || d == 0xFF)
+      return -1;
+
+    v = c + d * 45;
+    if (i + 2 < len) {
+      unsigned int e = base45_value[(unsigned char)src[i + 2]];
+
+      if (e == 0xFF)
+        return -1;
+      v += e * 45 * 45;
+      if (v > 0xFFFF)
+        return -1;
+      dst[n++] = v >> 8;
+      dst[n++] = v;
+    } else {
+      if (v > 0xFF)
+        return -1;
+      dst[n++] = v;
+    }
+  }
+
+  return n;
+}
+
+static size_t encode_base16(char *dst, const unsigned char *src, size_t len) {
+  size_t i, n = 0;
+
+  for (i = 0; i < len; i++) {
+    dst[n++] = hex_digits[src[i] >> 4];
+    dst[n++] = hex_digits[src[i] & 0x0F];
+    dst[n++] = ' ';
+  }
+
+  return n;
+}
+
+static ssize_t decode_base16(unsigned char *dst, const char *src, size_t len) {
+  size_t i = 0, n = 0;
+
+  while (i < len) {
+    int hi, lo;
+
+    if (src[i] == ' ') {
+      i++;
+      continue;
+    }
+    if (i + 1 >= len)
+      return -1;
+
+    hi = hex_value(src[i]);
+    lo = hex_value(src[i + 1]);
+    if (hi < 0 || lo < 0)
+      return -1;
+
+    dst[n++] = hi << 4 | lo;
+    i += 2;
+  }
+
+  return n;
+}
+
+int hex_value(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+#ifdef BASE64_SSSE3
+/* After Wojciech Mula's pshufb method: spread each 3 byte group over a
+   32-bit lane, cut it into four 6-bit indices with two multiplies, and
+   turn each index range into its character by adding an offset looked
+   up with pshufb. */
+__attribute__((target("ssse3"))) static size_t
+encode_base64_ssse3(char *dst, const unsigned char *src, size_t len) {
+  const __m128i spread =
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  const __m128i offsets = _mm_setr_epi8(
+      'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+      '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i;
+
+  for (i = 0; i + 12 <= len; i += 12) {
+    unsigned char tail[16] = {0};
+    __m128i in, hi, lo, indices, range;
+
+    /* Only 12 of the 16 bytes loaded are used. */
+    if (i + 16 <= len) {
+      in = _mm_loadu_si128((const __m128i *)&src[i]);
+    } else {
+      memcpy(tail, &src[i], 12);
+      in = _mm_loadu_si128((const __m128i *)tail);
+    }
+
+    in = _mm_shuffle_epi8(in, spread);
+    hi = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0FC0FC00)),
+                         _mm_set1_epi32(0x04000040));
+    lo = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003F03F0)),
+                         _mm_set1_epi32(0x01000010));
+    indices = _mm_or_si128(hi, lo);
+
+    range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    range = _mm_or_si128(range,
+                         _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices),
+                                       _mm_set1_epi8(13)));
+    _mm_storeu_si128((__m128i *)&dst[i / 3 * 4],
+                     _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices));
+  }
+
+  return i;
+}
+
+/* The reverse: classify each character by its nibbles to reject
+   anything outside the alphabet, add the offset for its range, then
+   merge the 6-bit values with two multiply-adds. */
+__attribute__((target("ssse3"))) static size_t
+decode_base64_ssse3(unsigned char *dst, const char *src, size_t len) {
+  const __m128i lut_lo =
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i lut_hi =
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i lut_roll =
+      _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i pack =
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16) {
+    unsigned char out[16];
+    __m128i in = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i hi_nibbles =
+        _mm_and_si128(_mm_srli_epi32(in, 4), _mm_set1_epi8(0x0F));
+    __m128i lo_nibbles = _mm_and_si128(in, _mm_set1_epi8(0x0F));
+    __m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo_nibbles),
+                                _mm_shuffle_epi8(lut_hi, hi_nibbles));
+    __m128i roll;
+
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(bad, _mm_setzero_si128())))
+      break;
+
+    roll = _mm_shuffle_epi8(
+        lut_roll,
+        _mm_add_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8('/')), hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+    in = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    in = _mm_madd_epi16(in, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(in, pack));
+    memcpy(&dst[i / 4 * 3], out, 12);
+  }
+
+  return i;
+}
+#endif
+
+size_t base64_encode_blocks(char *dst, const unsigned char *src, size_t len) {
+#ifdef BASE64_SSSE3
+  if (__builtin_cpu_supports("ssse3"))
+    return encode_base64_ssse3(dst, src, len);
+#endif
+  (void)dst;
+  (void)src;
+  (void)len;
+  return 0;
+}
+
+size_t base64_decode_blocks(unsigned char *dst, const char *src, size_t len) {
+#ifdef BASE64_SSSE3
+  if (__builtin_cpu_supports("ssse3"))
+    return decode_base64_ssse3(dst, src, len);
+#endif
+  (void)dst;
+  (void)src;
+  (void)len;
+  return 0;
+}
+
+static size_t encode_base64(char *dst, const unsigned char *src, size_t len) {
+  size_t done = base64_encode_blocks(dst, src, len);
+
+  return done / 3 * 4 + encode_bits(&dst[done / 3 * 4], &src[done],
+                                    len - done, base64_alphabet, 6);
+}
+
+static ssize_t decode_base64(unsigned char *dst, const char *src, size_t len) {
+  size_t done = base64_decode_blocks(dst, src, len);
+  ssize_t n = decode_bits(&dst[done / 4 * 3], &src[done], len - done,
+                          base64_value, 6);
+
+  return n < 0 ? -1 : (ssize_t)(done / 4 * 3) + n;
+}
+
+size_t encode_base64_padded(char *dst, const unsigned char *src, size_t len) {
+  size_t n = encode_base64(dst, src, len);
+
+  while (n % 4)
+    dst[n++] = '=';
+  return n;
+}
+
+size_t encode_data(enum data_type type, char *dst, const unsigned char *src,
+                   size_t len) {
+  switch (type) {
+  case BASE32:
+    return encode_bits(dst, src, len, base32_alphabet, 5);
+  case BASE64:
+    return encode_base64(dst, src, len);
+  case BASE45:
+    return encode_base45(dst, src, len);
+  default:
+    return encode_base16(dst, src, len);
+  }
+}
+
+ssize_t decode_data(enum data_type type, unsigned char *dst, const char *src,
+                    size_t len) {
+  switch (type) {
+  case BASE32:
+    return decode_bits(dst, src, len, base32_value, 5);
+  case BASE64:
+    return decode_base64(dst, src, len);
+  case BASE45:
+    return decode_base45(dst, src, len);
+  default:
+    return decode_base16(dst, src, len);
+  }
+}
+
+ssize_t decode_line(enum data_type type, const char *line, unsigned char *dst,
+                    unsigned long *crc) {
+  const char *data = strchr(line, ':');
+  size_t len;
+  int i;
+
+  if (data == NULL)
+    return -1;
+  data++;
+  if (*data == ' ')
+    data++;
+
+  len = strcspn(data, "\r\n");
+  if (len < 6)
+    return -1;
+
+  *crc = 0;
+  for (i = 0; i < 6; i++) {
+    int v = hex_value(data[len - 6 + i]);
+    if (v < 0)
+      return -1;
+    *crc = *crc << 4 | v;
+  }
+
+  if (len == 6)
+    return 0;
+  if (len < 8 || data[len - 7] != ' ')
+    return -1;
+
+  return decode_data(type, dst, data, len - 7);
+}
+
+enum data_type detect_data_type(const struct stream *input) {
+  struct stream peek = *input;
+  char line[1024];
+  int c;
+
+  c = stream_getc(&peek);
+  if (c == EOF)
+    return AUTO;
+  if (!(isascii(c) && (isprint(c) || isspace(c))))
+    return RAW;
+  stream_revert(&peek);
+
+  while (stream_gets(line, sizeof(line), &peek)) {
+    const char *data;
+    size_t len, i;
+    int lower = 0, b45only = 0, b32only = 1, spaced = 1;
+
+    if (line[0] == '#') {
+      /* Our own header says what follows. */
+      static const enum data_type types[] = {BASE16, BASE32, BASE64, BASE45};
+
+      for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        char tag[32];
+
+        snprintf(tag, sizeof(tag), "# %s data", encoding_name(types[i]));
+        if (strncmp(line, tag, strlen(tag)) == 0)
+          return types[i];
+      }
+      continue;
+    }
+
+    data = strchr(line, ':');
+    if (!isdigit((unsigned char)line[strspn(line, " ")]) || data == NULL)
+      continue;
+
+    /* No header, so go by the characters of the first data line,
+       leaving out the line number and the CRC. */
+    data++;
+    if (*data == ' ')
+      data++;
+    if (*data == '\0')
+      continue;
+    len = strcspn(data, "\r\n");
+    if (len <= 7)
+      continue;
+    len -= 7;
+
+    for (i = 0; i < len; i++) {
+      unsigned char ch = data[i];
+
+      if (islower(ch))
+        lower = 1;
+      if (strchr(" $%*-.:", ch))
+        b45only = 1;
+      if (!(isupper(ch) || (ch >= '2' && ch <= '7')))
+        b32only = 0;
+      if ((i % 3 == 2) != (ch == ' '))
+        spaced = 0;
+    }
+
+    if (spaced)
+      return BASE16;
+    if (lower)
+      return BASE64;
+    if (b45only)
+      return BASE45;
+    if (b32only)
+      return BASE32;
+    return strpbrk(data, "+/") ? BASE64 : BASE45;
+  }
+
+  return BASE16;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _ENCODE_H_
+#define _ENCODE_H_
+
+#include "output.h"
+#include "stream.h"
+#include <sys/types.h>
+
+const char *encoding_name(enum data_type type);
+/* Data bytes per line for an output width, or 0 if it is too narrow. */
+unsigned int encoding_line_items(enum data_type type, unsigned int width);
+/* Encode len bytes into dst and return the number of characters.
+   Base16 writes "XX " per byte, as it appears on a line; the others
+   write the bare alphabet characters without padding. */
+size_t encode_data(enum data_type type, char *dst, const unsigned char *src,
+                   size_t len);
+/* Decode len characters, returning the number of bytes or -1 if the
+   text is not valid for the encoding. */
+ssize_t decode_data(enum data_type type, unsigned char *dst, const char *src,
+                    size_t len);
+int hex_value(char c);
+/* Base64 in whole blocks of 12 bytes to 16 characters, vectorised
+   where the CPU allows.  They return how many bytes or characters they
+   handled, which may be none; decoding also stops at a block holding
+   anything outside the alphabet.  The rest is left to the caller. */
+size_t base64_encode_blocks(char *dst, const unsigned char *src, size_t len);
+size_t base64_decode_blocks(unsigned char *dst, const char *src, size_t len);
+/* RFC 4648 base64 with padding, as ASCII armor uses.  dst needs
+   (len + 2) / 3 * 4 characters. */
+size_t encode_base64_padded(char *dst, const unsigned char *src, size_t len);
+/* Split a text line "NNN: <data> CRC" after the line number, decoding
+   the data into dst (which must be as long as the line) and the CRC.
+   Returns the number of bytes, 0 for a line holding only a CRC, or -1
+   if the line is malformed. */
+ssize_t decode_line(enum data_type type, const char *line, unsigned char *dst,
+                    unsigned long *crc);
+/* Guess the type of a secrets document without consuming it.
+   Returns AUTO if the input is empty. */
+enum data_type detect_data_type(const struct stream *input);
+
+#endif /* !_ENCODE_H_ */
@@ -21,90 +21,134 @@
  */
 
 #include "extract.h"
+#include "armor.h"
 #include "config.h"
+#include "internal.h"
+#include "metrics.h"
 #include "output.h"
 #include "packets.h"
 #include "parse.h"
 #include <stdio.h>
 
-int extract(struct stream *input, struct stream *output,
-            enum data_type output_type, unsigned int output_width) {
-  struct packet *packet;
+/* The fingerprint, length and secret material of one key, after the
+   version octet of the document for the primary key. */
+static void output_key(struct paperkey_ctx *ctx, const struct packet *packet,
+                       size_t offset, const unsigned char *fingerprint) {
+  output_bytes(ctx, packet->buf, 1);
+  output_bytes(ctx, fingerprint, fingerprint_length(packet->buf[0]));
+  output_length16(ctx, packet->len - offset);
+  output_bytes(ctx, &packet->buf[offset], packet->len - offset);
+}
+
+/* The key packets are read in place, so nothing is allocated but the
+   FEC copy of the output. */
+static int extract_from(struct paperkey_ctx *ctx, struct stream *input,
+                        struct stream *output) {
+  struct packet packet;
   int offset;
-  unsigned char fingerprint[20];
-  unsigned char version = 0;
-  unsigned int line_items;
-  unsigned long all_crc = CRC24_INIT;
-  unsigned int line = 0;
-  unsigned long line_crc = CRC24_INIT;
-  unsigned int b16_offset = 0;
-
-  packet = parse(input, 5, 0);
-  if (!packet) {
+  unsigned char fingerprint[MAX_FINGERPRINT];
+  size_t fingerprint_len;
+  unsigned char version;
+
+  if (parse_view(ctx, input, 5, 0, &packet) != 0) {
     // fprintf(stderr, "Unable to find secret key packet\n");
     return 1;
   }
 
-  offset = extract_secrets(packet);
+  offset = extract_secrets(&packet);
   if (offset == -1)
     return 1;
 
   // if (verbose > 1)
   //   fprintf(stderr, "Secret offset is %d\n", offset);
 
-  calculate_fingerprint(packet, offset, fingerprint);
+  key_fingerprint(ctx, &packet, offset, fingerprint);
+  fingerprint_len = fingerprint_length(packet.buf[0]);
 
   // if (verbose) {
   //   fprintf(stderr, "Primary key fingerprint: ");
-  //   print_bytes(stderr, fingerprint, 20);
+  //   print_bytes(stderr, fingerprint, fingerprint_len);
   //   fprintf(stderr, "\n");
   // }
 
-  output_start(output, output_type, fingerprint, output_width, &line_items);
-  output_bytes(output, output_type, &version, 1, line_items, &all_crc, &line,
-               &line_crc, &b16_offset);
-  output_bytes(output, output_type, packet->buf, 1, line_items, &all_crc, &line,
-               &line_crc, &b16_offset);
-  output_bytes(output, output_type, fingerprint, 20, line_items, &all_crc,
-               &line, &line_crc, &b16_offset);
-  output_length16(output, output_type, packet->len - offset, line_items,
-                  &all_crc, &line, &line_crc, &b16_offset);
-  output_bytes(output, output_type, &packet->buf[offset], packet->len - offset,
-               line_items, &all_crc, &line, &line_crc, &b16_offset);
-
-  free_packet(packet);
-
-  while ((packet = parse(input, 7, 5))) {
-    offset = extract_secrets(packet);
-    if (offset == -1)
+  if (output_start(ctx, output, ctx->output_type, fingerprint,
+                   fingerprint_len) != 0)
+    return 1;
+  /* Format 1 says the document may hold 32 octet fingerprints, so
+     readers that only know format 0 refuse it. */
+  version = packet.buf[0] == 6 ? 1 : 0;
+  output_bytes(ctx, &version, 1);
+  output_key(ctx, &packet, offset, fingerprint);
+
+  while (parse_view(ctx, input, 7, 5, &packet) == 0) {
+    offset = extract_secrets(&packet);
+    if (offset == -1) {
+      output_discard(ctx);
       return 1;
+    }
 
     // if (verbose > 1)
     //   fprintf(stderr, "Secret subkey offset is %d\n", offset);
 
-    calculate_fingerprint(packet, offset, fingerprint);
+    key_fingerprint(ctx, &packet, offset, fingerprint);
 
     // if (verbose) {
     //   fprintf(stderr, "Subkey fingerprint: ");
-    //   print_bytes(stderr, fingerprint, 20);
+    //   print_bytes(stderr, fingerprint, fingerprint_len);
     //   fprintf(stderr, "\n");
     // }
 
-    output_bytes(output, output_type, packet->buf, 1, line_items, &all_crc,
-                 &line, &line_crc, &b16_offset);
-    output_bytes(output, output_type, fingerprint, 20, line_items, &all_crc,
-                 &line, &line_crc, &b16_offset);
-    output_length16(output, output_type, packet->len - offset, line_items,
-                    &all_crc, &line, &line_crc, &b16_offset);
-    output_bytes(output, output_type, &packet->buf[offset],
-                 packet->len - offset, line_items, &all_crc, &line, &line_crc,
-                 &b16_offset);
-
-    free_packet(packet);
+    output_key(ctx, &packet, offset, fingerprint);
   }
 
-  output_finish(output, output_type, line_items, &all_crc, &line, &line_crc,
-                &b16_offset);
+  /* Subkeys left out by a limit would make a document that restores
+     to less than the key. */
+  if (paperkey_ctx_limit_hit(ctx) != PAPERKEY_LIMIT_NONE) {
+    output_discard(ctx);
+    return 1;
+  }
+
+  if (output_finish(ctx) != 0)
+    return 1;
 
   return 0;
 }
+
+static int extract_input(struct paperkey_ctx *ctx, struct stream *input,
+                         struct stream *output) {
+  struct stream *binary;
+  int ret;
+
+  if (!armor_detect(input))
+    return extract_from(ctx, input, output);
+
+  binary = armor_decode(ctx, input);
+  if (binary == NULL)
+    return 1;
+  ret = extract_from(ctx, binary, output);
+  armor_free(ctx, binary);
+  return ret;
+}
+
+int paperkey_extract(struct paperkey_ctx *ctx, struct stream *input,
+                     struct stream *output) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = 1;
+
+  if (ctx_admit(ctx, input, NULL) == 0)
+    ret = extract_input(ctx, input, output);
+
+  metrics_record(ctx, PAPERKEY_METRIC_EXTRACT, timer);
+  return ret;
+}
+
+int extract(struct stream *input, struct stream *output,
+            enum data_type output_type, unsigned int output_width) {
+  struct paperkey_ctx ctx;
+
+  paperkey_ctx_init(&ctx);
+  ctx.output_type = output_type;
+  ctx.output_width = output_width;
+
+  return paperkey_extract(&ctx, input, output);
+}
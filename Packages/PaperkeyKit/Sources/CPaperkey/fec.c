@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "fec.h"
+#include "encode.h"
+#include "gf256.h"
+#include "internal.h"
+#include "output.h"
+#include "packets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Sanity limit on the number of data lines a header may claim, so a
+   damaged header cannot make us allocate without bound. */
+#define FEC_MAX_LINES 65535
+
+struct fec_params {
+  unsigned int lines;
+  unsigned int line_len;
+  unsigned long bytes;
+  unsigned int percent;
+  unsigned long crc;
+};
+
+static unsigned int parity_for(unsigned int k, unsigned int percent) {
+  unsigned int m = (k * percent + 99) / 100;
+
+  return m ? m : 1;
+}
+
+/* The data and parity rows of a group index one Cauchy matrix, parity
+   row i at x = i and data row j at y = m + j, so a group plus its
+   parity must fit in the 256 elements of the field. */
+static unsigned int group_count(unsigned int lines, unsigned int percent) {
+  unsigned int kmax = 255;
+
+  while (kmax + parity_for(kmax, percent) > 256)
+    kmax--;
+
+  return (lines + kmax - 1) / kmax;
+}
+
+static void group_span(unsigned int lines, unsigned int groups, unsigned int g,
+                       unsigned int *start, unsigned int *count) {
+  *start = (unsigned long)lines * g / groups;
+  *count = (unsigned long)lines * (g + 1) / groups - *start;
+}
+
+static unsigned char cauchy(unsigned int x, unsigned int y) {
+  return gf_div(1, x ^ y);
+}
+
+int fec_encode(struct paperkey_ctx *ctx) {
+  struct output_state *out = &ctx->out;
+  unsigned int percent = ctx->fec_percent;
+  unsigned int len = out->line_items;
+  unsigned int lines, groups, g, number = 0;
+  unsigned char parity[MAX_LINE_ITEMS], last[MAX_LINE_ITEMS];
+
+  if (out->fec_len == 0)
+    return 0;
+
+  lines = (out->fec_len + len - 1) / len;
+  if (lines > FEC_MAX_LINES)
+    return -1;
+  groups = group_count(lines, percent);
+
+  /* The last line is zero padded to a full line for the arithmetic. */
+  memset(last, 0, len);
+  memcpy(last, &out->fec_data[(size_t)(lines - 1) * len],
+         out->fec_len - (size_t)(lines - 1) * len);
+
+  stream_printf(out->stream,
+                "\n# FEC: %u data lines, %u bytes per line, %lu bytes, "
+                "%u%% parity, CRC %06lX\n",
+                lines, len, (unsigned long)out->fec_len, percent,
+                out->all_crc & 0xFFFFFFL);
+  stream_printf(out->stream,
+                "# The #R lines are Reed-Solomon parity over the data lines "
+                "above.  paperkey\n# can rebuild missing or damaged lines "
+                "from them, up to the number of\n# parity lines in each "
+                "group.\n");
+
+  for (g = 0; g < groups; g++) {
+    unsigned int start, k, m, i, j;
+
+    group_span(lines, groups, g, &start, &k);
+    m = parity_for(k, percent);
+
+    for (i = 0; i < m; i++) {
+      memset(parity, 0, len);
+      for (j = 0; j < k; j++) {
+        const unsigned char *src = start + j == lines - 1
+                                       ? last
+                                       : &out->fec_data[(size_t)(start + j) *
+                                                        len];
+
+        gf_mul_add(parity, src, len, cauchy(i, m + j));
+      }
+      output_text_line(out, "#R", ++number, parity, len);
+    }
+  }
+
+  return 0;
+}
+
+static int read_params(const char *line, struct fec_params *params) {
+  if (sscanf(line,
+             "# FEC: %u data lines, %u bytes per line, %lu bytes, %u%% "
+             "parity, CRC %06lX",
+             &params->lines, &params->line_len, &params->bytes,
+             &params->percent, &params->crc) != 5)
+    return -1;
+
+  if (params->lines == 0 || params->lines > FEC_MAX_LINES ||
+      params->line_len == 0 || params->line_len > MAX_LINE_ITEMS ||
+      params->percent == 0 || params->percent > 100)
+    return -1;
+
+  /* Only the last line may be short. */
+  if (params->bytes > (unsigned long)params->lines * params->line_len ||
+      params->bytes <= (unsigned long)(params->lines - 1) * params->line_len)
+    return -1;
+
+  return 0;
+}
+
+static int find_params(const struct stream *secrets,
+                       struct fec_params *params) {
+  struct stream peek = *secrets;
+  char line[1024];
+
+  while (stream_gets(line, sizeof(line), &peek))
+    if (strncmp(line, "# FEC:", 6) == 0 && read_params(line, params) == 0)
+      return 0;
+
+  return -1;
+}
+
+int fec_present(const struct stream *secrets) {
+  struct fec_params params;
+
+  return find_params(secrets, &params) == 0;
+}
+
+/* Invert the e x e matrix a in place by Gauss-Jordan elimination.  A
+   square Cauchy matrix is never singular, but check anyway. */
+static int invert(unsigned char *a, unsigned char *inv, unsigned int e) {
+  unsigned int r, c, i;
+
+  memset(inv, 0, (size_t)e * e);
+  for (i = 0; i < e; i++)
+    inv[i * e + i] = 1;
+
+  for (c = 0; c < e; c++) {
+    unsigned char scale;
+
+    for (r = c; r < e && a[r * e + c] == 0; r++)
+      ;
+    if (r == e)
+      return -1;
+
+    if (r != c) {
+      for (i = 0; i < e; i++) {
+        unsigned char t = a[r * e + i];
+        a[r * e + i] = a[c * e + i];
+        a[c * e + i] = t;
+        t = inv[r * e + i];
+        inv[r * e + i] = inv[c * e + i];
+        inv[c * e + i] = t;
+      }
+    }
+
+    scale = gf_div(1, a[c * e + c]);
+    for (i = 0; i < e; i++) {
+      a[c * e + i] = gf_mul(a[c * e + i], scale);
+      inv[c * e + i] = gf_mul(inv[c * e + i], scale);
+    }
+
+    for (r = 0; r < e; r++) {
+      unsigned char f = a[r * e + c];
+
+      if (r == c || f == 0)
+        continue;
+      gf_mul_add(&a[r * e], &a[c * e], e, f);
+      gf_mul_add(&inv[r * e], &inv[c * e], e, f);
+    }
+  }
+
+  return 0;
+}
+
+/* Rebuild the damaged lines of one group from its intact parity. */
+static int repair_group(struct paperkey_ctx *ctx,
+                        const struct fec_params *params, unsigned char *data,
+                        const unsigned char *have, const unsigned char *parity,
+                        const unsigned char *phave, unsigned int start,
+                        unsigned int k, unsigned int pstart, unsigned int m) {
+  unsigned int len = params->line_len;
+  unsigned int miss[256], rows[256];
+  unsigned int e = 0, p = 0, i, j, r;
+  unsigned char *a, *inv, *syn;
+  size_t size;
+  int ret = -1;
+
+  for (j = 0; j < k; j++)
+    if (have[start + j] != 1)
+      miss[e++] = j;
+  if (e == 0)
+    return 0;
+
+  for (i = 0; i < m && p < e; i++)
+    if (phave[pstart + i])
+      rows[p++] = i;
+  if (p < e)
+    return -1;
+
+  size = 2 * (size_t)e * e + (size_t)e * len;
+  a = ctx_malloc(ctx, size);
+  if (a == NULL)
+    return -1;
+  inv = a + (size_t)e * e;
+  syn = inv + (size_t)e * e;
+
+  /* Take the known data lines out of each parity line, leaving only
+     the contribution of the missing ones. */
+  for (r = 0; r < e; r++) {
+    unsigned char *s = &syn[(size_t)r * len];
+
+    memcpy(s, &parity[(size_t)(pstart + rows[r]) * len], len);
+    for (j = 0; j < k; j++)
+      if (have[start + j] == 1)
+        gf_mul_add(s, &data[(size_t)(start + j) * len], len,
+                   cauchy(rows[r], m + j));
+    for (i = 0; i < e; i++)
+      a[r * e + i] = cauchy(rows[r], m + miss[i]);
+  }
+
+  if (invert(a, inv, e) == 0) {
+    for (i = 0; i < e; i++) {
+      unsigned char *dst = &data[(size_t)(start + miss[i]) * len];
+
+      memset(dst, 0, len);
+      for (r = 0; r < e; r++)
+        gf_mul_add(dst, &syn[(size_t)r * len], len, inv[i * e + r]);
+    }
+    ret = 0;
+  }
+
+  ctx_free(ctx, a, size);
+  return ret;
+}
+
+struct packet *fec_read_secrets(struct paperkey_ctx *ctx,
+                                struct stream *secrets,
+                                enum data_type input_type) {
+  struct fec_params params;
+  struct packet *packet = NULL;
+  unsigned char *data = NULL, *parity, *have, *phave;
+  unsigned int lines, len, groups, g, nparity = 0, pstart = 0;
+  unsigned long my_crc, all_crc = CRC24_INIT;
+  size_t size = 0;
+  char line[1024];
+
+  if (input_type == AUTO)
+    input_type = BASE16;
+
+  if (find_params(secrets, &params) != 0)
+    return NULL;
+  lines = params.lines;
+  len = params.line_len;
+  my_crc = params.crc;
+
+  groups = group_count(lines, params.percent);
+  for (g = 0; g < groups; g++) {
+    unsigned int start, k;
+
+    group_span(lines, groups, g, &start, &k);
+    nparity += parity_for(k, params.percent);
+  }
+
+  size = (size_t)(lines + nparity) * (len + 1);
+  data = ctx_malloc(ctx, size);
+  if (data == NULL)
+    return NULL;
+  memset(data, 0, size);
+  parity = data + (size_t)lines * len;
+  have = parity + (size_t)nparity * len;
+  phave = have + lines;
+
+  /* have[] is 0 for a missing line, 1 for a good one and 2 for one
+     that failed its CRC, which is kept in case there is not enough
+     parity and the caller asked to ignore CRC errors. */
+  while (stream_gets(line, sizeof(line), secrets)) {
+    unsigned char decoded[sizeof(line)];
+    unsigned long new_crc, line_crc = CRC24_INIT;
+    unsigned int number, want;
+    ssize_t got;
+
+    if (strncmp(line, "#R", 2) == 0) {
+      number = atoi(line + 2);
+      got = decode_line(input_type, line, decoded, &new_crc);
+      if (number == 0 || number > nparity || got != (ssize_t)len)
+        continue;
+      do_crc24(&line_crc, decoded, got);
+      if ((line_crc & 0xFFFFFFL) != new_crc)
+        continue;
+      memcpy(&parity[(size_t)(number - 1) * len], decoded, len);
+      phave[number - 1] = 1;
+      continue;
+    }
+
+    if (line[0] == '#' || line[strspn(line, " \r\n")] == '\0')
+      continue;
+
+    number = atoi(line);
+    got = decode_line(input_type, line, decoded, &new_crc);
+    if (got == 0 && number == lines + 1) {
+      my_crc = new_crc;
+      continue;
+    }
+
+    want = number == lines ? params.bytes - (unsigned long)(lines - 1) * len
+                           : len;
+    if (number == 0 || number > lines || got != (ssize_t)want ||
+        have[number - 1] == 1)
+      continue;
+
+    do_crc24(&line_crc, decoded, got);
+    memcpy(&data[(size_t)(number - 1) * len], decoded, got);
+    have[number - 1] = (line_crc & 0xFFFFFFL) == new_crc ? 1 : 2;
+  }
+
+  for (g = 0; g < groups; g++) {
+    unsigned int start, k, m, j;
+
+    group_span(lines, groups, g, &start, &k);
+    m = parity_for(k, params.percent);
+
+    if (repair_group(ctx, &params, data, have, parity, phave, start, k,
+                     pstart, m) != 0) {
+      // fprintf(stderr, "Too many damaged lines to repair\n");
+      if (!ctx->ignore_crc_error)
+        goto out;
+      for (j = 0; j < k; j++)
+        if (have[start + j] == 0)
+          goto out;
+    }
+    pstart += m;
+  }
+
+  do_crc24(&all_crc, data, params.bytes);
+  if ((my_crc & 0xFFFFFFL) != (all_crc & 0xFFFFFFL) && !ctx->ignore_crc_error)
+    goto out;
+
+  packet = append_packet(ctx, NULL, data, params.bytes);
+
+out:
+  ctx_free(ctx, data, size);
+  return packet;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include "output.h"
+#include "packets.h"
+#include "stream.h"
+
+struct paperkey_ctx;
+
+/* Reed-Solomon erasure coding over the lines of a text document.  The
+   data lines are split into groups of at most 255 - parity lines, and
+   each group gets parity lines from a Cauchy matrix over GF(256), so
+   any set of damaged lines in a group no larger than its parity can be
+   rebuilt.  Parity lines start with "#R" and old readers skip them as
+   comments. */
+
+/* Append the parity block for the data kept in ctx->out.  Called by
+   output_finish() after the final CRC line. */
+int fec_encode(struct paperkey_ctx *ctx);
+
+/* Whether the document carries a parity block. */
+int fec_present(const struct stream *secrets);
+
+/* Read a document with a parity block, rebuilding lines that are
+   missing or fail their CRC.  Returns NULL if the damage is beyond
+   what the parity covers. */
+struct packet *fec_read_secrets(struct paperkey_ctx *ctx,
+                                struct stream *secrets,
+                                enum data_type input_type);
+
+#endif /* !_FEC_H_ */
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "fixed.h"
+#include "arena.h"
+#include "internal.h"
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+
+/* The bounds below count every block the operations allocate as if
+   none were ever freed, each rounded up to the arena's alignment:
+
+   - an armored input decodes into a stream of at most its own length;
+   - extract keeps a copy of the data for FEC in a buffer that doubles,
+     at most four times the data;
+   - restore decodes the secrets into a packet grown in place, which
+     FEC input first reads into lines and parity of up to four times
+     its size, and then copies each key out of it with a little
+     bookkeeping, at most five times the data for the shortest keys;
+   - with an index, restore copies a primary key packet for each key
+     it tries, at most the pubring and the bookkeeping again.
+
+   The data is never longer than the input it comes from. */
+#define BLOCK_SLACK 64
+#define BOUND_SLACK 4096
+
+static size_t saturate(size_t a, size_t b) {
+  return a > SIZE_MAX - b ? SIZE_MAX : a + b;
+}
+
+static size_t times(size_t n, size_t k) {
+  return n > SIZE_MAX / k ? SIZE_MAX : n * k;
+}
+
+static size_t armored_size(size_t len) {
+  return saturate(len, 2 * BLOCK_SLACK);
+}
+
+size_t paperkey_extract_scratch_size(size_t input_len) {
+  size_t size = ARENA_FIXED_OVERHEAD + BOUND_SLACK;
+
+  size = saturate(size, armored_size(input_len));
+  return saturate(size, times(input_len, 4));
+}
+
+size_t paperkey_restore_scratch_size(size_t pubring_len, size_t secrets_len) {
+  size_t size = ARENA_FIXED_OVERHEAD + BOUND_SLACK;
+
+  size = saturate(size, times(armored_size(pubring_len), 2));
+  return saturate(size, times(secrets_len, 16));
+}
+
+/* Copies what fits and counts the rest, so a short buffer still
+   learns the full length. */
+struct fixed_output {
+  unsigned char *buf;
+  size_t size;
+  size_t len;
+};
+
+static int fixed_sink(void *opaque, const void *buf, size_t len) {
+  struct fixed_output *out = opaque;
+
+  if (out->len < out->size)
+    memcpy(&out->buf[out->len], buf,
+           len < out->size - out->len ? len : out->size - out->len);
+  out->len += len;
+  return 0;
+}
+
+/* A context of the caller's options that allocates from the arena
+   and runs on this thread only, and streams over the buffers. */
+static void fixed_setup(struct paperkey_ctx *ctx,
+                        const struct paperkey_ctx *options,
+                        struct arena *arena, void *scratch,
+                        size_t scratch_len, struct stream *output,
+                        struct fixed_output *out, unsigned char *buf,
+                        size_t size) {
+  if (options)
+    *ctx = *options;
+  else
+    paperkey_ctx_init(ctx);
+  arena_init_fixed(arena, scratch, scratch_len);
+  ctx->alloc = arena_alloc;
+  ctx->alloc_opaque = arena;
+  ctx->allocated = 0;
+  ctx->decode_threads = 0;
+  ctx->scan_threads = 0;
+
+  out->buf = buf;
+  out->size = buf ? size : 0;
+  out->len = 0;
+  memset(output, 0, sizeof(*output));
+  output->sink = fixed_sink;
+  output->sink_opaque = out;
+}
+
+static void input_stream(struct stream *stream, const unsigned char *buf,
+                         size_t len) {
+  memset(stream, 0, sizeof(*stream));
+  /* Only ever read. */
+  stream->buffer = (unsigned char *)buf;
+  stream->size = stream->memsize = len;
+}
+
+static int fixed_status(int ret, const struct arena *arena,
+                        const struct fixed_output *out, size_t *output_len) {
+  *output_len = out->len;
+  if (arena->failed)
+    return PAPERKEY_FIXED_ESCRATCH;
+  if (ret != 0)
+    return PAPERKEY_FIXED_EINPUT;
+  if (out->len > out->size)
+    return PAPERKEY_FIXED_EOUTPUT;
+  return PAPERKEY_FIXED_OK;
+}
+
+int paperkey_extract_fixed(const struct paperkey_ctx *options,
+                           const unsigned char *input, size_t input_len,
+                           void *scratch, size_t scratch_len,
+                           unsigned char *output, size_t output_size,
+                           size_t *output_len) {
+  struct paperkey_ctx ctx;
+  struct arena arena;
+  struct stream in, out;
+  struct fixed_output sink;
+  int ret;
+
+  *output_len = 0;
+  if (input_len > INT_MAX)
+    return PAPERKEY_FIXED_EINPUT;
+
+  fixed_setup(&ctx, options, &arena, scratch, scratch_len, &out, &sink,
+              output, output_size);
+  input_stream(&in, input, input_len);
+  ret = paperkey_extract(&ctx, &in, &out);
+  return fixed_status(ret, &arena, &sink, output_len);
+}
+
+int paperkey_restore_fixed(const struct paperkey_ctx *options,
+                           const unsigned char *pubring, size_t pubring_len,
+                           const unsigned char *secrets, size_t secrets_len,
+                           enum data_type input_type, void *scratch,
+                           size_t scratch_len, unsigned char *output,
+                           size_t output_size, size_t *output_len) {
+  struct paperkey_ctx ctx;
+  struct arena arena;
+  struct stream pub, sec, out;
+  struct fixed_output sink;
+  int ret;
+
+  *output_len = 0;
+  if (pubring_len > INT_MAX || secrets_len > INT_MAX)
+    return PAPERKEY_FIXED_EINPUT;
+
+  fixed_setup(&ctx, options, &arena, scratch, scratch_len, &out, &sink,
+              output, output_size);
+  input_stream(&pub, pubring, pubring_len);
+  input_stream(&sec, secrets, secrets_len);
+  ret = paperkey_restore(&ctx, &pub, &sec, input_type, &out);
+  return fixed_status(ret, &arena, &sink, output_len);
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include "context.h"
+#include "output.h"
+#include <stddef.h>
+
+/* Extract and restore in memory the caller provides, for places with a
+   fixed memory budget.  These never call malloc(): everything the
+   operation needs comes out of a scratch buffer, the result goes
+   straight into an output buffer, and running out of either is an
+   error code rather than an abort.  Neither buffer needs any
+   alignment, and both may be reused as soon as the call returns.
+
+   The options are taken from a context, or the defaults with NULL.
+   Its allocator and threads are not used; the operation runs on the
+   calling thread alone. */
+
+enum paperkey_fixed_status {
+  PAPERKEY_FIXED_OK = 0,
+  /* The input is not something the operation can use. */
+  PAPERKEY_FIXED_EINPUT = -1,
+  /* The scratch buffer ran out. */
+  PAPERKEY_FIXED_ESCRATCH = -2,
+  /* The output did not fit, and *output_len holds the size it needs.
+     A call with no output buffer at all finds that size out. */
+  PAPERKEY_FIXED_EOUTPUT = -3
+};
+
+/* Scratch that is enough for any input of these lengths, except that
+   repairing damaged lines (OCR repair, FEC) takes more the more lines
+   are damaged. */
+size_t paperkey_extract_scratch_size(size_t input_len);
+size_t paperkey_restore_scratch_size(size_t pubring_len, size_t secrets_len);
+
+/* paperkey_extract() and paperkey_restore() on buffers.  *output_len
+   is set to the length of the output, and returns a
+   paperkey_fixed_status. */
+int paperkey_extract_fixed(const struct paperkey_ctx *options,
+                           const unsigned char *input, size_t input_len,
+                           void *scratch, size_t scratch_len,
+                           unsigned char *output, size_t output_size,
+                           size_t *output_len);
+int paperkey_restore_fixed(const struct paperkey_ctx *options,
+                           const unsigned char *pubring, size_t pubring_len,
+                           const unsigned char *secrets, size_t secrets_len,
+                           enum data_type input_type, void *scratch,
+                           size_t scratch_len, unsigned char *output,
+                           size_t output_size, size_t *output_len);
+
+#endif /* !_FIXED_H_ */
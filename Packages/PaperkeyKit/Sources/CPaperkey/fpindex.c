@@ -0,0 +1,352 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "fpindex.h"
+#include "internal.h"
+#include "pscan.h"
+#include "sha1.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define INDEX_MAGIC "PKFPIDX"
+#define INDEX_VERSION 1
+#define HEADER_SIZE 64
+#define ENTRY_SIZE 32
+
+struct paperkey_index {
+  const unsigned char *map;
+  size_t map_len;
+  uint64_t count;
+  /* Built in memory by paperkey_index_scan(), not mapped from a file. */
+  int owned;
+};
+
+struct entry {
+  unsigned char fpr[20];
+  uint64_t offset;
+  uint32_t length;
+};
+
+struct builder {
+  struct paperkey_ctx *ctx;
+  struct entry *entries;
+  size_t count;
+  size_t size;
+};
+
+static void put_be(unsigned char *p, uint64_t value, int bytes) {
+  while (bytes--) {
+    p[bytes] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+static uint64_t get_be(const unsigned char *p, int bytes) {
+  uint64_t value = 0;
+
+  while (bytes--)
+    value = value << 8 | *p++;
+  return value;
+}
+
+/* Map a whole file read-only.  An empty file maps to NULL with a zero
+   length. */
+static int map_file(const char *path, const unsigned char **map, size_t *len,
+                    struct stat *st) {
+  void *p = NULL;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, st) != 0 || (uint64_t)st->st_size > SIZE_MAX) {
+    close(fd);
+    return -1;
+  }
+
+  if (st->st_size) {
+    p = mmap(NULL, st->st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+  }
+  close(fd);
+
+  *map = p;
+  *len = st->st_size;
+  return 0;
+}
+
+static void unmap_file(const unsigned char *map, size_t len) {
+  if (len)
+    munmap((void *)map, len);
+}
+
+/* Every key and subkey of the pubring, fingerprinted on the scan
+   threads of ctx. */
+static int scan_pubring(struct builder *b, const unsigned char *map,
+                        size_t len) {
+  struct pscan_key *keys;
+  size_t count, i;
+
+  if (pscan_keys(b->ctx, map, len, b->ctx->scan_threads, &keys, &count) != 0)
+    return -1;
+
+  if (count) {
+    b->entries = ctx_malloc(b->ctx, count * sizeof(*b->entries));
+    if (b->entries == NULL) {
+      pscan_keys_free(b->ctx, keys, count);
+      return -1;
+    }
+    b->size = count;
+  }
+
+  for (i = 0; i < count; i++) {
+    memcpy(b->entries[i].fpr, keys[i].fpr, 20);
+    b->entries[i].offset = keys[i].cert_offset;
+    b->entries[i].length = keys[i].cert_length;
+  }
+  b->count = count;
+
+  pscan_keys_free(b->ctx, keys, count);
+  return 0;
+}
+
+static int compare_entries(const void *a, const void *b) {
+  const struct entry *x = a, *y = b;
+  int c = memcmp(x->fpr, y->fpr, 20);
+
+  if (c)
+    return c;
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+static void put_header(unsigned char header[HEADER_SIZE], uint64_t count) {
+  memset(header, 0, HEADER_SIZE);
+  memcpy(header, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+  put_be(&header[8], INDEX_VERSION, 4);
+  put_be(&header[12], ENTRY_SIZE, 4);
+  put_be(&header[16], count, 8);
+}
+
+static void put_entry(unsigned char entry[ENTRY_SIZE], const struct entry *e) {
+  memcpy(entry, e->fpr, 20);
+  put_be(&entry[20], e->offset, 8);
+  put_be(&entry[28], e->length, 4);
+}
+
+static int write_index(const struct builder *b, const struct stat *st,
+                       const unsigned char hash[20], FILE *out) {
+  unsigned char header[HEADER_SIZE];
+  size_t i;
+
+  put_header(header, b->count);
+  put_be(&header[24], st->st_size, 8);
+  put_be(&header[32], st->st_mtime, 8);
+  memcpy(&header[40], hash, 20);
+
+  if (fwrite(header, 1, sizeof(header), out) != sizeof(header))
+    return -1;
+
+  for (i = 0; i < b->count; i++) {
+    unsigned char entry[ENTRY_SIZE];
+
+    put_entry(entry, &b->entries[i]);
+    if (fwrite(entry, 1, sizeof(entry), out) != sizeof(entry))
+      return -1;
+  }
+
+  return 0;
+}
+
+int paperkey_index_build(struct paperkey_ctx *ctx, const char *pubring_path,
+                         const char *index_path) {
+  const unsigned char *map;
+  unsigned char hash[20];
+  struct builder b;
+  struct stat st;
+  size_t len, tmp_len = strlen(index_path) + 5;
+  char *tmp_path;
+  FILE *out;
+  int ret = -1;
+
+  if (map_file(pubring_path, &map, &len, &st) != 0)
+    return -1;
+
+  memset(&b, 0, sizeof(b));
+  b.ctx = ctx;
+
+  tmp_path = ctx_malloc(ctx, tmp_len);
+  if (tmp_path == NULL)
+    goto out;
+  snprintf(tmp_path, tmp_len, "%s.tmp", index_path);
+
+  if (scan_pubring(&b, map, len) != 0)
+    goto out;
+  if (b.count)
+    qsort(b.entries, b.count, sizeof(*b.entries), compare_entries);
+  sha1_buffer((const char *)map, len, hash);
+
+  out = fopen(tmp_path, "wb");
+  if (out == NULL)
+    goto out;
+  if (write_index(&b, &st, hash, out) != 0) {
+    fclose(out);
+    remove(tmp_path);
+    goto out;
+  }
+  if (fclose(out) != 0 || rename(tmp_path, index_path) != 0) {
+    remove(tmp_path);
+    goto out;
+  }
+  ret = 0;
+
+out:
+  ctx_free(ctx, tmp_path, tmp_len);
+  ctx_free(ctx, b.entries, b.size * sizeof(*b.entries));
+  unmap_file(map, len);
+  return ret;
+}
+
+static int pubring_hash_matches(const char *pubring_path,
+                                const unsigned char hash[20]) {
+  const unsigned char *map;
+  unsigned char actual[20];
+  struct stat st;
+  size_t len;
+
+  if (map_file(pubring_path, &map, &len, &st) != 0)
+    return 0;
+  sha1_buffer((const char *)map, len, actual);
+  unmap_file(map, len);
+  return memcmp(actual, hash, 20) == 0;
+}
+
+struct paperkey_index *paperkey_index_open(struct paperkey_ctx *ctx,
+                                           const char *index_path,
+                                           const char *pubring_path,
+                                           int check_hash) {
+  struct paperkey_index *index;
+  const unsigned char *map;
+  struct stat st, pubring_st;
+  uint64_t count;
+  size_t len;
+
+  if (stat(pubring_path, &pubring_st) != 0 ||
+      map_file(index_path, &map, &len, &st) != 0)
+    return NULL;
+
+  if (len < HEADER_SIZE)
+    goto stale;
+  count = get_be(&map[16], 8);
+  if (memcmp(map, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+      get_be(&map[8], 4) != INDEX_VERSION ||
+      get_be(&map[12], 4) != ENTRY_SIZE ||
+      count != (len - HEADER_SIZE) / ENTRY_SIZE ||
+      (len - HEADER_SIZE) % ENTRY_SIZE != 0)
+    goto stale;
+
+  if (get_be(&map[24], 8) != (uint64_t)pubring_st.st_size ||
+      get_be(&map[32], 8) != (uint64_t)pubring_st.st_mtime)
+    goto stale;
+  if (check_hash && !pubring_hash_matches(pubring_path, &map[40]))
+    goto stale;
+
+  index = ctx_malloc(ctx, sizeof(*index));
+  if (index == NULL)
+    goto stale;
+  index->map = map;
+  index->map_len = len;
+  index->count = count;
+  index->owned = 0;
+  return index;
+
+stale:
+  unmap_file(map, len);
+  return NULL;
+}
+
+struct paperkey_index *paperkey_index_scan(struct paperkey_ctx *ctx,
+                                           const unsigned char *pubring,
+                                           size_t len) {
+  struct paperkey_index *index;
+  unsigned char *map;
+  struct builder b;
+  size_t map_len, i;
+
+  memset(&b, 0, sizeof(b));
+  b.ctx = ctx;
+  if (scan_pubring(&b, pubring, len) != 0)
+    return NULL;
+  if (b.count)
+    qsort(b.entries, b.count, sizeof(*b.entries), compare_entries);
+
+  /* The layout of the file, so lookups are the same either way; the
+     header just has nothing to say about where it came from. */
+  map_len = HEADER_SIZE + b.count * ENTRY_SIZE;
+  map = ctx_malloc(ctx, map_len);
+  index = ctx_malloc(ctx, sizeof(*index));
+  if (map && index) {
+    put_header(map, b.count);
+    for (i = 0; i < b.count; i++)
+      put_entry(&map[HEADER_SIZE + i * ENTRY_SIZE], &b.entries[i]);
+    index->map = map;
+    index->map_len = map_len;
+    index->count = b.count;
+    index->owned = 1;
+  } else {
+    ctx_free(ctx, map, map_len);
+    ctx_free(ctx, index, sizeof(*index));
+    index = NULL;
+  }
+
+  ctx_free(ctx, b.entries, b.size * sizeof(*b.entries));
+  return index;
+}
+
+void paperkey_index_close(struct paperkey_ctx *ctx,
+                          struct paperkey_index *index) {
+  if (index == NULL)
+    return;
+  if (index->owned)
+    ctx_free(ctx, (void *)index->map, index->map_len);
+  else
+    unmap_file(index->map, index->map_len);
+  ctx_free(ctx, index, sizeof(*index));
+}
+
+uint64_t paperkey_index_count(const struct paperkey_index *index) {
+  return index->count;
+}
+
+int paperkey_index_lookup(const struct paperkey_index *index,
+                          const unsigned char fingerprint[20],
+                          uint64_t *offset, uint32_t *length) {
+  const unsigned char *entries = index->map + HEADER_SIZE;
+  uint64_t lo = 0, hi = index->count;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    const unsigned char *entry = &entries[mid * ENTRY_SIZE];
+    int c = memcmp(entry, fingerprint, 20);
+
+    if (c == 0) {
+      *offset = get_be(&entry[20], 8);
+      *length = get_be(&entry[28], 4);
+      return 0;
+    }
+    if (c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return -1;
+}
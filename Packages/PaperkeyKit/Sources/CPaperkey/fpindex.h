@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _FPINDEX_H_
+#define _FPINDEX_H_
+
+#include "context.h"
+#include <stdint.h>
+
+/* A sidecar index of a pubring file that maps the fingerprint of
+   every key and subkey to the offset and length of the certificate
+   holding it, from its primary key packet up to the next one.
+
+   The file is a 64 byte header followed by 32 byte entries sorted by
+   fingerprint, so it is searched in place once mapped:
+
+     0  8  magic "PKFPIDX\0"
+     8  4  format version, currently 1
+    12  4  entry size, 32
+    16  8  entry count
+    24  8  pubring size
+    32  8  pubring mtime, in seconds
+    40 20  SHA-1 of the whole pubring
+    60  4  zero
+
+   and each entry is the fingerprint, the 8 byte offset and the 4 byte
+   length.  Numbers are big endian. */
+
+#define PAPERKEY_INDEX_SUFFIX ".pkidx"
+
+struct paperkey_index;
+
+/* Write the index of pubring_path to index_path, by way of a
+   temporary file renamed into place.  Returns 0, or -1 if either file
+   cannot be used or the pubring is not a sequence of OpenPGP
+   packets. */
+int paperkey_index_build(struct paperkey_ctx *ctx, const char *pubring_path,
+                         const char *index_path);
+
+/* Map an index, or return NULL if it is missing, damaged or stale:
+   the pubring must have the size and mtime it was built from, and
+   with check_hash also the same contents, which means reading all of
+   it. */
+struct paperkey_index *paperkey_index_open(struct paperkey_ctx *ctx,
+                                           const char *index_path,
+                                           const char *pubring_path,
+                                           int check_hash);
+/* Index a pubring that is already in memory, without a file, for
+   callers that keep the pubring around.  Returns NULL if it is not a
+   sequence of OpenPGP packets or memory runs out. */
+struct paperkey_index *paperkey_index_scan(struct paperkey_ctx *ctx,
+                                           const unsigned char *pubring,
+                                           size_t len);
+void paperkey_index_close(struct paperkey_ctx *ctx,
+                          struct paperkey_index *index);
+
+uint64_t paperkey_index_count(const struct paperkey_index *index);
+
+/* Find the certificate holding the key with this fingerprint.
+   Returns 0, or -1 if the index does not have it. */
+int paperkey_index_lookup(const struct paperkey_index *index,
+                          const unsigned char fingerprint[20],
+                          uint64_t *offset, uint32_t *length);
+
+#endif /* !_FPINDEX_H_ */
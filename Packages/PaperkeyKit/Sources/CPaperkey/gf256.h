@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _GF256_H_
+#define _GF256_H_
+
+#include <stddef.h>
+
+/* Arithmetic in GF(2^8) with the polynomial x^8+x^4+x^3+x^2+1 (0x11D)
+   and generator 2, the field used by QR codes and most Reed-Solomon
+   implementations.  gf_exp is doubled in length so a sum of two logs
+   never needs reducing. */
+extern const unsigned char gf_exp[510];
+extern const unsigned char gf_log[256];
+
+static inline unsigned char gf_mul(unsigned char a, unsigned char b) {
+  if (a == 0 || b == 0)
+    return 0;
+  return gf_exp[gf_log[a] + gf_log[b]];
+}
+
+/* b must not be 0. */
+static inline unsigned char gf_div(unsigned char a, unsigned char b) {
+  if (a == 0)
+    return 0;
+  return gf_exp[gf_log[a] + 255 - gf_log[b]];
+}
+
+/* dst[i] ^= c * src[i], through a 256 entry product table for c. */
+void gf_mul_add(unsigned char *dst, const unsigned char *src, size_t len,
+                unsigned char c);
+
+#endif /* !_GF256_H_ */
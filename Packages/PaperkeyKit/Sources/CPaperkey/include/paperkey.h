@@ -8,5 +8,13 @@
 #pragma once
 
 #include "../stream.h"
+#include "../context.h"
+#include "../diagnose.h"
 #include "../extract.h"
+#include "../agent.h"
 #include "../restore.h"
+#include "../batch.h"
+#include "../render.h"
+#include "../verify.h"
+#include "../metrics.h"
+#include "../fixed.h"
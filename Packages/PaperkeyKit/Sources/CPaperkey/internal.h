@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _INTERNAL_H_
+#define _INTERNAL_H_
+
+#include "context.h"
+#include "output.h"
+#include <stddef.h>
+#include <time.h>
+
+/* The layout of struct paperkey_ctx is private to the library.  Users
+   of the API only ever see the forward declaration in context.h. */
+struct paperkey_ctx {
+  paperkey_alloc_fn alloc;
+  void *alloc_opaque;
+
+  enum data_type output_type;
+  unsigned int output_width;
+  int ignore_crc_error;
+  int ocr_repair;
+  unsigned int decode_threads;
+  unsigned int scan_threads;
+  unsigned int fec_percent;
+  int have_timestamp;
+  time_t timestamp;
+  const char *comment;
+  int armor_output;
+  const struct paperkey_index *pubring_index;
+  struct metrics_shard *metrics;
+  size_t limits[PAPERKEY_LIMIT_COUNT];
+
+  /* What the allocator holds for the context, the limit the current
+     operation hit (set from stage threads too, so atomically), and the
+     packets parse() has read of the certificate it is in. */
+  size_t allocated;
+  int limit_hit;
+  unsigned int cert_packets;
+
+  struct output_state out;
+};
+
+void paperkey_ctx_init(struct paperkey_ctx *ctx);
+
+void *ctx_realloc(struct paperkey_ctx *ctx, void *ptr, size_t osize,
+                  size_t nsize);
+#define ctx_malloc(_ctx, _size) ctx_realloc((_ctx), NULL, 0, (_size))
+void ctx_free(struct paperkey_ctx *ctx, void *ptr, size_t osize);
+
+/* Record that limit stopped the current operation, unless another
+   did first.  Returns -1. */
+int ctx_refuse(struct paperkey_ctx *ctx, enum paperkey_limit limit);
+/* Start an operation on input, and second when it takes two: clear
+   the limit hit by the last one and check the input limit.  Returns
+   0, or -1 if an input is too large. */
+int ctx_admit(struct paperkey_ctx *ctx, const struct stream *input,
+              const struct stream *second);
+/* Check the header of a packet about to be read against the packet
+   limit, and count it into *count, the packets of the certificate so
+   far, which a primary key starts over.  Returns 0 or -1. */
+int ctx_admit_packet(struct paperkey_ctx *ctx, unsigned int *count,
+                     unsigned char type, unsigned int length);
+
+#endif /* !_INTERNAL_H_ */
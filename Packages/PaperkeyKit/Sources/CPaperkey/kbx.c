@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "kbx.h"
+#include <string.h>
+
+#define BLOB_HEADER 1
+#define BLOB_OPENPGP 2
+
+/* Of an OpenPGP blob, up to the size of its key entries. */
+#define OPENPGP_FIXED 20
+
+#define KEY_FLAG_FPR32 0x80
+
+static unsigned long get_be(const unsigned char *p, int bytes) {
+  unsigned long value = 0;
+
+  while (bytes--)
+    value = value << 8 | *p++;
+  return value;
+}
+
+int kbx_detect(const struct stream *input) {
+  const unsigned char *p = &input->buffer[input->pos];
+
+  return input->size - input->pos >= 12 && get_be(p, 4) >= 12 &&
+         p[4] == BLOB_HEADER && memcmp(&p[8], "KBXf", 4) == 0;
+}
+
+/* Whether the key entries of an OpenPGP blob list this fingerprint.
+   Version 1 blobs only hold 20 byte fingerprints, so only version 2
+   ones have their flags looked at. */
+static int lists_key(const unsigned char *blob, unsigned long len,
+                     const unsigned char *fpr, size_t fpr_len) {
+  unsigned long nkeys = get_be(&blob[16], 2), size = get_be(&blob[18], 2);
+  unsigned long k;
+
+  if (blob[5] == 1) {
+    if (size < 20 || fpr_len != 20)
+      return 0;
+  } else if (size < 34 || fpr_len > 32) {
+    return 0;
+  }
+  if (nkeys * size > len - OPENPGP_FIXED)
+    return 0;
+
+  for (k = 0; k < nkeys; k++) {
+    const unsigned char *entry = &blob[OPENPGP_FIXED + k * size];
+
+    if (blob[5] == 2 &&
+        ((get_be(&entry[32], 2) & KEY_FLAG_FPR32) != 0) != (fpr_len == 32))
+      continue;
+    if (memcmp(entry, fpr, fpr_len) == 0)
+      return 1;
+  }
+
+  return 0;
+}
+
+int kbx_find(const struct stream *input, const unsigned char *fpr,
+             size_t fpr_len, struct stream *keyblock) {
+  int pos = input->pos;
+
+  while (input->size - pos >= 5) {
+    const unsigned char *blob = &input->buffer[pos];
+    unsigned long len = get_be(blob, 4);
+
+    if (len < 5 || len > (unsigned long)(input->size - pos))
+      return -1;
+
+    if (blob[4] == BLOB_OPENPGP && len >= OPENPGP_FIXED &&
+        (blob[5] == 1 || blob[5] == 2) &&
+        lists_key(blob, len, fpr, fpr_len)) {
+      unsigned long offset = get_be(&blob[8], 4);
+      unsigned long length = get_be(&blob[12], 4);
+
+      if (offset > len || length > len - offset)
+        return -1;
+
+      *keyblock = *input;
+      keyblock->pos = pos + offset;
+      keyblock->size = pos + offset + length;
+      return 0;
+    }
+
+    pos += len;
+  }
+
+  return -1;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _KBX_H_
+#define _KBX_H_
+
+#include "stream.h"
+
+/* GnuPG keybox files (pubring.kbx).  The file is a run of blobs, each
+   starting with its 4 byte length and a type byte; the first is a
+   header blob holding "KBXf".  An OpenPGP blob lists the fingerprint of
+   every key in its keyblock ahead of the keyblock itself, so a key is
+   found without hashing anything:
+
+     0  4  blob length
+     4  1  type, 2 for OpenPGP
+     5  1  blob version, 1 or 2
+     6  2  flags
+     8  4  offset of the keyblock in the blob
+    12  4  length of the keyblock
+    16  2  number of keys
+    18  2  size of each key entry, which starts with the fingerprint
+
+   A key entry in a version 1 blob is a 20 byte fingerprint, the 4
+   byte offset of its key ID and 2 bytes of flags.  In a version 2 blob
+   it is a 32 byte fingerprint field and 2 bytes of flags, where flag
+   0x80 marks a 32 byte fingerprint, that of a version 6 key; others
+   take the first 20 bytes.  Numbers are big endian. */
+
+/* Whether input holds a keybox at its position.  The position is left
+   alone. */
+int kbx_detect(const struct stream *input);
+
+/* Find the first OpenPGP blob listing a key with this fingerprint, of
+   20 or 32 bytes, and narrow a copy of input to its keyblock in
+   *keyblock.  Returns 0, or -1 if there is none or the keybox is
+   damaged before one is found. */
+int kbx_find(const struct stream *input, const unsigned char *fpr,
+             size_t fpr_len, struct stream *keyblock);
+
+#endif /* !_KBX_H_ */
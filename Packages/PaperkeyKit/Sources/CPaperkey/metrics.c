@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "metrics.h"
+#include "internal.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Values below 2 * SUB_COUNT get a bucket each; above, every power of
+   two up to 2^(MAX_EXP + 1) is split into SUB_COUNT buckets. */
+#define SUB_BITS 5
+#define SUB_COUNT (1 << SUB_BITS)
+#define MAX_EXP 40
+#define BUCKETS ((MAX_EXP - SUB_BITS + 2) * SUB_COUNT)
+#define MAX_VALUE ((UINT64_C(2) << MAX_EXP) - 1)
+
+/* The Prometheus buckets are powers of two from about a microsecond
+   to about a minute, which fall on edges of the fine buckets. */
+#define EXPORT_FIRST 10
+#define EXPORT_LAST 36
+
+struct histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[BUCKETS];
+};
+
+/* Written only by its context, read by exports at any time. */
+struct metrics_shard {
+  struct paperkey_metrics *registry;
+  struct histogram histograms[PAPERKEY_METRIC_COUNT];
+  struct metrics_shard *prev, *next;
+};
+
+struct paperkey_metrics {
+  pthread_mutex_t lock;
+  struct metrics_shard *shards;
+  /* What detached shards recorded. */
+  struct histogram retired[PAPERKEY_METRIC_COUNT];
+};
+
+static const char *const names[PAPERKEY_METRIC_COUNT] = {
+    "extract", "restore", "verify", "parse", "fingerprint", "encode", "decode"};
+
+static unsigned int bucket_of(uint64_t value) {
+  unsigned int shift = 0;
+
+  if (value > MAX_VALUE)
+    value = MAX_VALUE;
+  while ((value >> shift) >= 2 * SUB_COUNT)
+    shift++;
+  return shift * SUB_COUNT + (unsigned int)(value >> shift);
+}
+
+/* The highest value that lands in a bucket. */
+static uint64_t bucket_top(unsigned int bucket) {
+  unsigned int shift = bucket < 2 * SUB_COUNT ? 0 : bucket / SUB_COUNT - 1;
+  uint64_t mantissa = bucket - shift * SUB_COUNT;
+
+  return ((mantissa + 1) << shift) - 1;
+}
+
+static uint64_t load(const uint64_t *p) {
+  return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static void add(uint64_t *p, uint64_t value) {
+  __atomic_fetch_add(p, value, __ATOMIC_RELAXED);
+}
+
+static void histogram_add(struct histogram *h, uint64_t value) {
+  add(&h->buckets[bucket_of(value)], 1);
+  add(&h->sum, value);
+  add(&h->count, 1);
+}
+
+static void histogram_merge(struct histogram *into,
+                            const struct histogram *from) {
+  unsigned int i;
+
+  into->count += load(&from->count);
+  into->sum += load(&from->sum);
+  for (i = 0; i < BUCKETS; i++)
+    into->buckets[i] += load(&from->buckets[i]);
+}
+
+static uint64_t now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct paperkey_metrics *metrics_registry(const struct paperkey_ctx *ctx) {
+  return ctx->metrics ? ctx->metrics->registry : NULL;
+}
+
+uint64_t metrics_start(const struct paperkey_ctx *ctx) {
+  return ctx->metrics ? now() : 0;
+}
+
+void metrics_record(struct paperkey_ctx *ctx, enum paperkey_metric metric,
+                    uint64_t start) {
+  if (ctx->metrics && start)
+    histogram_add(&ctx->metrics->histograms[metric], now() - start);
+}
+
+struct paperkey_metrics *paperkey_metrics_new(void) {
+  struct paperkey_metrics *metrics = calloc(1, sizeof(*metrics));
+
+  if (metrics)
+    pthread_mutex_init(&metrics->lock, NULL);
+  return metrics;
+}
+
+void paperkey_metrics_free(struct paperkey_metrics *metrics) {
+  if (metrics == NULL)
+    return;
+  pthread_mutex_destroy(&metrics->lock);
+  free(metrics);
+}
+
+int paperkey_ctx_set_metrics(struct paperkey_ctx *ctx,
+                             struct paperkey_metrics *metrics) {
+  struct metrics_shard *shard = ctx->metrics;
+
+  if (shard) {
+    struct paperkey_metrics *registry = shard->registry;
+    unsigned int i;
+
+    pthread_mutex_lock(&registry->lock);
+    for (i = 0; i < PAPERKEY_METRIC_COUNT; i++)
+      histogram_merge(&registry->retired[i], &shard->histograms[i]);
+    if (shard->prev)
+      shard->prev->next = shard->next;
+    else
+      registry->shards = shard->next;
+    if (shard->next)
+      shard->next->prev = shard->prev;
+    pthread_mutex_unlock(&registry->lock);
+
+    free(shard);
+    ctx->metrics = NULL;
+  }
+
+  if (metrics == NULL)
+    return 0;
+
+  shard = calloc(1, sizeof(*shard));
+  if (shard == NULL)
+    return -1;
+  shard->registry = metrics;
+
+  pthread_mutex_lock(&metrics->lock);
+  shard->next = metrics->shards;
+  if (metrics->shards)
+    metrics->shards->prev = shard;
+  metrics->shards = shard;
+  pthread_mutex_unlock(&metrics->lock);
+
+  ctx->metrics = shard;
+  return 0;
+}
+
+/* Every shard and what the retired ones left, added up. */
+static struct histogram *snapshot(struct paperkey_metrics *metrics) {
+  struct histogram *all = calloc(PAPERKEY_METRIC_COUNT, sizeof(*all));
+  const struct metrics_shard *shard;
+  unsigned int i;
+
+  if (all == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&metrics->lock);
+  for (i = 0; i < PAPERKEY_METRIC_COUNT; i++)
+    histogram_merge(&all[i], &metrics->retired[i]);
+  for (shard = metrics->shards; shard; shard = shard->next)
+    for (i = 0; i < PAPERKEY_METRIC_COUNT; i++)
+      histogram_merge(&all[i], &shard->histograms[i]);
+  pthread_mutex_unlock(&metrics->lock);
+
+  return all;
+}
+
+static uint64_t quantile(const struct histogram *h, double q) {
+  uint64_t rank, seen = 0;
+  unsigned int i;
+
+  if (h->count == 0)
+    return 0;
+  if (q < 0)
+    q = 0;
+  if (q > 1)
+    q = 1;
+
+  /* The smallest value with at least a fraction q of the samples at or
+     below it. */
+  rank = (uint64_t)(q * h->count + 0.5);
+  if (rank == 0)
+    rank = 1;
+  for (i = 0; i < BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank)
+      return bucket_top(i);
+  }
+  return MAX_VALUE;
+}
+
+uint64_t paperkey_metrics_count(struct paperkey_metrics *metrics,
+                                enum paperkey_metric metric) {
+  struct histogram *all = snapshot(metrics);
+  uint64_t count;
+
+  if (all == NULL)
+    return 0;
+  count = all[metric].count;
+  free(all);
+  return count;
+}
+
+uint64_t paperkey_metrics_quantile(struct paperkey_metrics *metrics,
+                                   enum paperkey_metric metric, double q) {
+  struct histogram *all = snapshot(metrics);
+  uint64_t value;
+
+  if (all == NULL)
+    return 0;
+  value = quantile(&all[metric], q);
+  free(all);
+  return value;
+}
+
+static int emit(stream_sink_fn sink, void *opaque, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static int emit(stream_sink_fn sink, void *opaque, const char *format, ...) {
+  char line[256];
+  va_list args;
+  int len;
+
+  va_start(args, format);
+  len = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (len < 0 || len >= (int)sizeof(line))
+    return -1;
+  return sink(opaque, line, len);
+}
+
+static int export_family(const struct histogram *all, unsigned int first,
+                         unsigned int last, const char *family,
+                         const char *label, const char *help,
+                         stream_sink_fn sink, void *opaque) {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  unsigned int m, e, q;
+
+  if (emit(sink, opaque, "# HELP paperkey_%s_seconds %s\n", family, help) ||
+      emit(sink, opaque, "# TYPE paperkey_%s_seconds histogram\n", family))
+    return -1;
+
+  for (m = first; m <= last; m++) {
+    const struct histogram *h = &all[m];
+    uint64_t below = 0;
+    unsigned int i = 0;
+
+    for (e = EXPORT_FIRST; e <= EXPORT_LAST; e++) {
+      /* Everything under 2^e ns, which ends on a bucket edge. */
+      for (; i < BUCKETS && bucket_top(i) < (UINT64_C(1) << e); i++)
+        below += h->buckets[i];
+      if (emit(sink, opaque,
+               "paperkey_%s_seconds_bucket{%s=\"%s\",le=\"%.9f\"} %llu\n",
+               family, label, names[m], (double)(UINT64_C(1) << e) / 1e9,
+               (unsigned long long)below))
+        return -1;
+    }
+    if (emit(sink, opaque,
+             "paperkey_%s_seconds_bucket{%s=\"%s\",le=\"+Inf\"} %llu\n",
+             family, label, names[m], (unsigned long long)h->count) ||
+        emit(sink, opaque, "paperkey_%s_seconds_sum{%s=\"%s\"} %.9f\n",
+             family, label, names[m], h->sum / 1e9) ||
+        emit(sink, opaque, "paperkey_%s_seconds_count{%s=\"%s\"} %llu\n",
+             family, label, names[m], (unsigned long long)h->count))
+      return -1;
+  }
+
+  if (emit(sink, opaque,
+           "# HELP paperkey_%s_quantile_seconds %s, at full resolution.\n",
+           family, help) ||
+      emit(sink, opaque, "# TYPE paperkey_%s_quantile_seconds gauge\n",
+           family))
+    return -1;
+
+  for (m = first; m <= last; m++)
+    for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+      if (emit(sink, opaque,
+               "paperkey_%s_quantile_seconds{%s=\"%s\",quantile=\"%g\"} "
+               "%.9f\n",
+               family, label, names[m], quantiles[q],
+               quantile(&all[m], quantiles[q]) / 1e9))
+        return -1;
+
+  return 0;
+}
+
+int paperkey_metrics_export(struct paperkey_metrics *metrics,
+                            stream_sink_fn sink, void *opaque) {
+  struct histogram *all = snapshot(metrics);
+  int ret;
+
+  if (all == NULL)
+    return -1;
+  ret = export_family(all, PAPERKEY_METRIC_EXTRACT, PAPERKEY_METRIC_VERIFY,
+                      "operation", "op", "Latency of whole operations",
+                      sink, opaque);
+  if (ret == 0)
+    ret = export_family(all, PAPERKEY_METRIC_PARSE, PAPERKEY_METRIC_DECODE,
+                        "stage", "stage", "Latency of stages of operations",
+                        sink, opaque);
+  free(all);
+  return ret;
+}
+
+static int file_sink(void *opaque, const void *buf, size_t len) {
+  return fwrite(buf, 1, len, opaque) == len ? 0 : -1;
+}
+
+int paperkey_metrics_write_file(struct paperkey_metrics *metrics,
+                                const char *path) {
+  size_t tmp_len = strlen(path) + 5;
+  char *tmp_path = malloc(tmp_len);
+  FILE *out;
+  int ret = -1;
+
+  if (tmp_path == NULL)
+    return -1;
+  snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+  out = fopen(tmp_path, "w");
+  if (out) {
+    int ok = paperkey_metrics_export(metrics, file_sink, out) == 0;
+
+    if (fclose(out) != 0)
+      ok = 0;
+    if (ok && rename(tmp_path, path) == 0)
+      ret = 0;
+    if (ret != 0)
+      remove(tmp_path);
+  }
+
+  free(tmp_path);
+  return ret;
+}
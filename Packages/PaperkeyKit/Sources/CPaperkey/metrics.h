@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include "context.h"
+#include "stream.h"
+#include <stdint.h>
+
+/* Latency histograms for long-running processes.  A registry gathers
+   the operations and stages of every context attached to it.  Each
+   context records into a shard of its own with plain atomic adds, so
+   recording takes no lock, and exports add the shards up on demand.
+
+   The histograms are HDR-style: exact below 64 ns, then 32 buckets for
+   every power of two, so a quantile is within about 3% of the truth
+   anywhere from nanoseconds to half an hour. */
+
+enum paperkey_metric {
+  /* Whole calls of paperkey_extract() (and paperkey_extract_agent()),
+     paperkey_restore() and paperkey_verify(). */
+  PAPERKEY_METRIC_EXTRACT,
+  PAPERKEY_METRIC_RESTORE,
+  PAPERKEY_METRIC_VERIFY,
+  /* Stages inside them: reading one packet, fingerprinting one key,
+     writing one document from output_start() to output_finish() and
+     decoding one document. */
+  PAPERKEY_METRIC_PARSE,
+  PAPERKEY_METRIC_FINGERPRINT,
+  PAPERKEY_METRIC_ENCODE,
+  PAPERKEY_METRIC_DECODE,
+  PAPERKEY_METRIC_COUNT
+};
+
+struct paperkey_metrics;
+
+struct paperkey_metrics *paperkey_metrics_new(void);
+/* Only once no context is attached. */
+void paperkey_metrics_free(struct paperkey_metrics *metrics);
+
+/* Record the operations of ctx in metrics from now on, or stop with
+   NULL.  What a context recorded stays in the registry after it is
+   detached or freed. */
+int paperkey_ctx_set_metrics(struct paperkey_ctx *ctx,
+                             struct paperkey_metrics *metrics);
+
+/* Samples so far, and the latency in nanoseconds that a fraction q of
+   them (0 to 1) do not exceed, or 0 if there are none. */
+uint64_t paperkey_metrics_count(struct paperkey_metrics *metrics,
+                                enum paperkey_metric metric);
+uint64_t paperkey_metrics_quantile(struct paperkey_metrics *metrics,
+                                   enum paperkey_metric metric, double q);
+
+/* Everything in the Prometheus text format: a histogram in seconds
+   for the operations and one for the stages, with power of two
+   buckets, and gauges with the 0.5, 0.9, 0.99 and 0.999 quantiles
+   taken from the full resolution.  Returns 0, or -1 if the sink
+   fails. */
+int paperkey_metrics_export(struct paperkey_metrics *metrics,
+                            stream_sink_fn sink, void *opaque);
+/* The same into a file, by way of a temporary file renamed into place
+   so a collector never reads half of it. */
+int paperkey_metrics_write_file(struct paperkey_metrics *metrics,
+                                const char *path);
+
+/* For the library: the registry ctx records into, or NULL; a start
+   time in nanoseconds, or 0 when ctx records nothing; and the sample
+   from such a start to now. */
+struct paperkey_metrics *metrics_registry(const struct paperkey_ctx *ctx);
+uint64_t metrics_start(const struct paperkey_ctx *ctx);
+void metrics_record(struct paperkey_ctx *ctx, enum paperkey_metric metric,
+                    uint64_t start);
+
+#endif /* !_METRICS_H_ */
@@ -0,0 +1,253 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "ocr.h"
+#include "encode.h"
+#include "internal.h"
+#include "output.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CHARS (2 * MAX_LINE_ITEMS + 6)
+
+struct candidate {
+  unsigned long syn;
+  unsigned short pos;
+  char value;
+};
+
+/* What a character read off the page may really have been, most
+   likely first.  Letters that are not hex digits have to be one of
+   their alternatives.  Confusions between hex digits go both ways. */
+static const char *confusions(char c) {
+  switch (c) {
+  case '0':
+    return "D8C";
+  case 'O':
+  case 'Q':
+  case 'U':
+    return "0D";
+  case 'D':
+    return "0";
+  case '8':
+    return "B30";
+  case 'B':
+  case '3':
+    return "8";
+  case '1':
+    return "7";
+  case 'I':
+  case 'L':
+  case 'T':
+    return "17";
+  case '7':
+    return "1";
+  case '5':
+    return "6";
+  case 'S':
+    return "5";
+  case '6':
+    return "5";
+  case 'G':
+    return "6";
+  case 'Z':
+    return "2";
+  case 'E':
+    return "F";
+  case 'F':
+    return "E";
+  case 'C':
+    return "0";
+  case 'A':
+    return "4";
+  case '4':
+    return "A";
+  default:
+    return "";
+  }
+}
+
+static int compare_candidates(const void *a, const void *b) {
+  const struct candidate *x = a, *y = b;
+
+  if (x->syn != y->syn)
+    return x->syn < y->syn ? -1 : 1;
+  return x->pos - y->pos;
+}
+
+/* Index of the first candidate with a syndrome of at least syn. */
+static size_t lower_bound(const struct candidate *cands, size_t count,
+                          unsigned long syn) {
+  size_t lo = 0, hi = count;
+
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (cands[mid].syn < syn)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+ssize_t ocr_repair_base16(struct paperkey_ctx *ctx, const char *line,
+                          unsigned char *dst) {
+  char text[MAX_CHARS];
+  const char *p = strchr(line, ':');
+  size_t nchars = 0, nbytes, ncands = 0, size, i;
+  unsigned long expected = 0, all_crc = CRC24_INIT, diff;
+  unsigned long *pos_syn;
+  struct candidate *cands;
+  const struct candidate *fix[2] = {NULL, NULL};
+  size_t matches = 0;
+  ssize_t ret = -1;
+
+  if (p == NULL)
+    return -1;
+
+  /* Data tokens are two characters and the CRC token six. */
+  for (p++;;) {
+    size_t len;
+
+    p += strspn(p, " ");
+    len = strcspn(p, " \r\n");
+    if (len == 0)
+      break;
+    if ((len != 2 && len != 6) || nchars + len > MAX_CHARS)
+      return -1;
+    memcpy(&text[nchars], p, len);
+    nchars += len;
+    p += len;
+    if (len == 6)
+      break;
+  }
+  if (p[strspn(p, " \r\n")] != '\0' || nchars < 8 || nchars % 2 != 0)
+    return -1;
+  nbytes = (nchars - 6) / 2;
+
+  /* Read every character as its most likely hex digit. */
+  for (i = 0; i < nchars; i++) {
+    char c = toupper((unsigned char)text[i]);
+
+    if (!isxdigit((unsigned char)c))
+      c = confusions(c)[0];
+    if (c == '\0')
+      return -1;
+    text[i] = c;
+  }
+
+  for (i = 0; i < nbytes; i++)
+    dst[i] = hex_value(text[2 * i]) << 4 | hex_value(text[2 * i + 1]);
+  for (i = 0; i < 6; i++)
+    expected = expected << 4 | hex_value(text[2 * nbytes + i]);
+
+  do_crc24(&all_crc, dst, nbytes);
+  diff = (all_crc ^ expected) & 0xFFFFFFL;
+  if (diff == 0)
+    return nbytes;
+
+  for (i = 0; i < nchars; i++)
+    ncands += strlen(confusions(text[i]));
+  size = nbytes * 8 * sizeof(*pos_syn) + ncands * sizeof(*cands);
+  pos_syn = ctx_malloc(ctx, size);
+  if (pos_syn == NULL)
+    return -1;
+  cands = (struct candidate *)&pos_syn[nbytes * 8];
+
+  /* The CRC without its initial value is linear, so flipping bit j of
+     byte i changes it by a fixed syndrome: the CRC of that one bit
+     followed by the zero bytes up to the end of the line.  Build them
+     from the last byte back. */
+  for (i = nbytes; i-- > 0;) {
+    int j;
+
+    for (j = 0; j < 8; j++) {
+      unsigned long s = 0;
+
+      if (i == nbytes - 1) {
+        unsigned char bit = 1 << j;
+        do_crc24(&s, &bit, 1);
+      } else {
+        unsigned char zero = 0;
+        s = pos_syn[(i + 1) * 8 + j];
+        do_crc24(&s, &zero, 1);
+      }
+      pos_syn[i * 8 + j] = s & 0xFFFFFFL;
+    }
+  }
+
+  ncands = 0;
+  for (i = 0; i < nchars; i++) {
+    const char *alt = confusions(text[i]);
+    int from = hex_value(text[i]);
+
+    for (; *alt; alt++) {
+      int delta = from ^ hex_value(*alt);
+      unsigned long syn = 0;
+      int j;
+
+      if (*alt == text[i])
+        continue;
+
+      if (i < 2 * nbytes) {
+        int bits = i % 2 ? delta : delta << 4;
+
+        for (j = 0; j < 8; j++)
+          if (bits & (1 << j))
+            syn ^= pos_syn[(i / 2) * 8 + j];
+      } else {
+        /* A misread CRC digit changes the expected value directly. */
+        syn = (unsigned long)delta << (4 * (nchars - 1 - i));
+      }
+
+      cands[ncands].syn = syn;
+      cands[ncands].pos = i;
+      cands[ncands].value = *alt;
+      ncands++;
+    }
+  }
+
+  /* One substitution. */
+  for (i = 0; i < ncands; i++) {
+    if (cands[i].syn == diff) {
+      fix[0] = &cands[i];
+      matches++;
+    }
+  }
+
+  /* Two substitutions at different places, by looking up the syndrome
+     that would complete each candidate. */
+  if (matches == 0) {
+    qsort(cands, ncands, sizeof(*cands), compare_candidates);
+
+    for (i = 0; i < ncands && matches < 2; i++) {
+      unsigned long want = cands[i].syn ^ diff;
+      size_t k;
+
+      /* Each pair is found from both ends, so only count it from the
+         lower one. */
+      for (k = lower_bound(cands, ncands, want);
+           k < ncands && cands[k].syn == want; k++) {
+        if (k <= i || cands[k].pos == cands[i].pos)
+          continue;
+        fix[0] = &cands[i];
+        fix[1] = &cands[k];
+        matches++;
+      }
+    }
+  }
+
+  if (matches == 1) {
+    for (i = 0; i < 2 && fix[i]; i++)
+      text[fix[i]->pos] = fix[i]->value;
+    for (i = 0; i < nbytes; i++)
+      dst[i] = hex_value(text[2 * i]) << 4 | hex_value(text[2 * i + 1]);
+    ret = nbytes;
+  }
+
+  ctx_free(ctx, pos_syn, size);
+  return ret;
+}
@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _OCR_H_
+#define _OCR_H_
+
+#include <sys/types.h>
+
+struct paperkey_ctx;
+
+/* Repair a base16 line "NNN: XX XX ... CRC" that failed its CRC by
+   swapping characters that scanners confuse (0/O/D, 8/B, 1/I/7, 5/S
+   and so on), in the CRC as well as in the data.  One substitution is
+   tried before two, and a line is only accepted when exactly one
+   candidate of the smallest size that works makes the CRC match.  More
+   than two would leave too good a chance of a wrong match on 24 bits.
+   Writes the bytes to dst, which must hold MAX_LINE_ITEMS, and returns
+   their count, or -1 if there is no unique repair. */
+ssize_t ocr_repair_base16(struct paperkey_ctx *ctx, const char *line,
+                          unsigned char *dst);
+
+#endif /* !_OCR_H_ */
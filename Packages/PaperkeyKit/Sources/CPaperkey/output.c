@@ -22,8 +22,13 @@
 
 #include "output.h"
 #include "config.h"
+#include "encode.h"
+#include "fec.h"
+#include "internal.h"
+#include "metrics.h"
 #include "packets.h"
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,51 +36,197 @@
 
 #define CRC24_POLY 0x864CFBL
 
+/* The register update for each byte, by the top byte of the register
+   xored with it, from CRC24_POLY. */
+static const unsigned long crc24_table[256] = {
+    0x000000L, 0x864CFBL, 0x8AD50DL, 0x0C99F6L, 0x93E6E1L, 0x15AA1AL,
+    0x1933ECL, 0x9F7F17L, 0xA18139L, 0x27CDC2L, 0x2B5434L, 0xAD18CFL,
+    0x3267D8L, 0xB42B23L, 0xB8B2D5L, 0x3EFE2EL, 0xC54E89L, 0x430272L,
+    0x4F9B84L, 0xC9D77FL, 0x56A868L, 0xD0E493L, 0xDC7D65L, 0x5A319EL,
+    0x64CFB0L, 0xE2834BL, 0xEE1ABDL, 0x685646L, 0xF72951L, 0x7165AAL,
+    0x7DFC5CL, 0xFBB0A7L, 0x0CD1E9L, 0x8A9D12L, 0x8604E4L, 0x00481FL,
+    0x9F3708L, 0x197BF3L, 0x15E205L, 0x93AEFEL, 0xAD50D0L, 0x2B1C2BL,
+    0x2785DDL, 0xA1C926L, 0x3EB631L, 0xB8FACAL, 0xB4633CL, 0x322FC7L,
+    0xC99F60L, 0x4FD39BL, 0x434A6DL, 0xC50696L, 0x5A7981L, 0xDC357AL,
+    0xD0AC8CL, 0x56E077L, 0x681E59L, 0xEE52A2L, 0xE2CB54L, 0x6487AFL,
+    0xFBF8B8L, 0x7DB443L, 0x712DB5L, 0xF7614EL, 0x19A3D2L, 0x9FEF29L,
+    0x9376DFL, 0x153A24L, 0x8A4533L, 0x0C09C8L, 0x00903EL, 0x86DCC5L,
+    0xB822EBL, 0x3E6E10L, 0x32F7E6L, 0xB4BB1DL, 0x2BC40AL, 0xAD88F1L,
+    0xA11107L, 0x275DFCL, 0xDCED5BL, 0x5AA1A0L, 0x563856L, 0xD074ADL,
+    0x4F0BBAL, 0xC94741L, 0xC5DEB7L, 0x43924CL, 0x7D6C62L, 0xFB2099L,
+    0xF7B96FL, 0x71F594L, 0xEE8A83L, 0x68C678L, 0x645F8EL, 0xE21375L,
+    0x15723BL, 0x933EC0L, 0x9FA736L, 0x19EBCDL, 0x8694DAL, 0x00D821L,
+    0x0C41D7L, 0x8A0D2CL, 0xB4F302L, 0x32BFF9L, 0x3E260FL, 0xB86AF4L,
+    0x2715E3L, 0xA15918L, 0xADC0EEL, 0x2B8C15L, 0xD03CB2L, 0x567049L,
+    0x5AE9BFL, 0xDCA544L, 0x43DA53L, 0xC596A8L, 0xC90F5EL, 0x4F43A5L,
+    0x71BD8BL, 0xF7F170L, 0xFB6886L, 0x7D247DL, 0xE25B6AL, 0x641791L,
+    0x688E67L, 0xEEC29CL, 0x3347A4L, 0xB50B5FL, 0xB992A9L, 0x3FDE52L,
+    0xA0A145L, 0x26EDBEL, 0x2A7448L, 0xAC38B3L, 0x92C69DL, 0x148A66L,
+    0x181390L, 0x9E5F6BL, 0x01207CL, 0x876C87L, 0x8BF571L, 0x0DB98AL,
+    0xF6092DL, 0x7045D6L, 0x7CDC20L, 0xFA90DBL, 0x65EFCCL, 0xE3A337L,
+    0xEF3AC1L, 0x69763AL, 0x578814L, 0xD1C4EFL, 0xDD5D19L, 0x5B11E2L,
+    0xC46EF5L, 0x42220EL, 0x4EBBF8L, 0xC8F703L, 0x3F964DL, 0xB9DAB6L,
+    0xB54340L, 0x330FBBL, 0xAC70ACL, 0x2A3C57L, 0x26A5A1L, 0xA0E95AL,
+    0x9E1774L, 0x185B8FL, 0x14C279L, 0x928E82L, 0x0DF195L, 0x8BBD6EL,
+    0x872498L, 0x016863L, 0xFAD8C4L, 0x7C943FL, 0x700DC9L, 0xF64132L,
+    0x693E25L, 0xEF72DEL, 0xE3EB28L, 0x65A7D3L, 0x5B59FDL, 0xDD1506L,
+    0xD18CF0L, 0x57C00BL, 0xC8BF1CL, 0x4EF3E7L, 0x426A11L, 0xC426EAL,
+    0x2AE476L, 0xACA88DL, 0xA0317BL, 0x267D80L, 0xB90297L, 0x3F4E6CL,
+    0x33D79AL, 0xB59B61L, 0x8B654FL, 0x0D29B4L, 0x01B042L, 0x87FCB9L,
+    0x1883AEL, 0x9ECF55L, 0x9256A3L, 0x141A58L, 0xEFAAFFL, 0x69E604L,
+    0x657FF2L, 0xE33309L, 0x7C4C1EL, 0xFA00E5L, 0xF69913L, 0x70D5E8L,
+    0x4E2BC6L, 0xC8673DL, 0xC4FECBL, 0x42B230L, 0xDDCD27L, 0x5B81DCL,
+    0x57182AL, 0xD154D1L, 0x26359FL, 0xA07964L, 0xACE092L, 0x2AAC69L,
+    0xB5D37EL, 0x339F85L, 0x3F0673L, 0xB94A88L, 0x87B4A6L, 0x01F85DL,
+    0x0D61ABL, 0x8B2D50L, 0x145247L, 0x921EBCL, 0x9E874AL, 0x18CBB1L,
+    0xE37B16L, 0x6537EDL, 0x69AE1BL, 0xEFE2E0L, 0x709DF7L, 0xF6D10CL,
+    0xFA48FAL, 0x7C0401L, 0x42FA2FL, 0xC4B6D4L, 0xC82F22L, 0x4E63D9L,
+    0xD11CCEL, 0x575035L, 0x5BC9C3L, 0xDD8538L};
+
 void do_crc24(unsigned long *crc, const unsigned char *buf, size_t len) {
+  unsigned long c = *crc;
   size_t i;
 
-  for (i = 0; i < len; i++) {
-    int j;
+  for (i = 0; i < len; i++)
+    c = (c << 8 ^ crc24_table[(c >> 16 ^ buf[i]) & 0xFF]) & 0xFFFFFFL;
 
-    *crc ^= buf[i] << 16;
-    for (j = 0; j < 8; j++) {
-      *crc <<= 1;
-      if (*crc & 0x1000000)
-        *crc ^= CRC24_POLY;
-    }
+  *crc = c;
+}
+
+/* Multiply two polynomials modulo the CRC-24 polynomial, bit k of a
+   value being the coefficient of x^k. */
+static unsigned long crc24_mulmod(unsigned long a, unsigned long b) {
+  unsigned long r = 0;
+  int i;
+
+  for (i = 23; i >= 0; i--) {
+    r <<= 1;
+    if (r & 0x1000000)
+      r ^= 0x1000000 | CRC24_POLY;
+    if (b >> i & 1)
+      r ^= a;
   }
+  return r;
 }
 
-static void print_base16(struct stream *output, const unsigned char *buf,
-                         size_t length, unsigned int line_items,
-                         unsigned long all_crc, unsigned int *line,
-                         unsigned long *line_crc, unsigned int *offset) {
-  // static unsigned long line_crc = CRC24_INIT;
-  // static unsigned int line = 0;
+/* Running data through the CRC from register r gives the CRC from zero
+   plus r shifted along by the length, and shifting by n bytes is a
+   multiplication by x^(8n).  So the CRC of A followed by B is crc_b
+   with the difference between A's register and the initial value
+   shifted in, found by squaring in O(log len_b) steps. */
+unsigned long crc24_combine(unsigned long crc_a, unsigned long crc_b,
+                            size_t len_b) {
+  unsigned long shift = 1, power = 0x100;
+
+  for (; len_b; len_b >>= 1) {
+    if (len_b & 1)
+      shift = crc24_mulmod(shift, power);
+    power = crc24_mulmod(power, power);
+  }
 
-  if (buf) {
-    size_t i;
+  return (crc_b ^ crc24_mulmod((crc_a ^ CRC24_INIT) & 0xFFFFFFL, shift)) &
+         0xFFFFFFL;
+}
 
-    for (i = 0; i < length; i++, (*offset)++) {
-      if (*offset % line_items == 0) {
-        if (*line) {
-          stream_printf(output, "%06lX\n", *line_crc & 0xFFFFFFL);
-          *line_crc = CRC24_INIT;
-        }
+/* Write one text line: "<tag>NNN: <data> CRC".  Base16 data ends with
+   its own separating space; the denser encodings get one. */
+void output_text_line(struct output_state *out, const char *tag,
+                      unsigned int number, const unsigned char *buf,
+                      size_t len) {
+  char text[16 + 3 * MAX_LINE_ITEMS + 16];
+  unsigned long line_crc = CRC24_INIT;
+  int n;
 
-        stream_printf(output, "%3u: ", ++*line);
-      }
+  do_crc24(&line_crc, buf, len);
+
+  n = snprintf(text, 16, "%s%3u: ", tag, number);
+  n += encode_data(out->type, &text[n], buf, len);
+  if (out->type != BASE16)
+    text[n++] = ' ';
+  n += snprintf(&text[n], 16, "%06lX\n", line_crc & 0xFFFFFFL);
+
+  stream_write(text, 1, n, out->stream);
+}
+
+static void flush_line(struct output_state *out) {
+  if (out->linelen == 0)
+    return;
+
+  output_text_line(out, "", ++out->line, out->linebuf, out->linelen);
+  out->linelen = 0;
+}
 
-      stream_printf(output, "%02X ", buf[i]);
+/* With FEC on, the parity is computed over the whole document at the
+   end, so keep a copy of every data byte. */
+static void keep_fec_data(struct paperkey_ctx *ctx, const unsigned char *buf,
+                          size_t length) {
+  struct output_state *out = &ctx->out;
 
-      do_crc24(line_crc, &buf[i], 1);
+  if (out->fec_failed)
+    return;
+
+  if (out->fec_size - out->fec_len < length) {
+    size_t size = out->fec_size ? out->fec_size : 1024;
+    unsigned char *tmp;
+
+    while (size - out->fec_len < length)
+      size *= 2;
+
+    tmp = ctx_realloc(ctx, out->fec_data, out->fec_size, size);
+    if (tmp == NULL) {
+      out->fec_failed = 1;
+      return;
+    }
+    out->fec_data = tmp;
+    out->fec_size = size;
+  }
+
+  memcpy(&out->fec_data[out->fec_len], buf, length);
+  out->fec_len += length;
+}
+
+static void print_text(struct output_state *out, const unsigned char *buf,
+                       size_t length) {
+  if (buf) {
+    while (length) {
+      size_t room = out->line_items - out->linelen;
+      size_t n = length < room ? length : room;
+
+      memcpy(&out->linebuf[out->linelen], buf, n);
+      out->linelen += n;
+      buf += n;
+      length -= n;
+
+      if (out->linelen == out->line_items)
+        flush_line(out);
     }
   } else {
-    stream_printf(output, "%06lX\n", *line_crc & 0xFFFFFFL);
-    stream_printf(output, "%3u: %06lX\n", *line + 1, all_crc & 0xFFFFFFL);
+    flush_line(out);
+    stream_printf(out->stream, "%3u: %06lX\n", out->line + 1,
+                  out->all_crc & 0xFFFFFFL);
   }
 }
 
+/* Reentrant replacement for the "%.24s" of ctime().  The format is
+   the one asctime() is specified to produce, and the names are
+   spelled out so the header does not depend on the locale. */
+static void format_time(char buf[32], time_t when) {
+  static const char wday[7][4] = {"Sun", "Mon", "Tue", "Wed",
+                                  "Thu", "Fri", "Sat"};
+  static const char mon[12][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  struct tm tm;
+
+  if (localtime_r(&when, &tm) == NULL) {
+    strcpy(buf, "(unknown time)");
+    return;
+  }
+
+  snprintf(buf, 32, "%.3s %.3s%3d %.2d:%.2d:%.2d %d", wday[tm.tm_wday % 7],
+           mon[tm.tm_mon % 12], tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+           1900 + tm.tm_year);
+}
+
 void print_bytes(struct stream *stream, const unsigned char *buf,
                  size_t length) {
   size_t i;
@@ -87,16 +238,20 @@ void print_bytes(struct stream *stream, const unsigned char *buf,
 void output_file_format(struct stream *stream, const char *prefix) {
   stream_printf(stream, "%sFile format:\n", prefix);
   stream_printf(
-      stream, "%sa) 1 octet:  Version of the paperkey format (currently 0).\n",
+      stream,
+      "%sa) 1 octet:  Version of the paperkey format (0, or 1 when the "
+      "primary key\n",
       prefix);
+  stream_printf(stream, "%s             is version 6).\n", prefix);
   stream_printf(stream,
-                "%sb) 1 octet:  OpenPGP key or subkey version (currently 4)\n",
+                "%sb) 1 octet:  OpenPGP key or subkey version (4 or 6)\n",
                 prefix);
   stream_printf(
       stream,
       "%sc) n octets: Key fingerprint (20 octets for a version 4 key or "
-      "subkey)\n",
+      "subkey,\n",
       prefix);
+  stream_printf(stream, "%s             32 octets for version 6)\n", prefix);
   stream_printf(
       stream,
       "%sd) 2 octets: 16-bit big endian length of the following secret data\n",
@@ -107,12 +262,13 @@ void output_file_format(struct stream *stream, const char *prefix) {
       "packet as\n",
       prefix);
   stream_printf(stream,
-                "%s             specified in RFC 4880, starting with the "
-                "string-to-key usage\n",
+                "%s             specified in RFC 4880 or RFC 9580, starting "
+                "with the string-to-key\n",
                 prefix);
   stream_printf(
       stream,
-      "%s             octet and continuing until the end of the packet.\n",
+      "%s             usage octet and continuing until the end of the "
+      "packet.\n",
       prefix);
   stream_printf(stream,
                 "%sRepeat fields b through e as needed to cover all subkeys.\n",
@@ -153,44 +309,86 @@ void output_file_format(struct stream *stream, const char *prefix) {
                 prefix);
 }
 
-int output_start(struct stream *output, enum data_type type,
-                 unsigned char fingerprint[20], unsigned int output_width,
-                 unsigned int *line_items) {
-  // if (name) {
-  //   if (type == RAW)
-  //     output = fopen(name, "wb");
-  //   else
-  //     output = fopen(name, "w");
-
-  //   if (!output)
-  //     return -1;
-  // } else {
-  //   if (type == RAW)
-  //     set_binary_mode(stdout);
-
-  //   output = stdout;
-  // }
-
-  // output_type = type;
+int output_start(struct paperkey_ctx *ctx, struct stream *output,
+                 enum data_type type, const unsigned char *fingerprint,
+                 size_t fingerprint_len) {
+  struct output_state *out = &ctx->out;
+
+  if (fingerprint_len > MAX_FINGERPRINT)
+    return -1;
+  out->stream = output;
+  out->type = type;
+  if (fingerprint)
+    memcpy(out->fingerprint, fingerprint, fingerprint_len);
+  out->fingerprint_len = fingerprint_len;
+  out->line_items = 0;
+  out->all_crc = CRC24_INIT;
+  out->line = 0;
+  out->linelen = 0;
+  out->fec_data = NULL;
+  out->fec_len = 0;
+  out->fec_size = 0;
+  out->fec_failed = 0;
+  out->started = metrics_start(ctx);
 
   switch (type) {
   case RAW:
     break;
 
   case AUTO:
-  case BASE16: {
-    time_t now = time(NULL);
+    out->type = type = BASE16;
+    /* fall through */
+  case BASE16:
+  case BASE32:
+  case BASE64:
+  case BASE45: {
+    const char *name = encoding_name(type);
+    char when[32];
+
+    out->line_items = encoding_line_items(type, ctx->output_width);
+    if (out->line_items == 0)
+      return -1;
+
+    format_time(when, ctx->have_timestamp ? ctx->timestamp : time(NULL));
 
-    *line_items = (output_width - 5 - 6) / 3;
     stream_printf(output, "# Secret portions of key ");
-    print_bytes(output, fingerprint, 20);
+    print_bytes(output, fingerprint, fingerprint_len);
     stream_printf(output, "\n");
-    stream_printf(output, "# Base16 data extracted %.24s\n", ctime(&now));
+    stream_printf(output, "# %s data extracted %s\n", name, when);
     stream_printf(output,
                   "# Created with " PACKAGE_STRING " by David Shaw\n#\n");
+    if (ctx->comment) {
+      const char *line = ctx->comment;
+
+      /* Every line of it stays a comment to the reader. */
+      for (;;) {
+        size_t len = strcspn(line, "\n");
+
+        stream_printf(output, "# %.*s\n", (int)len, line);
+        if (line[len] == '\0')
+          break;
+        line += len + 1;
+      }
+      stream_printf(output, "#\n");
+    }
     output_file_format(output, "# ");
-    stream_printf(output,
-                  "#\n# Each base16 line ends with a CRC-24 of that line.\n");
+    stream_printf(output, "#\n# Each %c%s line ends with a CRC-24 of that line.\n",
+                  tolower((unsigned char)name[0]), name + 1);
+    switch (type) {
+    case BASE32:
+    case BASE64:
+      stream_printf(output,
+                    "# The data uses the RFC 4648 alphabet without padding.\n");
+      break;
+    case BASE45:
+      stream_printf(output,
+                    "# The data uses the RFC 9285 alphabet, which includes "
+                    "the space, so the\n# CRC-24 is always the last 6 "
+                    "characters of the line.\n");
+      break;
+    default:
+      break;
+    }
     stream_printf(output,
                   "# The entire block of data ends with a CRC-24 of the "
                   "entire block of data.\n\n");
@@ -200,33 +398,35 @@ int output_start(struct stream *output, enum data_type type,
   return 0;
 }
 
-ssize_t output_bytes(struct stream *output, enum data_type type,
-                     const unsigned char *buf, size_t length,
-                     unsigned int line_items, unsigned long *all_crc,
-                     unsigned int *line, unsigned long *line_crc,
-                     unsigned int *offset) {
+ssize_t output_bytes(struct paperkey_ctx *ctx, const unsigned char *buf,
+                     size_t length) {
+  struct output_state *out = &ctx->out;
   ssize_t ret = -1;
 
-  do_crc24(all_crc, buf, length);
+  do_crc24(&out->all_crc, buf, length);
 
-  switch (type) {
+  switch (out->type) {
   case RAW:
     if (buf == NULL) {
       unsigned char crc[3];
 
-      crc[0] = (*all_crc & 0xFFFFFFL) >> 16;
-      crc[1] = (*all_crc & 0xFFFFFFL) >> 8;
-      crc[2] = (*all_crc & 0xFFFFFFL);
+      crc[0] = (out->all_crc & 0xFFFFFFL) >> 16;
+      crc[1] = (out->all_crc & 0xFFFFFFL) >> 8;
+      crc[2] = (out->all_crc & 0xFFFFFFL);
 
-      ret = stream_write(crc, 1, 3, output);
+      ret = stream_write(crc, 1, 3, out->stream);
     } else
-      ret = stream_write(buf, 1, length, output);
+      ret = stream_write(buf, 1, length, out->stream);
     break;
 
   case AUTO:
   case BASE16:
-    print_base16(output, buf, length, line_items, *all_crc, line, line_crc,
-                 offset);
+  case BASE32:
+  case BASE64:
+  case BASE45:
+    if (buf && ctx->fec_percent)
+      keep_fec_data(ctx, buf, length);
+    print_text(out, buf, length);
     ret = length;
     break;
   }
@@ -234,10 +434,14 @@ ssize_t output_bytes(struct stream *output, enum data_type type,
   return ret;
 }
 
-ssize_t output_length16(struct stream *output, enum data_type type,
-                        size_t length, unsigned int line_items,
-                        unsigned long *all_crc, unsigned int *line,
-                        unsigned long *line_crc, unsigned int *offset) {
+ssize_t output_passthrough(struct paperkey_ctx *ctx, const unsigned char *buf,
+                           size_t length) {
+  assert(ctx->out.type == RAW);
+
+  return stream_write(buf, 1, length, ctx->out.stream);
+}
+
+ssize_t output_length16(struct paperkey_ctx *ctx, size_t length) {
   unsigned char encoded[2];
 
   assert(length <= 65535);
@@ -245,15 +449,11 @@ ssize_t output_length16(struct stream *output, enum data_type type,
   encoded[0] = length >> 8;
   encoded[1] = length;
 
-  return output_bytes(output, type, encoded, 2, line_items, all_crc, line,
-                      line_crc, offset);
+  return output_bytes(ctx, encoded, 2);
 }
 
-ssize_t output_openpgp_header(struct stream *output, enum data_type type,
-                              unsigned char tag, size_t length,
-                              unsigned int line_items, unsigned long *all_crc,
-                              unsigned int *line, unsigned long *line_crc,
-                              unsigned int *offset) {
+ssize_t output_openpgp_header(struct paperkey_ctx *ctx, unsigned char tag,
+                              size_t length, int new_style) {
   unsigned char encoded[6];
   size_t bytes;
 
@@ -262,9 +462,11 @@ ssize_t output_openpgp_header(struct stream *output, enum data_type type,
      byte-for-byte identical.  It's not a guarantee, as it is legal
      for the generating program to use whatever packet style it likes,
      but does help avoid questions why the input to paperkey might not
-     equal the output. */
+     equal the output.  Restore asks for new-style headers where the
+     public key packet had one, as RFC 9580 programs write them for
+     every packet. */
 
-  if (tag < 16) {
+  if (tag < 16 && !new_style) {
     if (length > 65535) {
       encoded[0] = 0x80 | (tag << 2) | 2;
       encoded[1] = length >> 24;
@@ -302,16 +504,30 @@ ssize_t output_openpgp_header(struct stream *output, enum data_type type,
     }
   }
 
-  return output_bytes(output, type, encoded, bytes, line_items, all_crc, line,
-                      line_crc, offset);
+  return output_bytes(ctx, encoded, bytes);
 }
 
-void output_finish(struct stream *output, enum data_type type,
-                   unsigned int line_items, unsigned long *all_crc,
-                   unsigned int *line, unsigned long *line_crc,
-                   unsigned int *offset) {
-  output_bytes(output, type, NULL, 0, line_items, all_crc, line, line_crc,
-               offset);
+int output_finish(struct paperkey_ctx *ctx) {
+  struct output_state *out = &ctx->out;
+  int ret = 0;
+
+  output_bytes(ctx, NULL, 0);
+
+  if (out->type != RAW && ctx->fec_percent)
+    if (out->fec_failed || fec_encode(ctx) != 0)
+      ret = -1;
+
+  output_discard(ctx);
+  metrics_record(ctx, PAPERKEY_METRIC_ENCODE, out->started);
+  return ret;
+}
+
+void output_discard(struct paperkey_ctx *ctx) {
+  struct output_state *out = &ctx->out;
+
+  ctx_free(ctx, out->fec_data, out->fec_size);
+  out->fec_data = NULL;
+  out->fec_len = out->fec_size = 0;
 }
 
 // void set_binary_mode(FILE *stream) {
@@ -23,25 +23,78 @@
 #ifndef _OUTPUT_H_
 #define _OUTPUT_H_
 
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include "stream.h"
 
-enum data_type { AUTO, BASE16, RAW };
+enum data_type { AUTO, BASE16, RAW, BASE32, BASE64, BASE45 };
+
+/* Upper bound on data bytes per text line, which keeps every line
+   well inside the 1024 byte line buffer of the reader. */
+#define MAX_LINE_ITEMS 240
 
 #define CRC24_INIT 0xB704CEL
 
+/* Octets in the longest key fingerprint, a version 6 key's SHA-256. */
+#define MAX_FINGERPRINT 32
+
 void do_crc24(unsigned long *crc, const unsigned char *buf, size_t len);
+/* The CRC-24 of A followed by B, from the CRCs of A and of B (both
+   started from CRC24_INIT) and the length of B, in the manner of
+   zlib's crc32_combine. */
+unsigned long crc24_combine(unsigned long crc_a, unsigned long crc_b,
+                            size_t len_b);
 void print_bytes(struct stream *stream, const unsigned char *buf, size_t length);
 void output_file_format(struct stream *stream, const char *prefix);
-int output_start(struct stream *output, enum data_type type,
-                 unsigned char fingerprint[20], unsigned int output_width,
-                 unsigned int *line_items);
-ssize_t output_bytes(struct stream *output, enum data_type type, const unsigned char *buf, size_t length, unsigned int line_items, unsigned long *all_crc, unsigned int *line, unsigned long *line_crc, unsigned int *offset);
-#define output_packet(output, type, _packet, line_items, all_crc, line, line_crc, offset) output_bytes((output), (type),(_packet)->buf, (_packet)->len, (line_items), (all_crc), (line), (line_crc), (offset))
-ssize_t output_length16(struct stream *output, enum data_type type, size_t length, unsigned int line_items, unsigned long *all_crc, unsigned int *line, unsigned long *line_crc, unsigned int *offset);
-ssize_t output_openpgp_header(struct stream *output, enum data_type type, unsigned char tag, size_t length, unsigned int line_items, unsigned long *all_crc, unsigned int *line, unsigned long *line_crc, unsigned int *offset);
-void output_finish(struct stream *output, enum data_type type, unsigned int line_items, unsigned long *all_crc, unsigned int *line, unsigned long *line_crc, unsigned int *offset);
+struct paperkey_ctx;
+
+/* Encoder state for one output document.  It lives inside the
+   operation context, so concurrent extractions never share it. */
+struct output_state {
+  struct stream *stream;
+  enum data_type type;
+  /* Of the primary key, for anything that labels the document. */
+  unsigned char fingerprint[MAX_FINGERPRINT];
+  size_t fingerprint_len;
+  unsigned int line_items;
+  unsigned long all_crc;
+  unsigned int line;
+  /* Text encodings build one line at a time. */
+  unsigned char linebuf[MAX_LINE_ITEMS];
+  unsigned int linelen;
+  /* Copy of the data for the parity lines when FEC is on. */
+  unsigned char *fec_data;
+  size_t fec_len;
+  size_t fec_size;
+  int fec_failed;
+  /* When output_start() was called, for the encode metric. */
+  uint64_t started;
+};
+
+int output_start(struct paperkey_ctx *ctx, struct stream *output,
+                 enum data_type type, const unsigned char *fingerprint,
+                 size_t fingerprint_len);
+ssize_t output_bytes(struct paperkey_ctx *ctx, const unsigned char *buf,
+                     size_t length);
+#define output_packet(ctx, _packet)                                          \
+  output_bytes((ctx), (_packet)->buf, (_packet)->len)
+/* Copy bytes that are already whole packets, headers and all, to RAW
+   output that is never finished, as restore's is.  They are left out of
+   the CRC-24, which only output_finish() uses. */
+ssize_t output_passthrough(struct paperkey_ctx *ctx, const unsigned char *buf,
+                           size_t length);
+ssize_t output_length16(struct paperkey_ctx *ctx, size_t length);
+/* A packet header in the new style when new_style is set or the tag
+   needs it, and in the old style otherwise. */
+ssize_t output_openpgp_header(struct paperkey_ctx *ctx, unsigned char tag,
+                              size_t length, int new_style);
+int output_finish(struct paperkey_ctx *ctx);
+/* Release what an unfinished output holds, after an error. */
+void output_discard(struct paperkey_ctx *ctx);
+void output_text_line(struct output_state *out, const char *tag,
+                      unsigned int number, const unsigned char *buf,
+                      size_t len);
 // void set_binary_mode(FILE *stream);
 
 #endif /* !_OUTPUT_H_ */
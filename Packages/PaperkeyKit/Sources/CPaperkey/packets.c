@@ -18,48 +18,68 @@
 
 #include "packets.h"
 #include "config.h"
+#include "internal.h"
 #include "output.h"
 #include "sha1.h"
-#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-void *xrealloc(void *ptr, size_t size) {
-  ptr = realloc(ptr, size);
-  if (!ptr) {
-    fprintf(stderr, "Unable to allocate memory\n");
-    abort();
-  }
+/* On allocation failure the packet is freed and NULL is returned, so
+   callers never have to untangle a half-grown packet. */
+struct packet *append_packet(struct paperkey_ctx *ctx, struct packet *packet,
+                             const unsigned char *buf, size_t len) {
+  size_t max = ctx->limits[PAPERKEY_LIMIT_PACKET];
+  size_t have = packet ? packet->len : 0;
 
-  return ptr;
-}
+  if (max && (have > max || len > max - have)) {
+    ctx_refuse(ctx, PAPERKEY_LIMIT_PACKET);
+    free_packet(ctx, packet);
+    return NULL;
+  }
 
-struct packet *append_packet(struct packet *packet, unsigned char *buf,
-                             size_t len) {
   if (packet) {
-    while (packet->size - packet->len < len) {
-      packet->size += 100;
-      packet->buf = xrealloc(packet->buf, packet->size);
+    if (packet->size - packet->len < len) {
+      size_t size = packet->size;
+      unsigned char *tmp;
+
+      while (size - packet->len < len)
+        size += 100;
+
+      tmp = ctx_realloc(ctx, packet->buf, packet->size, size);
+      if (tmp == NULL) {
+        free_packet(ctx, packet);
+        return NULL;
+      }
+
+      packet->buf = tmp;
+      packet->size = size;
     }
 
     memcpy(&packet->buf[packet->len], buf, len);
     packet->len += len;
   } else {
-    packet = xmalloc(sizeof(*packet));
+    packet = ctx_malloc(ctx, sizeof(*packet));
+    if (packet == NULL)
+      return NULL;
     packet->type = 0;
-    packet->buf = xmalloc(len);
+    packet->buf = len ? ctx_malloc(ctx, len) : NULL;
+    if (len && packet->buf == NULL) {
+      ctx_free(ctx, packet, sizeof(*packet));
+      return NULL;
+    }
     packet->len = len;
     packet->size = len;
 
-    memcpy(packet->buf, buf, len);
+    if (len)
+      memcpy(packet->buf, buf, len);
   }
 
   return packet;
 }
 
-void free_packet(struct packet *packet) {
+void free_packet(struct paperkey_ctx *ctx, struct packet *packet) {
   if (packet) {
-    free(packet->buf);
-    free(packet);
+    ctx_free(ctx, packet->buf, packet->size);
+    ctx_free(ctx, packet, sizeof(*packet));
   }
 }
@@ -30,10 +30,10 @@ struct packet {
   size_t size;
 };
 
-void *xrealloc(void *ptr, size_t size);
-#define xmalloc(_size) xrealloc(NULL, _size)
-struct packet *append_packet(struct packet *packet, unsigned char *buf,
-                             size_t len);
-void free_packet(struct packet *packet);
+struct paperkey_ctx;
+
+struct packet *append_packet(struct paperkey_ctx *ctx, struct packet *packet,
+                             const unsigned char *buf, size_t len);
+void free_packet(struct paperkey_ctx *ctx, struct packet *packet);
 
 #endif /* !_PACKETS_H_ */
@@ -0,0 +1,823 @@
+/*
+ * paperkey.c - Command line front end, with the options of upstream
+ * paperkey and a parallel batch mode for whole trees of keys
+ */
+
+#include "armor.h"
+#include "bulkio.h"
+#include "config.h"
+#include "context.h"
+#include "output.h"
+#include "packets.h"
+#include "parse.h"
+#include "pool.h"
+#include "stream.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Output is gathered into writes of this size. */
+#define SINK_SIZE 65536
+/* Keys per window of a batch run. */
+#define BATCH_WINDOW 1024
+
+enum {
+  OPT_INPUT_TYPE = 256,
+  OPT_OUTPUT_TYPE,
+  OPT_OUTPUT_WIDTH,
+  OPT_SECRET_KEY,
+  OPT_PUBRING,
+  OPT_SECRETS,
+  OPT_IGNORE_CRC_ERROR,
+  OPT_FILE_FORMAT,
+  OPT_COMMENT,
+  OPT_FEC,
+  OPT_ARMOR,
+  OPT_BATCH,
+  OPT_IO
+};
+
+static const struct option long_options[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"version", no_argument, NULL, 'V'},
+    {"verbose", no_argument, NULL, 'v'},
+    {"output", required_argument, NULL, 'o'},
+    {"input-type", required_argument, NULL, OPT_INPUT_TYPE},
+    {"output-type", required_argument, NULL, OPT_OUTPUT_TYPE},
+    {"output-width", required_argument, NULL, OPT_OUTPUT_WIDTH},
+    {"secret-key", required_argument, NULL, OPT_SECRET_KEY},
+    {"pubring", required_argument, NULL, OPT_PUBRING},
+    {"secrets", required_argument, NULL, OPT_SECRETS},
+    {"ignore-crc-error", no_argument, NULL, OPT_IGNORE_CRC_ERROR},
+    {"file-format", no_argument, NULL, OPT_FILE_FORMAT},
+    {"comment", required_argument, NULL, OPT_COMMENT},
+    {"fec", required_argument, NULL, OPT_FEC},
+    {"armor", no_argument, NULL, OPT_ARMOR},
+    {"batch", required_argument, NULL, OPT_BATCH},
+    {"io", required_argument, NULL, OPT_IO},
+    {"jobs", required_argument, NULL, 'j'},
+    {NULL, 0, NULL, 0}};
+
+struct options {
+  enum data_type input_type;
+  enum data_type output_type;
+  unsigned int output_width;
+  int ignore_crc_error;
+  const char *comment;
+  unsigned int fec_percent;
+  int armor;
+  unsigned int jobs;
+  /* Batch files go through I/O threads instead of io_uring. */
+  int io_threads;
+  int verbose;
+};
+
+/* Buffers what a stream writes and hands it to a file descriptor. */
+struct fd_sink {
+  int fd;
+  int failed;
+  size_t len;
+  unsigned char buf[SINK_SIZE];
+};
+
+struct batch_stats {
+  size_t keys;
+  size_t failed;
+  uint64_t bytes_in;
+  uint64_t bytes_out;
+};
+
+struct batch_worker {
+  struct paperkey_ctx *ctx;
+  struct batch_stats stats;
+};
+
+/* Either the files of a tree or the primary keys of one keyring. */
+struct batch {
+  const struct options *opts;
+  const char *outdir;
+  char **paths;
+  const struct stream *keyring;
+  size_t *offsets;
+  size_t count;
+  struct batch_worker *workers;
+  unsigned int nworkers;
+  /* The window being extracted: the index of its first key, the reads
+     of its files and the writes of its documents. */
+  size_t base;
+  struct bulkio_op *reads;
+  struct bulkio_op *writes;
+};
+
+static void usage(void) {
+  printf("Usage: paperkey [OPTIONS]\n");
+  printf("  --help (-h)\n");
+  printf("  --version (-V)\n");
+  printf("  --verbose (-v)  be more verbose\n");
+  printf("  --output (-o)   write output to this file\n");
+  printf("  --input-type    auto, base16, base32, base64, base45 or raw "
+         "(binary)\n");
+  printf("  --output-type   base16, base32, base64, base45 or raw "
+         "(binary)\n");
+  printf("  --output-width  maximum width of text output\n");
+  printf("  --ignore-crc-error  don't reject corrupted input\n");
+  printf("  --file-format   show the paperkey file format\n");
+  printf("  --comment       add a comment to the text output\n");
+  printf("  --fec           add parity lines worth this percentage of the "
+         "data\n");
+  printf("  --armor         write restored keys in ASCII armor\n");
+  printf("  --batch         extract every key in this directory tree or "
+         "keyring\n");
+  printf("                  into the directory given with --output\n");
+  printf("  --io            io_uring (the default) or threads, for the files "
+         "of --batch\n");
+  printf("  --jobs (-j)     use this many threads\n");
+}
+
+static int parse_type(const char *name, enum data_type *type, int allow_auto) {
+  static const struct {
+    const char *name;
+    enum data_type type;
+  } names[] = {{"auto", AUTO},     {"base16", BASE16}, {"base32", BASE32},
+               {"base64", BASE64}, {"base45", BASE45}, {"raw", RAW}};
+  size_t i;
+
+  for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (strcmp(name, names[i].name) == 0 &&
+        (allow_auto || names[i].type != AUTO)) {
+      *type = names[i].type;
+      return 0;
+    }
+  return -1;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+  while (len) {
+    ssize_t n = write(fd, buf, len);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static void sink_flush(struct fd_sink *sink) {
+  if (!sink->failed && write_all(sink->fd, sink->buf, sink->len) != 0)
+    sink->failed = 1;
+  sink->len = 0;
+}
+
+static int sink_write(void *opaque, const void *buf, size_t len) {
+  struct fd_sink *sink = opaque;
+
+  if (sink->len + len > SINK_SIZE)
+    sink_flush(sink);
+  if (len >= SINK_SIZE) {
+    if (!sink->failed && write_all(sink->fd, buf, len) != 0)
+      sink->failed = 1;
+  } else {
+    memcpy(&sink->buf[sink->len], buf, len);
+    sink->len += len;
+  }
+  return sink->failed ? -1 : 0;
+}
+
+static void sink_init(struct fd_sink *sink, struct stream *stream, int fd) {
+  sink->fd = fd;
+  sink->failed = 0;
+  sink->len = 0;
+  memset(stream, 0, sizeof(*stream));
+  stream->sink = sink_write;
+  stream->sink_opaque = sink;
+}
+
+/* The whole of a file or of standard input, which cannot be sized up
+   front. */
+static struct stream *load_file(const char *path) {
+  FILE *file = path ? fopen(path, "rb") : stdin;
+  struct stream *s;
+  unsigned char buf[65536];
+  size_t got;
+
+  if (file == NULL)
+    return NULL;
+  s = create_empty_stream();
+  while (s && (got = fread(buf, 1, sizeof(buf), file)) > 0)
+    if (stream_write(buf, 1, got, s) != got) {
+      free(s->buffer);
+      free(s);
+      s = NULL;
+    }
+  if (s && ferror(file)) {
+    free(s->buffer);
+    free(s);
+    s = NULL;
+  }
+  if (path)
+    fclose(file);
+  if (s)
+    s->pos = 0;
+  return s;
+}
+
+static void drop_stream(struct stream *s) {
+  if (s) {
+    free(s->buffer);
+    free(s);
+  }
+}
+
+static void configure(struct paperkey_ctx *ctx, const struct options *opts) {
+  paperkey_ctx_set_output_type(ctx, opts->output_type);
+  paperkey_ctx_set_output_width(ctx, opts->output_width);
+  paperkey_ctx_set_ignore_crc_error(ctx, opts->ignore_crc_error);
+  paperkey_ctx_set_comment(ctx, opts->comment);
+  paperkey_ctx_set_fec(ctx, opts->fec_percent);
+  paperkey_ctx_set_armor(ctx, opts->armor);
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Every regular file under dir, skipping dot files and the output
+   directory in case it is inside the tree. */
+static int walk(const char *dir, const struct stat *skip, char ***paths,
+                size_t *count, size_t *size) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  int ret = 0;
+
+  if (d == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", dir, strerror(errno));
+    return -1;
+  }
+
+  while (ret == 0 && (entry = readdir(d)) != NULL) {
+    size_t len = strlen(dir) + strlen(entry->d_name) + 2;
+    struct stat st;
+    char *path;
+
+    if (entry->d_name[0] == '.')
+      continue;
+    path = malloc(len);
+    if (path == NULL) {
+      ret = -1;
+      break;
+    }
+    snprintf(path, len, "%s/%s", dir, entry->d_name);
+
+    if (lstat(path, &st) != 0) {
+      free(path);
+    } else if (S_ISDIR(st.st_mode)) {
+      if (st.st_dev != skip->st_dev || st.st_ino != skip->st_ino)
+        ret = walk(path, skip, paths, count, size);
+      free(path);
+    } else if (S_ISREG(st.st_mode)) {
+      if (*count == *size) {
+        size_t nsize = *size ? *size * 2 : 64;
+        char **grown = realloc(*paths, nsize * sizeof(**paths));
+
+        if (grown == NULL) {
+          free(path);
+          ret = -1;
+          break;
+        }
+        *paths = grown;
+        *size = nsize;
+      }
+      (*paths)[(*count)++] = path;
+    } else {
+      free(path);
+    }
+  }
+
+  closedir(d);
+  return ret;
+}
+
+static int compare_paths(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Where each secret primary key of a keyring starts.  Extraction stops
+   at the next one by itself. */
+static size_t *find_keys(const struct stream *keyring, size_t *count) {
+  struct stream view = *keyring;
+  size_t *offsets = NULL, size = 0;
+  unsigned char type;
+  unsigned int length;
+
+  *count = 0;
+  for (;;) {
+    int start = view.pos;
+
+    if (parse_packet_header(&view, &type, &length) != 0 ||
+        length > (unsigned int)stream_leftbyte(&view))
+      break;
+    if (type == 5) {
+      if (*count == size) {
+        size_t *grown;
+
+        size = size ? size * 2 : 64;
+        grown = realloc(offsets, size * sizeof(*offsets));
+        if (grown == NULL) {
+          free(offsets);
+          return NULL;
+        }
+        offsets = grown;
+      }
+      offsets[(*count)++] = start;
+    }
+    view.pos += length;
+  }
+  return offsets;
+}
+
+/* The fingerprint of the first secret primary key in hex, to name its
+   output by. */
+static int key_name(struct paperkey_ctx *ctx, const struct stream *input,
+                    char name[2 * MAX_FINGERPRINT + 1]) {
+  struct stream view = *input;
+  unsigned char fpr[MAX_FINGERPRINT];
+  struct packet *packet = parse(ctx, &view, 5, 0);
+  ssize_t offset;
+  size_t len, i;
+
+  if (packet == NULL)
+    return -1;
+  offset = extract_secrets(packet);
+  len = fingerprint_length(packet->buf[0]);
+  if (offset == -1 || len == 0 ||
+      calculate_fingerprint(packet, offset, fpr) != 0) {
+    free_packet(ctx, packet);
+    return -1;
+  }
+  free_packet(ctx, packet);
+
+  for (i = 0; i < len; i++)
+    sprintf(&name[2 * i], "%02X", fpr[i]);
+  return 0;
+}
+
+static void run_job(void *opaque, size_t index, unsigned int worker) {
+  struct batch *b = opaque;
+  struct batch_worker *w = &b->workers[worker];
+  struct bulkio_op *write_op = &b->writes[index];
+  struct stream *binary = NULL, *output = NULL, input;
+  const char *from = b->paths ? b->paths[b->base + index] : "keyring";
+  char name[2 * MAX_FINGERPRINT + 1], *path;
+  size_t len;
+  int ret = 1;
+
+  write_op->path = NULL;
+  if (b->keyring) {
+    input = *b->keyring;
+    input.pos = b->offsets[b->base + index];
+  } else {
+    struct bulkio_op *read_op = &b->reads[index];
+
+    if (read_op->error || read_op->len > INT_MAX)
+      goto done;
+    memset(&input, 0, sizeof(input));
+    input.buffer = read_op->buf;
+    input.size = input.memsize = read_op->len;
+    w->stats.bytes_in += read_op->len;
+  }
+
+  if (armor_detect(&input)) {
+    binary = armor_decode(w->ctx, &input);
+    if (binary == NULL)
+      goto done;
+    input = *binary;
+  }
+
+  if (key_name(w->ctx, &input, name) != 0)
+    goto done;
+  output = create_empty_stream();
+  if (output == NULL || paperkey_extract(w->ctx, &input, output) != 0)
+    goto done;
+
+  len = strlen(b->outdir) + strlen(name) + 6;
+  path = malloc(len);
+  if (path == NULL)
+    goto done;
+  snprintf(path, len, "%s/%s.%s", b->outdir, name,
+           b->opts->output_type == RAW ? "bin" : "txt");
+  write_op->type = BULKIO_WRITE;
+  write_op->path = path;
+  write_op->buf = output->buffer;
+  write_op->len = output->size;
+  free(output);
+  output = NULL;
+  ret = 0;
+
+done:
+  if (ret != 0) {
+    w->stats.failed++;
+    if (b->opts->verbose)
+      fprintf(stderr, "paperkey: unable to extract from %s\n", from);
+  } else {
+    w->stats.keys++;
+    if (b->opts->verbose > 1)
+      fprintf(stderr, "paperkey: %s -> %s\n", from, write_op->path);
+  }
+  armor_free(w->ctx, binary);
+  drop_stream(output);
+  if (b->reads) {
+    free(b->reads[index].buf);
+    b->reads[index].buf = NULL;
+  }
+}
+
+/* Queue the reads of the files of a window. */
+static void read_window(struct batch *b, struct bulkio *io,
+                        struct bulkio_op *reads, size_t base, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    reads[i].type = BULKIO_READ;
+    reads[i].path = b->paths[base + i];
+  }
+  bulkio_submit(io, reads, n);
+}
+
+/* Wait for the writes of a window and count those that failed. */
+static void finish_writes(struct batch *b, struct bulkio *io,
+                          struct bulkio_op *writes, size_t n,
+                          struct batch_stats *total) {
+  size_t i;
+
+  bulkio_wait(io, writes, n);
+  for (i = 0; i < n; i++) {
+    if (writes[i].error) {
+      total->keys--;
+      total->failed++;
+      if (b->opts->verbose)
+        fprintf(stderr, "paperkey: unable to write %s: %s\n", writes[i].path,
+                strerror(writes[i].error));
+      unlink(writes[i].path);
+    } else {
+      total->bytes_out += writes[i].len;
+    }
+    free((char *)writes[i].path);
+    free(writes[i].buf);
+  }
+}
+
+/* Extract every key under source, a directory tree or a keyring, to a
+   file in outdir named by its fingerprint.  The keys go through in
+   windows: while the workers extract one, the files of the next are
+   read and the documents of the last are written. */
+static int batch_extract(const struct options *opts, const char *source,
+                         const char *outdir) {
+  struct batch b;
+  struct batch_stats total;
+  struct paperkey_ctx *ctx = NULL;
+  struct stream *keyring = NULL, *binary = NULL;
+  struct bulkio_op *reads[2] = {NULL, NULL}, *writes[2] = {NULL, NULL};
+  size_t nwrites[2] = {0, 0};
+  struct bulkio *io = NULL;
+  struct pool *pool = NULL;
+  struct stat st, out_st;
+  size_t size = 0, windows, k, i;
+  unsigned int workers = 0;
+  double start;
+  int ret = 1;
+
+  memset(&b, 0, sizeof(b));
+  memset(&total, 0, sizeof(total));
+  b.opts = opts;
+  b.outdir = outdir;
+
+  if (stat(source, &st) != 0) {
+    fprintf(stderr, "Unable to open %s: %s\n", source, strerror(errno));
+    return 1;
+  }
+  if (mkdir(outdir, 0700) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create %s: %s\n", outdir, strerror(errno));
+    return 1;
+  }
+  if (stat(outdir, &out_st) != 0 || !S_ISDIR(out_st.st_mode)) {
+    fprintf(stderr, "Not a directory: %s\n", outdir);
+    return 1;
+  }
+
+  start = now();
+  if (S_ISDIR(st.st_mode)) {
+    if (walk(source, &out_st, &b.paths, &b.count, &size) != 0)
+      goto out;
+    qsort(b.paths, b.count, sizeof(*b.paths), compare_paths);
+  } else {
+    ctx = paperkey_ctx_new();
+    keyring = load_file(source);
+    if (ctx == NULL || keyring == NULL) {
+      fprintf(stderr, "Unable to read %s\n", source);
+      goto out;
+    }
+    total.bytes_in = keyring->size;
+    b.keyring = keyring;
+    if (armor_detect(keyring)) {
+      binary = armor_decode(ctx, keyring);
+      if (binary == NULL) {
+        fprintf(stderr, "Unable to read the armor of %s\n", source);
+        goto out;
+      }
+      b.keyring = binary;
+    }
+    b.offsets = find_keys(b.keyring, &b.count);
+  }
+
+  if (b.count == 0) {
+    fprintf(stderr, "No keys found in %s\n", source);
+    goto out;
+  }
+
+  io = bulkio_new(0, opts->io_threads);
+  pool = pool_new(opts->jobs);
+  for (i = 0; i < 2; i++) {
+    reads[i] = calloc(BATCH_WINDOW, sizeof(*reads[i]));
+    writes[i] = calloc(BATCH_WINDOW, sizeof(*writes[i]));
+    if (reads[i] == NULL || writes[i] == NULL)
+      goto out;
+  }
+  if (io == NULL || pool == NULL)
+    goto out;
+  workers = pool_workers(pool);
+  b.workers = calloc(workers, sizeof(*b.workers));
+  if (b.workers == NULL)
+    goto out;
+  b.nworkers = workers;
+  for (i = 0; i < workers; i++) {
+    b.workers[i].ctx = paperkey_ctx_new();
+    if (b.workers[i].ctx == NULL)
+      goto out;
+    configure(b.workers[i].ctx, opts);
+  }
+
+  windows = (b.count + BATCH_WINDOW - 1) / BATCH_WINDOW;
+  if (b.paths)
+    read_window(&b, io, reads[0], 0,
+                b.count < BATCH_WINDOW ? b.count : BATCH_WINDOW);
+  for (k = 0; k < windows; k++) {
+    size_t base = k * BATCH_WINDOW, n = b.count - base;
+    int cur = k % 2;
+
+    if (n > BATCH_WINDOW) {
+      size_t rest = n - BATCH_WINDOW;
+
+      n = BATCH_WINDOW;
+      if (b.paths)
+        read_window(&b, io, reads[!cur], base + n,
+                    rest < BATCH_WINDOW ? rest : BATCH_WINDOW);
+    }
+    if (b.paths)
+      bulkio_wait(io, reads[cur], n);
+    /* The writes of two windows back used the same ops. */
+    finish_writes(&b, io, writes[cur], nwrites[cur], &total);
+    nwrites[cur] = 0;
+
+    b.base = base;
+    b.reads = b.paths ? reads[cur] : NULL;
+    b.writes = writes[cur];
+    pool_run(pool, n, run_job, &b);
+
+    for (i = 0; i < n; i++)
+      if (writes[cur][i].path)
+        writes[cur][nwrites[cur]++] = writes[cur][i];
+    bulkio_submit(io, writes[cur], nwrites[cur]);
+  }
+  for (i = 0; i < 2; i++) {
+    finish_writes(&b, io, writes[i], nwrites[i], &total);
+    nwrites[i] = 0;
+  }
+
+  for (i = 0; i < workers; i++) {
+    total.keys += b.workers[i].stats.keys;
+    total.failed += b.workers[i].stats.failed;
+    total.bytes_in += b.workers[i].stats.bytes_in;
+  }
+  {
+    double elapsed = now() - start;
+
+    fprintf(stderr,
+            "paperkey: %zu keys extracted, %zu failed, %.1f MB in, %.1f MB "
+            "out in %.3f s (%.0f keys/s on %u threads, %s I/O)\n",
+            total.keys, total.failed, total.bytes_in / 1e6,
+            total.bytes_out / 1e6, elapsed,
+            elapsed > 0 ? total.keys / elapsed : 0.0, workers,
+            bulkio_backend(io));
+  }
+  ret = total.failed ? 1 : 0;
+
+out:
+  bulkio_free(io);
+  pool_free(pool);
+  for (i = 0; i < b.nworkers; i++)
+    paperkey_ctx_free(b.workers[i].ctx);
+  free(b.workers);
+  for (i = 0; i < 2; i++) {
+    free(reads[i]);
+    free(writes[i]);
+  }
+  for (i = 0; b.paths && i < b.count; i++)
+    free(b.paths[i]);
+  free(b.paths);
+  free(b.offsets);
+  armor_free(ctx, binary);
+  drop_stream(keyring);
+  paperkey_ctx_free(ctx);
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  struct options opts = {AUTO, BASE16, 78, 0, NULL, 0, 0, 0, 0, 0};
+  const char *output_path = NULL, *secret_key = NULL, *pubring_path = NULL;
+  const char *secrets_path = NULL, *batch_source = NULL;
+  struct stream *input, *pubring = NULL, output;
+  struct paperkey_ctx *ctx;
+  struct fd_sink *sink;
+  int opt, fd = STDOUT_FILENO, file_format = 0, ret;
+
+  while ((opt = getopt_long(argc, argv, "hVvo:j:", long_options, NULL)) !=
+         -1) {
+    switch (opt) {
+    case 'V':
+      printf("%s\n%s\n", PACKAGE_STRING, COPYRIGHT_STRING);
+      return 0;
+    case 'v':
+      opts.verbose++;
+      break;
+    case 'o':
+      output_path = optarg;
+      break;
+    case 'j':
+      opts.jobs = atoi(optarg);
+      break;
+    case OPT_INPUT_TYPE:
+      if (parse_type(optarg, &opts.input_type, 1) != 0) {
+        fprintf(stderr, "Unknown input type \"%s\"\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_OUTPUT_TYPE:
+      if (parse_type(optarg, &opts.output_type, 0) != 0) {
+        fprintf(stderr, "Unknown output type \"%s\"\n", optarg);
+        return 1;
+      }
+      break;
+    case OPT_OUTPUT_WIDTH:
+      opts.output_width = atoi(optarg);
+      break;
+    case OPT_SECRET_KEY:
+      secret_key = optarg;
+      break;
+    case OPT_PUBRING:
+      pubring_path = optarg;
+      break;
+    case OPT_SECRETS:
+      secrets_path = optarg;
+      break;
+    case OPT_IGNORE_CRC_ERROR:
+      opts.ignore_crc_error = 1;
+      break;
+    case OPT_FILE_FORMAT:
+      file_format = 1;
+      break;
+    case OPT_COMMENT:
+      opts.comment = optarg;
+      break;
+    case OPT_FEC:
+      opts.fec_percent = atoi(optarg);
+      if (opts.fec_percent > 100) {
+        fprintf(stderr, "FEC percentage must be 0 to 100\n");
+        return 1;
+      }
+      break;
+    case OPT_ARMOR:
+      opts.armor = 1;
+      break;
+    case OPT_BATCH:
+      batch_source = optarg;
+      break;
+    case OPT_IO:
+      if (strcmp(optarg, "threads") == 0)
+        opts.io_threads = 1;
+      else if (strcmp(optarg, "io_uring") == 0)
+        opts.io_threads = 0;
+      else {
+        fprintf(stderr, "Unknown I/O back end \"%s\"\n", optarg);
+        return 1;
+      }
+      break;
+    case 'h':
+      usage();
+      return 0;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  sink = malloc(sizeof(*sink));
+  if (sink == NULL)
+    return 1;
+
+  if (file_format) {
+    sink_init(sink, &output, STDOUT_FILENO);
+    output_file_format(&output, "");
+    sink_flush(sink);
+    free(sink);
+    return 0;
+  }
+
+  if (batch_source) {
+    free(sink);
+    if (output_path == NULL) {
+      fprintf(stderr, "--batch needs an output directory with --output\n");
+      return 1;
+    }
+    return batch_extract(&opts, batch_source, output_path);
+  }
+
+  if (pubring_path) {
+    pubring = load_file(pubring_path);
+    if (pubring == NULL) {
+      fprintf(stderr, "Unable to open pubring file %s: %s\n", pubring_path,
+              strerror(errno));
+      free(sink);
+      return 1;
+    }
+    input = load_file(secrets_path);
+  } else {
+    input = load_file(secret_key);
+  }
+  if (input == NULL) {
+    const char *name = pubring ? secrets_path : secret_key;
+
+    fprintf(stderr, "Unable to open %s %s: %s\n",
+            pubring ? "secrets file" : "secret key file",
+            name ? name : "(stdin)", strerror(errno));
+    drop_stream(pubring);
+    free(sink);
+    return 1;
+  }
+
+  if (output_path) {
+    fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+      fprintf(stderr, "Unable to open output file %s: %s\n", output_path,
+              strerror(errno));
+      drop_stream(input);
+      drop_stream(pubring);
+      free(sink);
+      return 1;
+    }
+  }
+
+  ctx = paperkey_ctx_new();
+  if (ctx == NULL)
+    return 1;
+  configure(ctx, &opts);
+  /* One document at a time, so the threads go to decoding it and to
+     scanning the pubring. */
+  if (opts.jobs > 1) {
+    paperkey_ctx_set_decode_threads(ctx, opts.jobs);
+    paperkey_ctx_set_scan_threads(ctx, opts.jobs);
+  }
+
+  sink_init(sink, &output, fd);
+  if (pubring)
+    ret = paperkey_restore(ctx, pubring, input, opts.input_type, &output);
+  else
+    ret = paperkey_extract(ctx, input, &output);
+  sink_flush(sink);
+  if (sink->failed || (output_path && close(fd) != 0))
+    ret = 1;
+  if (ret != 0)
+    fprintf(stderr, "Unable to %s\n",
+            pubring ? "restore the secret key" : "extract the secret key");
+
+  paperkey_ctx_free(ctx);
+  drop_stream(input);
+  drop_stream(pubring);
+  free(sink);
+  return ret ? 1 : 0;
+}
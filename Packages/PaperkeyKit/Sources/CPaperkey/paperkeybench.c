@@ -0,0 +1,405 @@
+/*
+ * paperkeybench.c - Throughput benchmarks for the paperkey core
+ *
+ * Run from the directory that holds checks/, like paperkeytest.  The
+ * file reading benchmark writes its files there too, as tmpfs has no
+ * cold cache.
+ */
+
+#include "armor.h"
+#include "batch.h"
+#include "bulkio.h"
+#include "config.h"
+#include "context.h"
+#include "extract.h"
+#include "ocr.h"
+#include "output.h"
+#include "pool.h"
+#include "pscan.h"
+#include "qr.h"
+#include "restore.h"
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *types[] = {"rsa", "dsaelg", "ecc", "eddsa"};
+#define NUM_TYPES (int)(sizeof(types) / sizeof(types[0]))
+
+static struct stream *sec[NUM_TYPES];
+static struct stream *pub[NUM_TYPES];
+
+static struct stream *load_stream(const char *path) {
+  FILE *file = fopen(path, "rb");
+  struct stream *s;
+
+  if (!file) {
+    fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  s = create_stream(file);
+  fclose(file);
+  return s;
+}
+
+static void drop_stream(struct stream *s) {
+  if (s) {
+    free(s->buffer);
+    free(s);
+  }
+}
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Jobs per second for one batch of extracts and one batch of restores
+static void bench_batch(struct paperkey_ctx *ctx, unsigned int threads,
+                        size_t count, double *extract_rate,
+                        double *restore_rate) {
+  struct extract_job *ejobs = calloc(count, sizeof(*ejobs));
+  struct restore_job *rjobs = calloc(count, sizeof(*rjobs));
+  struct paperkey_batch batch = {threads, 0};
+  double start;
+
+  for (size_t j = 0; j < count; j++)
+    ejobs[j].input = sec[j % NUM_TYPES];
+
+  start = now();
+  if (extract_many(ctx, &batch, ejobs, count) != 0)
+    exit(1);
+  *extract_rate = count / (now() - start);
+
+  for (size_t j = 0; j < count; j++) {
+    if (ejobs[j].status != 0)
+      exit(1);
+    rjobs[j].pubring = pub[j % NUM_TYPES];
+    rjobs[j].secrets = ejobs[j].output;
+    rjobs[j].input_type = AUTO;
+  }
+
+  start = now();
+  if (restore_many(ctx, &batch, rjobs, count) != 0)
+    exit(1);
+  *restore_rate = count / (now() - start);
+
+  for (size_t j = 0; j < count; j++) {
+    if (rjobs[j].status != 0)
+      exit(1);
+    drop_stream(ejobs[j].output);
+    drop_stream(rjobs[j].output);
+  }
+  free(ejobs);
+  free(rjobs);
+}
+
+// A base16 line of len bytes as extract prints it, with the data
+// digits drawn from the most confusable ones
+static void make_line(char *line, unsigned int len, unsigned int seed) {
+  static const unsigned char confusable[] = {0x00, 0x08, 0x80, 0x88, 0x0B,
+                                             0xB0, 0x18, 0x81, 0xE5, 0x5E};
+  unsigned char data[MAX_LINE_ITEMS];
+  unsigned long crc = CRC24_INIT;
+  int n = sprintf(line, "%3u: ", 1);
+
+  for (unsigned int i = 0; i < len; i++) {
+    data[i] = confusable[(seed + i * 7) % sizeof(confusable)];
+    n += sprintf(&line[n], "%02X ", data[i]);
+  }
+  do_crc24(&crc, data, len);
+  sprintf(&line[n], "%06lX\n", crc & 0xFFFFFFL);
+}
+
+// Repairs per second of a line with one misread at the default width,
+// and of the worst case: the longest line, every character confusable
+// and a CRC that no candidate matches, so every pair gets searched
+static void bench_ocr(struct paperkey_ctx *ctx, size_t count) {
+  unsigned char fixed[MAX_LINE_ITEMS];
+  char line[1024];
+  double start, typical, worst;
+
+  make_line(line, 22, 0);
+  line[5] = line[5] == '0' ? 'O' : 'B';
+  start = now();
+  for (size_t i = 0; i < count; i++)
+    if (ocr_repair_base16(ctx, line, fixed) != 22)
+      exit(1);
+  typical = count / (now() - start);
+
+  make_line(line, MAX_LINE_ITEMS, 3);
+  memcpy(strrchr(line, ' ') + 1, "123456", 6);
+  start = now();
+  for (size_t i = 0; i < count / 100; i++)
+    if (ocr_repair_base16(ctx, line, fixed) != -1)
+      exit(1);
+  worst = count / 100 / (now() - start);
+
+  printf("\nOCR repair, lines/s\n");
+  printf("%8s %14s\n", "one fix", "worst case");
+  printf("%8.0f %14.0f\n", typical, worst);
+}
+
+// Symbols per second for the RAW extract of each test key, as one
+// symbol at the default level and split across version 10 symbols
+static void bench_qr(size_t count) {
+  static struct qr_symbol symbols[QR_MAX_SYMBOLS];
+  const unsigned int versions[] = {0, 10};
+
+  printf("\nQR encode, symbols/s\n");
+  printf("%8s %8s %8s %14s\n", "key", "bytes", "symbols", "symbols/s");
+
+  for (int i = 0; i < NUM_TYPES; i++) {
+    struct stream *raw = create_empty_stream();
+
+    sec[i]->pos = 0;
+    if (extract(sec[i], raw, RAW, 0) != 0)
+      exit(1);
+
+    for (int v = 0; v < 2; v++) {
+      struct qr_options options = {QR_ECC_M, versions[v], 1, -1};
+      size_t n = 0, total = 0;
+      double start = now();
+
+      for (size_t j = 0; j < count; j++) {
+        if (qr_encode(raw->buffer, raw->size, &options, symbols,
+                      QR_MAX_SYMBOLS, &n) != 0)
+          exit(1);
+        total += n;
+      }
+      printf("%8s %8d %5zu v%-2u %14.0f\n", types[i], raw->size, n,
+             symbols[0].version, total / (now() - start));
+    }
+    drop_stream(raw);
+  }
+}
+
+// Keys per second fingerprinted in a pubring of copies of the test
+// keys, for each thread count
+static void bench_scan(struct paperkey_ctx *ctx, unsigned int max_threads,
+                       size_t copies) {
+  struct stream *pubring = create_empty_stream();
+  double base = 0;
+
+  for (size_t copy = 0; copy < copies; copy++)
+    for (int i = 0; i < NUM_TYPES; i++)
+      stream_write(pub[i]->buffer, 1, pub[i]->size, pubring);
+
+  printf("\nPubring scan, %d bytes\n", pubring->size);
+  printf("%8s %14s %9s\n", "threads", "keys/s", "x");
+
+  for (unsigned int threads = 1;; threads *= 2) {
+    struct pscan_key *keys;
+    size_t count;
+    double start, rate;
+
+    if (threads > max_threads)
+      threads = max_threads;
+
+    start = now();
+    if (pscan_keys(ctx, pubring->buffer, pubring->size, threads, &keys,
+                   &count) != 0)
+      exit(1);
+    rate = count / (now() - start);
+    pscan_keys_free(ctx, keys, count);
+
+    if (threads == 1)
+      base = rate;
+    printf("%8u %14.0f %9.2f\n", threads, rate, rate / base);
+
+    if (threads == max_threads)
+      break;
+  }
+
+  drop_stream(pubring);
+}
+
+// Megabytes of binary per second through the armor writer and reader
+static void bench_armor(struct paperkey_ctx *ctx, size_t copies) {
+  struct stream *binary = create_empty_stream();
+  struct stream *text = create_empty_stream(), sink;
+  struct armor_writer armor;
+  struct stream *decoded;
+  double start, encode_rate, decode_rate;
+
+  for (size_t copy = 0; copy < copies; copy++)
+    for (int i = 0; i < NUM_TYPES; i++)
+      stream_write(pub[i]->buffer, 1, pub[i]->size, binary);
+
+  start = now();
+  armor_begin(&armor, text, "PUBLIC KEY BLOCK", &sink);
+  stream_write(binary->buffer, 1, binary->size, &sink);
+  if (armor_end(&armor) != 0)
+    exit(1);
+  encode_rate = binary->size / (now() - start) / 1e6;
+
+  text->pos = 0;
+  start = now();
+  decoded = armor_decode(ctx, text);
+  if (decoded == NULL || decoded->size != binary->size)
+    exit(1);
+  decode_rate = binary->size / (now() - start) / 1e6;
+
+  printf("\nASCII armor, %d bytes\n", binary->size);
+  printf("%14s %14s\n", "encode MB/s", "decode MB/s");
+  printf("%14.1f %14.1f\n", encode_rate, decode_rate);
+
+  armor_free(ctx, decoded);
+  drop_stream(text);
+  drop_stream(binary);
+}
+
+// Drop the files from the page cache, so the next reads go to the disk.
+// Does nothing on tmpfs.
+static void evict(char **paths, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    int fd = open(paths[i], O_RDONLY);
+
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+      close(fd);
+    }
+  }
+}
+
+// Files read per second one at a time through stdio, as the CLI did,
+// and through both bulkio back ends, from a cold and a warm page cache
+static void bench_bulkio(size_t count) {
+  char dir[] = "paperkeybench-io.XXXXXX";
+  char **paths = calloc(count, sizeof(*paths));
+  struct bulkio_op *ops = calloc(count, sizeof(*ops));
+  const char *names[] = {"stdio", "threads", "io_uring"};
+
+  if (paths == NULL || ops == NULL || mkdtemp(dir) == NULL)
+    exit(1);
+  for (size_t i = 0; i < count; i++) {
+    const struct stream *key = sec[i % NUM_TYPES];
+    FILE *file;
+
+    paths[i] = malloc(sizeof(dir) + 16);
+    sprintf(paths[i], "%s/%zu.sec", dir, i);
+    file = fopen(paths[i], "wb");
+    if (file == NULL || fwrite(key->buffer, 1, key->size, file) !=
+                            (size_t)key->size)
+      exit(1);
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+  }
+
+  printf("\nReading %zu small files, files/s\n", count);
+  printf("%10s %14s %14s\n", "back end", "cold cache", "warm cache");
+  for (int b = 0; b < 3; b++) {
+    struct bulkio *io = b ? bulkio_new(0, b == 1) : NULL;
+    double rate[2];
+
+    if (b && io == NULL)
+      exit(1);
+    if (b == 2 && strcmp(bulkio_backend(io), "io_uring") != 0) {
+      printf("%10s %14s %14s\n", names[b], "-", "-");
+      bulkio_free(io);
+      continue;
+    }
+
+    for (int warm = 0; warm < 2; warm++) {
+      double start;
+
+      if (!warm)
+        evict(paths, count);
+      start = now();
+      if (io == NULL) {
+        for (size_t i = 0; i < count; i++) {
+          FILE *file = fopen(paths[i], "rb");
+
+          if (file == NULL)
+            exit(1);
+          drop_stream(create_stream(file));
+          fclose(file);
+        }
+      } else {
+        for (size_t i = 0; i < count; i++) {
+          ops[i].type = BULKIO_READ;
+          ops[i].path = paths[i];
+        }
+        bulkio_submit(io, ops, count);
+        bulkio_wait(io, ops, count);
+        for (size_t i = 0; i < count; i++) {
+          if (ops[i].error)
+            exit(1);
+          free(ops[i].buf);
+        }
+      }
+      rate[warm] = count / (now() - start);
+    }
+    printf("%10s %14.0f %14.0f\n", names[b], rate[0], rate[1]);
+    bulkio_free(io);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    unlink(paths[i]);
+    free(paths[i]);
+  }
+  rmdir(dir);
+  free(paths);
+  free(ops);
+}
+
+int main(int argc, char *argv[]) {
+  size_t count = argc > 1 ? strtoul(argv[1], NULL, 10) : 20000;
+  unsigned int max_threads = pool_default_workers();
+  struct paperkey_ctx *ctx = paperkey_ctx_new();
+  double base_extract = 0, base_restore = 0;
+
+  for (int i = 0; i < NUM_TYPES; i++) {
+    char path[256];
+
+    sprintf(path, "checks/papertest-%s.sec", types[i]);
+    sec[i] = load_stream(path);
+    sprintf(path, "checks/papertest-%s.pub", types[i]);
+    pub[i] = load_stream(path);
+  }
+
+  paperkey_ctx_set_output_type(ctx, BASE16);
+
+  printf("Batch throughput, %zu jobs per run\n", count);
+  printf("%8s %14s %14s %9s %9s\n", "threads", "extract/s", "restore/s",
+         "x extract", "x restore");
+
+  for (unsigned int threads = 1;; threads *= 2) {
+    double e, r;
+
+    if (threads > max_threads)
+      threads = max_threads;
+
+    bench_batch(ctx, threads, count, &e, &r);
+    if (threads == 1) {
+      base_extract = e;
+      base_restore = r;
+    }
+    printf("%8u %14.0f %14.0f %9.2f %9.2f\n", threads, e, r, e / base_extract,
+           r / base_restore);
+
+    if (threads == max_threads)
+      break;
+  }
+
+  bench_ocr(ctx, count * 10);
+  bench_qr(count / 20);
+  bench_scan(ctx, max_threads, count);
+  bench_armor(ctx, count);
+  bench_bulkio(count);
+
+  paperkey_ctx_free(ctx);
+  for (int i = 0; i < NUM_TYPES; i++) {
+    drop_stream(sec[i]);
+    drop_stream(pub[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,295 @@
+/*
+ * paperkeyd.c - Serve extracts and restores from hot pubrings over a
+ * Unix domain socket
+ */
+
+#include "context.h"
+#include "metrics.h"
+#include "pool.h"
+#include "service.h"
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Connections accepted but not yet picked up by a worker. */
+#define QUEUE_SIZE 256
+
+struct server {
+  struct paperkey_service *service;
+  struct paperkey_metrics *metrics;
+  /* What each worker may hold through its context, or 0. */
+  size_t worker_memory;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int queue[QUEUE_SIZE];
+  unsigned int head, count;
+  /* The connection each worker is serving, or -1, so shutdown can cut
+     idle connections short. */
+  int *active;
+  int stopping;
+};
+
+struct worker {
+  struct server *server;
+  unsigned int id;
+};
+
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  (void)sig;
+  stop = 1;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: paperkeyd [-j WORKERS] [-m METRICS] [-M MEMORY] SOCKET "
+          "PUBRING...\n"
+          "\n"
+          "Restore requests name a pubring by its position, from 0.  With\n"
+          "-m, latency histograms are written to the file METRICS in the\n"
+          "Prometheus text format every second.  With -M, a worker fails\n"
+          "requests that would have it hold more than MEMORY bytes, and\n"
+          "packets or certificates larger than a request can be are\n"
+          "refused as they are read.\n");
+  exit(2);
+}
+
+static void *work(void *arg) {
+  struct worker *w = arg;
+  struct server *s = w->server;
+  struct paperkey_ctx *ctx = paperkey_ctx_new();
+
+  if (ctx && s->metrics)
+    paperkey_ctx_set_metrics(ctx, s->metrics);
+  if (ctx && s->worker_memory) {
+    paperkey_ctx_set_limit(ctx, PAPERKEY_LIMIT_MEMORY, s->worker_memory);
+    paperkey_ctx_set_limit(ctx, PAPERKEY_LIMIT_PACKET, SERVICE_MAX_FRAME);
+    paperkey_ctx_set_limit(ctx, PAPERKEY_LIMIT_CERT_PACKETS,
+                           SERVICE_MAX_FRAME / 2);
+  }
+
+  for (;;) {
+    int fd;
+
+    pthread_mutex_lock(&s->lock);
+    while (s->count == 0 && !s->stopping)
+      pthread_cond_wait(&s->ready, &s->lock);
+    if (s->count == 0) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    fd = s->queue[s->head];
+    s->head = (s->head + 1) % QUEUE_SIZE;
+    s->count--;
+    s->active[w->id] = fd;
+    pthread_mutex_unlock(&s->lock);
+
+    if (ctx)
+      paperkey_service_serve(s->service, ctx, fd);
+
+    pthread_mutex_lock(&s->lock);
+    s->active[w->id] = -1;
+    pthread_mutex_unlock(&s->lock);
+    close(fd);
+  }
+
+  paperkey_ctx_free(ctx);
+  return NULL;
+}
+
+static int listen_on(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  mode_t mask;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  /* A socket left by an earlier run is replaced, anything else is
+     not. */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  /* Secrets go through the socket, so only its owner may connect. */
+  mask = umask(077);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    umask(mask);
+    close(fd);
+    return -1;
+  }
+  umask(mask);
+  return fd;
+}
+
+int main(int argc, char *argv[]) {
+  struct paperkey_ctx *ctx;
+  struct server server;
+  struct worker *workers;
+  pthread_t *threads;
+  struct sigaction sa;
+  unsigned int nworkers = 0, i;
+  const char *metrics_path = NULL;
+  size_t worker_memory = 0;
+  time_t checked;
+  int opt, listener;
+
+  while ((opt = getopt(argc, argv, "j:m:M:")) != -1) {
+    switch (opt) {
+    case 'j':
+      nworkers = atoi(optarg);
+      break;
+    case 'm':
+      metrics_path = optarg;
+      break;
+    case 'M':
+      worker_memory = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind < 2)
+    usage();
+  if (nworkers == 0)
+    nworkers = pool_default_workers();
+
+  ctx = paperkey_ctx_new();
+  paperkey_ctx_set_scan_threads(ctx, pool_default_workers());
+  memset(&server, 0, sizeof(server));
+  server.worker_memory = worker_memory;
+  server.service = paperkey_service_new(
+      ctx, (const char *const *)&argv[optind + 1], argc - optind - 1);
+  if (server.service == NULL) {
+    fprintf(stderr, "Unable to load the pubrings\n");
+    return 1;
+  }
+  if (metrics_path) {
+    server.metrics = paperkey_metrics_new();
+    if (server.metrics == NULL)
+      return 1;
+  }
+
+  listener = listen_on(argv[optind]);
+  if (listener < 0) {
+    fprintf(stderr, "Unable to listen on %s: %s\n", argv[optind],
+            strerror(errno));
+    return 1;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.ready, NULL);
+  server.active = malloc(nworkers * sizeof(*server.active));
+  workers = malloc(nworkers * sizeof(*workers));
+  threads = malloc(nworkers * sizeof(*threads));
+  if (server.active == NULL || workers == NULL || threads == NULL)
+    return 1;
+  for (i = 0; i < nworkers; i++) {
+    server.active[i] = -1;
+    workers[i].server = &server;
+    workers[i].id = i;
+    pthread_create(&threads[i], NULL, work, &workers[i]);
+  }
+
+  fprintf(stderr, "paperkeyd: serving %d pubrings on %s with %u workers\n",
+          argc - optind - 1, argv[optind], nworkers);
+
+  /* Accept until told to stop, and look for changed pubrings and write
+     the metrics every second or so. */
+  checked = time(NULL);
+  while (!stop) {
+    struct pollfd pfd;
+
+    pfd.fd = listener;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 1000) > 0) {
+      int fd = accept(listener, NULL, NULL);
+
+      if (fd >= 0) {
+        pthread_mutex_lock(&server.lock);
+        if (server.count < QUEUE_SIZE) {
+          server.queue[(server.head + server.count) % QUEUE_SIZE] = fd;
+          server.count++;
+          fd = -1;
+          pthread_cond_signal(&server.ready);
+        }
+        pthread_mutex_unlock(&server.lock);
+        /* Turned away when every worker is behind. */
+        if (fd >= 0)
+          close(fd);
+      }
+    }
+
+    if (time(NULL) != checked) {
+      int reloaded = paperkey_service_reload(server.service);
+
+      checked = time(NULL);
+      if (reloaded > 0)
+        fprintf(stderr, "paperkeyd: reloaded %d pubrings\n", reloaded);
+      else if (reloaded < 0)
+        fprintf(stderr, "paperkeyd: unable to reload, still serving the "
+                        "old pubrings\n");
+      if (server.metrics &&
+          paperkey_metrics_write_file(server.metrics, metrics_path) != 0)
+        fprintf(stderr, "paperkeyd: unable to write %s\n", metrics_path);
+    }
+  }
+
+  close(listener);
+  unlink(argv[optind]);
+
+  pthread_mutex_lock(&server.lock);
+  server.stopping = 1;
+  while (server.count) {
+    close(server.queue[server.head]);
+    server.head = (server.head + 1) % QUEUE_SIZE;
+    server.count--;
+  }
+  for (i = 0; i < nworkers; i++)
+    if (server.active[i] >= 0)
+      shutdown(server.active[i], SHUT_RD);
+  pthread_cond_broadcast(&server.ready);
+  pthread_mutex_unlock(&server.lock);
+
+  for (i = 0; i < nworkers; i++)
+    pthread_join(threads[i], NULL);
+
+  if (server.metrics) {
+    paperkey_metrics_write_file(server.metrics, metrics_path);
+    paperkey_metrics_free(server.metrics);
+  }
+  paperkey_service_free(server.service);
+  paperkey_ctx_free(ctx);
+  pthread_cond_destroy(&server.ready);
+  pthread_mutex_destroy(&server.lock);
+  free(server.active);
+  free(workers);
+  free(threads);
+  return 0;
+}
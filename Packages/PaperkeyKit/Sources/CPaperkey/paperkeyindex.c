@@ -0,0 +1,116 @@
+/*
+ * paperkeyindex.c - Build and query the fingerprint index of a pubring
+ */
+
+#include "context.h"
+#include "fpindex.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: paperkeyindex build PUBRING [INDEX]\n"
+          "       paperkeyindex check PUBRING [INDEX]\n"
+          "       paperkeyindex lookup PUBRING FINGERPRINT [INDEX]\n"
+          "\n"
+          "INDEX defaults to PUBRING" PAPERKEY_INDEX_SUFFIX ".\n");
+  exit(2);
+}
+
+static int parse_fingerprint(const char *text, unsigned char fpr[20]) {
+  int n = 0;
+
+  for (; *text && n < 40; text++) {
+    int digit;
+
+    if (*text == ' ' || *text == ':')
+      continue;
+    if (*text >= '0' && *text <= '9')
+      digit = *text - '0';
+    else if (*text >= 'a' && *text <= 'f')
+      digit = *text - 'a' + 10;
+    else if (*text >= 'A' && *text <= 'F')
+      digit = *text - 'A' + 10;
+    else
+      return -1;
+
+    if (n % 2 == 0)
+      fpr[n / 2] = digit << 4;
+    else
+      fpr[n / 2] |= digit;
+    n++;
+  }
+
+  return n == 40 && *text == '\0' ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+  struct paperkey_ctx *ctx;
+  struct paperkey_index *index;
+  const char *command, *pubring, *index_path;
+  char default_path[4096];
+  int ret = 0, args;
+
+  if (argc < 3)
+    usage();
+  command = argv[1];
+  pubring = argv[2];
+  args = strcmp(command, "lookup") == 0 ? 4 : 3;
+  if (argc < args || argc > args + 1)
+    usage();
+
+  if (argc == args + 1) {
+    index_path = argv[args];
+  } else {
+    snprintf(default_path, sizeof(default_path), "%s%s", pubring,
+             PAPERKEY_INDEX_SUFFIX);
+    index_path = default_path;
+  }
+
+  ctx = paperkey_ctx_new();
+
+  if (strcmp(command, "build") == 0) {
+    if (paperkey_index_build(ctx, pubring, index_path) != 0) {
+      fprintf(stderr, "Unable to index %s\n", pubring);
+      ret = 1;
+    }
+  } else if (strcmp(command, "check") == 0) {
+    index = paperkey_index_open(ctx, index_path, pubring, 1);
+    if (index) {
+      printf("%s: %" PRIu64 " keys, up to date\n", index_path,
+             paperkey_index_count(index));
+      paperkey_index_close(ctx, index);
+    } else {
+      printf("%s: missing or stale\n", index_path);
+      ret = 1;
+    }
+  } else if (strcmp(command, "lookup") == 0) {
+    unsigned char fpr[20];
+    uint64_t offset;
+    uint32_t length;
+
+    if (parse_fingerprint(argv[3], fpr) != 0)
+      usage();
+
+    index = paperkey_index_open(ctx, index_path, pubring, 0);
+    if (index == NULL) {
+      fprintf(stderr, "%s: missing or stale\n", index_path);
+      ret = 1;
+    } else {
+      if (paperkey_index_lookup(index, fpr, &offset, &length) == 0) {
+        printf("%" PRIu64 " %" PRIu32 "\n", offset, length);
+      } else {
+        fprintf(stderr, "Key not found\n");
+        ret = 1;
+      }
+      paperkey_index_close(ctx, index);
+    }
+  } else {
+    usage();
+  }
+
+  paperkey_ctx_free(ctx);
+  return ret;
+}
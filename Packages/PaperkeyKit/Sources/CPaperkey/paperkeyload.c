@@ -0,0 +1,210 @@
+/*
+ * paperkeyload.c - Load generator for paperkeyd
+ */
+
+#include "service.h"
+#include "stream.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUT_SIZE (1 << 20)
+
+struct client {
+  const char *path;
+  enum service_op op;
+  unsigned int pubring;
+  const struct stream *input;
+  unsigned long requests;
+  /* Nanoseconds per request, in the order sent. */
+  unsigned long long *latency;
+  unsigned long failed;
+};
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: paperkeyload [-c CONNECTIONS] [-n REQUESTS] [-p PUBRING] "
+          "SOCKET SECRETS\n"
+          "       paperkeyload -e [-c CONNECTIONS] [-n REQUESTS] SOCKET "
+          "SECRET_KEY\n"
+          "\n"
+          "Sends restores of SECRETS against pubring PUBRING (default 0),\n"
+          "or with -e extracts of SECRET_KEY, REQUESTS in all (default\n"
+          "10000) spread over CONNECTIONS (default 4), one at a time on\n"
+          "each, and reports the throughput and latency.\n");
+  exit(2);
+}
+
+static unsigned long long now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int connect_to(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void *run(void *arg) {
+  struct client *c = arg;
+  unsigned char *out = malloc(OUT_SIZE);
+  unsigned long i;
+  int fd;
+
+  fd = connect_to(c->path);
+  if (fd < 0 || out == NULL) {
+    c->failed = c->requests;
+    c->requests = 0;
+    free(out);
+    return NULL;
+  }
+
+  for (i = 0; i < c->requests; i++) {
+    enum service_status status;
+    unsigned long long start = now();
+    ssize_t got;
+
+    got = paperkey_service_call(
+        fd, c->op, c->op == SERVICE_EXTRACT ? BASE16 : AUTO, c->pubring,
+        c->input->buffer, c->input->size, out, OUT_SIZE, &status);
+    c->latency[i] = now() - start;
+    if (got < 0) {
+      /* The connection is gone with the rest of the requests. */
+      c->failed += c->requests - i;
+      c->requests = i;
+      break;
+    }
+    if (status != SERVICE_OK)
+      c->failed++;
+  }
+
+  close(fd);
+  free(out);
+  return NULL;
+}
+
+static int compare(const void *a, const void *b) {
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double micros(const unsigned long long *sorted, unsigned long n,
+                     double q) {
+  return sorted[(unsigned long)(q * (n - 1))] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned long total = 10000, done = 0, failed = 0, i;
+  unsigned int connections = 4, pubring = 0;
+  enum service_op op = SERVICE_RESTORE;
+  unsigned long long start, elapsed, *all;
+  struct client *clients;
+  pthread_t *threads;
+  struct stream *input;
+  FILE *file;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:en:p:")) != -1) {
+    switch (opt) {
+    case 'c':
+      connections = atoi(optarg);
+      break;
+    case 'e':
+      op = SERVICE_EXTRACT;
+      break;
+    case 'n':
+      total = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      pubring = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (argc - optind != 2 || connections == 0 || total < connections)
+    usage();
+
+  file = fopen(argv[optind + 1], "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Unable to open %s: %s\n", argv[optind + 1],
+            strerror(errno));
+    return 1;
+  }
+  input = create_stream(file);
+  fclose(file);
+
+  clients = calloc(connections, sizeof(*clients));
+  threads = calloc(connections, sizeof(*threads));
+  all = malloc(total * sizeof(*all));
+  if (clients == NULL || threads == NULL || all == NULL)
+    return 1;
+
+  for (i = 0; i < connections; i++) {
+    clients[i].path = argv[optind];
+    clients[i].op = op;
+    clients[i].pubring = pubring;
+    clients[i].input = input;
+    clients[i].requests = total / connections + (i < total % connections);
+    clients[i].latency = &all[done];
+    done += clients[i].requests;
+  }
+
+  start = now();
+  for (i = 0; i < connections; i++)
+    pthread_create(&threads[i], NULL, run, &clients[i]);
+  for (i = 0; i < connections; i++)
+    pthread_join(threads[i], NULL);
+  elapsed = now() - start;
+
+  /* Close up the latencies of connections that ended early. */
+  done = 0;
+  for (i = 0; i < connections; i++) {
+    memmove(&all[done], clients[i].latency,
+            clients[i].requests * sizeof(*all));
+    done += clients[i].requests;
+    failed += clients[i].failed;
+  }
+
+  printf("%lu requests, %lu failed, over %u connections in %.3f s\n", done,
+         failed, connections, elapsed / 1e9);
+  if (done) {
+    qsort(all, done, sizeof(*all), compare);
+    printf("%.0f requests/s\n", done / (elapsed / 1e9));
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+           micros(all, done, 0.50), micros(all, done, 0.90),
+           micros(all, done, 0.99), all[done - 1] / 1000.0);
+  }
+
+  free(input->buffer);
+  free(input);
+  free(clients);
+  free(threads);
+  free(all);
+  return failed ? 1 : 0;
+}
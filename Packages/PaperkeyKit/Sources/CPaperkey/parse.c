@@ -22,132 +22,157 @@
 
 #include "parse.h"
 #include "config.h"
+#include "encode.h"
+#include "fec.h"
+#include "internal.h"
+#include "metrics.h"
+#include "ocr.h"
 #include "output.h"
 #include "packets.h"
+#include "pdecode.h"
 #include "sha1.h"
+#include "sha256.h"
 #include "stream.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct packet *parse(struct stream *input, unsigned char want,
-                     unsigned char stop) {
-  int byte;
-  struct packet *packet = NULL;
+int parse_packet_header(struct stream *input, unsigned char *type,
+                        unsigned int *length) {
+  int byte, tmp;
 
-  while ((byte = stream_getc(input)) != EOF) {
-    unsigned char type;
-    unsigned int length;
+  byte = stream_getc(input);
+  if (byte == EOF)
+    return 1;
 
-    if (byte & 0x80) {
-      int tmp;
+  if (!(byte & 0x80)) {
+    // fprintf(stderr, "Error: unable to parse OpenPGP packets"
+    //                 " (is this armored data?)\n");
+    return -1;
+  }
 
-      type = byte & 0x3F;
+  *type = byte & 0x3F;
 
-      /* Old-style packet type */
-      if (!(byte & 0x40))
-        type >>= 2;
+  /* Old-style packet type */
+  if (!(byte & 0x40))
+    *type >>= 2;
 
-      if (type == stop) {
-        stream_revert(input);
-        break;
-      }
+  if (byte & 0x40) {
+    /* New-style packets */
+    byte = stream_getc(input);
+    if (byte == EOF)
+      return -1;
 
-      if (byte & 0x40) {
-        /* New-style packets */
-        byte = stream_getc(input);
-        if (byte == EOF)
-          goto fail;
-
-        if (byte == 255) {
-          /* 4-byte length */
-          if (stream_leftbyte(input) < 4)
-            goto fail;
-          tmp = stream_getc(input);
-          length = tmp << 24;
-          tmp = stream_getc(input);
-          length |= tmp << 16;
-          tmp = stream_getc(input);
-          length |= tmp << 8;
-          tmp = stream_getc(input);
-          length |= tmp;
-        } else if (byte >= 224) {
-          /* Partial body length, so fail (keys can't use
-             partial body) */
-          // fprintf(stderr, "Invalid partial packet encoding\n");
-          goto fail;
-        } else if (byte >= 192) {
-          /* 2-byte length */
-          tmp = stream_getc(input);
-          if (tmp == EOF)
-            goto fail;
-          length = ((byte - 192) << 8) + tmp + 192;
-        } else
-          length = byte;
-      } else {
-        /* Old-style packets */
-        switch (byte & 0x03) {
-        case 0:
-          /* 1-byte length */
-          byte = stream_getc(input);
-          if (byte == EOF)
-            goto fail;
-          length = byte;
-          break;
-
-        case 1:
-          /* 2-byte length */
-          if (stream_leftbyte(input) < 2)
-            goto fail;
-          byte = stream_getc(input);
-          tmp = stream_getc(input);
-          length = byte << 8;
-          length |= tmp;
-          break;
-
-        case 2:
-          /* 4-byte length */
-          if (stream_leftbyte(input) < 4)
-            goto fail;
-          tmp = stream_getc(input);
-          length = tmp << 24;
-          tmp = stream_getc(input);
-          length |= tmp << 16;
-          tmp = stream_getc(input);
-          length |= tmp << 8;
-          tmp = stream_getc(input);
-          length |= tmp;
-          break;
-
-        default:
-          // fprintf(stderr, "Error: unable to parse old-style length\n");
-          goto fail;
-        }
-      }
+    if (byte == 255) {
+      /* 4-byte length */
+      if (stream_leftbyte(input) < 4)
+        return -1;
+      tmp = stream_getc(input);
+      *length = tmp << 24;
+      tmp = stream_getc(input);
+      *length |= tmp << 16;
+      tmp = stream_getc(input);
+      *length |= tmp << 8;
+      tmp = stream_getc(input);
+      *length |= tmp;
+    } else if (byte >= 224) {
+      /* Partial body length, so fail (keys can't use
+         partial body) */
+      // fprintf(stderr, "Invalid partial packet encoding\n");
+      return -1;
+    } else if (byte >= 192) {
+      /* 2-byte length */
+      tmp = stream_getc(input);
+      if (tmp == EOF)
+        return -1;
+      *length = ((byte - 192) << 8) + tmp + 192;
+    } else
+      *length = byte;
+  } else {
+    /* Old-style packets */
+    switch (byte & 0x03) {
+    case 0:
+      /* 1-byte length */
+      byte = stream_getc(input);
+      if (byte == EOF)
+        return -1;
+      *length = byte;
+      break;
 
-      // if (verbose > 1)
-      //   fprintf(stderr, "Found packet of type %d, length %d\n", type,
-      //   length);
-    } else {
-      // fprintf(stderr, "Error: unable to parse OpenPGP packets"
-      //                 " (is this armored data?)\n");
+    case 1:
+      /* 2-byte length */
+      if (stream_leftbyte(input) < 2)
+        return -1;
+      byte = stream_getc(input);
+      tmp = stream_getc(input);
+      *length = byte << 8;
+      *length |= tmp;
+      break;
+
+    case 2:
+      /* 4-byte length */
+      if (stream_leftbyte(input) < 4)
+        return -1;
+      tmp = stream_getc(input);
+      *length = tmp << 24;
+      tmp = stream_getc(input);
+      *length |= tmp << 16;
+      tmp = stream_getc(input);
+      *length |= tmp << 8;
+      tmp = stream_getc(input);
+      *length |= tmp;
+      break;
+
+    default:
+      // fprintf(stderr, "Error: unable to parse old-style length\n");
+      return -1;
+    }
+  }
+
+  // if (verbose > 1)
+  //   fprintf(stderr, "Found packet of type %d, length %d\n", *type,
+  //   *length);
+
+  return 0;
+}
+
+struct packet *parse(struct paperkey_ctx *ctx, struct stream *input,
+                     unsigned char want, unsigned char stop) {
+  uint64_t timer = metrics_start(ctx);
+  struct packet *packet = NULL;
+
+  for (;;) {
+    int start = input->pos;
+    unsigned char type;
+    unsigned int length;
+
+    if (parse_packet_header(input, &type, &length) != 0)
       goto fail;
+
+    if (type == stop) {
+      input->pos = start;
+      break;
     }
 
+    if (ctx_admit_packet(ctx, &ctx->cert_packets, type, length) != 0)
+      goto fail;
+
     if (want == 0 || type == want) {
-      packet = malloc(sizeof(*packet));
+      /* A header can claim up to 4GB, so nothing is allocated until
+         the input is seen to hold that much. */
+      if (length > (unsigned int)stream_leftbyte(input))
+        goto fail;
+      packet = ctx_malloc(ctx, sizeof(*packet));
       if (packet == NULL)
         goto fail;
       packet->type = type;
-      packet->buf = malloc(length);
+      packet->buf = ctx_malloc(ctx, length);
       if (packet->buf == NULL) {
-        free(packet);
+        ctx_free(ctx, packet, sizeof(*packet));
         goto fail;
       }
       packet->len = length;
       packet->size = length;
-      if (stream_leftbyte(input) < (int)packet->len)
-        goto fail;
       stream_read(packet->buf, 1, packet->len, input);
       // if (fread(packet->buf, 1, packet->len, input) < packet->len) {
       //   fprintf(stderr, "Short read on packet type %d\n", type);
@@ -155,28 +180,77 @@ struct packet *parse(struct stream *input, unsigned char want,
       // }
       break;
     } else {
-      /* We don't want it, so skip the packet.  We don't use fseek
-         here since the input might be on stdin and that isn't
-         seekable. */
-
-      size_t i;
-
-      for (i = 0; i < length; i++)
-        stream_getc(input);
+      /* We don't want it, so skip the packet.  The whole input is in
+         memory, so that is just a move of the position. */
+      if (length > (unsigned int)stream_leftbyte(input))
+        length = stream_leftbyte(input);
+      input->pos += length;
     }
   }
 
+  metrics_record(ctx, PAPERKEY_METRIC_PARSE, timer);
   return packet;
 
 fail:
+  metrics_record(ctx, PAPERKEY_METRIC_PARSE, timer);
   return NULL;
 }
 
+int parse_view(struct paperkey_ctx *ctx, struct stream *input,
+               unsigned char want, unsigned char stop, struct packet *packet) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = -1;
+
+  for (;;) {
+    int start = input->pos;
+    unsigned char type;
+    unsigned int length;
+
+    if (parse_packet_header(input, &type, &length) != 0)
+      break;
+
+    if (type == stop) {
+      input->pos = start;
+      break;
+    }
+
+    if (ctx_admit_packet(ctx, &ctx->cert_packets, type, length) != 0)
+      break;
+
+    if (want == 0 || type == want) {
+      if (length > (unsigned int)stream_leftbyte(input))
+        break;
+      packet->type = type;
+      packet->buf = &input->buffer[input->pos];
+      packet->len = packet->size = length;
+      input->pos += length;
+      ret = 0;
+      break;
+    }
+
+    if (length > (unsigned int)stream_leftbyte(input))
+      length = stream_leftbyte(input);
+    input->pos += length;
+  }
+
+  metrics_record(ctx, PAPERKEY_METRIC_PARSE, timer);
+  return ret;
+}
+
+size_t fingerprint_length(unsigned char version) {
+  switch (version) {
+  case 4:
+    return 20;
+  case 6:
+    return 32;
+  default:
+    return 0;
+  }
+}
+
 int calculate_fingerprint(struct packet *packet, size_t public_len,
-                          unsigned char fingerprint[20]) {
-  if (packet->buf[0] == 3) {
-    return -1;
-  } else if (packet->buf[0] == 4) {
+                          unsigned char *fingerprint) {
+  if (packet->buf[0] == 4) {
     struct sha1_ctx sha;
     unsigned char head[3];
 
@@ -189,11 +263,39 @@ int calculate_fingerprint(struct packet *packet, size_t public_len,
     sha1_process_bytes(head, 3, &sha);
     sha1_process_bytes(packet->buf, public_len, &sha);
     sha1_finish_ctx(&sha, fingerprint);
+  } else if (packet->buf[0] == 6) {
+    /* RFC 9580 5.5.4.3: SHA-256 over 0x9B, a four-octet length and the
+       packet body. */
+    struct sha256_ctx sha;
+    unsigned char head[5];
+
+    sha256_init_ctx(&sha);
+
+    head[0] = 0x9B;
+    head[1] = public_len >> 24;
+    head[2] = public_len >> 16;
+    head[3] = public_len >> 8;
+    head[4] = public_len & 0xFF;
+
+    sha256_process_bytes(head, 5, &sha);
+    sha256_process_bytes(packet->buf, public_len, &sha);
+    sha256_finish_ctx(&sha, fingerprint);
+  } else {
+    return -1;
   }
 
   return 0;
 }
 
+int key_fingerprint(struct paperkey_ctx *ctx, struct packet *packet,
+                    size_t public_len, unsigned char *fingerprint) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = calculate_fingerprint(packet, public_len, fingerprint);
+
+  metrics_record(ctx, PAPERKEY_METRIC_FINGERPRINT, timer);
+  return ret;
+}
+
 #define MPI_LENGTH(_start) (((((_start)[0] << 8 | (_start)[1]) + 7) / 8) + 2)
 
 ssize_t extract_secrets(struct packet *packet) {
@@ -214,6 +316,18 @@ ssize_t extract_secrets(struct packet *packet) {
        bytes of timestamp. */
 
     offset = 5;
+  } else if (packet->buf[0] == 6) {
+    /* Version, timestamp and algorithm, then a 4 byte count of the
+       public key material that follows, whatever the algorithm. */
+    size_t material;
+
+    if (packet->len < 10)
+      return -1;
+    material = (size_t)packet->buf[6] << 24 | packet->buf[7] << 16 |
+               packet->buf[8] << 8 | packet->buf[9];
+    if (material >= packet->len - 10)
+      return -1;
+    return 10 + material;
   } else
     return -1;
 
@@ -297,27 +411,132 @@ ssize_t extract_secrets(struct packet *packet) {
   return offset;
 }
 
-struct packet *read_secrets_file(struct stream *secrets,
-                                 enum data_type input_type,
-                                 int ignore_crc_error) {
+/* Read the lines of the denser text encodings: "NNN: <data> CRC".
+   Base45 data may itself contain spaces, so the CRC is taken from the
+   end of the line rather than by splitting on spaces. */
+static struct packet *read_encoded_lines(struct paperkey_ctx *ctx,
+                                         struct stream *secrets,
+                                         enum data_type input_type,
+                                         int *final_crc,
+                                         unsigned long *my_crc) {
+  struct packet *packet = NULL;
+  unsigned int next_linenum = 1;
+  char line[1024];
+
+  while (stream_gets(line, 1024, secrets)) {
+    unsigned char decoded[sizeof(line)];
+    unsigned long line_crc = CRC24_INIT;
+    unsigned long new_crc = 0;
+    size_t len = strcspn(line, "\r\n");
+    ssize_t got;
+    char *data;
+    int i;
+
+    if (line[0] == '#' || len == 0)
+      continue;
+
+    if ((unsigned int)atoi(line) != next_linenum)
+      goto fail;
+    next_linenum++;
+
+    data = strchr(line, ':');
+    if (data == NULL)
+      goto fail;
+    data++;
+    if (*data == ' ')
+      data++;
+
+    len -= data - line;
+    if (len < 6)
+      goto fail;
+
+    for (i = 0; i < 6; i++) {
+      int v = hex_value(data[len - 6 + i]);
+      if (v < 0)
+        goto fail;
+      new_crc = new_crc << 4 | v;
+    }
+
+    if (len == 6) {
+      *final_crc = 1;
+      *my_crc = new_crc;
+      continue;
+    }
+
+    if (len < 8 || data[len - 7] != ' ')
+      goto fail;
+
+    got = decode_data(input_type, decoded, data, len - 7);
+    if (got <= 0)
+      goto fail;
+
+    do_crc24(&line_crc, decoded, got);
+    if ((line_crc & 0xFFFFFFL) != new_crc && !ctx->ignore_crc_error)
+      goto fail;
+
+    packet = append_packet(ctx, packet, decoded, got);
+    if (packet == NULL)
+      return NULL;
+  }
+
+  return packet;
+
+fail:
+  free_packet(ctx, packet);
+  return NULL;
+}
+
+/* Replace the bytes a base16 line added from line_start on with its
+   OCR repair.  Returns 1 if the line was repaired, 0 if it could not
+   be, and -1 if memory ran out, which frees the packet. */
+static int repair_line(struct paperkey_ctx *ctx, struct packet **packet,
+                       size_t line_start, const char *line) {
+  unsigned char fixed[MAX_LINE_ITEMS];
+  ssize_t len = ocr_repair_base16(ctx, line, fixed);
+
+  if (len <= 0)
+    return 0;
+
+  if (*packet)
+    (*packet)->len = line_start;
+  *packet = append_packet(ctx, *packet, fixed, len);
+  return *packet ? 1 : -1;
+}
+
+static struct packet *decode_secrets(struct paperkey_ctx *ctx,
+                                     struct stream *secrets,
+                                     enum data_type input_type) {
+  int ignore_crc_error = ctx->ignore_crc_error;
   struct packet *packet = NULL;
   int final_crc = 0;
   unsigned long my_crc = 0;
 
+  if (input_type != RAW && fec_present(secrets))
+    return fec_read_secrets(ctx, secrets, input_type);
+
+  if ((input_type == BASE16 || input_type == AUTO) && ctx->decode_threads > 1) {
+    packet = pdecode_base16(ctx, secrets, ctx->decode_threads);
+    if (packet)
+      return packet;
+  }
+
   if (input_type == RAW) {
     unsigned char buffer[1024];
     size_t got;
 
-    while ((got = stream_read(buffer, 1, 1024, secrets)))
-      packet = append_packet(packet, buffer, got);
+    while ((got = stream_read(buffer, 1, 1024, secrets))) {
+      packet = append_packet(ctx, packet, buffer, got);
+      if (packet == NULL)
+        return NULL;
+    }
 
     if (got == 0 && !stream_eof(secrets)) {
       // fprintf(stderr, "Error: unable to read secrets file\n");
-      free_packet(packet);
+      free_packet(ctx, packet);
       return NULL;
     }
 
-    if (packet->len >= 3) {
+    if (packet && packet->len >= 3) {
       /* Grab the last 3 bytes to be the CRC24 */
       my_crc = packet->buf[packet->len - 3] << 16;
       my_crc |= packet->buf[packet->len - 2] << 8;
@@ -325,6 +544,10 @@ struct packet *read_secrets_file(struct stream *secrets,
       final_crc = 1;
       packet->len -= 3;
     }
+  } else if (input_type != BASE16 && input_type != AUTO) {
+    packet = read_encoded_lines(ctx, secrets, input_type, &final_crc, &my_crc);
+    if (packet == NULL)
+      return NULL;
   } else {
     char line[1024];
     unsigned int next_linenum = 1;
@@ -332,6 +555,7 @@ struct packet *read_secrets_file(struct stream *secrets,
     while (stream_gets(line, 1024, secrets)) {
       unsigned int linenum, did_digit = 0;
       unsigned long line_crc = CRC24_INIT;
+      size_t line_start = packet ? packet->len : 0;
       char *tok;
 
       if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
@@ -341,7 +565,7 @@ struct packet *read_secrets_file(struct stream *secrets,
       if (linenum != next_linenum) {
         // fprintf(stderr, "Error: missing line number %u (saw %u)\n",
         //         next_linenum, linenum);
-        free_packet(packet);
+        free_packet(ctx, packet);
         return NULL;
       } else
         next_linenum = linenum + 1;
@@ -370,8 +594,14 @@ struct packet *read_secrets_file(struct stream *secrets,
                   //         " match (%06lX!=%06lX)\n",
                   //         linenum, new_crc & 0xFFFFFFL, line_crc &
                   //         0xFFFFFFL);
-                  if (!ignore_crc_error) {
-                    free_packet(packet);
+                  int fixed = ctx->ocr_repair
+                                  ? repair_line(ctx, &packet, line_start, line)
+                                  : 0;
+
+                  if (fixed < 0)
+                    return NULL;
+                  if (!fixed && !ignore_crc_error) {
+                    free_packet(ctx, packet);
                     return NULL;
                   }
                 }
@@ -379,13 +609,25 @@ struct packet *read_secrets_file(struct stream *secrets,
                 final_crc = 1;
                 my_crc = new_crc;
               }
+            } else if (did_digit && ctx->ocr_repair) {
+              /* The CRC itself was misread past recognition. */
+              int fixed = repair_line(ctx, &packet, line_start, line);
+
+              if (fixed < 0)
+                return NULL;
+              if (!fixed && !ignore_crc_error) {
+                free_packet(ctx, packet);
+                return NULL;
+              }
             }
           } else {
             unsigned int digit;
 
             if (sscanf(tok, "%02X", &digit)) {
               unsigned char d = digit;
-              packet = append_packet(packet, &d, 1);
+              packet = append_packet(ctx, packet, &d, 1);
+              if (packet == NULL)
+                return NULL;
               do_crc24(&line_crc, &d, 1);
               did_digit = 1;
             }
@@ -395,7 +637,7 @@ struct packet *read_secrets_file(struct stream *secrets,
         }
       } else {
         // fprintf(stderr, "No colon ':' found in line %u\n", linenum);
-        free_packet(packet);
+        free_packet(ctx, packet);
         return NULL;
       }
     }
@@ -410,17 +652,27 @@ struct packet *read_secrets_file(struct stream *secrets,
       // fprintf(stderr, "CRC of secret does not match (%06lX!=%06lX)\n",
       //         my_crc & 0xFFFFFFL, all_crc & 0xFFFFFFL);
       if (!ignore_crc_error) {
-        free_packet(packet);
+        free_packet(ctx, packet);
         return NULL;
       }
     }
   } else {
     // fprintf(stderr, "CRC of secret is missing\n");
     if (!ignore_crc_error) {
-      free_packet(packet);
+      free_packet(ctx, packet);
       return NULL;
     }
   }
 
   return packet;
 }
+
+struct packet *read_secrets_file(struct paperkey_ctx *ctx,
+                                 struct stream *secrets,
+                                 enum data_type input_type) {
+  uint64_t timer = metrics_start(ctx);
+  struct packet *packet = decode_secrets(ctx, secrets, input_type);
+
+  metrics_record(ctx, PAPERKEY_METRIC_DECODE, timer);
+  return packet;
+}
@@ -26,13 +26,36 @@
 #include "output.h"
 #include "stream.h"
 
-struct packet *parse(struct stream *input, unsigned char want,
-                     unsigned char stop);
+struct paperkey_ctx;
+
+/* Read the header of the next packet, leaving input at its body.
+   Returns 0, 1 at the end of the input, or -1 if it is not an OpenPGP
+   packet or its length cannot be used. */
+int parse_packet_header(struct stream *input, unsigned char *type,
+                        unsigned int *length);
+struct packet *parse(struct paperkey_ctx *ctx, struct stream *input,
+                     unsigned char want, unsigned char stop);
+/* The same without the copy: packet points into the input, which is
+   in memory anyway, and is not freed.  Returns 0, or -1 where parse()
+   returns NULL. */
+int parse_view(struct paperkey_ctx *ctx, struct stream *input,
+               unsigned char want, unsigned char stop, struct packet *packet);
+/* Octets in the fingerprint of a key of this version: 20 for version
+   4 (SHA-1), 32 for version 6 (SHA-256), or 0 for anything else. */
+size_t fingerprint_length(unsigned char version);
+/* Hash the first public_len octets of a key packet into fingerprint,
+   which needs fingerprint_length() of its version octet. */
 int calculate_fingerprint(struct packet *packet, size_t public_len,
-                          unsigned char fingerprint[20]);
+                          unsigned char *fingerprint);
+/* The same, timed into the metrics of ctx. */
+int key_fingerprint(struct paperkey_ctx *ctx, struct packet *packet,
+                    size_t public_len, unsigned char *fingerprint);
+/* The offset of the secret material in a secret key packet.  A version
+   6 key states the length of its public material, so that is skipped
+   without walking the MPIs. */
 ssize_t extract_secrets(struct packet *packet);
-struct packet *read_secrets_file(struct stream *secrets,
-                                 enum data_type input_type,
-                                 int ignore_crc_error);
+struct packet *read_secrets_file(struct paperkey_ctx *ctx,
+                                 struct stream *secrets,
+                                 enum data_type input_type);
 
 #endif /* !_PARSE_H_ */
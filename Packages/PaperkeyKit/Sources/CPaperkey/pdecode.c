@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "pdecode.h"
+#include "encode.h"
+#include "internal.h"
+#include "output.h"
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct text_line {
+  size_t start;
+  size_t len;
+  /* Where its bytes go in the output, from a bound of len / 2. */
+  size_t out;
+};
+
+struct range {
+  size_t first;
+  size_t count;
+  size_t len;
+  unsigned long crc;
+  int failed;
+};
+
+struct pdecode {
+  const unsigned char *text;
+  const struct text_line *lines;
+  size_t nlines;
+  struct range *ranges;
+  unsigned char *buf;
+  unsigned long final_crc;
+};
+
+static void decode_range(void *opaque, size_t index, unsigned int worker) {
+  struct pdecode *pd = opaque;
+  struct range *range = &pd->ranges[index];
+  unsigned long crc = CRC24_INIT;
+  size_t i;
+
+  (void)worker;
+
+  for (i = range->first; i < range->first + range->count; i++) {
+    const struct text_line *tl = &pd->lines[i];
+    unsigned char *dst = &pd->buf[tl->out];
+    unsigned long line_crc = CRC24_INIT, new_crc;
+    char line[1024];
+    ssize_t got;
+
+    memcpy(line, &pd->text[tl->start], tl->len);
+    line[tl->len] = '\0';
+
+    if ((size_t)atoi(line) != i + 1)
+      goto fail;
+
+    got = decode_line(BASE16, line, dst, &new_crc);
+    if (got < 0 || (got == 0) != (i == pd->nlines - 1))
+      goto fail;
+    if (got == 0) {
+      pd->final_crc = new_crc;
+      break;
+    }
+
+    /* Bytes land right after the previous line of the range, so the
+       range comes out contiguous. */
+    if (dst != &pd->buf[pd->lines[range->first].out + range->len])
+      memmove(&pd->buf[pd->lines[range->first].out + range->len], dst, got);
+    do_crc24(&line_crc, &pd->buf[pd->lines[range->first].out + range->len],
+             got);
+    if ((line_crc & 0xFFFFFFL) != new_crc)
+      goto fail;
+
+    crc = crc24_combine(crc, line_crc & 0xFFFFFFL, got);
+    range->len += got;
+  }
+
+  range->crc = crc;
+  return;
+
+fail:
+  range->failed = 1;
+}
+
+struct packet *pdecode_base16(struct paperkey_ctx *ctx, struct stream *secrets,
+                              unsigned int threads) {
+  struct pdecode pd;
+  struct text_line *lines = NULL;
+  struct packet *packet = NULL;
+  struct pool *pool = NULL;
+  size_t nlines = 0, size = 0, bound = 0, nranges = 0, pos, i;
+  size_t total = 0;
+  unsigned long all_crc = CRC24_INIT;
+
+  memset(&pd, 0, sizeof(pd));
+
+  /* Index the data lines, the same ones the serial reader would look
+     at. */
+  for (pos = secrets->pos; pos < (size_t)secrets->size;) {
+    const unsigned char *nl =
+        memchr(&secrets->buffer[pos], '\n', secrets->size - pos);
+    size_t len = nl ? (size_t)(nl - &secrets->buffer[pos])
+                    : (size_t)secrets->size - pos;
+    unsigned char c = secrets->buffer[pos];
+
+    if (len >= 1023)
+      goto out;
+
+    if (c != '#' && c != '\n' && c != '\r') {
+      if (nlines == size) {
+        size_t n = size ? size * 2 : 256;
+        struct text_line *tmp = ctx_realloc(ctx, lines, size * sizeof(*lines),
+                                            n * sizeof(*lines));
+        if (tmp == NULL)
+          goto out;
+        lines = tmp;
+        size = n;
+      }
+      lines[nlines].start = pos;
+      lines[nlines].len = len;
+      lines[nlines].out = bound;
+      bound += len / 2;
+      nlines++;
+    }
+    pos += len + 1;
+  }
+
+  if (nlines < PDECODE_MIN_LINES)
+    goto out;
+
+  nranges = threads * 4;
+  if (nranges > nlines)
+    nranges = nlines;
+
+  pd.text = secrets->buffer;
+  pd.lines = lines;
+  pd.nlines = nlines;
+  pd.ranges = ctx_malloc(ctx, nranges * sizeof(*pd.ranges));
+  pd.buf = ctx_malloc(ctx, bound);
+  pool = pool_new(threads);
+  if (pd.ranges == NULL || pd.buf == NULL || pool == NULL)
+    goto out;
+
+  for (i = 0; i < nranges; i++) {
+    pd.ranges[i].first = nlines * i / nranges;
+    pd.ranges[i].count = nlines * (i + 1) / nranges - pd.ranges[i].first;
+    pd.ranges[i].len = 0;
+    pd.ranges[i].failed = 0;
+  }
+
+  pool_run(pool, nranges, decode_range, &pd);
+
+  /* Close up the gaps between ranges and combine their CRCs. */
+  for (i = 0; i < nranges; i++) {
+    struct range *range = &pd.ranges[i];
+
+    if (range->failed)
+      goto out;
+    memmove(&pd.buf[total], &pd.buf[lines[range->first].out], range->len);
+    total += range->len;
+    all_crc = crc24_combine(all_crc, range->crc, range->len);
+  }
+
+  if (all_crc != (pd.final_crc & 0xFFFFFFL))
+    goto out;
+
+  packet = ctx_malloc(ctx, sizeof(*packet));
+  if (packet == NULL)
+    goto out;
+  packet->type = 0;
+  packet->buf = pd.buf;
+  packet->len = total;
+  packet->size = bound;
+  pd.buf = NULL;
+  secrets->pos = secrets->size;
+
+out:
+  if (pool)
+    pool_free(pool);
+  ctx_free(ctx, pd.buf, bound);
+  ctx_free(ctx, pd.ranges, nranges * sizeof(*pd.ranges));
+  ctx_free(ctx, lines, size * sizeof(*lines));
+  return packet;
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _PDECODE_H_
+#define _PDECODE_H_
+
+#include "packets.h"
+#include "stream.h"
+
+struct paperkey_ctx;
+
+/* Documents with fewer data lines than this are not worth the threads. */
+#define PDECODE_MIN_LINES 32
+
+/* Decode a base16 document on several threads.  The data lines are
+   split into ranges; each range is decoded and its per-line CRCs
+   checked on its own, and the whole-document CRC is put together from
+   the range CRCs with crc24_combine() instead of a second pass.
+   Returns NULL whenever anything is out of the ordinary (a bad line, a
+   gap in the numbering, a CRC mismatch, no memory), leaving the stream
+   untouched so the serial reader can deal with it and report it. */
+struct packet *pdecode_base16(struct paperkey_ctx *ctx, struct stream *secrets,
+                              unsigned int threads);
+
+#endif /* !_PDECODE_H_ */
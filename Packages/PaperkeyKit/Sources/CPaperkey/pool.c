@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Keep each range on its own cache line so the owner popping from it
+   does not bounce the lines of its neighbours. */
+struct pool_range {
+  pthread_mutex_t lock;
+  size_t lo;
+  size_t hi;
+  unsigned char pad[64];
+};
+
+struct pool_worker {
+  struct pool *pool;
+  unsigned int id;
+};
+
+struct pool {
+  unsigned int workers;
+  pthread_t *threads;
+  struct pool_worker *args;
+  struct pool_range *ranges;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  unsigned int running;
+  int shutdown;
+
+  pool_fn fn;
+  void *opaque;
+};
+
+unsigned int pool_default_workers(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (unsigned int)n : 1;
+}
+
+static int take_own(struct pool_range *range, size_t *index) {
+  int got = 0;
+
+  pthread_mutex_lock(&range->lock);
+  if (range->lo < range->hi) {
+    *index = range->lo++;
+    got = 1;
+  }
+  pthread_mutex_unlock(&range->lock);
+
+  return got;
+}
+
+static int steal(struct pool *pool, unsigned int self) {
+  unsigned int i;
+
+  for (i = 1; i < pool->workers; i++) {
+    struct pool_range *victim = &pool->ranges[(self + i) % pool->workers];
+    size_t lo = 0, hi = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    if (victim->lo < victim->hi) {
+      /* Take the upper half, leaving the victim the tasks it is
+         about to reach anyway. */
+      hi = victim->hi;
+      lo = hi - (hi - victim->lo + 1) / 2;
+      victim->hi = lo;
+    }
+    pthread_mutex_unlock(&victim->lock);
+
+    if (lo < hi) {
+      struct pool_range *own = &pool->ranges[self];
+
+      pthread_mutex_lock(&own->lock);
+      own->lo = lo;
+      own->hi = hi;
+      pthread_mutex_unlock(&own->lock);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void *pool_thread(void *arg) {
+  struct pool_worker *worker = arg;
+  struct pool *pool = worker->pool;
+  unsigned long seen = 0;
+
+  for (;;) {
+    pool_fn fn;
+    void *opaque;
+    size_t index;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == seen && !pool->shutdown)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if (pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    seen = pool->generation;
+    fn = pool->fn;
+    opaque = pool->opaque;
+    pthread_mutex_unlock(&pool->lock);
+
+    do {
+      while (take_own(&pool->ranges[worker->id], &index))
+        fn(opaque, index, worker->id);
+    } while (steal(pool, worker->id));
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->running == 0)
+      pthread_cond_signal(&pool->done);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  return NULL;
+}
+
+struct pool *pool_new(unsigned int workers) {
+  struct pool *pool;
+  unsigned int i;
+
+  if (workers == 0)
+    workers = pool_default_workers();
+
+  pool = calloc(1, sizeof(*pool));
+  if (pool == NULL)
+    return NULL;
+
+  pool->workers = workers;
+  pool->threads = calloc(workers, sizeof(*pool->threads));
+  pool->args = calloc(workers, sizeof(*pool->args));
+  pool->ranges = calloc(workers, sizeof(*pool->ranges));
+  if (!pool->threads || !pool->args || !pool->ranges) {
+    free(pool->threads);
+    free(pool->args);
+    free(pool->ranges);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (i = 0; i < workers; i++) {
+    pthread_mutex_init(&pool->ranges[i].lock, NULL);
+    pool->args[i].pool = pool;
+    pool->args[i].id = i;
+    if (pthread_create(&pool->threads[i], NULL, pool_thread,
+                       &pool->args[i]) != 0) {
+      /* Run with the threads we managed to start. */
+      pool->workers = i;
+      break;
+    }
+  }
+
+  if (pool->workers == 0) {
+    pool_free(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+unsigned int pool_workers(const struct pool *pool) { return pool->workers; }
+
+void pool_run(struct pool *pool, size_t count, pool_fn fn, void *opaque) {
+  unsigned int i;
+
+  for (i = 0; i < pool->workers; i++) {
+    struct pool_range *range = &pool->ranges[i];
+
+    pthread_mutex_lock(&range->lock);
+    range->lo = count * i / pool->workers;
+    range->hi = count * (i + 1) / pool->workers;
+    pthread_mutex_unlock(&range->lock);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->opaque = opaque;
+  pool->running = pool->workers;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  while (pool->running)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(struct pool *pool) {
+  unsigned int i;
+
+  if (pool == NULL)
+    return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->workers; i++) {
+    pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->ranges[i].lock);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->threads);
+  free(pool->args);
+  free(pool->ranges);
+  free(pool);
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+
+/* A fixed set of worker threads that run batches of independent
+   tasks.  Each batch is split into one contiguous range per worker;
+   a worker that runs dry steals half of the remaining range of
+   another worker, so uneven task costs still keep every core busy. */
+struct pool;
+
+typedef void (*pool_fn)(void *opaque, size_t index, unsigned int worker);
+
+/* Number of online CPUs, at least 1. */
+unsigned int pool_default_workers(void);
+/* workers == 0 means pool_default_workers(). */
+struct pool *pool_new(unsigned int workers);
+unsigned int pool_workers(const struct pool *pool);
+/* Run fn for every index in [0, count) and wait for all of them.
+   Only one batch may run on a pool at a time. */
+void pool_run(struct pool *pool, size_t count, pool_fn fn, void *opaque);
+void pool_free(struct pool *pool);
+
+#endif /* !_POOL_H_ */
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "pscan.h"
+#include "internal.h"
+#include "packets.h"
+#include "parse.h"
+#include "pool.h"
+#include <limits.h>
+#include <string.h>
+
+/* Streams count in int, so the header pass walks the pubring through a
+   window that moves up to the current packet once it is this far
+   along.  A certificate must fit in one window. */
+#define WINDOW_SLIDE (1 << 30)
+
+/* Ranges per thread, so a range of large certificates does not hold up
+   the rest. */
+#define RANGES_PER_THREAD 4
+
+#define NOT_FOUND ((size_t)-1)
+
+struct cert {
+  uint64_t offset;
+  /* Key packets with a fingerprint, the primary included. */
+  size_t keys;
+};
+
+struct range {
+  size_t first;
+  size_t count;
+  /* Where its keys go in the result. */
+  size_t key_first;
+  /* The first certificate whose primary key matched. */
+  size_t found;
+  int failed;
+};
+
+struct pscan {
+  const unsigned char *buf;
+  uint64_t len;
+
+  struct cert *certs;
+  size_t ncerts;
+  size_t certs_size;
+  size_t nkeys;
+
+  struct range *ranges;
+  size_t nranges;
+
+  struct pscan_key *keys;
+  const unsigned char *target;
+};
+
+static uint64_t cert_end(const struct pscan *ps, size_t c) {
+  return c + 1 < ps->ncerts ? ps->certs[c + 1].offset : ps->len;
+}
+
+static int add_cert(struct paperkey_ctx *ctx, struct pscan *ps,
+                    uint64_t offset) {
+  if (ps->ncerts && offset - ps->certs[ps->ncerts - 1].offset > INT_MAX)
+    return -1;
+
+  if (ps->ncerts == ps->certs_size) {
+    size_t size = ps->certs_size ? ps->certs_size * 2 : 1024;
+    struct cert *tmp;
+
+    tmp = ctx_realloc(ctx, ps->certs, ps->certs_size * sizeof(*ps->certs),
+                      size * sizeof(*ps->certs));
+    if (tmp == NULL)
+      return -1;
+    ps->certs = tmp;
+    ps->certs_size = size;
+  }
+
+  ps->certs[ps->ncerts].offset = offset;
+  ps->certs[ps->ncerts].keys = 0;
+  ps->ncerts++;
+  return 0;
+}
+
+/* The serial pass: packet headers only, nothing copied or hashed. */
+static int find_certs(struct paperkey_ctx *ctx, struct pscan *ps) {
+  struct stream window;
+  uint64_t base = 0;
+
+  memset(&window, 0, sizeof(window));
+
+  for (;;) {
+    unsigned char type;
+    unsigned int length;
+    uint64_t start;
+
+    if (window.buffer == NULL || window.pos >= WINDOW_SLIDE) {
+      base += window.pos;
+      window.buffer = (unsigned char *)ps->buf + base;
+      window.size = ps->len - base > INT_MAX ? INT_MAX : ps->len - base;
+      window.pos = 0;
+    }
+
+    start = base + window.pos;
+    if (start == ps->len)
+      break;
+
+    if (parse_packet_header(&window, &type, &length) != 0 ||
+        length > (unsigned int)stream_leftbyte(&window))
+      return -1;
+
+    if (type == 6 && add_cert(ctx, ps, start) != 0)
+      return -1;
+    if ((type == 6 || type == 14) && ps->ncerts && length &&
+        window.buffer[window.pos] == 4) {
+      ps->certs[ps->ncerts - 1].keys++;
+      ps->nkeys++;
+    }
+
+    window.pos += length;
+  }
+
+  if (ps->ncerts && ps->len - ps->certs[ps->ncerts - 1].offset > INT_MAX)
+    return -1;
+  return 0;
+}
+
+/* Split the certificates into ranges of about len / nranges bytes. */
+static void split_ranges(struct pscan *ps) {
+  size_t c = 0, keys = 0, k;
+
+  for (k = 0; k < ps->nranges; k++) {
+    struct range *range = &ps->ranges[k];
+    uint64_t limit = ps->len / ps->nranges * (k + 1);
+
+    if (k == ps->nranges - 1)
+      limit = ps->len;
+
+    range->first = c;
+    range->key_first = keys;
+    range->found = NOT_FOUND;
+    range->failed = 0;
+    while (c < ps->ncerts && (c == range->first || ps->certs[c].offset < limit))
+      keys += ps->certs[c++].keys;
+    range->count = c - range->first;
+  }
+}
+
+static void scan_range(void *opaque, size_t index, unsigned int worker) {
+  struct pscan *ps = opaque;
+  struct range *range = &ps->ranges[index];
+  struct pscan_key *key = ps->keys ? &ps->keys[range->key_first] : NULL;
+  size_t c;
+
+  (void)worker;
+
+  for (c = range->first; c < range->first + range->count; c++) {
+    uint64_t offset = ps->certs[c].offset, end = cert_end(ps, c);
+    struct stream window;
+
+    memset(&window, 0, sizeof(window));
+    window.buffer = (unsigned char *)ps->buf + offset;
+    window.size = end - offset;
+
+    while (!stream_eof(&window)) {
+      int start = window.pos;
+      unsigned char type;
+      unsigned int length;
+      struct packet view;
+
+      /* The header pass already walked these. */
+      parse_packet_header(&window, &type, &length);
+
+      if ((type == 6 || type == 14) && length &&
+          window.buffer[window.pos] == 4) {
+        view.type = type;
+        view.buf = &window.buffer[window.pos];
+        view.len = view.size = length;
+
+        if (ps->target) {
+          unsigned char fpr[20];
+
+          calculate_fingerprint(&view, length, fpr);
+          if (memcmp(fpr, ps->target, 20) == 0) {
+            range->found = c;
+            return;
+          }
+          /* Only the primary key can match. */
+          break;
+        }
+
+        calculate_fingerprint(&view, length, key->fpr);
+        key->type = type;
+        key->offset = offset + start;
+        key->cert_offset = offset;
+        key->cert_length = end - offset;
+        key++;
+      } else if (ps->target && type == 6) {
+        break;
+      }
+
+      window.pos += length;
+    }
+  }
+}
+
+static int run_scan(struct paperkey_ctx *ctx, struct pscan *ps,
+                    unsigned int threads) {
+  size_t k;
+
+  if (threads < 1)
+    threads = 1;
+
+  ps->nranges = threads > 1 ? threads * RANGES_PER_THREAD : 1;
+  if (ps->nranges > ps->ncerts)
+    ps->nranges = ps->ncerts ? ps->ncerts : 1;
+  ps->ranges = ctx_malloc(ctx, ps->nranges * sizeof(*ps->ranges));
+  if (ps->ranges == NULL)
+    return -1;
+  split_ranges(ps);
+
+  if (threads > 1 && ps->nranges > 1) {
+    struct pool *pool = pool_new(threads);
+
+    if (pool == NULL)
+      return -1;
+    pool_run(pool, ps->nranges, scan_range, ps);
+    pool_free(pool);
+  } else {
+    for (k = 0; k < ps->nranges; k++)
+      scan_range(ps, k, 0);
+  }
+
+  return 0;
+}
+
+static void pscan_done(struct paperkey_ctx *ctx, struct pscan *ps) {
+  ctx_free(ctx, ps->certs, ps->certs_size * sizeof(*ps->certs));
+  ctx_free(ctx, ps->ranges, ps->nranges * sizeof(*ps->ranges));
+}
+
+int pscan_keys(struct paperkey_ctx *ctx, const unsigned char *buf,
+               uint64_t len, unsigned int threads, struct pscan_key **keys,
+               size_t *count) {
+  struct pscan ps;
+  int ret = -1;
+
+  memset(&ps, 0, sizeof(ps));
+  ps.buf = buf;
+  ps.len = len;
+
+  if (find_certs(ctx, &ps) != 0)
+    goto out;
+
+  if (ps.nkeys) {
+    ps.keys = ctx_malloc(ctx, ps.nkeys * sizeof(*ps.keys));
+    if (ps.keys == NULL)
+      goto out;
+  }
+
+  if (run_scan(ctx, &ps, threads) != 0) {
+    pscan_keys_free(ctx, ps.keys, ps.nkeys);
+    goto out;
+  }
+
+  *keys = ps.keys;
+  *count = ps.nkeys;
+  ret = 0;
+
+out:
+  pscan_done(ctx, &ps);
+  return ret;
+}
+
+void pscan_keys_free(struct paperkey_ctx *ctx, struct pscan_key *keys,
+                     size_t count) {
+  ctx_free(ctx, keys, count * sizeof(*keys));
+}
+
+int pscan_find_primary(struct paperkey_ctx *ctx, const unsigned char *buf,
+                       uint64_t len, unsigned int threads,
+                       const unsigned char fpr[20], uint64_t *offset) {
+  struct pscan ps;
+  int ret = -1;
+  size_t k;
+
+  memset(&ps, 0, sizeof(ps));
+  ps.buf = buf;
+  ps.len = len;
+  ps.target = fpr;
+
+  if (find_certs(ctx, &ps) != 0 || run_scan(ctx, &ps, threads) != 0)
+    goto out;
+
+  for (k = 0; k < ps.nranges; k++) {
+    if (ps.ranges[k].found != NOT_FOUND) {
+      *offset = ps.certs[ps.ranges[k].found].offset;
+      ret = 0;
+      break;
+    }
+  }
+
+out:
+  pscan_done(ctx, &ps);
+  return ret;
+}
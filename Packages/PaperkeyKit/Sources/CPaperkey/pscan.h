@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _PSCAN_H_
+#define _PSCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct paperkey_ctx;
+
+/* Parallel scanning of a whole pubring in memory.  A first pass reads
+   only packet headers to find where each certificate starts, at its
+   primary key packet.  The certificates are then split into ranges of
+   about equal size, which the workers fingerprint on their own, each
+   into its own slice of the result, so the results come out in pubring
+   order with nothing to merge. */
+
+struct pscan_key {
+  unsigned char fpr[20];
+  unsigned char type;
+  /* The key packet, and the certificate it belongs to. */
+  uint64_t offset;
+  uint64_t cert_offset;
+  uint64_t cert_length;
+};
+
+/* Fingerprint every version 4 key and subkey packet of buf on threads
+   (0 or 1 for the calling thread only).  Subkeys before the first
+   primary key belong to no certificate and are left out.  Returns 0
+   with the keys in *keys, to be released with pscan_keys_free(), or -1
+   if buf is not a sequence of OpenPGP packets or memory runs out. */
+int pscan_keys(struct paperkey_ctx *ctx, const unsigned char *buf,
+               uint64_t len, unsigned int threads, struct pscan_key **keys,
+               size_t *count);
+void pscan_keys_free(struct paperkey_ctx *ctx, struct pscan_key *keys,
+                     size_t count);
+
+/* Find the first primary key packet with this fingerprint, hashing
+   only primary keys.  Returns 0 with its offset, or -1. */
+int pscan_find_primary(struct paperkey_ctx *ctx, const unsigned char *buf,
+                       uint64_t len, unsigned int threads,
+                       const unsigned char fpr[20], uint64_t *offset);
+
+#endif /* !_PSCAN_H_ */
@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "qr.h"
+#include "gf256.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Error correction codewords per block and number of blocks, by level
+   and version, from ISO/IEC 18004 table 9. */
+static const unsigned char ecc_per_block[4][41] = {
+    {0,  7,  10, 15, 20, 26, 18, 20, 24, 30, 18, 20, 24, 26,
+     30, 22, 24, 28, 30, 28, 28, 28, 28, 30, 30, 26, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {0,  10, 16, 26, 18, 24, 16, 18, 22, 22, 26, 30, 22, 22,
+     24, 24, 28, 28, 26, 26, 26, 26, 28, 28, 28, 28, 28, 28,
+     28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28, 28},
+    {0,  13, 22, 18, 26, 18, 24, 18, 22, 20, 24, 28, 26, 24,
+     20, 30, 24, 28, 28, 26, 30, 28, 30, 30, 30, 30, 28, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+    {0,  17, 28, 22, 16, 22, 28, 26, 26, 24, 28, 24, 28, 22,
+     24, 24, 30, 28, 28, 26, 28, 30, 24, 30, 30, 30, 30, 30,
+     30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30, 30},
+};
+
+static const unsigned char num_blocks[4][41] = {
+    {0,  1,  1,  1,  1,  1,  2,  2,  2,  2,  4,  4,  4,  4,
+     4,  6,  6,  6,  6,  7,  8,  8,  9,  9,  10, 12, 12, 12,
+     13, 14, 15, 16, 17, 18, 19, 19, 20, 21, 22, 24, 25},
+    {0,  1,  1,  1,  2,  2,  4,  4,  4,  5,  5,  5,  8,  9,
+     9,  10, 10, 11, 13, 14, 16, 17, 17, 18, 20, 21, 23, 25,
+     26, 28, 29, 31, 33, 35, 37, 38, 40, 43, 45, 47, 49},
+    {0,  1,  1,  2,  2,  4,  4,  6,  6,  8,  8,  8,  10, 12,
+     16, 12, 17, 16, 18, 21, 20, 23, 23, 25, 27, 29, 34, 34,
+     35, 38, 40, 43, 45, 48, 51, 53, 56, 59, 62, 65, 68},
+    {0,  1,  1,  2,  4,  4,  4,  5,  6,  8,  8,  11, 11, 16,
+     16, 18, 16, 19, 21, 25, 25, 25, 34, 30, 32, 35, 37, 40,
+     42, 45, 48, 51, 54, 57, 60, 63, 66, 70, 74, 77, 81},
+};
+
+/* The two bit level indicator in the format information. */
+static const unsigned char ecc_format_bits[4] = {1, 0, 3, 2};
+
+#define MAX_CODEWORDS 3706
+#define MAX_ECC 30
+
+/* Each cell of the work grid: bit 0 is the module, bit 1 marks the
+   function patterns that masking and data placement leave alone. */
+#define DARK 1
+#define FUNCTION 2
+
+struct grid {
+  unsigned int size;
+  unsigned char cell[QR_MAX_SIZE][QR_MAX_SIZE];
+};
+
+struct bits {
+  unsigned char *buf;
+  size_t len;
+};
+
+static void put_bits(struct bits *bits, unsigned long value, int count) {
+  int i;
+
+  for (i = count - 1; i >= 0; i--) {
+    if (value >> i & 1)
+      bits->buf[bits->len >> 3] |= 0x80 >> (bits->len & 7);
+    bits->len++;
+  }
+}
+
+static unsigned int alignment_positions(unsigned int version,
+                                        unsigned char *pos) {
+  unsigned int count, step, size = 17 + 4 * version, i, p;
+
+  if (version == 1)
+    return 0;
+
+  count = version / 7 + 2;
+  step = version == 32 ? 26
+                       : (version * 4 + count * 2 + 1) / (count * 2 - 2) * 2;
+  pos[0] = 6;
+  for (i = count - 1, p = size - 7; i >= 1; i--, p -= step)
+    pos[i] = p;
+  return count;
+}
+
+/* Modules left for data and error correction once the function
+   patterns are drawn. */
+static unsigned int raw_modules(unsigned int version) {
+  unsigned int result = (16 * version + 128) * version + 64;
+
+  if (version >= 2) {
+    unsigned int align = version / 7 + 2;
+
+    result -= (25 * align - 10) * align - 55;
+    if (version >= 7)
+      result -= 36;
+  }
+  return result;
+}
+
+static unsigned int data_codewords(unsigned int version, enum qr_ecc ecc) {
+  return raw_modules(version) / 8 -
+         ecc_per_block[ecc][version] * num_blocks[ecc][version];
+}
+
+static unsigned int count_bits(unsigned int version) {
+  return version < 10 ? 8 : 16;
+}
+
+size_t qr_capacity(unsigned int version, enum qr_ecc ecc, int append) {
+  size_t bits;
+
+  if (version < QR_MIN_VERSION || version > QR_MAX_VERSION || ecc > QR_ECC_H)
+    return 0;
+
+  bits = data_codewords(version, ecc) * 8;
+  bits -= 4 + count_bits(version) + (append ? 20 : 0);
+  return bits / 8;
+}
+
+/* The generator polynomial of the given degree with roots 2^0 up to
+   2^(degree - 1), as logs of its coefficients from the highest power
+   down, leaving out the leading 1. */
+static void rs_generator(unsigned int degree, unsigned char *log_gen) {
+  unsigned char gen[MAX_ECC];
+  unsigned char root = 1;
+  unsigned int i, j;
+
+  memset(gen, 0, degree);
+  gen[degree - 1] = 1;
+
+  for (i = 0; i < degree; i++) {
+    for (j = 0; j < degree; j++) {
+      gen[j] = gf_mul(gen[j], root);
+      if (j + 1 < degree)
+        gen[j] ^= gen[j + 1];
+    }
+    root = gf_mul(root, 2);
+  }
+
+  for (i = 0; i < degree; i++)
+    log_gen[i] = gf_log[gen[i]];
+}
+
+static void rs_remainder(const unsigned char *data, size_t len,
+                         const unsigned char *log_gen, unsigned int degree,
+                         unsigned char *rem) {
+  size_t i;
+  unsigned int j;
+
+  memset(rem, 0, degree);
+  for (i = 0; i < len; i++) {
+    unsigned char factor = data[i] ^ rem[0];
+
+    memmove(rem, rem + 1, degree - 1);
+    rem[degree - 1] = 0;
+    if (factor) {
+      unsigned int log_factor = gf_log[factor];
+
+      for (j = 0; j < degree; j++)
+        rem[j] ^= gf_exp[log_gen[j] + log_factor];
+    }
+  }
+}
+
+/* Split the data codewords into blocks, add error correction to each
+   and interleave them into out. */
+static void add_ecc(const unsigned char *data, unsigned int version,
+                    enum qr_ecc ecc, unsigned char *out) {
+  unsigned int blocks = num_blocks[ecc][version];
+  unsigned int ecc_len = ecc_per_block[ecc][version];
+  unsigned int raw = raw_modules(version) / 8;
+  unsigned int short_blocks = blocks - raw % blocks;
+  unsigned int short_data = raw / blocks - ecc_len;
+  unsigned char log_gen[MAX_ECC], rem[MAX_ECC];
+  unsigned int b, i, k = 0;
+
+  rs_generator(ecc_len, log_gen);
+
+  for (b = 0; b < blocks; b++) {
+    unsigned int len = short_data + (b < short_blocks ? 0 : 1);
+
+    /* Data codeword i of block b goes to column i, row b, and short
+       blocks have no codeword in the last data column. */
+    for (i = 0; i < len; i++) {
+      unsigned int at = i * blocks + b;
+
+      if (i == short_data)
+        at = short_data * blocks + (b - short_blocks);
+      out[at] = data[k + i];
+    }
+
+    rs_remainder(&data[k], len, log_gen, ecc_len, rem);
+    for (i = 0; i < ecc_len; i++)
+      out[short_data * blocks + (blocks - short_blocks) + i * blocks + b] =
+          rem[i];
+    k += len;
+  }
+}
+
+static void set_function(struct grid *g, unsigned int x, unsigned int y,
+                         int dark) {
+  g->cell[y][x] = FUNCTION | (dark ? DARK : 0);
+}
+
+static void draw_format(struct grid *g, enum qr_ecc ecc, unsigned int mask) {
+  unsigned int data = ecc_format_bits[ecc] << 3 | mask;
+  unsigned int rem = data, bits, i, size = g->size;
+
+  for (i = 0; i < 10; i++)
+    rem = (rem << 1) ^ ((rem >> 9) * 0x537);
+  bits = (data << 10 | rem) ^ 0x5412;
+
+  for (i = 0; i <= 5; i++)
+    set_function(g, 8, i, bits >> i & 1);
+  set_function(g, 8, 7, bits >> 6 & 1);
+  set_function(g, 8, 8, bits >> 7 & 1);
+  set_function(g, 7, 8, bits >> 8 & 1);
+  for (i = 9; i < 15; i++)
+    set_function(g, 14 - i, 8, bits >> i & 1);
+
+  for (i = 0; i < 8; i++)
+    set_function(g, size - 1 - i, 8, bits >> i & 1);
+  for (i = 8; i < 15; i++)
+    set_function(g, 8, size - 15 + i, bits >> i & 1);
+  set_function(g, 8, size - 8, 1);
+}
+
+static void draw_functions(struct grid *g, unsigned int version) {
+  unsigned int size = g->size, i, j, count;
+  unsigned char align[7];
+  int corner[3][2];
+
+  for (i = 0; i < size; i++) {
+    set_function(g, 6, i, i % 2 == 0);
+    set_function(g, i, 6, i % 2 == 0);
+  }
+
+  corner[0][0] = 3, corner[0][1] = 3;
+  corner[1][0] = size - 4, corner[1][1] = 3;
+  corner[2][0] = 3, corner[2][1] = size - 4;
+  for (i = 0; i < 3; i++) {
+    int dx, dy;
+
+    for (dy = -4; dy <= 4; dy++) {
+      for (dx = -4; dx <= 4; dx++) {
+        int x = corner[i][0] + dx, y = corner[i][1] + dy;
+        int dist = abs(dx) > abs(dy) ? abs(dx) : abs(dy);
+
+        if (x >= 0 && x < (int)size && y >= 0 && y < (int)size)
+          set_function(g, x, y, dist != 2 && dist != 4);
+      }
+    }
+  }
+
+  count = alignment_positions(version, align);
+  for (i = 0; i < count; i++) {
+    for (j = 0; j < count; j++) {
+      int dx, dy;
+
+      /* Not where they would overlap the finder patterns. */
+      if ((i == 0 && j == 0) || (i == 0 && j == count - 1) ||
+          (i == count - 1 && j == 0))
+        continue;
+
+      for (dy = -2; dy <= 2; dy++)
+        for (dx = -2; dx <= 2; dx++)
+          set_function(g, align[i] + dx, align[j] + dy,
+                       abs(dx) == 2 || abs(dy) == 2 || (dx == 0 && dy == 0));
+    }
+  }
+
+  /* Reserve the format areas; the real bits go in with the mask. */
+  draw_format(g, QR_ECC_L, 0);
+
+  if (version >= 7) {
+    unsigned long rem = version, bits;
+
+    for (i = 0; i < 12; i++)
+      rem = (rem << 1) ^ ((rem >> 11) * 0x1F25);
+    bits = (unsigned long)version << 12 | rem;
+
+    for (i = 0; i < 18; i++) {
+      unsigned int a = size - 11 + i % 3, b = i / 3;
+      int dark = bits >> i & 1;
+
+      set_function(g, a, b, dark);
+      set_function(g, b, a, dark);
+    }
+  }
+}
+
+/* Lay the codewords out in the two module wide zigzag from the bottom
+   right corner, skipping the function patterns. */
+static void draw_codewords(struct grid *g, const unsigned char *data,
+                           size_t len) {
+  unsigned int size = g->size;
+  size_t i = 0;
+  int right;
+
+  for (right = size - 1; right >= 1; right -= 2) {
+    unsigned int vert;
+
+    if (right == 6)
+      right = 5;
+
+    for (vert = 0; vert < size; vert++) {
+      int j;
+
+      for (j = 0; j < 2; j++) {
+        unsigned int x = right - j;
+        int upward = ((right + 1) & 2) == 0;
+        unsigned int y = upward ? size - 1 - vert : vert;
+
+        if (!(g->cell[y][x] & FUNCTION)) {
+          if (i < len * 8 && (data[i >> 3] >> (7 - (i & 7)) & 1))
+            g->cell[y][x] |= DARK;
+          i++;
+        }
+      }
+    }
+  }
+}
+
+/* Whether each of the eight masks inverts a module depends only on x
+   modulo 6 and y modulo 12, so one small table covers the symbol. */
+static void mask_table(unsigned char table[12][6]) {
+  unsigned int x, y;
+
+  for (y = 0; y < 12; y++) {
+    for (x = 0; x < 6; x++) {
+      unsigned int bits = 0;
+
+      bits |= ((x + y) % 2 == 0) << 0;
+      bits |= (y % 2 == 0) << 1;
+      bits |= (x % 3 == 0) << 2;
+      bits |= ((x + y) % 3 == 0) << 3;
+      bits |= ((x / 3 + y / 2) % 2 == 0) << 4;
+      bits |= (x * y % 2 + x * y % 3 == 0) << 5;
+      bits |= ((x * y % 2 + x * y % 3) % 2 == 0) << 6;
+      bits |= (((x + y) % 2 + x * y % 3) % 2 == 0) << 7;
+      table[y][x] = bits;
+    }
+  }
+}
+
+static void apply_mask(struct grid *g, unsigned char table[12][6],
+                       unsigned int mask) {
+  unsigned int x, y;
+
+  for (y = 0; y < g->size; y++)
+    for (x = 0; x < g->size; x++)
+      if (!(g->cell[y][x] & FUNCTION))
+        g->cell[y][x] ^= table[y % 12][x % 6] >> mask & 1;
+}
+
+/* Runs of five or more alike, and finder-like 1:1:3:1:1 patterns with
+   four light modules on either side, along one row or column.  A
+   window of the last fifteen modules slides along the line with the
+   edges counted as light, so each pattern is seen once whichever side
+   the light modules are on. */
+static long line_penalty(const unsigned char *cell, int stride, int size) {
+  unsigned int window = 0;
+  long score = 0;
+  int i, run = 0, last = -1;
+
+  for (i = 0; i < size + 4; i++) {
+    int c = i < size ? cell[i * stride] & DARK : 0;
+
+    if (i < size) {
+      if (c == last) {
+        run++;
+      } else {
+        if (run >= 5)
+          score += run - 2;
+        run = 1;
+        last = c;
+      }
+    }
+
+    window = (window << 1 | c) & 0x7FFF;
+    /* The pattern starts at i - 10 and must lie inside the symbol. */
+    if (i >= 10 && i - 10 + 7 <= size && (window >> 4 & 0x7F) == 0x5D &&
+        (!(window >> 11) || !(window & 0xF)))
+      score += 40;
+  }
+  if (run >= 5)
+    score += run - 2;
+  return score;
+}
+
+static long penalty(const struct grid *g) {
+  int size = g->size, x, y;
+  long score = 0, black = 0, k;
+
+  for (y = 0; y < size; y++) {
+    score += line_penalty(g->cell[y], 1, size);
+    score += line_penalty(&g->cell[0][y], QR_MAX_SIZE, size);
+  }
+
+  for (y = 0; y < size; y++) {
+    const unsigned char *row = g->cell[y], *next = g->cell[y + 1];
+
+    for (x = 0; x < size; x++) {
+      int c = row[x] & DARK;
+
+      black += c;
+      if (x + 1 < size && y + 1 < size && c == (row[x + 1] & DARK) &&
+          c == (next[x] & DARK) && c == (next[x + 1] & DARK))
+        score += 3;
+    }
+  }
+
+  /* 10 points for every 5% the dark share strays from half. */
+  k = (labs(black * 20 - (long)size * size * 10) + (long)size * size - 1) /
+          ((long)size * size) -
+      1;
+  if (k > 0)
+    score += k * 10;
+
+  return score;
+}
+
+static void encode_symbol(const unsigned char *data, size_t len,
+                          unsigned int version, enum qr_ecc ecc, int mask,
+                          int index, int total, unsigned char parity,
+                          struct qr_symbol *symbol) {
+  unsigned char codewords[MAX_CODEWORDS], out[MAX_CODEWORDS];
+  unsigned char table[12][6];
+  unsigned int capacity = data_codewords(version, ecc), x, y;
+  struct grid g;
+  struct bits bits;
+  unsigned int i;
+
+  memset(codewords, 0, capacity);
+  bits.buf = codewords;
+  bits.len = 0;
+
+  if (total > 1) {
+    put_bits(&bits, 0x3, 4);
+    put_bits(&bits, index, 4);
+    put_bits(&bits, total - 1, 4);
+    put_bits(&bits, parity, 8);
+  }
+  put_bits(&bits, 0x4, 4);
+  put_bits(&bits, len, count_bits(version));
+  for (i = 0; i < len; i++)
+    put_bits(&bits, data[i], 8);
+
+  /* Terminator, then pad to a byte and fill with alternating pad
+     codewords. */
+  bits.len += capacity * 8 - bits.len < 4 ? capacity * 8 - bits.len : 4;
+  bits.len = (bits.len + 7) / 8 * 8;
+  for (i = bits.len / 8; i < capacity; i++)
+    codewords[i] = (i - bits.len / 8) % 2 ? 0x11 : 0xEC;
+
+  add_ecc(codewords, version, ecc, out);
+
+  g.size = 17 + 4 * version;
+  for (y = 0; y < g.size; y++)
+    memset(g.cell[y], 0, g.size);
+  draw_functions(&g, version);
+  draw_codewords(&g, out, raw_modules(version) / 8);
+  mask_table(table);
+
+  if (mask < 0) {
+    long best_score = -1;
+    int m;
+
+    for (m = 0; m < 8; m++) {
+      long score;
+
+      apply_mask(&g, table, m);
+      draw_format(&g, ecc, m);
+      score = penalty(&g);
+      if (best_score < 0 || score < best_score) {
+        best_score = score;
+        mask = m;
+      }
+      apply_mask(&g, table, m);
+    }
+  }
+  apply_mask(&g, table, mask);
+  draw_format(&g, ecc, mask);
+
+  symbol->version = version;
+  symbol->ecc = ecc;
+  symbol->mask = mask;
+  symbol->size = g.size;
+  memset(symbol->modules, 0, sizeof(symbol->modules));
+  for (y = 0; y < g.size; y++)
+    for (x = 0; x < g.size; x++)
+      if (g.cell[y][x] & DARK)
+        symbol->modules[y * QR_ROW_BYTES + x / 8] |= 0x80 >> (x % 8);
+}
+
+int qr_encode(const unsigned char *data, size_t len,
+              const struct qr_options *options, struct qr_symbol *symbols,
+              size_t max_symbols, size_t *count) {
+  unsigned int max_version = options->max_version, version = 0;
+  unsigned long best_area = 0;
+  size_t n, best_n = 0, i;
+  unsigned char parity = 0;
+
+  if (max_version == 0 || max_version > QR_MAX_VERSION)
+    max_version = QR_MAX_VERSION;
+  if (max_symbols > QR_MAX_SYMBOLS)
+    max_symbols = QR_MAX_SYMBOLS;
+  if (options->ecc > QR_ECC_H || options->mask > 7)
+    return -1;
+
+  /* Every split into n symbols uses the smallest version that holds
+     the largest share; keep the split with the least total area. */
+  for (n = 1; n <= max_symbols; n++) {
+    size_t chunk = (len + n - 1) / n;
+    unsigned long area;
+    unsigned int v;
+
+    if (best_n && n * 21UL * 21UL >= best_area)
+      break;
+
+    for (v = QR_MIN_VERSION; v <= max_version; v++)
+      if (qr_capacity(v, options->ecc, n > 1) >= chunk)
+        break;
+    if (v > max_version)
+      continue;
+
+    area = n * (17 + 4 * v) * (17 + 4 * v);
+    if (best_n == 0 || area < best_area) {
+      best_area = area;
+      best_n = n;
+      version = v;
+    }
+  }
+
+  if (best_n == 0)
+    return -1;
+
+  for (i = 0; i < len; i++)
+    parity ^= data[i];
+
+  for (i = 0; i < best_n; i++) {
+    size_t start = len * i / best_n, end = len * (i + 1) / best_n;
+    enum qr_ecc ecc = options->ecc;
+
+    if (options->boost_ecc)
+      while (ecc < QR_ECC_H &&
+             qr_capacity(version, ecc + 1, best_n > 1) >= end - start)
+        ecc++;
+
+    encode_symbol(&data[start], end - start, version, ecc, options->mask, i,
+                  best_n, parity, &symbols[i]);
+  }
+
+  *count = best_n;
+  return 0;
+}
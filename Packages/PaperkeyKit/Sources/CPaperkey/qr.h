@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _QR_H_
+#define _QR_H_
+
+#include <stddef.h>
+
+/* A QR Code Model 2 encoder for binary payloads such as a RAW extract.
+   Byte mode only; no allocation, no dependencies. */
+
+enum qr_ecc { QR_ECC_L, QR_ECC_M, QR_ECC_Q, QR_ECC_H };
+
+#define QR_MIN_VERSION 1
+#define QR_MAX_VERSION 40
+/* Modules per side of a version 40 symbol. */
+#define QR_MAX_SIZE 177
+#define QR_ROW_BYTES ((QR_MAX_SIZE + 7) / 8)
+/* Structured append can chain at most 16 symbols. */
+#define QR_MAX_SYMBOLS 16
+
+struct qr_symbol {
+  unsigned int version;
+  enum qr_ecc ecc;
+  unsigned int mask;
+  /* Modules per side, 17 + 4 * version, not counting the quiet zone. */
+  unsigned int size;
+  /* One bit per module, 1 for dark, row by row with each row padded to
+     QR_ROW_BYTES and the leftmost module in the top bit. */
+  unsigned char modules[QR_MAX_SIZE * QR_ROW_BYTES];
+};
+
+struct qr_options {
+  /* The lowest error correction level to use. */
+  enum qr_ecc ecc;
+  /* The largest version to use, 0 for 40.  Smaller symbols are easier
+     to scan, at the price of more of them. */
+  unsigned int max_version;
+  /* Raise the error correction of a symbol when the data still fits
+     the same version at the higher level. */
+  int boost_ecc;
+  /* The mask pattern 0 to 7, or -1 to pick the one with the lowest
+     penalty score. */
+  int mask;
+};
+
+static inline int qr_module(const struct qr_symbol *symbol, unsigned int x,
+                            unsigned int y) {
+  return symbol->modules[y * QR_ROW_BYTES + x / 8] >> (7 - x % 8) & 1;
+}
+
+/* Bytes of byte mode data that fit in one symbol, with or without the
+   structured append header. */
+size_t qr_capacity(unsigned int version, enum qr_ecc ecc, int append);
+
+/* Encode data into as many structured append symbols as give the
+   least total area, at most max_symbols (and never more than 16), all
+   of the same version.  A single symbol carries no structured append
+   header.  Returns 0 and sets *count, or -1 if the data does not fit. */
+int qr_encode(const unsigned char *data, size_t len,
+              const struct qr_options *options, struct qr_symbol *symbols,
+              size_t max_symbols, size_t *count);
+
+#endif /* !_QR_H_ */
@@ -0,0 +1,741 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "render.h"
+#include "config.h"
+#include "internal.h"
+#include "output.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/* A4, with half an inch all round. */
+#define DEFAULT_PAGE_WIDTH 595.0
+#define DEFAULT_PAGE_HEIGHT 842.0
+#define DEFAULT_MARGIN 36.0
+#define DEFAULT_FONT_SIZE 9.0
+#define DEFAULT_DPI 300
+#define DEFAULT_QR_MODULE 1.5
+
+/* Courier, and the bitmap font below, advance 0.6 em a character. */
+#define ADVANCE 0.6
+#define LEADING 1.25
+#define QR_QUIET_ZONE 4
+
+/* A 5x7 font for PBM output covering printable ASCII, one byte per
+   row with the leftmost column in bit 4.  The zero is slashed so it
+   cannot be read as an O. */
+static const unsigned char font[95][7] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, /* ' ' */
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, /* '!' */
+    {0x0A, 0x0A, 0x0A, 0x00, 0x00, 0x00, 0x00}, /* '"' */
+    {0x0A, 0x0A, 0x1F, 0x0A, 0x1F, 0x0A, 0x0A}, /* '#' */
+    {0x04, 0x0F, 0x14, 0x0E, 0x05, 0x1E, 0x04}, /* '$' */
+    {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, /* '%' */
+    {0x0C, 0x12, 0x14, 0x08, 0x15, 0x12, 0x0D}, /* '&' */
+    {0x04, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00}, /* "'" */
+    {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, /* '(' */
+    {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, /* ')' */
+    {0x00, 0x04, 0x15, 0x0E, 0x15, 0x04, 0x00}, /* '*' */
+    {0x00, 0x04, 0x04, 0x1F, 0x04, 0x04, 0x00}, /* '+' */
+    {0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08}, /* ',' */
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, /* '-' */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C}, /* '.' */
+    {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}, /* '/' */
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, /* '0' */
+    {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E}, /* '1' */
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, /* '2' */
+    {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E}, /* '3' */
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, /* '4' */
+    {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E}, /* '5' */
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, /* '6' */
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, /* '7' */
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, /* '8' */
+    {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C}, /* '9' */
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00}, /* ':' */
+    {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x04, 0x08}, /* ';' */
+    {0x02, 0x04, 0x08, 0x10, 0x08, 0x04, 0x02}, /* '<' */
+    {0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00}, /* '=' */
+    {0x08, 0x04, 0x02, 0x01, 0x02, 0x04, 0x08}, /* '>' */
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04}, /* '?' */
+    {0x0E, 0x11, 0x01, 0x0D, 0x15, 0x15, 0x0E}, /* '@' */
+    {0x0E, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, /* 'A' */
+    {0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E}, /* 'B' */
+    {0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E}, /* 'C' */
+    {0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C}, /* 'D' */
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F}, /* 'E' */
+    {0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10}, /* 'F' */
+    {0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F}, /* 'G' */
+    {0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11}, /* 'H' */
+    {0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, /* 'I' */
+    {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C}, /* 'J' */
+    {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}, /* 'K' */
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F}, /* 'L' */
+    {0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11}, /* 'M' */
+    {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, /* 'N' */
+    {0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, /* 'O' */
+    {0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10}, /* 'P' */
+    {0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D}, /* 'Q' */
+    {0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11}, /* 'R' */
+    {0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E}, /* 'S' */
+    {0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, /* 'T' */
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E}, /* 'U' */
+    {0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04}, /* 'V' */
+    {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A}, /* 'W' */
+    {0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11}, /* 'X' */
+    {0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04}, /* 'Y' */
+    {0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F}, /* 'Z' */
+    {0x0E, 0x08, 0x08, 0x08, 0x08, 0x08, 0x0E}, /* '[' */
+    {0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00}, /* '\\' */
+    {0x0E, 0x02, 0x02, 0x02, 0x02, 0x02, 0x0E}, /* ']' */
+    {0x04, 0x0A, 0x11, 0x00, 0x00, 0x00, 0x00}, /* '^' */
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x1F}, /* '_' */
+    {0x08, 0x04, 0x02, 0x00, 0x00, 0x00, 0x00}, /* '`' */
+    {0x00, 0x00, 0x0E, 0x01, 0x0F, 0x11, 0x0F}, /* 'a' */
+    {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x1E}, /* 'b' */
+    {0x00, 0x00, 0x0E, 0x10, 0x10, 0x11, 0x0E}, /* 'c' */
+    {0x01, 0x01, 0x0D, 0x13, 0x11, 0x11, 0x0F}, /* 'd' */
+    {0x00, 0x00, 0x0E, 0x11, 0x1F, 0x10, 0x0E}, /* 'e' */
+    {0x06, 0x09, 0x08, 0x1C, 0x08, 0x08, 0x08}, /* 'f' */
+    {0x00, 0x0F, 0x11, 0x11, 0x0F, 0x01, 0x0E}, /* 'g' */
+    {0x10, 0x10, 0x16, 0x19, 0x11, 0x11, 0x11}, /* 'h' */
+    {0x04, 0x00, 0x0C, 0x04, 0x04, 0x04, 0x0E}, /* 'i' */
+    {0x02, 0x00, 0x06, 0x02, 0x02, 0x12, 0x0C}, /* 'j' */
+    {0x10, 0x10, 0x12, 0x14, 0x18, 0x14, 0x12}, /* 'k' */
+    {0x0C, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E}, /* 'l' */
+    {0x00, 0x00, 0x1A, 0x15, 0x15, 0x11, 0x11}, /* 'm' */
+    {0x00, 0x00, 0x16, 0x19, 0x11, 0x11, 0x11}, /* 'n' */
+    {0x00, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E}, /* 'o' */
+    {0x00, 0x00, 0x1E, 0x11, 0x1E, 0x10, 0x10}, /* 'p' */
+    {0x00, 0x00, 0x0D, 0x13, 0x0F, 0x01, 0x01}, /* 'q' */
+    {0x00, 0x00, 0x16, 0x19, 0x10, 0x10, 0x10}, /* 'r' */
+    {0x00, 0x00, 0x0E, 0x10, 0x0E, 0x01, 0x1E}, /* 's' */
+    {0x08, 0x08, 0x1C, 0x08, 0x08, 0x09, 0x06}, /* 't' */
+    {0x00, 0x00, 0x11, 0x11, 0x11, 0x13, 0x0D}, /* 'u' */
+    {0x00, 0x00, 0x11, 0x11, 0x11, 0x0A, 0x04}, /* 'v' */
+    {0x00, 0x00, 0x11, 0x11, 0x15, 0x15, 0x0A}, /* 'w' */
+    {0x00, 0x00, 0x11, 0x0A, 0x04, 0x0A, 0x11}, /* 'x' */
+    {0x00, 0x00, 0x11, 0x11, 0x0F, 0x01, 0x0E}, /* 'y' */
+    {0x00, 0x00, 0x1F, 0x02, 0x04, 0x08, 0x1F}, /* 'z' */
+    {0x02, 0x04, 0x04, 0x08, 0x04, 0x04, 0x02}, /* '{' */
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, /* '|' */
+    {0x08, 0x04, 0x04, 0x02, 0x04, 0x04, 0x08}, /* '}' */
+    {0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00}, /* '~' */
+};
+
+struct renderer {
+  struct paperkey_ctx *ctx;
+  enum render_format format;
+  struct stream *output;
+  /* The first pass only counts the pages, which the SVG size and the
+     PostScript comments need up front. */
+  int dry;
+  int failed;
+
+  /* In points, or in whole pixels for PBM. */
+  double width;
+  double height;
+  double margin;
+  double font_size;
+  double advance;
+  double pitch;
+  double module;
+  unsigned int columns;
+
+  unsigned int pages;
+  unsigned int page;
+  int open;
+  /* Top of the next thing to go on the page. */
+  double y;
+
+  /* The text line being received. */
+  char line[1024];
+  size_t len;
+
+  /* PBM is written a pixel row at a time. */
+  unsigned char *row;
+  size_t row_bytes;
+  unsigned int rows_out;
+  unsigned int glyph_scale;
+
+  const struct qr_symbol *symbols;
+  size_t nsymbols;
+};
+
+static void emit(struct renderer *r, const char *format, ...) {
+  char buf[8192];
+  va_list args;
+  int len;
+
+  if (r->dry || r->failed)
+    return;
+
+  va_start(args, format);
+  len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+
+  if (len < 0 || len >= (int)sizeof(buf) ||
+      stream_write(buf, 1, len, r->output) != (size_t)len)
+    r->failed = 1;
+}
+
+static void pbm_put_row(struct renderer *r) {
+  if (stream_write(r->row, 1, r->row_bytes, r->output) != r->row_bytes)
+    r->failed = 1;
+  r->rows_out++;
+}
+
+/* Write blank rows down to row y of the page. */
+static void pbm_skip_to(struct renderer *r, unsigned int y) {
+  memset(r->row, 0, r->row_bytes);
+  while (r->rows_out < y && !r->failed)
+    pbm_put_row(r);
+}
+
+static void pbm_fill(unsigned char *row, unsigned int x, unsigned int w) {
+  for (; w; x++, w--)
+    row[x / 8] |= 0x80 >> (x % 8);
+}
+
+/* Hex in groups of four digits, with room for the terminator. */
+#define FINGERPRINT_TEXT (MAX_FINGERPRINT * 5 / 2)
+
+static void format_fingerprint(char buf[FINGERPRINT_TEXT],
+                               const struct output_state *out) {
+  size_t i;
+  int n = 0;
+
+  buf[0] = '\0';
+  for (i = 0; i < out->fingerprint_len; i++)
+    n += sprintf(&buf[n], i && i % 2 == 0 ? " %02X" : "%02X",
+                 out->fingerprint[i]);
+}
+
+/* One line of text with its top at y. */
+static void draw_text(struct renderer *r, const char *text, size_t len) {
+  char escaped[6 * sizeof(r->line)];
+  size_t i, n = 0;
+
+  if (r->dry)
+    return;
+
+  switch (r->format) {
+  case RENDER_SVG:
+    for (i = 0; i < len; i++) {
+      const char *entity = text[i] == '&'   ? "&amp;"
+                           : text[i] == '<' ? "&lt;"
+                           : text[i] == '>' ? "&gt;"
+                                            : NULL;
+
+      if (entity) {
+        strcpy(&escaped[n], entity);
+        n += strlen(entity);
+      } else
+        escaped[n++] = text[i];
+    }
+    escaped[n] = '\0';
+    emit(r, "<text x=\"%g\" y=\"%g\">%s</text>\n", r->margin,
+         r->y + r->font_size, escaped);
+    break;
+
+  case RENDER_POSTSCRIPT:
+    for (i = 0; i < len; i++) {
+      if (text[i] == '(' || text[i] == ')' || text[i] == '\\')
+        escaped[n++] = '\\';
+      escaped[n++] = text[i];
+    }
+    escaped[n] = '\0';
+    emit(r, "(%s) %g %g T\n", escaped, r->margin,
+         r->height - r->y - r->font_size);
+    break;
+
+  case RENDER_PBM: {
+    unsigned int s = r->glyph_scale, pitch = r->pitch, advance = r->advance;
+    unsigned int top = (pitch - 7 * s) / 2, inset = (advance - 5 * s) / 2;
+    unsigned int py;
+
+    pbm_skip_to(r, r->y);
+    for (py = 0; py < pitch && !r->failed; py++) {
+      memset(r->row, 0, r->row_bytes);
+      if (py >= top && (py - top) / s < 7) {
+        for (i = 0; i < len; i++) {
+          int c = (unsigned char)text[i];
+          unsigned int bits, x, b;
+
+          if (c < 32 || c > 126)
+            c = '?';
+          bits = font[c - 32][(py - top) / s];
+          x = r->margin + i * advance + inset;
+          for (b = 0; b < 5; b++)
+            if (bits >> (4 - b) & 1)
+              pbm_fill(r->row, x + b * s, s);
+        }
+      }
+      pbm_put_row(r);
+    }
+  } break;
+  }
+}
+
+/* A hairline across the text area at y. */
+static void draw_rule(struct renderer *r, double y) {
+  if (r->dry)
+    return;
+
+  switch (r->format) {
+  case RENDER_SVG:
+    emit(r, "<path d=\"M%g %gH%g\" stroke=\"#000\" stroke-width=\"0.5\"/>\n",
+         r->margin, y, r->width - r->margin);
+    break;
+
+  case RENDER_POSTSCRIPT:
+    emit(r, "0.5 setlinewidth %g %g moveto %g %g lineto stroke\n", r->margin,
+         r->height - y, r->width - r->margin, r->height - y);
+    break;
+
+  case RENDER_PBM:
+    pbm_skip_to(r, y);
+    pbm_fill(r->row, r->margin, r->width - 2 * r->margin);
+    pbm_put_row(r);
+    break;
+  }
+}
+
+static void prologue(struct renderer *r) {
+  char fp[FINGERPRINT_TEXT];
+
+  format_fingerprint(fp, &r->ctx->out);
+
+  switch (r->format) {
+  case RENDER_SVG:
+    emit(r, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    emit(r,
+         "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%gpt\" "
+         "height=\"%gpt\" viewBox=\"0 0 %g %g\">\n",
+         r->width, r->height * r->pages, r->width, r->height * r->pages);
+    emit(r, "<title>Secret portions of key %s</title>\n", fp);
+    emit(r,
+         "<style>text{font-family:Courier,monospace;font-size:%gpx;"
+         "white-space:pre}</style>\n",
+         r->font_size);
+    break;
+
+  case RENDER_POSTSCRIPT:
+    emit(r, "%%!PS-Adobe-3.0\n");
+    emit(r, "%%%%Title: Secret portions of key %s\n", fp);
+    emit(r, "%%%%Creator: " PACKAGE_STRING "\n");
+    emit(r, "%%%%Pages: %u\n", r->pages);
+    emit(r, "%%%%BoundingBox: 0 0 %.0f %.0f\n", r->width, r->height);
+    emit(r, "%%%%DocumentNeededResources: font Courier\n");
+    emit(r, "%%%%EndComments\n");
+    emit(r, "%%%%BeginProlog\n");
+    emit(r, "/T { moveto show } bind def\n");
+    emit(r, "/R { 1 rectfill } bind def\n");
+    emit(r, "%%%%EndProlog\n");
+    break;
+
+  case RENDER_PBM:
+    break;
+  }
+}
+
+static void epilogue(struct renderer *r) {
+  switch (r->format) {
+  case RENDER_SVG:
+    emit(r, "</svg>\n");
+    break;
+
+  case RENDER_POSTSCRIPT:
+    emit(r, "%%%%Trailer\n%%%%EOF\n");
+    break;
+
+  case RENDER_PBM:
+    break;
+  }
+}
+
+static void begin_page(struct renderer *r) {
+  char fp[FINGERPRINT_TEXT], header[sizeof(r->line)], right[32];
+  int n, m;
+
+  r->page++;
+  r->open = 1;
+  r->y = r->margin;
+  format_fingerprint(fp, &r->ctx->out);
+
+  if (r->page == 1)
+    prologue(r);
+
+  switch (r->format) {
+  case RENDER_SVG:
+    emit(r, "<g transform=\"translate(0 %g)\">\n", r->height * (r->page - 1));
+    emit(r, "<rect width=\"%g\" height=\"%g\" fill=\"#fff\"/>\n", r->width,
+         r->height);
+    break;
+
+  case RENDER_POSTSCRIPT:
+    emit(r, "%%%%Page: %u %u\n", r->page, r->page);
+    emit(r, "%%%%BeginPageSetup\n/Courier findfont %g scalefont setfont\n"
+            "%%%%EndPageSetup\n",
+         r->font_size);
+    break;
+
+  case RENDER_PBM:
+    emit(r, "P4\n# Secret portions of key %s, page %u of %u\n%.0f %.0f\n", fp,
+         r->page, r->pages, r->width, r->height);
+    r->rows_out = 0;
+    break;
+  }
+
+  /* The fingerprint on the left and the page number on the right,
+     or after it if the line is too narrow for both. */
+  n = snprintf(header, sizeof(header), "Key %s", fp);
+  m = snprintf(right, sizeof(right), "Page %u of %u", r->page, r->pages);
+  while (n < (int)r->columns - m - 2 && n < (int)sizeof(header) - 1)
+    header[n++] = ' ';
+  n += snprintf(&header[n], sizeof(header) - n, "  %s", right);
+  if (n > (int)r->columns)
+    n = r->columns;
+
+  draw_text(r, header, n);
+  draw_rule(r, r->y + r->pitch * 1.25);
+  r->y += r->pitch * 2;
+}
+
+static void end_page(struct renderer *r) {
+  switch (r->format) {
+  case RENDER_SVG:
+    emit(r, "</g>\n");
+    break;
+
+  case RENDER_POSTSCRIPT:
+    emit(r, "showpage\n");
+    break;
+
+  case RENDER_PBM:
+    if (!r->dry)
+      pbm_skip_to(r, r->height);
+    break;
+  }
+  r->open = 0;
+}
+
+/* Start a new page unless h more fits on this one.  Fails when it
+   would not fit even on a new page. */
+static int make_room(struct renderer *r, double h) {
+  if (r->open && r->y + h <= r->height - r->margin)
+    return 0;
+  if (r->open)
+    end_page(r);
+  begin_page(r);
+  return r->y + h <= r->height - r->margin ? 0 : -1;
+}
+
+static void layout_line(struct renderer *r) {
+  size_t len = r->len;
+
+  if (len && r->line[len - 1] == '\r')
+    len--;
+  /* The comment lines can lose their ends, but not the data. */
+  if (len > r->columns) {
+    if (r->line[0] != '#') {
+      r->failed = 1;
+      return;
+    }
+    len = r->columns;
+  }
+
+  if (make_room(r, r->pitch) != 0) {
+    r->failed = 1;
+    return;
+  }
+  draw_text(r, r->line, len);
+  r->y += r->pitch;
+}
+
+static int text_sink(void *opaque, const void *buf, size_t len) {
+  struct renderer *r = opaque;
+  const char *text = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    if (text[i] == '\n') {
+      layout_line(r);
+      r->len = 0;
+    } else if (r->len < sizeof(r->line)) {
+      r->line[r->len++] = text[i];
+    }
+  }
+
+  return r->failed ? -1 : 0;
+}
+
+/* Runs of dark modules in row y, as (x, width) pairs. */
+static unsigned int module_runs(const struct qr_symbol *symbol, unsigned int y,
+                                unsigned int runs[][2]) {
+  unsigned int x = 0, n = 0;
+
+  while (x < symbol->size) {
+    unsigned int start;
+
+    while (x < symbol->size && !qr_module(symbol, x, y))
+      x++;
+    if (x == symbol->size)
+      break;
+    start = x;
+    while (x < symbol->size && qr_module(symbol, x, y))
+      x++;
+    runs[n][0] = start;
+    runs[n][1] = x - start;
+    n++;
+  }
+  return n;
+}
+
+/* Draw symbols side by side with their quiet zones, the top at y. */
+static void draw_qr_row(struct renderer *r, const struct qr_symbol *symbols,
+                        size_t count, double side) {
+  unsigned int runs[QR_MAX_SIZE / 2 + 1][2];
+  unsigned int size = symbols[0].size, y, i;
+  double quiet = QR_QUIET_ZONE * r->module;
+  size_t k;
+
+  if (r->dry)
+    return;
+
+  switch (r->format) {
+  case RENDER_SVG:
+    for (k = 0; k < count; k++) {
+      emit(r, "<path transform=\"translate(%g %g) scale(%g)\" d=\"",
+           r->margin + k * side + quiet, r->y + quiet, r->module);
+      for (y = 0; y < size; y++) {
+        unsigned int n = module_runs(&symbols[k], y, runs);
+
+        for (i = 0; i < n; i++)
+          emit(r, "M%u %uh%uv1h-%uz", runs[i][0], y, runs[i][1], runs[i][1]);
+      }
+      emit(r, "\"/>\n");
+    }
+    break;
+
+  case RENDER_POSTSCRIPT:
+    for (k = 0; k < count; k++) {
+      emit(r, "gsave %g %g translate %g %g scale\n",
+           r->margin + k * side + quiet, r->height - r->y - quiet, r->module,
+           -r->module);
+      for (y = 0; y < size; y++) {
+        unsigned int n = module_runs(&symbols[k], y, runs);
+
+        for (i = 0; i < n; i++)
+          emit(r, "%u %u %u R\n", runs[i][0], y, runs[i][1]);
+      }
+      emit(r, "grestore\n");
+    }
+    break;
+
+  case RENDER_PBM: {
+    unsigned int module = r->module, top = r->y + quiet;
+
+    pbm_skip_to(r, top);
+    for (y = 0; y < size && !r->failed; y++) {
+      unsigned int repeat;
+
+      memset(r->row, 0, r->row_bytes);
+      for (k = 0; k < count; k++) {
+        unsigned int n = module_runs(&symbols[k], y, runs);
+        unsigned int left = r->margin + k * side + quiet;
+
+        for (i = 0; i < n; i++)
+          pbm_fill(r->row, left + runs[i][0] * module, runs[i][1] * module);
+      }
+      for (repeat = 0; repeat < module; repeat++)
+        pbm_put_row(r);
+    }
+  } break;
+  }
+}
+
+static void layout_qr(struct renderer *r) {
+  double side = (r->symbols[0].size + 2 * QR_QUIET_ZONE) * r->module;
+  size_t per_row = (r->width - 2 * r->margin) / side, i;
+
+  if (per_row == 0) {
+    r->failed = 1;
+    return;
+  }
+
+  if (r->open)
+    r->y += r->pitch;
+
+  for (i = 0; i < r->nsymbols && !r->failed; i += per_row) {
+    size_t count = r->nsymbols - i < per_row ? r->nsymbols - i : per_row;
+
+    if (make_room(r, side) != 0) {
+      r->failed = 1;
+      return;
+    }
+    draw_qr_row(r, &r->symbols[i], count, side);
+    r->y += side;
+  }
+}
+
+struct raw_buffer {
+  unsigned char *buf;
+  size_t len;
+  size_t size;
+};
+
+static int raw_sink(void *opaque, const void *buf, size_t len) {
+  struct raw_buffer *raw = opaque;
+
+  if (len > raw->size - raw->len)
+    return -1;
+  memcpy(&raw->buf[raw->len], buf, len);
+  raw->len += len;
+  return 0;
+}
+
+/* Extract input from the start again, as type, into a sink. */
+static int extract_pass(struct paperkey_ctx *ctx, struct stream *input,
+                        int start, enum data_type type, stream_sink_fn sink,
+                        void *opaque) {
+  enum data_type saved = ctx->output_type;
+  struct stream output;
+  int ret;
+
+  memset(&output, 0, sizeof(output));
+  output.sink = sink;
+  output.sink_opaque = opaque;
+
+  input->pos = start;
+  ctx->output_type = type;
+  ret = paperkey_extract(ctx, input, &output);
+  ctx->output_type = saved;
+  return ret;
+}
+
+static int encode_qr(struct paperkey_ctx *ctx, struct stream *input,
+                     int start, const struct render_options *options,
+                     struct qr_symbol *symbols, size_t *count) {
+  struct raw_buffer raw;
+  int ret = -1;
+
+  raw.len = 0;
+  raw.size = QR_MAX_SYMBOLS * qr_capacity(QR_MAX_VERSION, QR_ECC_L, 1);
+  raw.buf = ctx_malloc(ctx, raw.size);
+  if (raw.buf == NULL)
+    return -1;
+
+  if (extract_pass(ctx, input, start, RAW, raw_sink, &raw) == 0 &&
+      qr_encode(raw.buf, raw.len, &options->qr_options, symbols,
+                QR_MAX_SYMBOLS, count) == 0)
+    ret = 0;
+
+  ctx_free(ctx, raw.buf, raw.size);
+  return ret;
+}
+
+static int run_pass(struct renderer *r, struct stream *input, int start) {
+  enum data_type type = r->ctx->output_type;
+
+  r->page = 0;
+  r->open = 0;
+  r->len = 0;
+  r->failed = 0;
+
+  if (type == RAW ||
+      extract_pass(r->ctx, input, start, type, text_sink, r) != 0 ||
+      r->failed)
+    return -1;
+
+  if (r->len)
+    layout_line(r);
+  if (r->nsymbols)
+    layout_qr(r);
+  if (r->open)
+    end_page(r);
+  if (!r->dry)
+    epilogue(r);
+
+  return r->failed ? -1 : 0;
+}
+
+int paperkey_render(struct paperkey_ctx *ctx, struct stream *input,
+                    const struct render_options *options,
+                    struct stream *output) {
+  struct qr_symbol *symbols = NULL;
+  struct renderer r;
+  int start = input->pos, ret = -1;
+  double scale;
+
+  memset(&r, 0, sizeof(r));
+  r.ctx = ctx;
+  r.format = options->format;
+  r.output = output;
+
+  scale = r.format == RENDER_PBM
+              ? (options->dpi ? options->dpi : DEFAULT_DPI) / 72.0
+              : 1;
+  r.width = scale * (options->page_width > 0 ? options->page_width
+                                             : DEFAULT_PAGE_WIDTH);
+  r.height = scale * (options->page_height > 0 ? options->page_height
+                                               : DEFAULT_PAGE_HEIGHT);
+  r.margin = scale * (options->margin > 0 ? options->margin : DEFAULT_MARGIN);
+  r.font_size =
+      scale * (options->font_size > 0 ? options->font_size : DEFAULT_FONT_SIZE);
+  r.advance = ADVANCE * r.font_size;
+  r.pitch = LEADING * r.font_size;
+  r.module = scale * (options->qr_module > 0 ? options->qr_module
+                                             : DEFAULT_QR_MODULE);
+
+  /* Pixels are whole, and glyphs scale by whole pixels too. */
+  if (r.format == RENDER_PBM) {
+    r.width = (unsigned long)r.width;
+    r.height = (unsigned long)r.height;
+    r.margin = (unsigned long)r.margin;
+    r.advance = (unsigned long)r.advance;
+    r.pitch = (unsigned long)r.pitch;
+    r.module = (unsigned long)(r.module + 0.5);
+    r.glyph_scale = r.advance / 6 < r.pitch / 9 ? r.advance / 6 : r.pitch / 9;
+    if (r.glyph_scale == 0 || r.module == 0 || r.width > 65535 ||
+        r.height > 65535)
+      return -1;
+  }
+
+  if (r.format > RENDER_PBM || r.width <= 2 * r.margin || r.advance <= 0 ||
+      r.height - 2 * r.margin < 3 * r.pitch)
+    return -1;
+  r.columns = (r.width - 2 * r.margin) / r.advance;
+  if (r.columns >= sizeof(r.line))
+    r.columns = sizeof(r.line) - 1;
+
+  if (options->qr) {
+    symbols = ctx_malloc(ctx, QR_MAX_SYMBOLS * sizeof(*symbols));
+    if (symbols == NULL)
+      return -1;
+    if (encode_qr(ctx, input, start, options, symbols, &r.nsymbols) != 0)
+      goto out;
+    r.symbols = symbols;
+  }
+
+  r.dry = 1;
+  if (run_pass(&r, input, start) != 0)
+    goto out;
+  r.pages = r.page;
+
+  if (r.format == RENDER_PBM) {
+    r.row_bytes = ((unsigned long)r.width + 7) / 8;
+    r.row = ctx_malloc(ctx, r.row_bytes);
+    if (r.row == NULL)
+      goto out;
+  }
+
+  r.dry = 0;
+  ret = run_pass(&r, input, start);
+
+out:
+  ctx_free(ctx, r.row, r.row_bytes);
+  ctx_free(ctx, symbols, QR_MAX_SYMBOLS * sizeof(*symbols));
+  return ret;
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include "context.h"
+#include "qr.h"
+#include "stream.h"
+
+enum render_format { RENDER_SVG, RENDER_POSTSCRIPT, RENDER_PBM };
+
+struct render_options {
+  enum render_format format;
+  /* Page size and margin in points, 0 for A4 and half an inch. */
+  double page_width;
+  double page_height;
+  double margin;
+  /* Text size in points, 0 for 9. */
+  double font_size;
+  /* Resolution of PBM output, 0 for 300 dpi. */
+  unsigned int dpi;
+  /* Follow the text with the RAW extract as QR symbols, split and
+     leveled as qr_options asks, each module qr_module points wide (0
+     for 1.5). */
+  int qr;
+  struct qr_options qr_options;
+  double qr_module;
+};
+
+/* Extract the secrets of input as the context's text encoding and lay
+   them out on pages, each headed with the key fingerprint and page
+   number.  PostScript pages follow the DSC, PBM pages are consecutive
+   images in one file and SVG pages are stacked down one drawing.  The
+   text is laid out a line at a time as it is extracted, and PBM is
+   drawn a pixel row at a time, so output to a sink stream runs in
+   memory that does not depend on the size of the key.  Returns 0, or
+   -1 if the key cannot be extracted, a data line is too wide for the
+   page or a QR symbol too big for it, or the output fails. */
+int paperkey_render(struct paperkey_ctx *ctx, struct stream *input,
+                    const struct render_options *options,
+                    struct stream *output);
+
+#endif /* !_RENDER_H_ */
@@ -21,57 +21,74 @@
  */
 
 #include "restore.h"
+#include "armor.h"
 #include "config.h"
+#include "encode.h"
+#include "fpindex.h"
+#include "kbx.h"
+#include "internal.h"
+#include "metrics.h"
 #include "output.h"
 #include "packets.h"
 #include "parse.h"
-#include <ctype.h>
+#include "pscan.h"
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 struct key {
-  unsigned char fpr[20];
+  unsigned char fpr[MAX_FINGERPRINT];
+  size_t fpr_len;
   struct packet *packet;
   struct key *next;
 };
 
-static struct key *extract_keys(struct packet *packet) {
+static struct key *extract_keys(struct paperkey_ctx *ctx,
+                                struct packet *packet) {
   struct key *key = NULL;
   size_t idx = 1;
 
-  /* Check the version */
-  if (packet->len && packet->buf[0] != 0) {
+  /* Check the version; format 1 only adds version 6 keys. */
+  if (packet->len && packet->buf[0] > 1) {
     // fprintf(stderr, "Cannot handle secrets file version %d\n",
     // packet->buf[0]);
     return NULL;
   }
 
   while (idx < packet->len) {
-    /* 1+20+2 == version + fingerprint + length */
-    if (idx + 1 + 20 + 2 <= packet->len) {
-      if (packet->buf[idx] == 4) {
+    size_t fpr_len = fingerprint_length(packet->buf[idx]);
+
+    /* 1+fpr_len+2 == version + fingerprint + length */
+    if (idx + 1 + fpr_len + 2 <= packet->len) {
+      if (fpr_len) {
         unsigned int len;
         struct key *newkey;
 
-        newkey = xmalloc(sizeof(*newkey));
+        newkey = ctx_malloc(ctx, sizeof(*newkey));
+        if (newkey == NULL)
+          break;
         newkey->next = NULL;
 
         idx++;
-        memcpy(newkey->fpr, &packet->buf[idx], 20);
+        memcpy(newkey->fpr, &packet->buf[idx], fpr_len);
+        newkey->fpr_len = fpr_len;
 
-        idx += 20;
+        idx += fpr_len;
 
         len = packet->buf[idx++] << 8;
         len |= packet->buf[idx++];
 
         if (idx + len <= packet->len) {
-          newkey->packet = append_packet(NULL, &packet->buf[idx], len);
+          newkey->packet = append_packet(ctx, NULL, &packet->buf[idx], len);
+          if (newkey->packet == NULL) {
+            ctx_free(ctx, newkey, sizeof(*newkey));
+            break;
+          }
           idx += len;
         } else {
           // fprintf(stderr, "Warning: Short data in secret image\n");
-          free(newkey);
+          ctx_free(ctx, newkey, sizeof(*newkey));
           break;
         }
 
@@ -90,108 +107,318 @@ static struct key *extract_keys(struct packet *packet) {
   return key;
 }
 
-static void free_keys(struct key *key) {
+static void free_keys(struct paperkey_ctx *ctx, struct key *key) {
   while (key) {
     struct key *keytmp = key;
-    free_packet(key->packet);
+    free_packet(ctx, key->packet);
     key = key->next;
-    free(keytmp);
+    ctx_free(ctx, keytmp, sizeof(*keytmp));
   }
 }
 
-int restore(struct stream *pubring, struct stream *secrets,
-            enum data_type input_type, struct stream *output,
-            int ignore_crc_error) {
-  struct packet *secret;
-  unsigned int line_items;
-  unsigned long all_crc = CRC24_INIT;
-  unsigned int line = 0;
-  unsigned long line_crc = CRC24_INIT;
-  unsigned int b16_offset = 0;
+/* Turn the public key packets that match keys into secret ones and
+   copy the rest of their certificate, stopping at the certificate
+   after the first primary key that matched.  Only key packets are
+   hashed, in place; the user IDs, signatures and the like between them
+   are copied as they are, headers and all, one run at a time.  Trust
+   packets are left out when drop_trust is set. */
+static void restore_keys(struct paperkey_ctx *ctx, struct stream *pubring,
+                         struct key *keys, int drop_trust) {
+  int did_pubkey = 0, run = -1;
+  unsigned int count = 0;
 
-  if (input_type == AUTO) {
-    int test = stream_getc(secrets);
+  for (;;) {
+    int start = pubring->pos;
+    unsigned char type, fpr[MAX_FINGERPRINT];
+    unsigned int length;
+    struct packet pubkey;
+    struct key *keyidx;
 
-    if (test == EOF) {
-      // fprintf(stderr, "Unable to check type of secrets file\n");
-      return 1;
-    } else if (isascii(test) && isprint(test))
-      input_type = BASE16;
-    else
-      input_type = RAW;
+    if (parse_packet_header(pubring, &type, &length) != 0 ||
+        length > (unsigned int)stream_leftbyte(pubring) ||
+        ctx_admit_packet(ctx, &count, type, length) != 0) {
+      pubring->pos = start;
+      break;
+    }
+
+    if (type == 12 && drop_trust) {
+      /* gpg keeps its trust packets in the keybox, and never exports
+         them. */
+      if (run >= 0) {
+        output_passthrough(ctx, &pubring->buffer[run], start - run);
+        run = -1;
+      }
+      pubring->pos += length;
+      continue;
+    }
+
+    if (type != 6 && type != 14) {
+      /* Copy the usual user ID, sigs, etc, so the key is
+         well-formed. */
+      if (did_pubkey && run < 0)
+        run = start;
+      pubring->pos += length;
+      continue;
+    }
+
+    if (run >= 0) {
+      output_passthrough(ctx, &pubring->buffer[run], start - run);
+      run = -1;
+    }
+
+    if (type == 6 && did_pubkey) {
+      pubring->pos = start;
+      break;
+    }
 
-    secrets->pos--;
+    /* Public key or subkey */
+    pubkey.type = type;
+    pubkey.buf = &pubring->buffer[pubring->pos];
+    pubkey.len = pubkey.size = length;
+    pubring->pos += length;
+
+    if (length == 0 || key_fingerprint(ctx, &pubkey, length, fpr) != 0)
+      continue;
+
+    /* Do we have a secret key that matches? */
+    for (keyidx = keys; keyidx; keyidx = keyidx->next) {
+      if (keyidx->fpr_len == fingerprint_length(pubkey.buf[0]) &&
+          memcmp(fpr, keyidx->fpr, keyidx->fpr_len) == 0) {
+        if (type == 6)
+          did_pubkey = 1;
+
+        /* Match, so create a secret key. */
+        output_openpgp_header(ctx, type == 6 ? 5 : 7,
+                              length + keyidx->packet->len,
+                              pubring->buffer[start] & 0x40);
+        output_bytes(ctx, pubkey.buf, length);
+        output_packet(ctx, keyidx->packet);
+      }
+    }
   }
 
-  secret = read_secrets_file(secrets, input_type, ignore_crc_error);
-  if (secret) {
-    struct packet *pubkey;
-    struct key *keys;
-    int did_pubkey = 0;
+  if (run >= 0)
+    output_passthrough(ctx, &pubring->buffer[run], pubring->pos - run);
+}
 
-    /* Build a list of all keys.  We need to do this since the
-       public key we are transforming might have the subkeys in a
-       different order than (or not match subkeys at all with) our
-       secret data. */
+/* Narrow a copy of pubring to the certificate the index gives for one
+   of the keys, once its primary key packet is seen to be one of them
+   too, so a stale or mismatched index falls back to the scan. */
+static int find_certificate(struct paperkey_ctx *ctx, struct stream *pubring,
+                            struct key *keys, struct stream *view) {
+  struct key *key;
 
-    keys = extract_keys(secret);
-    if (keys) {
-      output_start(output, RAW, NULL, 0, &line_items);
+  for (key = keys; key; key = key->next) {
+    struct stream peek;
+    struct packet *primary;
+    unsigned char fpr[MAX_FINGERPRINT];
+    struct key *match = NULL;
+    uint64_t offset;
+    uint32_t length;
 
-      while ((pubkey = parse(pubring, 0, 0))) {
-        unsigned char ptag;
+    /* The index only holds version 4 fingerprints. */
+    if (key->fpr_len != 20 ||
+        paperkey_index_lookup(ctx->pubring_index, key->fpr, &offset,
+                              &length) != 0 ||
+        offset + length > (uint64_t)pubring->size)
+      continue;
 
-        if (pubkey->type == 6 || pubkey->type == 14) {
-          /* Public key or subkey */
-          unsigned char fpr[20];
-          struct key *keyidx;
+    peek = *pubring;
+    peek.pos = offset;
+    peek.size = offset + length;
+    primary = parse(ctx, &peek, 0, 0);
+    if (primary && primary->type == 6 && primary->len &&
+        key_fingerprint(ctx, primary, primary->len, fpr) == 0)
+      for (match = keys; match; match = match->next)
+        if (match->fpr_len == fingerprint_length(primary->buf[0]) &&
+            memcmp(fpr, match->fpr, match->fpr_len) == 0)
+          break;
+    free_packet(ctx, primary);
 
-          if (pubkey->type == 6 && did_pubkey)
-            break;
+    if (match) {
+      *view = *pubring;
+      view->pos = offset;
+      view->size = offset + length;
+      return 1;
+    }
+  }
 
-          calculate_fingerprint(pubkey, pubkey->len, fpr);
-
-          /* Do we have a secret key that matches? */
-          for (keyidx = keys; keyidx; keyidx = keyidx->next) {
-            if (memcmp(fpr, keyidx->fpr, 20) == 0) {
-              if (pubkey->type == 6) {
-                ptag = 5;
-                did_pubkey = 1;
-              } else
-                ptag = 7;
-
-              /* Match, so create a secret key. */
-              output_openpgp_header(
-                  output, RAW, ptag, pubkey->len + keyidx->packet->len,
-                  line_items, &all_crc, &line, &line_crc, &b16_offset);
-              output_packet(output, RAW, pubkey, line_items, &all_crc, &line,
-                            &line_crc, &b16_offset);
-              output_packet(output, RAW, keyidx->packet, line_items, &all_crc,
-                            &line, &line_crc, &b16_offset);
-            }
-          }
-        } else if (did_pubkey) {
-          /* Copy the usual user ID, sigs, etc, so the key is
-             well-formed. */
-          output_openpgp_header(output, RAW, pubkey->type, pubkey->len,
-                                line_items, &all_crc, &line, &line_crc,
-                                &b16_offset);
-          output_packet(output, RAW, pubkey, line_items, &all_crc, &line,
-                        &line_crc, &b16_offset);
-        }
+  return 0;
+}
+
+/* The secrets list the primary key first, and extract_keys() builds
+   its list backwards. */
+static const struct key *primary_key(const struct key *keys) {
+  while (keys->next)
+    keys = keys->next;
+  return keys;
+}
+
+/* Move pubring to the primary key packet with key's fingerprint, reading
+   only packet headers and hashing only primary key packets in place,
+   so other certificates are passed over without copying anything.
+   Leaves pubring where it was if there is no such key. */
+static int seek_primary(struct paperkey_ctx *ctx, struct stream *pubring,
+                        const struct key *key) {
+  int saved = pubring->pos;
+
+  /* On several threads the rest of the pubring has to be well formed;
+     otherwise the walk below stops where it goes wrong.  The parallel
+     scan only fingerprints version 4 keys. */
+  if (ctx->scan_threads > 1 && key->fpr_len == 20) {
+    uint64_t offset;
+
+    if (pscan_find_primary(ctx, &pubring->buffer[pubring->pos],
+                           stream_leftbyte(pubring), ctx->scan_threads,
+                           key->fpr, &offset) == 0) {
+      pubring->pos += offset;
+      return 0;
+    }
+  }
+
+  for (;;) {
+    int start = pubring->pos;
+    unsigned char type;
+    unsigned int length;
 
-        free_packet(pubkey);
+    if (parse_packet_header(pubring, &type, &length) != 0 ||
+        length > (unsigned int)stream_leftbyte(pubring))
+      break;
+
+    if (type == 6 && length) {
+      struct packet view;
+      unsigned char found[MAX_FINGERPRINT];
+
+      view.type = type;
+      view.buf = &pubring->buffer[pubring->pos];
+      view.len = view.size = length;
+      if (fingerprint_length(view.buf[0]) == key->fpr_len &&
+          key_fingerprint(ctx, &view, length, found) == 0 &&
+          memcmp(found, key->fpr, key->fpr_len) == 0) {
+        pubring->pos = start;
+        return 0;
       }
+    }
 
-      free_keys(keys);
-    } else {
-      // fprintf(stderr, "Unable to parse secret data\n");
-      return 1;
+    pubring->pos += length;
+  }
+
+  pubring->pos = saved;
+  return -1;
+}
+
+/* Build a list of all keys.  We need to do this since the public key
+   we are transforming might have the subkeys in a different order
+   than (or not match subkeys at all with) our secret data. */
+static struct key *decode_keys(struct paperkey_ctx *ctx,
+                               struct stream *secrets,
+                               enum data_type input_type) {
+  struct packet *secret;
+  struct key *keys;
+
+  if (input_type == AUTO) {
+    input_type = detect_data_type(secrets);
+    if (input_type == AUTO) {
+      // fprintf(stderr, "Unable to check type of secrets file\n");
+      return NULL;
     }
-  } else {
+  }
+
+  secret = read_secrets_file(ctx, secrets, input_type);
+  if (secret == NULL) {
     // fprintf(stderr, "Unable to read secrets file\n");
+    return NULL;
+  }
+
+  keys = extract_keys(ctx, secret);
+  free_packet(ctx, secret);
+  // if (keys == NULL)
+  //   fprintf(stderr, "Unable to parse secret data\n");
+  return keys;
+}
+
+static int restore_from(struct paperkey_ctx *ctx, struct stream *pubring,
+                        struct stream *secrets, enum data_type input_type,
+                        struct stream *output) {
+  struct armor_writer armor;
+  struct stream view, armored;
+  struct key *keys;
+
+  keys = decode_keys(ctx, secrets, input_type);
+  if (keys == NULL)
     return 1;
+
+  if (ctx->armor_output) {
+    armor_begin(&armor, output, "PRIVATE KEY BLOCK", &armored);
+    output = &armored;
+  }
+  output_start(ctx, output, RAW, NULL, 0);
+
+  if (kbx_detect(pubring)) {
+    /* A keybox names the keys of each keyblock up front. */
+    if (kbx_find(pubring, primary_key(keys)->fpr, primary_key(keys)->fpr_len,
+                 &view) == 0) {
+      restore_keys(ctx, &view, keys, 1);
+      pubring->pos = view.pos;
+    }
+  } else if (ctx->pubring_index &&
+             find_certificate(ctx, pubring, keys, &view)) {
+    restore_keys(ctx, &view, keys, 0);
+    pubring->pos = view.pos;
+  } else {
+    /* Without the primary key anywhere, fall back to whatever subkeys
+       match on the way through. */
+    seek_primary(ctx, pubring, primary_key(keys));
+    restore_keys(ctx, pubring, keys, 0);
   }
 
+  free_keys(ctx, keys);
+  if (ctx->armor_output && armor_end(&armor) != 0)
+    return 1;
+
   return 0;
 }
+
+static int restore_input(struct paperkey_ctx *ctx, struct stream *pubring,
+                         struct stream *secrets, enum data_type input_type,
+                         struct stream *output) {
+  struct stream *binary;
+  int ret;
+
+  if (!armor_detect(pubring))
+    return restore_from(ctx, pubring, secrets, input_type, output);
+
+  binary = armor_decode(ctx, pubring);
+  if (binary == NULL)
+    return 1;
+  ret = restore_from(ctx, binary, secrets, input_type, output);
+  armor_free(ctx, binary);
+  return ret;
+}
+
+int paperkey_restore(struct paperkey_ctx *ctx, struct stream *pubring,
+                     struct stream *secrets, enum data_type input_type,
+                     struct stream *output) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = 1;
+
+  if (ctx_admit(ctx, pubring, secrets) == 0)
+    ret = restore_input(ctx, pubring, secrets, input_type, output);
+  /* A certificate cut short by a limit is not a restore. */
+  if (paperkey_ctx_limit_hit(ctx) != PAPERKEY_LIMIT_NONE)
+    ret = 1;
+
+  metrics_record(ctx, PAPERKEY_METRIC_RESTORE, timer);
+  return ret;
+}
+
+int restore(struct stream *pubring, struct stream *secrets,
+            enum data_type input_type, struct stream *output,
+            int ignore_crc_error) {
+  struct paperkey_ctx ctx;
+
+  paperkey_ctx_init(&ctx);
+  ctx.ignore_crc_error = ignore_crc_error;
+
+  return paperkey_restore(&ctx, pubring, secrets, input_type, output);
+}
@@ -0,0 +1,430 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "service.h"
+#include "armor.h"
+#include "fpindex.h"
+#include "internal.h"
+#include "kbx.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* One loaded pubring.  It stays until no request holds it, so a reload
+   never pulls the mapping out from under a running restore. */
+struct ring {
+  const unsigned char *map;
+  size_t map_len;
+  /* The pubring itself, or what its armor decodes to. */
+  struct stream *binary;
+  struct stream view;
+  struct paperkey_index *index;
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  unsigned int refs;
+  struct ring *next;
+};
+
+struct paperkey_service {
+  struct paperkey_ctx *ctx;
+  pthread_mutex_t lock;
+  size_t count;
+  char **paths;
+  struct ring **rings;
+  /* Replaced by a reload, but maybe still in use. */
+  struct ring *retired;
+};
+
+static void put_be(unsigned char *p, uint32_t value, int bytes) {
+  while (bytes--) {
+    p[bytes] = value & 0xFF;
+    value >>= 8;
+  }
+}
+
+static uint32_t get_be(const unsigned char *p, int bytes) {
+  uint32_t value = 0;
+
+  while (bytes--)
+    value = value << 8 | *p++;
+  return value;
+}
+
+static int changed(const struct ring *ring, const struct stat *st) {
+  return ring->dev != st->st_dev || ring->ino != st->st_ino ||
+         ring->size != st->st_size || ring->mtime != st->st_mtime;
+}
+
+static void ring_free(struct paperkey_ctx *ctx, struct ring *ring) {
+  paperkey_index_close(ctx, ring->index);
+  armor_free(ctx, ring->binary);
+  if (ring->map_len)
+    munmap((void *)ring->map, ring->map_len);
+  ctx_free(ctx, ring, sizeof(*ring));
+}
+
+static struct ring *ring_load(struct paperkey_ctx *ctx, const char *path) {
+  struct ring *ring;
+  struct stat st;
+  void *p = NULL;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  /* Streams count in ints. */
+  if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > INT_MAX ||
+      (p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+          MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  ring = ctx_malloc(ctx, sizeof(*ring));
+  if (ring == NULL) {
+    munmap(p, st.st_size);
+    return NULL;
+  }
+  memset(ring, 0, sizeof(*ring));
+  ring->map = p;
+  ring->map_len = st.st_size;
+  ring->dev = st.st_dev;
+  ring->ino = st.st_ino;
+  ring->size = st.st_size;
+  ring->mtime = st.st_mtime;
+
+  /* Restore only reads the pubring, so the mapping serves as one. */
+  ring->view.buffer = (unsigned char *)ring->map;
+  ring->view.size = ring->view.memsize = st.st_size;
+
+  if (armor_detect(&ring->view)) {
+    ring->binary = armor_decode(ctx, &ring->view);
+    if (ring->binary == NULL)
+      goto fail;
+    ring->view = *ring->binary;
+    ring->view.pos = 0;
+  }
+
+  /* A keybox lists its own fingerprints, which restore reads instead
+     of an index. */
+  if (!kbx_detect(&ring->view)) {
+    ring->index =
+        paperkey_index_scan(ctx, ring->view.buffer, ring->view.size);
+    if (ring->index == NULL)
+      goto fail;
+  }
+
+  return ring;
+
+fail:
+  ring_free(ctx, ring);
+  return NULL;
+}
+
+struct paperkey_service *paperkey_service_new(struct paperkey_ctx *ctx,
+                                              const char *const *paths,
+                                              size_t count) {
+  struct paperkey_service *service;
+  size_t i;
+
+  if (count == 0 || count > 256)
+    return NULL;
+
+  service = ctx_malloc(ctx, sizeof(*service));
+  if (service == NULL)
+    return NULL;
+  memset(service, 0, sizeof(*service));
+  service->ctx = ctx;
+  pthread_mutex_init(&service->lock, NULL);
+
+  service->paths = ctx_malloc(ctx, count * sizeof(*service->paths));
+  service->rings = ctx_malloc(ctx, count * sizeof(*service->rings));
+  if (service->paths == NULL || service->rings == NULL) {
+    ctx_free(ctx, service->paths, count * sizeof(*service->paths));
+    ctx_free(ctx, service->rings, count * sizeof(*service->rings));
+    pthread_mutex_destroy(&service->lock);
+    ctx_free(ctx, service, sizeof(*service));
+    return NULL;
+  }
+  memset(service->paths, 0, count * sizeof(*service->paths));
+  memset(service->rings, 0, count * sizeof(*service->rings));
+  service->count = count;
+
+  for (i = 0; i < count; i++) {
+    size_t len = strlen(paths[i]) + 1;
+
+    service->paths[i] = ctx_malloc(ctx, len);
+    if (service->paths[i] == NULL)
+      goto fail;
+    memcpy(service->paths[i], paths[i], len);
+
+    service->rings[i] = ring_load(ctx, paths[i]);
+    if (service->rings[i] == NULL)
+      goto fail;
+  }
+
+  return service;
+
+fail:
+  paperkey_service_free(service);
+  return NULL;
+}
+
+int paperkey_service_reload(struct paperkey_service *service) {
+  struct ring **link, *done = NULL;
+  int reloaded = 0, failed = 0;
+  size_t i;
+
+  for (i = 0; i < service->count; i++) {
+    struct ring *ring;
+    struct stat st;
+
+    /* Only this thread replaces rings, so reading it unlocked is
+       safe. */
+    if (stat(service->paths[i], &st) != 0) {
+      failed = 1;
+      continue;
+    }
+    if (!changed(service->rings[i], &st))
+      continue;
+
+    ring = ring_load(service->ctx, service->paths[i]);
+    if (ring == NULL) {
+      failed = 1;
+      continue;
+    }
+
+    pthread_mutex_lock(&service->lock);
+    service->rings[i]->next = service->retired;
+    service->retired = service->rings[i];
+    service->rings[i] = ring;
+    pthread_mutex_unlock(&service->lock);
+    reloaded++;
+  }
+
+  /* Collect the retired rings nothing holds any more, and free them
+     outside the lock. */
+  pthread_mutex_lock(&service->lock);
+  for (link = &service->retired; *link;) {
+    struct ring *ring = *link;
+
+    if (ring->refs == 0) {
+      *link = ring->next;
+      ring->next = done;
+      done = ring;
+    } else {
+      link = &ring->next;
+    }
+  }
+  pthread_mutex_unlock(&service->lock);
+
+  while (done) {
+    struct ring *next = done->next;
+
+    ring_free(service->ctx, done);
+    done = next;
+  }
+
+  return failed ? -1 : reloaded;
+}
+
+void paperkey_service_free(struct paperkey_service *service) {
+  struct paperkey_ctx *ctx;
+  size_t i;
+
+  if (service == NULL)
+    return;
+  ctx = service->ctx;
+
+  for (i = 0; i < service->count; i++) {
+    if (service->paths[i])
+      ctx_free(ctx, service->paths[i], strlen(service->paths[i]) + 1);
+    if (service->rings[i])
+      ring_free(ctx, service->rings[i]);
+  }
+  while (service->retired) {
+    struct ring *next = service->retired->next;
+
+    ring_free(ctx, service->retired);
+    service->retired = next;
+  }
+
+  ctx_free(ctx, service->paths, service->count * sizeof(*service->paths));
+  ctx_free(ctx, service->rings, service->count * sizeof(*service->rings));
+  pthread_mutex_destroy(&service->lock);
+  ctx_free(ctx, service, sizeof(*service));
+}
+
+/* Returns 1 with all of buf, 0 at the end of the input before any of
+   it, or -1. */
+static int read_full(int fd, void *buf, size_t len) {
+  unsigned char *p = buf;
+  size_t got = 0;
+
+  while (got < len) {
+    ssize_t n = read(fd, p + got, len - got);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return n == 0 && got == 0 ? 0 : -1;
+    got += n;
+  }
+  return 1;
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+
+  while (len) {
+    ssize_t n = write(fd, p, len);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+static enum service_status answer(struct paperkey_service *service,
+                                  struct paperkey_ctx *ctx,
+                                  const unsigned char *request, size_t len,
+                                  struct stream *out) {
+  unsigned char op = request[0], type = request[1], number = request[2];
+  struct stream in;
+  struct ring *ring;
+  int ret;
+
+  if (type > BASE45 || (op != SERVICE_EXTRACT && op != SERVICE_RESTORE) ||
+      (op == SERVICE_RESTORE && number >= service->count))
+    return SERVICE_BAD_REQUEST;
+
+  memset(&in, 0, sizeof(in));
+  in.buffer = (unsigned char *)&request[SERVICE_REQUEST_HEADER - 4];
+  in.size = in.memsize = len - (SERVICE_REQUEST_HEADER - 4);
+
+  if (op == SERVICE_EXTRACT) {
+    paperkey_ctx_set_output_type(ctx, type);
+    return paperkey_extract(ctx, &in, out) == 0 ? SERVICE_OK : SERVICE_FAILED;
+  }
+
+  pthread_mutex_lock(&service->lock);
+  ring = service->rings[number];
+  ring->refs++;
+  pthread_mutex_unlock(&service->lock);
+
+  {
+    struct stream pubring = ring->view;
+
+    paperkey_ctx_set_pubring_index(ctx, ring->index);
+    ret = paperkey_restore(ctx, &pubring, &in, type, out);
+    paperkey_ctx_set_pubring_index(ctx, NULL);
+  }
+
+  pthread_mutex_lock(&service->lock);
+  ring->refs--;
+  pthread_mutex_unlock(&service->lock);
+
+  return ret == 0 ? SERVICE_OK : SERVICE_FAILED;
+}
+
+int paperkey_service_serve(struct paperkey_service *service,
+                           struct paperkey_ctx *ctx, int fd) {
+  unsigned char head[SERVICE_RESPONSE_HEADER], *request = NULL;
+  size_t request_size = 0;
+  struct stream out;
+  int ret = -1;
+
+  /* Both buffers are kept from one request to the next.  The output
+     grows the way any stream does. */
+  memset(&out, 0, sizeof(out));
+  out.buffer = malloc(1);
+  out.memsize = 1;
+  if (out.buffer == NULL)
+    return -1;
+
+  for (;;) {
+    enum service_status status;
+    uint32_t len;
+    int r;
+
+    r = read_full(fd, head, 4);
+    if (r <= 0) {
+      ret = r;
+      break;
+    }
+    len = get_be(head, 4);
+    if (len < SERVICE_REQUEST_HEADER - 4 || len > SERVICE_MAX_FRAME)
+      break;
+
+    if (len > request_size) {
+      unsigned char *tmp = ctx_realloc(ctx, request, request_size, len);
+
+      if (tmp == NULL)
+        break;
+      request = tmp;
+      request_size = len;
+    }
+    if (read_full(fd, request, len) != 1)
+      break;
+
+    out.size = out.pos = 0;
+    status = answer(service, ctx, request, len, &out);
+    if (status != SERVICE_OK || out.size > SERVICE_MAX_FRAME - 1)
+      out.size = 0;
+
+    put_be(head, out.size + 1, 4);
+    head[4] = status;
+    if (write_full(fd, head, sizeof(head)) != 0 ||
+        write_full(fd, out.buffer, out.size) != 0)
+      break;
+  }
+
+  ctx_free(ctx, request, request_size);
+  free(out.buffer);
+  return ret;
+}
+
+ssize_t paperkey_service_call(int fd, enum service_op op, enum data_type type,
+                              unsigned int pubring, const void *data,
+                              size_t len, void *out, size_t out_size,
+                              enum service_status *status) {
+  unsigned char head[SERVICE_REQUEST_HEADER];
+  uint32_t body;
+
+  if (len > SERVICE_MAX_FRAME - (SERVICE_REQUEST_HEADER - 4) || pubring > 255)
+    return -1;
+
+  put_be(head, len + SERVICE_REQUEST_HEADER - 4, 4);
+  head[4] = op;
+  head[5] = type;
+  head[6] = pubring;
+  head[7] = 0;
+  if (write_full(fd, head, sizeof(head)) != 0 ||
+      write_full(fd, data, len) != 0)
+    return -1;
+
+  if (read_full(fd, head, SERVICE_RESPONSE_HEADER) != 1)
+    return -1;
+  body = get_be(head, 4);
+  if (body == 0 || body - 1 > out_size ||
+      (body > 1 && read_full(fd, out, body - 1) != 1))
+    return -1;
+
+  *status = head[4];
+  return body - 1;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _SERVICE_H_
+#define _SERVICE_H_
+
+#include "context.h"
+#include "output.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A long-lived extract and restore service.  Each configured pubring is
+   mapped once (decoded once if armored) and indexed in memory, so a
+   restore is an index lookup and a copy of one certificate instead of a
+   read and scan of the whole file.  Requests come as length-prefixed
+   frames on a connected socket, any number on one connection, one at a
+   time:
+
+     request   4  length of the rest
+               1  operation, SERVICE_EXTRACT or SERVICE_RESTORE
+               1  data type (enum data_type): the output type of an
+                  extract, the input type of a restore
+               1  pubring number, in the order configured, for a restore
+               1  zero
+               n  the secret key to extract, or the secrets to restore
+
+     response  4  length of the rest
+               1  status (enum service_status)
+               n  the extracted secrets or the restored secret key
+
+   Numbers are big endian. */
+
+#define SERVICE_MAX_FRAME (16 << 20)
+#define SERVICE_REQUEST_HEADER 8
+#define SERVICE_RESPONSE_HEADER 5
+
+enum service_op { SERVICE_EXTRACT = 1, SERVICE_RESTORE = 2 };
+
+enum service_status {
+  SERVICE_OK,
+  /* The request was understood but the extract or restore failed. */
+  SERVICE_FAILED,
+  /* Unknown operation, data type or pubring number. */
+  SERVICE_BAD_REQUEST
+};
+
+struct paperkey_service;
+
+/* Map and index the pubrings, scanning on the scan threads of ctx.
+   The service keeps ctx for its own memory, used only by the reload
+   and free calls; requests are served with contexts of their own.
+   Returns NULL if a pubring cannot be used, or for more than 256 of
+   them. */
+struct paperkey_service *paperkey_service_new(struct paperkey_ctx *ctx,
+                                              const char *const *paths,
+                                              size_t count);
+
+/* Map and index again each pubring whose file has changed: another
+   file renamed over it, or a new size or mtime.  Requests already
+   running keep the old mapping, which is released by a later reload
+   once they are done, so call this from one thread only.  Returns the
+   number of pubrings reloaded, or -1 if one could not be, which keeps
+   its old mapping. */
+int paperkey_service_reload(struct paperkey_service *service);
+
+/* Answer requests on fd until the peer closes it.  Returns 0 at the end
+   of a frame, or -1 on a read or write error or a frame that is too
+   long or cut short.  Any number of threads may serve at once, each
+   with its own ctx. */
+int paperkey_service_serve(struct paperkey_service *service,
+                           struct paperkey_ctx *ctx, int fd);
+
+/* Only once nothing is being served. */
+void paperkey_service_free(struct paperkey_service *service);
+
+/* Send one request and wait for its response, whose body is read into
+   out if it fits.  Returns the length of the body with its status in
+   *status, or -1 if the connection fails or the body is longer than
+   out_size, either of which leaves the connection unusable. */
+ssize_t paperkey_service_call(int fd, enum service_op op, enum data_type type,
+                              unsigned int pubring, const void *data,
+                              size_t len, void *out, size_t out_size,
+                              enum service_status *status);
+
+#endif /* !_SERVICE_H_ */
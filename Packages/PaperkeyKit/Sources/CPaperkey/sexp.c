@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "sexp.h"
+#include "encode.h"
+#include "internal.h"
+#include <string.h>
+
+/* Deeper than any key file nests. */
+#define MAX_DEPTH 32
+
+struct parser {
+  struct paperkey_ctx *ctx;
+  const unsigned char *buf;
+  size_t len;
+  size_t pos;
+  struct sexp_tree *tree;
+  size_t text_len;
+};
+
+static int is_space(unsigned char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+         c == '\v';
+}
+
+static int is_token(unsigned char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || strchr("-./_:*+=", c) != NULL;
+}
+
+static struct sexp *add_node(struct parser *p) {
+  struct sexp_tree *tree = p->tree;
+
+  if (tree->count == tree->size) {
+    size_t size = tree->size ? tree->size * 2 : 32;
+    struct sexp *tmp;
+
+    tmp = ctx_realloc(p->ctx, tree->nodes, tree->size * sizeof(*tree->nodes),
+                      size * sizeof(*tree->nodes));
+    if (tmp == NULL)
+      return NULL;
+    tree->nodes = tmp;
+    tree->size = size;
+  }
+
+  tree->nodes[tree->count].end = tree->count + 1;
+  return &tree->nodes[tree->count++];
+}
+
+/* Room for the decoded form of an atom, which is never longer than
+   what is left of the input.  The buffer is only made when the input
+   turns out not to be canonical. */
+static unsigned char *text_space(struct parser *p) {
+  struct sexp_tree *tree = p->tree;
+
+  if (tree->text == NULL) {
+    tree->text = ctx_malloc(p->ctx, p->len);
+    if (tree->text == NULL)
+      return NULL;
+    tree->text_size = p->len;
+  }
+  return &tree->text[p->text_len];
+}
+
+static int add_atom(struct parser *p, const unsigned char *data, size_t len) {
+  struct sexp *node = add_node(p);
+
+  if (node == NULL)
+    return -1;
+  node->data = data;
+  node->len = len;
+  return 0;
+}
+
+/* An atom written out, which the caller has decoded into text_space(). */
+static int add_text(struct parser *p, size_t len) {
+  unsigned char *text = &p->tree->text[p->text_len];
+
+  p->text_len += len;
+  return add_atom(p, text, len);
+}
+
+static int parse_verbatim(struct parser *p) {
+  size_t len = 0;
+
+  while (p->pos < p->len && p->buf[p->pos] >= '0' && p->buf[p->pos] <= '9') {
+    if (len > p->len)
+      return -1;
+    len = len * 10 + (p->buf[p->pos++] - '0');
+  }
+
+  if (p->pos >= p->len || p->buf[p->pos++] != ':' || len > p->len - p->pos)
+    return -1;
+
+  p->pos += len;
+  return add_atom(p, &p->buf[p->pos - len], len);
+}
+
+static int parse_hex(struct parser *p) {
+  unsigned char *out = text_space(p);
+  size_t len = 0;
+  int high = -1;
+
+  if (out == NULL)
+    return -1;
+
+  for (p->pos++; p->pos < p->len && p->buf[p->pos] != '#'; p->pos++) {
+    int value = hex_value(p->buf[p->pos]);
+
+    if (value < 0) {
+      if (!is_space(p->buf[p->pos]))
+        return -1;
+    } else if (high < 0) {
+      high = value;
+    } else {
+      out[len++] = high << 4 | value;
+      high = -1;
+    }
+  }
+
+  if (p->pos++ >= p->len || high >= 0)
+    return -1;
+  return add_text(p, len);
+}
+
+static int parse_base64(struct parser *p) {
+  unsigned char *out = text_space(p);
+  size_t len = 0;
+  ssize_t n;
+
+  if (out == NULL)
+    return -1;
+
+  /* Gather the characters without spaces or padding, then decode them
+     in place; the output never overtakes the input. */
+  for (p->pos++; p->pos < p->len && p->buf[p->pos] != '|'; p->pos++)
+    if (!is_space(p->buf[p->pos]) && p->buf[p->pos] != '=')
+      out[len++] = p->buf[p->pos];
+
+  if (p->pos++ >= p->len)
+    return -1;
+  n = decode_data(BASE64, out, (const char *)out, len);
+  if (n < 0)
+    return -1;
+  return add_text(p, n);
+}
+
+static int parse_string(struct parser *p) {
+  unsigned char *out = text_space(p);
+  size_t len = 0;
+
+  if (out == NULL)
+    return -1;
+
+  for (p->pos++; p->pos < p->len && p->buf[p->pos] != '"'; p->pos++) {
+    unsigned char c = p->buf[p->pos];
+
+    if (c == '\\') {
+      const char *from = "btvnfr\"'\\", *to = "\b\t\v\n\f\r\"'\\";
+      const char *escape;
+
+      if (++p->pos >= p->len)
+        return -1;
+      c = p->buf[p->pos];
+
+      if (c && (escape = strchr(from, c))) {
+        c = to[escape - from];
+      } else if (c == 'x' && p->pos + 2 < p->len &&
+                 hex_value(p->buf[p->pos + 1]) >= 0 &&
+                 hex_value(p->buf[p->pos + 2]) >= 0) {
+        c = hex_value(p->buf[p->pos + 1]) << 4 | hex_value(p->buf[p->pos + 2]);
+        p->pos += 2;
+      } else if (c == '\r' || c == '\n') {
+        /* A line continuation. */
+        if (p->pos + 1 < p->len && p->buf[p->pos + 1] != c &&
+            (p->buf[p->pos + 1] == '\r' || p->buf[p->pos + 1] == '\n'))
+          p->pos++;
+        continue;
+      } else if (c >= '0' && c <= '7' && p->pos + 2 < p->len) {
+        int i, value = 0;
+
+        for (i = 0; i < 3; i++) {
+          if (p->buf[p->pos + i] < '0' || p->buf[p->pos + i] > '7')
+            return -1;
+          value = value << 3 | (p->buf[p->pos + i] - '0');
+        }
+        c = value;
+        p->pos += 2;
+      } else {
+        return -1;
+      }
+    }
+
+    out[len++] = c;
+  }
+
+  if (p->pos++ >= p->len)
+    return -1;
+  return add_text(p, len);
+}
+
+static int parse_token(struct parser *p) {
+  size_t start = p->pos;
+
+  while (p->pos < p->len && is_token(p->buf[p->pos]))
+    p->pos++;
+  return add_atom(p, &p->buf[start], p->pos - start);
+}
+
+int sexp_parse(struct paperkey_ctx *ctx, const unsigned char *buf,
+               size_t len, struct sexp_tree *tree) {
+  struct parser p;
+  size_t open[MAX_DEPTH];
+  int depth = 0;
+
+  memset(tree, 0, sizeof(*tree));
+  p.ctx = ctx;
+  p.buf = buf;
+  p.len = len;
+  p.pos = 0;
+  p.tree = tree;
+  p.text_len = 0;
+
+  for (;;) {
+    unsigned char c;
+    int ret;
+
+    while (p.pos < len && is_space(buf[p.pos]))
+      p.pos++;
+    if (p.pos >= len)
+      goto fail;
+    c = buf[p.pos];
+
+    if (c == '(') {
+      struct sexp *node;
+
+      if (depth == MAX_DEPTH || (node = add_node(&p)) == NULL)
+        goto fail;
+      node->data = NULL;
+      node->len = 0;
+      open[depth++] = tree->count - 1;
+      p.pos++;
+      continue;
+    }
+
+    if (c == ')') {
+      if (depth == 0)
+        goto fail;
+      tree->nodes[open[--depth]].end = tree->count;
+      p.pos++;
+      if (depth == 0)
+        return 0;
+      continue;
+    }
+
+    /* Only lists at the top. */
+    if (depth == 0)
+      goto fail;
+
+    if (c >= '0' && c <= '9')
+      ret = parse_verbatim(&p);
+    else if (c == '#')
+      ret = parse_hex(&p);
+    else if (c == '|')
+      ret = parse_base64(&p);
+    else if (c == '"')
+      ret = parse_string(&p);
+    else if (is_token(c))
+      ret = parse_token(&p);
+    else
+      ret = -1;
+    if (ret != 0)
+      goto fail;
+  }
+
+fail:
+  sexp_tree_free(ctx, tree);
+  return -1;
+}
+
+void sexp_tree_free(struct paperkey_ctx *ctx, struct sexp_tree *tree) {
+  ctx_free(ctx, tree->nodes, tree->size * sizeof(*tree->nodes));
+  ctx_free(ctx, tree->text, tree->text_size);
+  memset(tree, 0, sizeof(*tree));
+}
+
+int sexp_is(const struct sexp *node, const char *token) {
+  return node->data && node->len == strlen(token) &&
+         memcmp(node->data, token, node->len) == 0;
+}
+
+size_t sexp_find(const struct sexp_tree *tree, size_t list, const char *token) {
+  size_t i;
+
+  for (i = list + 1; i < tree->nodes[list].end; i = tree->nodes[i].end)
+    if (tree->nodes[i].data == NULL && tree->nodes[i].end > i + 1 &&
+        sexp_is(&tree->nodes[i + 1], token))
+      return i;
+  return 0;
+}
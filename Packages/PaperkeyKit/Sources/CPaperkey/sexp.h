@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _SEXP_H_
+#define _SEXP_H_
+
+#include <stddef.h>
+
+struct paperkey_ctx;
+
+/* One element of a parsed S-expression.  The elements are kept in a
+   flat array in the order they appear, so the first element of a list
+   directly follows it, and end says where the list stops. */
+struct sexp {
+  /* The bytes of an atom, NULL for a list. */
+  const unsigned char *data;
+  size_t len;
+  /* For a list, the index just past its last element.  For an atom,
+     its own index plus one. */
+  size_t end;
+};
+
+struct sexp_tree {
+  struct sexp *nodes;
+  size_t count;
+  size_t size;
+  /* Atoms that had to be decoded, such as hex or quoted strings. */
+  unsigned char *text;
+  size_t text_size;
+};
+
+/* Parse one S-expression, in canonical form ("(3:rsa(1:n3:...))") or
+   in the advanced form GnuPG writes to its extended key files
+   ("(rsa (n #00E3...#))"), including tokens, quoted strings, #hex#
+   and |base64| atoms.  Canonical atoms point into buf, which must
+   outlive the tree.  Returns 0, or -1 if buf is not a single
+   S-expression or memory runs out. */
+int sexp_parse(struct paperkey_ctx *ctx, const unsigned char *buf,
+               size_t len, struct sexp_tree *tree);
+void sexp_tree_free(struct paperkey_ctx *ctx, struct sexp_tree *tree);
+
+/* Whether an element is an atom holding exactly this string. */
+int sexp_is(const struct sexp *node, const char *token);
+
+/* The index of the list directly inside list whose first element is
+   token, or 0 if there is none. */
+size_t sexp_find(const struct sexp_tree *tree, size_t list, const char *token);
+
+#endif /* !_SEXP_H_ */
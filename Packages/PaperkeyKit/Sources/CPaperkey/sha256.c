@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "sha256.h"
+#include <string.h>
+
+/* The SHA extensions are chosen at run time, like the SSSE3 base64
+   code, so the build needs no special flags. */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SHA256_SHANI
+#include <cpuid.h>
+#include <immintrin.h>
+#include <pthread.h>
+#endif
+
+static const uint32_t K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+#define ROTR(_x, _n) (((_x) >> (_n)) | ((_x) << (32 - (_n))))
+
+static void process_blocks_generic(uint32_t state[8], const unsigned char *data,
+                                   size_t blocks) {
+  for (; blocks; blocks--, data += 64) {
+    uint32_t w[64], a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+      w[i] = (uint32_t)data[4 * i] << 24 | (uint32_t)data[4 * i + 1] << 16 |
+             (uint32_t)data[4 * i + 2] << 8 | data[4 * i + 3];
+    for (; i < 64; i++) {
+      uint32_t s0 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; i++) {
+      uint32_t t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) +
+                    ((e & f) ^ (~e & g)) + K[i] + w[i];
+      uint32_t t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) +
+                    ((a & b) ^ (a & c) ^ (b & c));
+
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#ifdef SHA256_SHANI
+/* The state is kept as ABEF and CDGH for sha256rnds2, which does two
+   rounds at a time; the message schedule takes four words a step with
+   sha256msg1 and sha256msg2. */
+__attribute__((target("sha,sse4.1"))) static void
+process_blocks_shani(uint32_t state[8], const unsigned char *data,
+                     size_t blocks) {
+  const __m128i swap =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, tmp;
+
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xB1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1B);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (; blocks; blocks--, data += 64) {
+    __m128i abef = state0, cdgh = state1, msg[4];
+    int i;
+
+    for (i = 0; i < 16; i++) {
+      __m128i m;
+
+      if (i < 4) {
+        msg[i] = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)&data[16 * i]), swap);
+      } else {
+        m = _mm_sha256msg1_epu32(msg[i % 4], msg[(i + 1) % 4]);
+        m = _mm_add_epi32(m, _mm_alignr_epi8(msg[(i + 3) % 4],
+                                             msg[(i + 2) % 4], 4));
+        msg[i % 4] = _mm_sha256msg2_epu32(m, msg[(i + 3) % 4]);
+      }
+
+      m = _mm_add_epi32(msg[i % 4],
+                        _mm_loadu_si128((const __m128i *)&K[4 * i]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, m);
+      state0 = _mm_sha256rnds2_epu32(state0, state1,
+                                     _mm_shuffle_epi32(m, 0x0E));
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i *)&state[0], state0);
+  _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+static pthread_once_t shani_once = PTHREAD_ONCE_INIT;
+static int have_shani;
+
+static void check_shani(void) {
+  unsigned int a, b, c, d;
+
+  /* SHA is bit 29 of EBX in leaf 7; SSE4.1 is bit 19 of ECX in leaf 1. */
+  if (__get_cpuid(1, &a, &b, &c, &d) && (c & (1u << 19)) &&
+      __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 29)))
+    have_shani = 1;
+}
+#endif
+
+static void process_blocks(uint32_t state[8], const unsigned char *data,
+                           size_t blocks) {
+#ifdef SHA256_SHANI
+  pthread_once(&shani_once, check_shani);
+  if (have_shani) {
+    process_blocks_shani(state, data, blocks);
+    return;
+  }
+#endif
+  process_blocks_generic(state, data, blocks);
+}
+
+void sha256_init_ctx(struct sha256_ctx *ctx) {
+  static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19};
+
+  memcpy(ctx->state, init, sizeof(init));
+  ctx->total = 0;
+  ctx->buflen = 0;
+}
+
+void sha256_process_bytes(const void *buffer, size_t len,
+                          struct sha256_ctx *ctx) {
+  const unsigned char *data = buffer;
+
+  ctx->total += len;
+
+  if (ctx->buflen) {
+    size_t take = 64 - ctx->buflen;
+
+    if (take > len)
+      take = len;
+    memcpy(&ctx->buffer[ctx->buflen], data, take);
+    ctx->buflen += take;
+    data += take;
+    len -= take;
+
+    if (ctx->buflen < 64)
+      return;
+    process_blocks(ctx->state, ctx->buffer, 1);
+    ctx->buflen = 0;
+  }
+
+  /* Whole blocks straight from the caller's buffer. */
+  if (len >= 64) {
+    process_blocks(ctx->state, data, len / 64);
+    data += len / 64 * 64;
+    len %= 64;
+  }
+
+  memcpy(ctx->buffer, data, len);
+  ctx->buflen = len;
+}
+
+void *sha256_finish_ctx(struct sha256_ctx *ctx, void *resbuf) {
+  unsigned char *out = resbuf;
+  uint64_t bits = ctx->total * 8;
+  int i;
+
+  ctx->buffer[ctx->buflen++] = 0x80;
+  if (ctx->buflen > 56) {
+    memset(&ctx->buffer[ctx->buflen], 0, 64 - ctx->buflen);
+    process_blocks(ctx->state, ctx->buffer, 1);
+    ctx->buflen = 0;
+  }
+  memset(&ctx->buffer[ctx->buflen], 0, 56 - ctx->buflen);
+  for (i = 0; i < 8; i++)
+    ctx->buffer[56 + i] = bits >> (56 - 8 * i);
+  process_blocks(ctx->state, ctx->buffer, 1);
+
+  for (i = 0; i < 8; i++) {
+    out[4 * i] = ctx->state[i] >> 24;
+    out[4 * i + 1] = ctx->state[i] >> 16;
+    out[4 * i + 2] = ctx->state[i] >> 8;
+    out[4 * i + 3] = ctx->state[i];
+  }
+  return resbuf;
+}
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+
+/* SHA-256 (FIPS 180-4), for version 6 key fingerprints.  Whole blocks
+   go through the SHA extensions on x86 CPUs that have them. */
+struct sha256_ctx {
+  uint32_t state[8];
+  uint64_t total;
+  size_t buflen;
+  unsigned char buffer[64];
+};
+
+void sha256_init_ctx(struct sha256_ctx *ctx);
+void sha256_process_bytes(const void *buffer, size_t len,
+                          struct sha256_ctx *ctx);
+/* Write the digest to resbuf, which needs SHA256_DIGEST_SIZE bytes. */
+void *sha256_finish_ctx(struct sha256_ctx *ctx, void *resbuf);
+
+#endif /* !_SHA256_H_ */
@@ -3,6 +3,7 @@
  */
 
 #include "stream.h"
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
@@ -54,16 +55,35 @@ char *stream_gets(char *buf, size_t n, struct stream *stream) {
 }
 
 struct stream *create_stream(FILE *file) {
-  if (file == NULL)
+  return create_stream_limited(file, 0);
+}
+
+struct stream *create_stream_limited(FILE *file, size_t max) {
+  struct stream *s;
+  long size;
+
+  if (file == NULL || fseek(file, 0, SEEK_END) != 0)
     return NULL;
-  struct stream *s = malloc(sizeof(struct stream));
-  fseek(file, 0, SEEK_END);
-  s->size = ftell(file);
-  fseek(file, 0, SEEK_SET);
+  size = ftell(file);
+  if (size < 0 || size > INT_MAX || (max && (unsigned long)size > max) ||
+      fseek(file, 0, SEEK_SET) != 0)
+    return NULL;
+
+  s = malloc(sizeof(struct stream));
+  if (s == NULL)
+    return NULL;
+  s->size = size;
   s->pos = 0;
   s->buffer = malloc(s->size);
   s->memsize = s->size;
-  fread(s->buffer, 1, s->size, file);
+  s->sink = NULL;
+  s->sink_opaque = NULL;
+  if ((s->size && s->buffer == NULL) ||
+      fread(s->buffer, 1, s->size, file) != (size_t)s->size) {
+    free(s->buffer);
+    free(s);
+    return NULL;
+  }
   return s;
 }
 
@@ -75,8 +95,18 @@ int stream_printf(struct stream *stream, const char *format, ...) {
   va_end(args);
   if (len < 0 || len >= (int)sizeof(buffer))
     return -1;
+  if (stream->sink) {
+    if (stream->sink(stream->sink_opaque, buffer, len) != 0)
+      return -1;
+    stream->pos = stream->size += len;
+    return len;
+  }
   if (stream->pos + len >= stream->memsize) {
-    stream->buffer = realloc(stream->buffer, 2 * (stream->pos + len));
+    unsigned char *grown = realloc(stream->buffer, 2 * (stream->pos + len));
+
+    if (grown == NULL)
+      return -1;
+    stream->buffer = grown;
     stream->memsize = 2 * (stream->pos + len);
   }
   if (stream->pos + len > stream->size)
@@ -89,8 +119,18 @@ int stream_printf(struct stream *stream, const char *format, ...) {
 size_t stream_write(const void *ptr, size_t size, size_t nmemb,
                     struct stream *stream) {
   int total = size * nmemb;
+  if (stream->sink) {
+    if (total && stream->sink(stream->sink_opaque, ptr, total) != 0)
+      return 0;
+    stream->pos = stream->size += total;
+    return nmemb;
+  }
   if (stream->pos + total >= stream->memsize) {
-    stream->buffer = realloc(stream->buffer, 2 * (stream->pos + total));
+    unsigned char *grown = realloc(stream->buffer, 2 * (stream->pos + total));
+
+    if (grown == NULL)
+      return 0;
+    stream->buffer = grown;
     stream->memsize = 2 * (stream->pos + total);
   }
   if (stream->pos + total > stream->size)
@@ -106,5 +146,18 @@ struct stream *create_empty_stream(void) {
   s->size = 0;
   s->buffer = malloc(1);
   s->memsize = 1;
+  s->sink = NULL;
+  s->sink_opaque = NULL;
+  return s;
+}
+
+struct stream *create_sink_stream(stream_sink_fn sink, void *opaque) {
+  struct stream *s = malloc(sizeof(struct stream));
+  s->pos = 0;
+  s->size = 0;
+  s->buffer = NULL;
+  s->memsize = 0;
+  s->sink = sink;
+  s->sink_opaque = opaque;
   return s;
 }
@@ -7,11 +7,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+/* Receives what is written to a sink stream, in order, as it is
+   written.  Returns 0, or -1 to fail the write. */
+typedef int (*stream_sink_fn)(void *opaque, const void *buf, size_t len);
+
 struct stream {
   unsigned char *buffer;
   int size;
   int pos;
   int memsize;
+  /* When set, writes go to the sink instead of the buffer, which stays
+     empty, and size and pos count the bytes passed on. */
+  stream_sink_fn sink;
+  void *sink_opaque;
 };
 
 int stream_eof(const struct stream *stream);
@@ -21,7 +29,11 @@ int stream_leftbyte(struct stream *stream);
 int stream_read(void *buf, size_t size, size_t items, struct stream *stream);
 char *stream_gets(char *buf, size_t n, struct stream *stream);
 struct stream *create_stream(FILE *file);
+/* The same, or NULL without reading anything if the file holds more
+   than max octets (0 for no limit). */
+struct stream *create_stream_limited(FILE *file, size_t max);
 int stream_printf(struct stream *stream, const char *format, ...);
 size_t stream_write(const void *ptr, size_t size, size_t nmemb,
                     struct stream *stream);
 struct stream *create_empty_stream(void);
+struct stream *create_sink_stream(stream_sink_fn sink, void *opaque);
@@ -0,0 +1,230 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#include "verify.h"
+#include "armor.h"
+#include "encode.h"
+#include "internal.h"
+#include "metrics.h"
+#include "packets.h"
+#include "parse.h"
+#include <string.h>
+
+const char *verify_status_name(enum verify_status status) {
+  switch (status) {
+  case VERIFY_MATCH:
+    return "match";
+  case VERIFY_MISMATCH:
+    return "mismatch";
+  case VERIFY_MISSING:
+    return "missing";
+  case VERIFY_EXTRA:
+    return "extra";
+  }
+  return "unknown";
+}
+
+static int add_result(struct paperkey_ctx *ctx,
+                      struct paperkey_verify_report *report,
+                      const unsigned char *fpr, size_t fpr_len,
+                      unsigned char type, enum verify_status status) {
+  if (report->count == report->size) {
+    size_t size = report->size ? report->size * 2 : 8;
+    struct verify_result *tmp;
+
+    tmp = ctx_realloc(ctx, report->results,
+                      report->size * sizeof(*report->results),
+                      size * sizeof(*report->results));
+    if (tmp == NULL)
+      return -1;
+    report->results = tmp;
+    report->size = size;
+  }
+
+  memcpy(report->results[report->count].fpr, fpr, fpr_len);
+  report->results[report->count].fpr_len = fpr_len;
+  report->results[report->count].type = type;
+  report->results[report->count].status = status;
+  report->count++;
+  return 0;
+}
+
+/* Step to the next key in a decoded document, with the same rules as
+   restore.  Returns its secret bytes, or NULL at the end. */
+static const unsigned char *next_secret(const struct packet *doc, size_t *idx,
+                                        const unsigned char **fpr,
+                                        size_t *fpr_len, size_t *len) {
+  size_t at;
+
+  if (*idx >= doc->len)
+    return NULL;
+  *fpr_len = fingerprint_length(doc->buf[*idx]);
+
+  /* 1+fpr_len+2 == version + fingerprint + length */
+  if (*fpr_len == 0 || *idx + 1 + *fpr_len + 2 > doc->len)
+    return NULL;
+
+  *fpr = &doc->buf[*idx + 1];
+  at = *idx + 1 + *fpr_len;
+  *len = doc->buf[at] << 8 | doc->buf[at + 1];
+  if (at + 2 + *len > doc->len)
+    return NULL;
+
+  *idx = at + 2 + *len;
+  return &doc->buf[at + 2];
+}
+
+static const unsigned char *find_secret(const struct packet *doc,
+                                        const unsigned char *fpr,
+                                        size_t fpr_len, size_t *len) {
+  const unsigned char *secret, *found;
+  size_t idx = 1, found_len;
+
+  while ((secret = next_secret(doc, &idx, &found, &found_len, len)))
+    if (found_len == fpr_len && memcmp(found, fpr, fpr_len) == 0)
+      return secret;
+  return NULL;
+}
+
+static int reported(const struct paperkey_verify_report *report,
+                    const unsigned char *fpr, size_t fpr_len) {
+  size_t i;
+
+  for (i = 0; i < report->count; i++)
+    if (report->results[i].fpr_len == fpr_len &&
+        memcmp(report->results[i].fpr, fpr, fpr_len) == 0)
+      return 1;
+  return 0;
+}
+
+/* One pass over the packets of the first secret key, stopping at the
+   next primary key like extract does. */
+static int verify_keys(struct paperkey_ctx *ctx, struct stream *secret_key,
+                       const struct packet *doc,
+                       struct paperkey_verify_report *report) {
+  int did_primary = 0;
+  unsigned int count = 0;
+
+  for (;;) {
+    unsigned char type, fpr[MAX_FINGERPRINT];
+    unsigned int length;
+    struct packet view;
+    const unsigned char *secret;
+    enum verify_status status;
+    size_t fpr_len, len;
+    ssize_t offset;
+    int r;
+
+    r = parse_packet_header(secret_key, &type, &length);
+    if (r == 1)
+      break;
+    if (r != 0 || length > (unsigned int)stream_leftbyte(secret_key) ||
+        ctx_admit_packet(ctx, &count, type, length) != 0)
+      return -1;
+
+    view.type = type;
+    view.buf = &secret_key->buffer[secret_key->pos];
+    view.len = view.size = length;
+    secret_key->pos += length;
+
+    if (type == 5) {
+      if (did_primary)
+        break;
+      did_primary = 1;
+    } else if (type != 7 || !did_primary) {
+      continue;
+    }
+
+    offset = extract_secrets(&view);
+    if (offset == -1)
+      return -1;
+    key_fingerprint(ctx, &view, offset, fpr);
+    fpr_len = fingerprint_length(view.buf[0]);
+
+    secret = find_secret(doc, fpr, fpr_len, &len);
+    if (secret == NULL)
+      status = VERIFY_MISSING;
+    else if (len == (size_t)(length - offset) &&
+             memcmp(secret, &view.buf[offset], len) == 0)
+      status = VERIFY_MATCH;
+    else
+      status = VERIFY_MISMATCH;
+
+    if (add_result(ctx, report, fpr, fpr_len, type, status) != 0)
+      return -1;
+  }
+
+  return did_primary ? 0 : -1;
+}
+
+static int verify_input(struct paperkey_ctx *ctx, struct stream *secret_key,
+                        struct stream *secrets, enum data_type input_type,
+                        struct paperkey_verify_report *report) {
+  const unsigned char *fpr;
+  struct packet *doc;
+  size_t idx = 1, fpr_len, len, i;
+  int ret;
+
+  memset(report, 0, sizeof(*report));
+
+  if (input_type == AUTO) {
+    input_type = detect_data_type(secrets);
+    if (input_type == AUTO)
+      return -1;
+  }
+
+  doc = read_secrets_file(ctx, secrets, input_type);
+  if (doc == NULL)
+    return -1;
+  /* Check the version */
+  if (doc->len == 0 || doc->buf[0] > 1) {
+    free_packet(ctx, doc);
+    return -1;
+  }
+
+  if (armor_detect(secret_key)) {
+    struct stream *binary = armor_decode(ctx, secret_key);
+
+    ret = binary ? verify_keys(ctx, binary, doc, report) : -1;
+    armor_free(ctx, binary);
+  } else {
+    ret = verify_keys(ctx, secret_key, doc, report);
+  }
+
+  while (ret == 0 && next_secret(doc, &idx, &fpr, &fpr_len, &len))
+    if (!reported(report, fpr, fpr_len) &&
+        add_result(ctx, report, fpr, fpr_len, 0, VERIFY_EXTRA) != 0)
+      ret = -1;
+
+  free_packet(ctx, doc);
+  if (ret != 0)
+    return -1;
+
+  for (i = 0; i < report->count; i++)
+    if (report->results[i].status != VERIFY_MATCH)
+      return 1;
+  return 0;
+}
+
+int paperkey_verify(struct paperkey_ctx *ctx, struct stream *secret_key,
+                    struct stream *secrets, enum data_type input_type,
+                    struct paperkey_verify_report *report) {
+  uint64_t timer = metrics_start(ctx);
+  int ret = -1;
+
+  if (ctx_admit(ctx, secret_key, secrets) == 0)
+    ret = verify_input(ctx, secret_key, secrets, input_type, report);
+  else
+    memset(report, 0, sizeof(*report));
+
+  metrics_record(ctx, PAPERKEY_METRIC_VERIFY, timer);
+  return ret;
+}
+
+void paperkey_verify_report_free(struct paperkey_ctx *ctx,
+                                 struct paperkey_verify_report *report) {
+  ctx_free(ctx, report->results, report->size * sizeof(*report->results));
+  report->results = NULL;
+  report->count = report->size = 0;
+}
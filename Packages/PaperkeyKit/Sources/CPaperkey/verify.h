@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2025 helmholtz <helmholtz@fomal.host>
+ */
+
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include "context.h"
+#include "output.h"
+#include "stream.h"
+#include <stddef.h>
+
+enum verify_status {
+  /* The document holds the same secret as the key. */
+  VERIFY_MATCH,
+  /* The document holds a different secret for this fingerprint. */
+  VERIFY_MISMATCH,
+  /* The key has it, the document does not. */
+  VERIFY_MISSING,
+  /* The document has it, the key does not. */
+  VERIFY_EXTRA
+};
+
+struct verify_result {
+  /* 20 bytes for a version 4 key, 32 for version 6. */
+  unsigned char fpr[MAX_FINGERPRINT];
+  size_t fpr_len;
+  /* 5 for the primary key, 7 for a subkey, 0 for VERIFY_EXTRA. */
+  unsigned char type;
+  enum verify_status status;
+};
+
+struct paperkey_verify_report {
+  /* The keys in the order of the secret key, then anything extra in
+     the order of the document. */
+  struct verify_result *results;
+  size_t count;
+  size_t size;
+};
+
+/* Check that a secrets document holds the secret parts of the first
+   secret key (with its subkeys) in secret_key, binary or armored.  The
+   document is decoded once, and each key packet is compared with it
+   where it lies in secret_key, so nothing is restored or copied.
+   Returns 0 when every key matches and nothing is extra, 1 when the
+   report says otherwise, and -1 if either input cannot be read or
+   memory runs out.  Release the report with
+   paperkey_verify_report_free() whatever the result. */
+int paperkey_verify(struct paperkey_ctx *ctx, struct stream *secret_key,
+                    struct stream *secrets, enum data_type input_type,
+                    struct paperkey_verify_report *report);
+void paperkey_verify_report_free(struct paperkey_ctx *ctx,
+                                 struct paperkey_verify_report *report);
+
+const char *verify_status_name(enum verify_status status);
+
+#endif /* !_VERIFY_H_ */
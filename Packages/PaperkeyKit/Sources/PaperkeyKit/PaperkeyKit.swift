@@ -17,6 +17,23 @@ public class PaperkeyKit {
         case RAW
         /// Base16 (hexadecimal) encoded text
         case BASE16
+        /// Base32 (RFC 4648) encoded text
+        case BASE32
+        /// Base64 (RFC 4648) encoded text
+        case BASE64
+        /// Base45 (RFC 9285) encoded text, the QR code alphanumeric set
+        case BASE45
+
+        var cType: data_type {
+            switch self {
+            case .AUTO: CPaperkey.AUTO
+            case .RAW: CPaperkey.RAW
+            case .BASE16: CPaperkey.BASE16
+            case .BASE32: CPaperkey.BASE32
+            case .BASE64: CPaperkey.BASE64
+            case .BASE45: CPaperkey.BASE45
+            }
+        }
     }
     
     /// Extracts secret data from an OpenPGP secret key file.
@@ -25,9 +42,11 @@ public class PaperkeyKit {
     /// The extracted data can be printed on paper for backup purposes.
     ///
     /// - Parameters:
-    ///   - input: The OpenPGP secret key data as a Data object
-    ///   - outputType: The format for the output data (AUTO, RAW, or BASE16)
+    ///   - input: The OpenPGP secret key data as a Data object, binary or ASCII-armored
+    ///   - outputType: The format for the output data (AUTO, RAW, BASE16, BASE32, BASE64 or BASE45)
     ///   - outputWidth: The number of characters per line for the output (typically 78 for standard formatting)
+    ///   - parityPercent: Reed-Solomon parity lines to append to text output, as a percentage of the data lines (0 for none).
+    ///     Restore uses them to rebuild lines that are missing or fail their CRC.
     /// - Returns: The extracted secret data in the specified format, or nil if extraction fails
     ///
     /// # Example:
@@ -38,25 +57,145 @@ public class PaperkeyKit {
     ///     print(extractedString ?? "")
     /// }
     /// ```
-    public static func extract(input: Data, outputType: DataType, outputWidth: UInt) -> Data? {
+    public static func extract(input: Data, outputType: DataType, outputWidth: UInt, parityPercent: UInt = 0) -> Data? {
         if input.isEmpty { return nil }
         
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+        
         guard let outputStream = create_empty_stream() else { return nil }
         
-        let outputTypeC: data_type = switch outputType {
-            case .AUTO: AUTO
-            case .RAW: RAW
-            case .BASE16: BASE16
+        paperkey_ctx_set_output_type(ctx, outputType.cType)
+        paperkey_ctx_set_output_width(ctx, CUnsignedInt(outputWidth))
+        paperkey_ctx_set_fec(ctx, CUnsignedInt(parityPercent))
+        
+        let result = input.withUnsafeBytes { inputPtr in
+            var inputStream = stream(
+                buffer: UnsafeMutableRawPointer(mutating: inputPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
+                size: CInt(input.count),
+                pos: 0,
+                memsize: CInt(input.count),
+                sink: nil,
+                sink_opaque: nil
+            )
+            return paperkey_extract(ctx, &inputStream, outputStream)
         }
         
+        defer {
+            outputStream.pointee.buffer.deallocate()
+            outputStream.deallocate()
+        }
+        
+        if result != 0 { return nil }
+        
+        return Data(bytes: outputStream.pointee.buffer, count: Int(outputStream.pointee.size))
+    }
+    
+    /// Extracts secret data straight from gpg-agent's key files, without exporting the secret key.
+    ///
+    /// The keys of the certificate are looked up by keygrip in `keyDirectory`. The result is the same as
+    /// `extract` gives for the secret key gpg would export. Keys the agent has protected with its own
+    /// passphrase cannot be turned back into OpenPGP and count as missing.
+    ///
+    /// - Parameters:
+    ///   - publicKey: The OpenPGP public key (certificate) data, binary or armored
+    ///   - keyDirectory: The agent's key directory, usually `~/.gnupg/private-keys-v1.d`
+    ///   - outputType: The desired output format (RAW, BASE16, BASE32, BASE64 or BASE45)
+    ///   - outputWidth: The width of the output lines (for text formats)
+    ///   - parityPercent: Reed-Solomon parity lines as a percentage of the data lines (0 for none)
+    /// - Returns: The extracted data, or nil if the primary key has no usable key file
+    public static func extract(publicKey: Data, keyDirectory: String, outputType: DataType, outputWidth: UInt,
+                               parityPercent: UInt = 0) -> Data? {
+        if publicKey.isEmpty { return nil }
+
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+
+        guard let outputStream = create_empty_stream() else { return nil }
+
+        paperkey_ctx_set_output_type(ctx, outputType.cType)
+        paperkey_ctx_set_output_width(ctx, CUnsignedInt(outputWidth))
+        paperkey_ctx_set_fec(ctx, CUnsignedInt(parityPercent))
+
+        let result = publicKey.withUnsafeBytes { inputPtr in
+            var inputStream = stream(
+                buffer: UnsafeMutableRawPointer(mutating: inputPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
+                size: CInt(publicKey.count),
+                pos: 0,
+                memsize: CInt(publicKey.count),
+                sink: nil,
+                sink_opaque: nil
+            )
+            return paperkey_extract_agent(ctx, &inputStream, keyDirectory, outputStream)
+        }
+
+        defer {
+            outputStream.pointee.buffer.deallocate()
+            outputStream.deallocate()
+        }
+
+        if result != 0 { return nil }
+
+        return Data(bytes: outputStream.pointee.buffer, count: Int(outputStream.pointee.size))
+    }
+
+    public enum RenderFormat {
+        /// One SVG drawing with the pages stacked top to bottom
+        case SVG
+        /// DSC-conforming PostScript
+        case PostScript
+        /// Binary PBM, one image per page
+        case PBM
+
+        var cType: render_format {
+            switch self {
+            case .SVG: RENDER_SVG
+            case .PostScript: RENDER_POSTSCRIPT
+            case .PBM: RENDER_PBM
+            }
+        }
+    }
+    
+    /// Extracts secret data and lays it out as print-ready A4 pages.
+    ///
+    /// Each page is headed with the key fingerprint and the page number. With `includeQR` the text is followed
+    /// by the raw extract as QR codes, split across as many structured append symbols as take the least space.
+    ///
+    /// - Parameters:
+    ///   - input: The OpenPGP secret key data as a Data object
+    ///   - format: SVG, PostScript or PBM
+    ///   - outputType: The text encoding to print (BASE16, BASE32, BASE64 or BASE45)
+    ///   - outputWidth: The number of characters per line of text
+    ///   - includeQR: Whether to add QR codes after the text
+    /// - Returns: The rendered document, or nil if extraction fails or the lines are too wide for the page
+    public static func render(input: Data, format: RenderFormat, outputType: DataType = .BASE16,
+                              outputWidth: UInt = 78, includeQR: Bool = false) -> Data? {
+        if input.isEmpty { return nil }
+        
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+        
+        guard let outputStream = create_empty_stream() else { return nil }
+        
+        paperkey_ctx_set_output_type(ctx, outputType.cType)
+        paperkey_ctx_set_output_width(ctx, CUnsignedInt(outputWidth))
+        
+        var options = render_options()
+        options.format = format.cType
+        options.qr = includeQR ? 1 : 0
+        options.qr_options.ecc = QR_ECC_M
+        options.qr_options.mask = -1
+        
         let result = input.withUnsafeBytes { inputPtr in
             var inputStream = stream(
                 buffer: UnsafeMutableRawPointer(mutating: inputPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
                 size: CInt(input.count),
                 pos: 0,
-                memsize: CInt(input.count)
+                memsize: CInt(input.count),
+                sink: nil,
+                sink_opaque: nil
             )
-            return CPaperkey.extract(&inputStream, outputStream, outputTypeC, CUnsignedInt(outputWidth))
+            return paperkey_render(ctx, &inputStream, &options, outputStream)
         }
         
         defer {
@@ -80,8 +219,11 @@ public class PaperkeyKit {
     /// - Parameters:
     ///   - pubring: The public key data as a Data object (GPG public key file)
     ///   - secrets: The extracted secret data from paperkey output
-    ///   - inputType: The format of the secrets data (AUTO, RAW, or BASE16). Use AUTO for automatic detection.
+    ///   - inputType: The format of the secrets data (AUTO, RAW, BASE16, BASE32, BASE64 or BASE45). Use AUTO for automatic detection.
     ///   - ignoreCRCError: If true, ignores CRC checksum errors during restoration (use with caution)
+    ///   - repairOCR: If true, base16 lines that fail their CRC are repaired when exactly one swap of commonly
+    ///     misscanned characters (0/O/D, 8/B, 1/I/7, 5/S and so on) makes the CRC match
+    ///   - armored: If true, the restored key is written in ASCII armor. The pubring may be armored either way.
     /// - Returns: The restored complete OpenPGP secret key data, or nil if restoration fails
     ///
     /// # Example:
@@ -96,16 +238,19 @@ public class PaperkeyKit {
     ///     try? restoredSecret.write(to: URL(fileURLWithPath: "restored-sec.gpg"))
     /// }
     /// ```
-    public static func restore(pubring: Data, secrets: Data, inputType: DataType, ignoreCRCError: Bool) -> Data? {
+    public static func restore(pubring: Data, secrets: Data, inputType: DataType, ignoreCRCError: Bool, repairOCR: Bool = false,
+                               armored: Bool = false) -> Data? {
         if pubring.isEmpty || secrets.isEmpty { return nil }
         
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+        
         guard let outputStream = create_empty_stream() else { return nil }
         
-        let inputTypeC: data_type = switch inputType {
-            case .AUTO: AUTO
-            case .RAW: RAW
-            case .BASE16: BASE16
-        }
+        let inputTypeC = inputType.cType
+        paperkey_ctx_set_ignore_crc_error(ctx, ignoreCRCError ? 1 : 0)
+        paperkey_ctx_set_ocr_repair(ctx, repairOCR ? 1 : 0)
+        paperkey_ctx_set_armor(ctx, armored ? 1 : 0)
         
         let result = pubring.withUnsafeBytes { pubringPtr in
             secrets.withUnsafeBytes { secretsPtr in
@@ -113,17 +258,21 @@ public class PaperkeyKit {
                     buffer: UnsafeMutableRawPointer(mutating: pubringPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
                     size: CInt(pubring.count),
                     pos: 0,
-                    memsize: CInt(pubring.count)
+                    memsize: CInt(pubring.count),
+                    sink: nil,
+                    sink_opaque: nil
                 )
                 
                 var secretsStream = stream(
                     buffer: UnsafeMutableRawPointer(mutating: secretsPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
                     size: CInt(secrets.count),
                     pos: 0,
-                    memsize: CInt(secrets.count)
+                    memsize: CInt(secrets.count),
+                    sink: nil,
+                    sink_opaque: nil
                 )
                 
-                return CPaperkey.restore(&pubringStream, &secretsStream, inputTypeC, outputStream, CInt(ignoreCRCError ? 1 : 0))
+                return paperkey_restore(ctx, &pubringStream, &secretsStream, inputTypeC, outputStream)
             }
         }
         
@@ -136,4 +285,124 @@ public class PaperkeyKit {
         
         return Data(bytes: outputStream.pointee.buffer, count: Int(outputStream.pointee.size))
     }
+    
+    /// A problem with one line of a paperkey text document.
+    public struct LineIssue {
+        /// The line number as printed, 0 if it could not be read
+        public let number: UInt
+        /// Where the line is in the document, counting from 1, or 0 for a missing line
+        public let inputLine: UInt
+        /// What is wrong with it: missing, duplicated, out of order, bad CRC or malformed
+        public let problem: String
+    }
+    
+    /// Everything found wrong with a paperkey document in one pass.
+    public struct Report {
+        public let issues: [LineIssue]
+        /// Whether the CRC-24 over the whole document was present and matched
+        public let totalCRCValid: Bool
+        public var isClean: Bool { issues.isEmpty && totalCRCValid }
+    }
+    
+    /// Checks extracted secret data without restoring it.
+    ///
+    /// Unlike restore, which stops at the first bad line, this decodes the whole document and lists every line that is
+    /// missing, duplicated, out of order, malformed or fails its CRC, so they can all be fixed at once.
+    ///
+    /// - Parameters:
+    ///   - secrets: The extracted secret data from paperkey output
+    ///   - inputType: The format of the secrets data. Use AUTO for automatic detection.
+    /// - Returns: The report, or nil if the format could not be detected
+    public static func diagnose(secrets: Data, inputType: DataType) -> Report? {
+        if secrets.isEmpty { return nil }
+        
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+        
+        var report = paperkey_report()
+        let result = secrets.withUnsafeBytes { secretsPtr in
+            var secretsStream = stream(
+                buffer: UnsafeMutableRawPointer(mutating: secretsPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
+                size: CInt(secrets.count),
+                pos: 0,
+                memsize: CInt(secrets.count),
+                sink: nil,
+                sink_opaque: nil
+            )
+            return paperkey_diagnose(ctx, &secretsStream, inputType.cType, &report)
+        }
+        defer { paperkey_report_free(ctx, &report) }
+        
+        if result < 0 { return nil }
+        
+        let issues = (0..<report.count).map { i -> LineIssue in
+            let issue = report.issues[i]
+            return LineIssue(number: UInt(issue.number),
+                             inputLine: UInt(issue.input_line),
+                             problem: String(cString: line_problem_name(issue.problem)))
+        }
+        return Report(issues: issues, totalCRCValid: report.total_crc == TOTAL_CRC_OK)
+    }
+    
+    /// How one key compares with a paperkey document.
+    public struct KeyVerification {
+        /// The fingerprint of the key, 20 bytes for a version 4 key or 32 for version 6
+        public let fingerprint: Data
+        /// Whether this is the primary key; false for subkeys and for keys only the document has
+        public let isPrimary: Bool
+        /// match, mismatch, missing (from the document) or extra (in the document only)
+        public let status: String
+    }
+    
+    /// Checks that a paperkey document matches the secret key it was made from, without restoring it.
+    ///
+    /// The document is decoded once and each secret part is compared with the key packet it came from, so this is
+    /// much cheaper than a restore followed by a byte compare.
+    ///
+    /// - Parameters:
+    ///   - secretKey: The secret key in OpenPGP binary format
+    ///   - secrets: The extracted secret data from paperkey output
+    ///   - inputType: The format of the secrets data. Use AUTO for automatic detection.
+    /// - Returns: One entry per key, or nil if either input could not be read
+    public static func verify(secretKey: Data, secrets: Data, inputType: DataType) -> [KeyVerification]? {
+        if secretKey.isEmpty || secrets.isEmpty { return nil }
+        
+        guard let ctx = paperkey_ctx_new() else { return nil }
+        defer { paperkey_ctx_free(ctx) }
+        
+        var report = paperkey_verify_report()
+        let result = secretKey.withUnsafeBytes { keyPtr in
+            secrets.withUnsafeBytes { secretsPtr in
+                var keyStream = stream(
+                    buffer: UnsafeMutableRawPointer(mutating: keyPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
+                    size: CInt(secretKey.count),
+                    pos: 0,
+                    memsize: CInt(secretKey.count),
+                    sink: nil,
+                    sink_opaque: nil
+                )
+                
+                var secretsStream = stream(
+                    buffer: UnsafeMutableRawPointer(mutating: secretsPtr.baseAddress!).assumingMemoryBound(to: UInt8.self),
+                    size: CInt(secrets.count),
+                    pos: 0,
+                    memsize: CInt(secrets.count),
+                    sink: nil,
+                    sink_opaque: nil
+                )
+                
+                return paperkey_verify(ctx, &keyStream, &secretsStream, inputType.cType, &report)
+            }
+        }
+        defer { paperkey_verify_report_free(ctx, &report) }
+        
+        if result < 0 { return nil }
+        
+        return (0..<report.count).map { i -> KeyVerification in
+            let entry = report.results[i]
+            return KeyVerification(fingerprint: withUnsafeBytes(of: entry.fpr) { Data($0.prefix(entry.fpr_len)) },
+                                   isPrimary: entry.type == 5,
+                                   status: String(cString: verify_status_name(entry.status)))
+        }
+    }
 }
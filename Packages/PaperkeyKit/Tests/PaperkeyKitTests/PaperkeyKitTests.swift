@@ -60,6 +60,14 @@ struct PaperkeyKitTests {
         let restoredBase16 = try #require(PaperkeyKit.restore(pubring: pubData, secrets: extractedBase16, inputType: .BASE16, ignoreCRCError: false))
         
         #expect(restoredBase16 == secData, "Base16 roundtrip failed for \(keyType) key")
+        
+        // Test the denser text formats, letting restore detect the type
+        for format in [PaperkeyKit.DataType.BASE32, .BASE64, .BASE45] {
+            let extracted = try #require(PaperkeyKit.extract(input: secData, outputType: format, outputWidth: 78))
+            let restored = try #require(PaperkeyKit.restore(pubring: pubData, secrets: extracted, inputType: .AUTO, ignoreCRCError: false))
+            
+            #expect(restored == secData, "\(format) roundtrip failed for \(keyType) key")
+        }
     }
     
     enum TestError: Error, CustomDebugStringConvertible {
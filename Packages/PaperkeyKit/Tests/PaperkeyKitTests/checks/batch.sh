@@ -0,0 +1,35 @@
+#!/bin/sh
+
+rm -rf batch-in batch-out batch-ring
+mkdir -p batch-in/sub
+for type in rsa dsaelg ; do
+    cp ${srcdir}/papertest-${type}.sec batch-in/
+done
+for type in ecc eddsa ; do
+    cp ${srcdir}/papertest-${type}.sec batch-in/sub/
+done
+cat ${srcdir}/papertest-rsa.pub ${srcdir}/papertest-dsaelg.pub \
+    ${srcdir}/papertest-ecc.pub ${srcdir}/papertest-eddsa.pub > batch-pubring.pgp
+
+../paperkey --batch batch-in --output batch-out --jobs 4 2>/dev/null || exit 1
+test `ls batch-out | wc -l` -eq 4 || exit 1
+
+# Each document comes back as one of the keys
+for doc in batch-out/* ; do
+    ../paperkey --secrets $doc --pubring batch-pubring.pgp --output batch-regen.pgp || exit 1
+    found=no
+    for type in rsa dsaelg ecc eddsa ; do
+        cmp -s batch-regen.pgp ${srcdir}/papertest-${type}.sec && found=yes
+    done
+    test $found = yes || exit 1
+done
+
+# A keyring of the same keys gives the same documents
+cat batch-in/*.sec batch-in/sub/*.sec > batch-keyring.pgp
+../paperkey --batch batch-keyring.pgp --output batch-ring --jobs 2 2>/dev/null || exit 1
+for doc in batch-out/* ; do
+    grep -v '^#' $doc > batch-a.txt
+    grep -v '^#' batch-ring/`basename $doc` > batch-b.txt || exit 1
+    cmp batch-a.txt batch-b.txt || exit 1
+done
+/bin/echo -n "batch "